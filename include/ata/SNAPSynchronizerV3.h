@@ -28,9 +28,33 @@ namespace gr {
   namespace ata {
 
     /*!
-     * \brief <+description of block+>
+     * \brief Time-aligns multiple SNAP source streams based on their sample_num tags.
      * \ingroup ata
      *
+     * \details
+     * In the default mode, the block sits in the data path, consumes the
+     * difference between the first timestamps on each input, and then passes
+     * the aligned streams through.
+     *
+     * If align_at_source is set, the block has no stream ports at all.  It
+     * collects the sync_header messages from each SNAP source (send_start_msg
+     * and wait_for_align need to be enabled on the sources), and publishes the
+     * common starting timestamp on its sync port as an align_timestamp message.
+     * Each source then discards its own leading frames, so no data is copied
+     * through this block once alignment is achieved.
+     *
+     * Once synchronized in the default mode, the sample_num tags at the head of
+     * each input are compared every resync_interval items.  If they no longer
+     * match, a resync message with the per-input offsets is published on the
+     * resync port and the block re-aligns by consuming the difference.  Set
+     * resync_interval to 0 to disable the check.  Note that the check needs the
+     * source tags, so it is skipped if the sources have been told to stop
+     * tagging via their sync port.
+     *
+     * For large arrays, num_threads > 1 splits the synchronized per-input copy
+     * and tag forwarding across a pool of worker threads.  The workers are
+     * bound to the NUMA node the block thread is running on when the first
+     * copy is made.
      */
     class ATA_API SNAPSynchronizerV3 : virtual public gr::block
     {
@@ -45,7 +69,7 @@ namespace gr {
        * class. ata::SNAPSynchronizerV3::make is the public interface for
        * creating new instances.
        */
-      static sptr make(int num_inputs, int num_channels);
+      static sptr make(int num_inputs, int num_channels, bool align_at_source=false, int resync_interval=250000, int num_threads=1);
     };
 
   } // namespace ata
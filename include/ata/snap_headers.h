@@ -6,6 +6,8 @@
 #define SNAP_PACKETTYPE_SPECT 2
 
 #include <stdint.h>
+#include <string.h>
+#include <endian.h>
 
 namespace gr {
 namespace ata {
@@ -21,6 +23,41 @@ namespace ata {
 		uint8_t type;
 	};
 
+	// Header decoders shared by the SNAP source and the capture tools.  pBuff points at
+	// the start of the UDP payload.
+
+	// Voltage (v2.0): version, type, n_chans, chan, feng_id (16-bit, big-endian), then a
+	// 64-bit big-endian sample number.
+	inline void parse_voltage_header(snap_header& hdr, const unsigned char *pBuff) {
+		uint16_t chan, feng_id;
+		uint64_t timestamp;
+
+		memcpy(&chan, pBuff + 4, sizeof(chan));
+		memcpy(&feng_id, pBuff + 6, sizeof(feng_id));
+		memcpy(&timestamp, pBuff + 8, sizeof(timestamp));
+
+		hdr.antenna_id = be16toh(feng_id);
+		hdr.channel_id = be16toh(chan);
+		hdr.firmware_version = pBuff[0]; // no need to network->host order, only a byte
+		hdr.sample_number = be64toh(timestamp);
+		hdr.type = pBuff[1];
+	}
+
+	// Spectrometer: one 64-bit big-endian word.
+	inline void parse_spect_header(snap_header& hdr, const unsigned char *pBuff) {
+		uint64_t header;
+		memcpy(&header, pBuff, sizeof(header));
+
+		// Convert from network format to host format.
+		header = be64toh(header);
+
+		hdr.antenna_id = header & 0xff;
+		hdr.channel_id = ((header >> 8) & 0x07) * 512; // Id cycles 0-7.  Channel is 512*val
+		hdr.sample_number = (header >> 11) & 0x1fffffffffffULL;
+		hdr.firmware_version = (header >> 56) & 0xff;
+		hdr.type = SNAP_PACKETTYPE_SPECT;
+	}
+
 } // namespace ata
 } // namespace gr
 
@@ -66,7 +66,13 @@ public:
   static sptr make(int port, int headerType, bool notifyMissed,
                    bool sourceZeros, bool ipv6, int starting_channel, int ending_channel,
 				   int data_source, std::string file="", bool repeat_file=false, bool packed_output=false,
-				   std::string mcast_group="", bool send_start_msg=false, std::string udp_ip="");
+				   std::string mcast_group="", bool send_start_msg=false, std::string udp_ip="",
+				   bool wait_for_align=false, uint64_t start_sample=0, uint64_t end_sample=0,
+				   int pcap_pacing=0, double pacing_speedup=1.0,
+				   int loop_cache_mb=0, bool loop_continue_timestamps=false,
+				   int decode_threads=0, std::string record_file="", int record_compression=0,
+				   double stats_interval=1.0, bool rx_timestamps=false,
+				   double quant_stats_interval=0.0);
 };
 
 } // namespace ata 
@@ -0,0 +1,75 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_SYNCHRONIZER_H
+#define INCLUDED_ATA_SNAP_SYNCHRONIZER_H
+
+#include <ata/api.h>
+#include <gnuradio/block.h>
+#include <gnuradio/gr_complex.h>
+#include <complex>
+#include <cstdint>
+
+namespace gr {
+  namespace ata {
+
+    /*!
+     * \brief Time-aligns multiple SNAP-derived streams of any item type based on their sample_num tags.
+     * \ingroup ata
+     *
+     * \details
+     * This is the typed form of SNAPSynchronizerV3.  T is the stream's element
+     * type, and vlen is the number of elements per item.  FRAME_ITEMS is the
+     * number of items the source produces per SNAP frame: 16 for voltage data
+     * (16 time samples per packet), and 1 for spectrometer dumps.  Alignment
+     * only ever drops whole frames.
+     *
+     * frame_timestamp_step is how much sample_num advances from one frame to the
+     * next.  For voltage data that is 16.  Drift detection and the worker pool
+     * behave the same as in SNAPSynchronizerV3.
+     */
+    template <class T, int FRAME_ITEMS>
+    class ATA_API snap_synchronizer : virtual public gr::block
+    {
+     public:
+      typedef std::shared_ptr<snap_synchronizer<T, FRAME_ITEMS>> sptr;
+
+      /*!
+       * \brief Return a shared_ptr to a new instance of ata::snap_synchronizer.
+       */
+      static sptr make(int num_inputs, int vlen, int resync_interval=250000, int num_threads=1,
+    		  int frame_timestamp_step=FRAME_ITEMS);
+    };
+
+    // 8-bit interleaved IQ voltage from snap_source (vlen = 2 * channels)
+    typedef snap_synchronizer<char, 16> snap_synchronizer_b;
+    // Packed 4-bit XY voltage from snap_source (vlen = 2 * channels)
+    typedef snap_synchronizer<unsigned char, 16> snap_synchronizer_packed;
+    // Voltage converted to 16-bit complex (vlen = channels)
+    typedef snap_synchronizer<std::complex<int16_t>, 16> snap_synchronizer_sc16;
+    // Voltage converted to float complex (vlen = channels)
+    typedef snap_synchronizer<gr_complex, 16> snap_synchronizer_c;
+    // Spectrometer XX/YY/XY float outputs (vlen = 4096)
+    typedef snap_synchronizer<float, 1> snap_synchronizer_f;
+
+  } // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_SYNCHRONIZER_H */
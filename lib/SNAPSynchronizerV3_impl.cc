@@ -25,48 +25,35 @@
 #include <gnuradio/io_signature.h>
 #include "SNAPSynchronizerV3_impl.h"
 
+#include <sstream>
+
 namespace gr {
 namespace ata {
 
 SNAPSynchronizerV3::sptr
-SNAPSynchronizerV3::make(int num_inputs, int num_channels)
+SNAPSynchronizerV3::make(int num_inputs, int num_channels, bool align_at_source, int resync_interval, int num_threads)
 {
 	return gnuradio::get_initial_sptr
-			(new SNAPSynchronizerV3_impl(num_inputs, num_channels));
+			(new SNAPSynchronizerV3_impl(num_inputs, num_channels, align_at_source, resync_interval, num_threads));
 }
 
 
 /*
  * The private constructor
  */
-SNAPSynchronizerV3_impl::SNAPSynchronizerV3_impl(int num_inputs, int num_channels)
+SNAPSynchronizerV3_impl::SNAPSynchronizerV3_impl(int num_inputs, int num_channels, bool align_at_source, int resync_interval, int num_threads)
 : gr::block("SNAPSynchronizerV3",
-		gr::io_signature::make(num_inputs, num_inputs, sizeof(char)*2*num_channels),
-		gr::io_signature::make(num_inputs, num_inputs, sizeof(char)*2*num_channels)),
-		d_num_inputs(num_inputs), d_num_channels(num_channels)
+		align_at_source ? gr::io_signature::make(0, 0, 0) : gr::io_signature::make(num_inputs, num_inputs, sizeof(char)*2*num_channels),
+		align_at_source ? gr::io_signature::make(0, 0, 0) : gr::io_signature::make(num_inputs, num_inputs, sizeof(char)*2*num_channels)),
+		snap_synchronizer_impl<char, 16>(num_inputs, 2*num_channels, resync_interval, num_threads, 16),
+		d_num_channels(num_channels), d_align_at_source(align_at_source)
 {
-	d_synchronized = false;
-
-	d_num_channels_x2 = 2*d_num_channels;
-
-	// frame size is used to take a sixteen time frame block in as a single unit.
-	// The * 16 here comes from the SNAP packet format.
-	frame_size = sizeof(char)*d_num_channels_x2;
-
-	d_pmt_seqnum = pmt::string_to_symbol("sample_num");
-
-	d_block_name = pmt::string_to_symbol(identifier());
-
-	pmt_sequence_number_zero =pmt::from_uint64(0);
-
-	tag_list = new unsigned long[d_num_inputs];
-
-	set_tag_propagation_policy(TPP_DONT);
-
-	// The SNAP outputs packets in 16-time step blocks.  So let's take advantage of that here.
-	set_output_multiple(16);
-
-	message_port_register_out(pmt::mp("sync"));
+	if (d_align_at_source) {
+		// In this mode we never see the data.  The sources tell us where they started,
+		// and we tell them where to start.
+		message_port_register_in(pmt::mp("sync_header"));
+		set_msg_handler(pmt::mp("sync_header"), boost::bind(&SNAPSynchronizerV3_impl::handleSyncHeaderMsg, this, _1) );
+	}
 }
 
 /*
@@ -74,130 +61,69 @@ SNAPSynchronizerV3_impl::SNAPSynchronizerV3_impl(int num_inputs, int num_channel
  */
 SNAPSynchronizerV3_impl::~SNAPSynchronizerV3_impl()
 {
-	delete[] tag_list;
 }
 
 void
-SNAPSynchronizerV3_impl::forecast (int noutput_items, gr_vector_int &ninput_items_required)
+SNAPSynchronizerV3_impl::handleSyncHeaderMsg(pmt::pmt_t msg)
 {
-	for (int i=0;i< ninput_items_required.size();i++) {
-		ninput_items_required[i] = noutput_items;
+	// The SNAP source sends a (dict . nil) pair with the header of its first aligned packet.
+	pmt::pmt_t meta = pmt::is_pair(msg) ? pmt::car(msg) : msg;
+
+	if (!pmt::is_dict(meta) || !pmt::dict_has_key(meta, pmt::mp("sample_number"))) {
+		GR_LOG_WARN(d_logger, "A sync_header message was received without a sample_number.  Ignoring it.");
+		return;
 	}
-}
 
-int
-SNAPSynchronizerV3_impl::general_work (int noutput_items,
-		gr_vector_int &ninput_items,
-		gr_vector_const_void_star &input_items,
-		gr_vector_void_star &output_items)
-{
+	gr::thread::scoped_lock guard(d_setlock);
+
 	if (d_synchronized) {
-		// If we're synchronized, just memcpy the results.  The SNAP source blocks
-		// will fill in missing sequence numbers with zeros so they'll stay aligned.
-		for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
-			const char * input_stream = (const char *)input_items[cur_input];
-			char * output_stream = (char *)output_items[cur_input];
-			memcpy(output_stream, input_stream, noutput_items*frame_size);
-
-			// And copy the tags
-			std::vector<gr::tag_t> tags;
-			this->get_tags_in_window(tags, cur_input, 0, noutput_items);
-
-			int num_tags = tags.size();
-
-			for (int i=0;i<num_tags;i++) {
-				add_item_tag(cur_input, i, tags[i].key, tags[i].value, d_block_name);
-			}
-		}
-		consume_each (noutput_items);
-
-		// Tell runtime system how many output items we produced.
-		return noutput_items;
+		// Late or repeated header after we've already aligned everyone.
+		return;
+	}
+
+	uint64_t sample_number = pmt::to_uint64(pmt::dict_ref(meta, pmt::mp("sample_number"), pmt::PMT_NIL));
+
+	// Key on the source port if we have it.  Fall back to the F-engine ID.  Sources on
+	// the same port for different channel blocks are told apart by their starting channel.
+	long source_id;
+	if (pmt::dict_has_key(meta, pmt::mp("port"))) {
+		source_id = pmt::to_long(pmt::dict_ref(meta, pmt::mp("port"), pmt::PMT_NIL));
 	}
 	else {
-		gr::thread::scoped_lock guard(d_setlock);
-
-		// We need to synchronize.
-		// Each timestamp will always be t[n+1] = t[n] + 16
-		// Look at each input channel's tags and find the highest starting tag.
-		// Take the timestamp diff for each input, and that's how many items we need to consume.
-		unsigned long highest_tag = 0;
-		unsigned long first_input_timestamp;
-
-		bool test_sync = true;
-
-		// Find the highest tag in the first slot.
-		for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
-			std::vector<gr::tag_t> tags;
-			// We only need the first tag.  No need to get them all.
-			this->get_tags_in_window(tags, cur_input, 0, 1);
-
-			unsigned long tag0 = pmt::to_uint64(tags[0].value);
-
-			if (cur_input == 0) {
-				first_input_timestamp = tag0;
-			}
-			else {
-				if (tag0 != first_input_timestamp) {
-					test_sync = false;
-				}
-			}
-
-			// Save these so we don't have to get tags and iterate again.
-			tag_list[cur_input] = tag0;
-
-			if (tag0 > highest_tag) {
-				highest_tag = tag0;
-			}
-		}
-
-		if (test_sync) {
-			// we're actually now synchronized.  We'll set our sync flag and process as if we came in sync'd
-			d_synchronized = true;
-			for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
-				const char * input_stream = (const char *)input_items[cur_input];
-				char * output_stream = (char *)output_items[cur_input];
-				memcpy(output_stream, input_stream, noutput_items*frame_size);
-
-				// And copy the tags
-				std::vector<gr::tag_t> tags;
-				this->get_tags_in_window(tags, cur_input, 0, noutput_items);
-
-				int num_tags = tags.size();
-
-				for (int i=0;i<num_tags;i++) {
-					add_item_tag(cur_input, i, tags[i].key, tags[i].value,d_block_name);
-				}
-			}
-			consume_each (noutput_items);
-
-	        pmt::pmt_t pdu = pmt::cons( pmt::intern("synctimestamp"), pmt::from_uint64(highest_tag) );
-			message_port_pub(pmt::mp("sync"),pdu);
-
-			std::stringstream msg_stream;
-			msg_stream << "Synchronized on timestamp " << highest_tag;
-			GR_LOG_INFO(d_logger, msg_stream.str());
-
-			// Tell runtime system how many output items we produced.
-			return noutput_items;
-		}
-
-		// So we're still not sync'd so we need to figure out what we need to dump.
-		for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
-
-			// tag_diff will increment by 16 with the tag #'s so no need to divide by 16.
-			// We need this # anyway.
-			uint64_t items_to_consume = highest_tag - tag_list[cur_input];
-
-			if (items_to_consume > noutput_items)
-				items_to_consume = noutput_items;
-
-			consume(cur_input,items_to_consume);
-		}
-
-		// We're going to return 0 here so we don't forward any data along yet.  That won't happen till we're synchronized.
-		return 0;
+		source_id = pmt::to_long(pmt::dict_ref(meta, pmt::mp("antenna_id"), pmt::PMT_NIL));
+	}
+
+	long starting_channel = 0;
+	if (pmt::dict_has_key(meta, pmt::mp("starting_channel"))) {
+		starting_channel = pmt::to_long(pmt::dict_ref(meta, pmt::mp("starting_channel"), pmt::PMT_NIL));
+	}
+
+	d_source_timestamps[std::make_pair(source_id, starting_channel)] = sample_number;
+	SNAP_TRACE3(sync_source_header, source_id, sample_number, d_source_timestamps.size());
+
+	if (d_source_timestamps.size() < (size_t)d_num_inputs) {
+		return;
+	}
+
+	// Everyone has reported in.  The latest starting timestamp is the first one all sources have.
+	uint64_t highest_tag = 0;
+	for (auto it = d_source_timestamps.begin(); it != d_source_timestamps.end(); ++it) {
+		if (it->second > highest_tag)
+			highest_tag = it->second;
 	}
+
+	d_synchronized = true;
+	// There's no general_work() in this mode, so this is the only writer.
+	d_stats.syncs.add();
+	d_stats.synchronized.set(1);
+	SNAP_TRACE2(sync_align_sources, highest_tag, d_num_inputs);
+
+	pmt::pmt_t pdu = pmt::cons( pmt::intern("align_timestamp"), pmt::from_uint64(highest_tag) );
+	message_port_pub(pmt::mp("sync"),pdu);
+
+	std::stringstream msg_stream;
+	msg_stream << "Sources instructed to align on timestamp " << highest_tag;
+	GR_LOG_INFO(d_logger, msg_stream.str());
 }
 
 } /* namespace ata */
@@ -22,37 +22,31 @@
 #define INCLUDED_ATA_SNAPSYNCHRONIZERV3_IMPL_H
 
 #include <ata/SNAPSynchronizerV3.h>
+#include "snap_synchronizer_impl.h"
+#include <map>
+#include <utility>
 
 namespace gr {
   namespace ata {
 
-    class SNAPSynchronizerV3_impl : public SNAPSynchronizerV3
+    // The stream alignment, drift check and copy pool all live in the <char, 16>
+    // snap_synchronizer engine.  This adds the align-at-source message mode.
+    class SNAPSynchronizerV3_impl : public SNAPSynchronizerV3, public snap_synchronizer_impl<char, 16>
     {
      private:
-		bool d_synchronized;
-		int d_num_inputs;
 		int d_num_channels;
-    	int d_num_channels_x2;
-    	int frame_size;
 
-    	pmt::pmt_t d_pmt_seqnum;
-    	pmt::pmt_t d_block_name;
-    	pmt::pmt_t pmt_sequence_number_zero;
-
-    	unsigned long *tag_list;
+    	// Source alignment mode: the first timestamp reported by each source, keyed by UDP port
+    	// and starting channel, since sources for different channel blocks can share a port.
+    	// Sources are aligned once, when they have all reported.  Nothing re-aligns them later.
+    	bool d_align_at_source;
+    	std::map<std::pair<long, long>, uint64_t> d_source_timestamps;
 
      public:
-      SNAPSynchronizerV3_impl(int num_inputs, int num_channels);
+      SNAPSynchronizerV3_impl(int num_inputs, int num_channels, bool align_at_source, int resync_interval, int num_threads);
       ~SNAPSynchronizerV3_impl();
 
-      // Where all the action really happens
-      void forecast (int noutput_items, gr_vector_int &ninput_items_required);
-
-      int general_work(int noutput_items,
-           gr_vector_int &ninput_items,
-           gr_vector_const_void_star &input_items,
-           gr_vector_void_star &output_items);
-
+      void handleSyncHeaderMsg(pmt::pmt_t msg);
     };
 
   } // namespace ata
@@ -0,0 +1,145 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pacing_clock.h"
+
+#include <time.h>
+
+// Spin (rather than sleep) for the last part of every wait.  Scheduler wakeup
+// latency is typically tens of microseconds.
+#define PACING_SPIN_NS 50000
+// Sleep in slices no longer than this so a stop request isn't stuck behind a long gap in the capture.
+#define PACING_MAX_SLEEP_NS 10000000
+// Stream time going back by more than this means the file started over.  Less than
+// this is just items from several streams interleaved a little out of order.
+#define PACING_REWIND_NS 10000000ULL
+
+namespace gr {
+namespace ata {
+
+pacing_clock::pacing_clock(double speed) {
+	set_speed(speed);
+	reset();
+}
+
+pacing_clock::~pacing_clock() {
+}
+
+int64_t pacing_clock::now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void pacing_clock::set_speed(double speed) {
+	if (speed <= 0.0)
+		speed = 1.0;
+
+	d_speed = speed;
+}
+
+void pacing_clock::reset() {
+	d_started = false;
+	d_stream_origin = 0;
+	d_clock_origin = 0;
+	d_last_stream_time = 0;
+	d_last_deadline = 0;
+	d_max_late_ns = 0;
+}
+
+int64_t pacing_clock::deadline_for(uint64_t stream_time_ns) {
+	return d_clock_origin + (int64_t)((double)(stream_time_ns - d_stream_origin) / d_speed);
+}
+
+bool pacing_clock::is_due(uint64_t stream_time_ns) {
+	if (!d_started || (stream_time_ns <= d_last_stream_time))
+		return true;
+
+	return now_ns() >= deadline_for(stream_time_ns);
+}
+
+bool pacing_clock::wait_until_due(uint64_t stream_time_ns, const volatile bool &stop) {
+	if (!d_started) {
+		d_started = true;
+		d_stream_origin = stream_time_ns;
+		d_clock_origin = now_ns();
+		d_last_stream_time = stream_time_ns;
+		d_last_deadline = d_clock_origin;
+		return true;
+	}
+
+	if (stream_time_ns + PACING_REWIND_NS < d_last_stream_time) {
+		// Time went well backwards (the file started over).  Carry on from the last deadline.
+		d_stream_origin = stream_time_ns;
+		d_clock_origin = d_last_deadline;
+		d_last_stream_time = stream_time_ns;
+	}
+
+	int64_t now = now_ns();
+
+	if (stream_time_ns < d_last_stream_time) {
+		// Slightly out of order.  It's already due.
+		return true;
+	}
+
+	int64_t deadline = deadline_for(stream_time_ns);
+
+	d_last_stream_time = stream_time_ns;
+	d_last_deadline = deadline;
+
+	if (now >= deadline) {
+		if (now - deadline > d_max_late_ns)
+			d_max_late_ns = now - deadline;
+
+		return true;
+	}
+
+	// Sleep to an absolute time short of the deadline...
+	while (!stop && (deadline - now > PACING_SPIN_NS)) {
+		int64_t wake = deadline - PACING_SPIN_NS;
+
+		if (wake - now > PACING_MAX_SLEEP_NS)
+			wake = now + PACING_MAX_SLEEP_NS;
+
+		struct timespec ts;
+		ts.tv_sec = wake / 1000000000LL;
+		ts.tv_nsec = wake % 1000000000LL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		now = now_ns();
+	}
+
+	// ...then spin out the rest.
+	while (!stop && (now < deadline)) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+		now = now_ns();
+	}
+
+	return !stop;
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,82 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_PACING_CLOCK_H
+#define INCLUDED_ATA_PACING_CLOCK_H
+
+#include <stdint.h>
+
+namespace gr {
+namespace ata {
+
+/*
+ * Releases items on a schedule taken from their own timestamps (capture time, or
+ * sample_number converted to time).  Every deadline is computed from a fixed origin on
+ * CLOCK_MONOTONIC, so timing errors never accumulate the way they do with relative
+ * sleeps.  Long waits sleep to an absolute time just short of the deadline, and the
+ * last stretch is spun out on the clock for low jitter.
+ *
+ * Items that are a little out of order (several ports interleaved in one capture) are
+ * just released immediately.  If the stream time jumps back by more than 10 ms (a
+ * repeated file), the schedule is re-anchored so playback carries straight on.
+ */
+class pacing_clock {
+protected:
+	double d_speed;
+
+	bool d_started;
+	uint64_t d_stream_origin;
+	int64_t d_clock_origin;
+
+	uint64_t d_last_stream_time;
+	int64_t d_last_deadline;
+
+	// How late we've been, for anyone who wants to report it.
+	int64_t d_max_late_ns;
+
+	int64_t deadline_for(uint64_t stream_time_ns);
+
+public:
+	pacing_clock(double speed=1.0);
+	virtual ~pacing_clock();
+
+	static int64_t now_ns();
+
+	// speed is a multiplier on the stream's own rate: 2.0 plays twice as fast.
+	void set_speed(double speed);
+	double speed() { return d_speed; };
+
+	// Forget the schedule.  The next item will be released immediately and becomes the new origin.
+	void reset();
+
+	// Blocks until the item stamped stream_time_ns is due.  Returns early (false) if stop goes true.
+	bool wait_until_due(uint64_t stream_time_ns, const volatile bool &stop);
+
+	// True if the item would go out right away.  Lets a sender decide to flush a batch
+	// now rather than hold it while waiting on the next item.
+	bool is_due(uint64_t stream_time_ns);
+
+	int64_t max_late_ns() { return d_max_late_ns; };
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_PACING_CLOCK_H */
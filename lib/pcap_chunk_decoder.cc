@@ -0,0 +1,113 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap_chunk_decoder.h"
+
+#include <sstream>
+
+namespace gr {
+namespace ata {
+
+pcap_chunk_decoder::pcap_chunk_decoder(const std::string &filename, uint16_t port, int starting_channel, int ending_channel,
+		bool packed_output, int num_threads, bool repeat, uint64_t start_sample, uint64_t end_sample,
+		uint64_t max_fill_frames)
+	: snap_chunk_decoder(starting_channel, ending_channel, packed_output, num_threads, repeat, start_sample, end_sample,
+			max_fill_frames) {
+	d_filename = filename;
+	d_port = port;
+}
+
+pcap_chunk_decoder::~pcap_chunk_decoder() {
+	// The workers read through the readers, so they have to be done first.
+	stop();
+}
+
+bool pcap_chunk_decoder::open(pcap_index &index) {
+	stop();
+
+	d_opened = false;
+	d_readers.clear();
+
+	auto port_entries = index.ports().find(d_port);
+
+	if ((port_entries == index.ports().end()) || port_entries->second.empty()) {
+		std::stringstream msg;
+		msg << "No packets for port " << d_port << " in " << d_filename;
+		d_last_error = msg.str();
+		return false;
+	}
+
+	const std::vector<pcap_index_entry> &entries = port_entries->second;
+	std::vector<index_point> points(entries.size());
+
+	for (size_t i=0;i<entries.size();i++) {
+		points[i].sample_number = entries[i].sample_number;
+		points[i].position = entries[i].file_offset;
+	}
+
+	if (!layout_regions(points, DECODER_INDEX_POINTS_PER_REGION))
+		return false;
+
+	for (int i=0;i<d_num_threads;i++) {
+		std::unique_ptr<pcap_mmap_reader> reader(new pcap_mmap_reader());
+
+		if (!reader->open(d_filename)) {
+			d_last_error = reader->last_error();
+			d_readers.clear();
+			d_regions.clear();
+			return false;
+		}
+
+		d_readers.push_back(std::move(reader));
+	}
+
+	d_opened = true;
+
+	return true;
+}
+
+void pcap_chunk_decoder::collect_packets(int worker_id, region &r, std::vector<const unsigned char *> &packets) {
+	pcap_mmap_reader &reader = *d_readers[worker_id];
+
+	pcap_record rec;
+	uint16_t port;
+	const unsigned char *payload;
+	size_t payload_len;
+
+	if (!reader.seek(r.position_begin))
+		return;
+
+	while (reader.next(rec) && (rec.file_offset < r.position_end)) {
+		if (!pcap_mmap_reader::udp_payload(rec.data, rec.caplen, port, payload, payload_len))
+			continue;
+
+		if ((port != d_port) || (payload_len != VOLTAGE_PACKET_SIZE))
+			continue;
+
+		packets.push_back(payload);
+	}
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,64 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_PCAP_CHUNK_DECODER_H
+#define INCLUDED_ATA_PCAP_CHUNK_DECODER_H
+
+#include "snap_chunk_decoder.h"
+#include "pcap_index.h"
+#include "pcap_mmap_reader.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gr {
+namespace ata {
+
+/*
+ * Parallel decode of one port of a voltage capture, using the capture's timestamp index
+ * for the regions.
+ */
+class pcap_chunk_decoder : public snap_chunk_decoder {
+protected:
+	std::string d_filename;
+	uint16_t d_port;
+
+	// One reader per worker.  They all map the same file and stay open until the
+	// decoder is destroyed, so frame tables can point into any of them.
+	std::vector<std::unique_ptr<pcap_mmap_reader>> d_readers;
+
+	virtual void collect_packets(int worker_id, region &r, std::vector<const unsigned char *> &packets);
+
+public:
+	pcap_chunk_decoder(const std::string &filename, uint16_t port, int starting_channel, int ending_channel,
+			bool packed_output, int num_threads, bool repeat, uint64_t start_sample=0, uint64_t end_sample=0,
+			uint64_t max_fill_frames=20000);
+	virtual ~pcap_chunk_decoder();
+
+	// Opens the capture and lays out the regions.  Returns false (see last_error()) if the
+	// capture can't be read or has nothing for this port.
+	bool open(pcap_index &index);
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_PCAP_CHUNK_DECODER_H */
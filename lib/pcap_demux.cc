@@ -0,0 +1,296 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap_demux.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+// How many records one call to read_forward() walks.
+#define DEMUX_READ_BATCH 256
+
+// Reading pauses if any other subscriber has this many payloads waiting.  Each entry
+// is just a pointer into the mapping, so this is a few MB per source.
+#define DEMUX_MAX_QUEUED 262144
+
+namespace gr {
+namespace ata {
+
+static boost::mutex s_registry_mutex;
+static std::map<std::string, std::weak_ptr<pcap_demux>> s_registry;
+
+std::shared_ptr<pcap_demux> pcap_demux::get(const std::string &filename, std::string &error) {
+	// Key on the real path so different spellings of the same file share a reader.
+	std::string key = filename;
+	char resolved[PATH_MAX];
+	if (realpath(filename.c_str(), resolved) != NULL)
+		key = resolved;
+
+	boost::mutex::scoped_lock lock(s_registry_mutex);
+
+	auto it = s_registry.find(key);
+
+	if (it != s_registry.end()) {
+		std::shared_ptr<pcap_demux> existing = it->second.lock();
+
+		if (existing)
+			return existing;
+	}
+
+	std::shared_ptr<pcap_demux> demux = std::make_shared<pcap_demux>(key);
+
+	if (!demux->open(error))
+		return std::shared_ptr<pcap_demux>();
+
+	s_registry[key] = demux;
+
+	return demux;
+}
+
+pcap_demux::pcap_demux(const std::string &filename) {
+	d_filename = filename;
+	d_reading_started = false;
+	d_start_requested = false;
+	d_start_offset = 0;
+	d_max_queued = DEMUX_MAX_QUEUED;
+	d_routed_this_pass = 0;
+}
+
+pcap_demux::~pcap_demux() {
+	d_reader.close();
+}
+
+bool pcap_demux::open(std::string &error) {
+	if (!d_reader.open(d_filename)) {
+		error = d_reader.last_error();
+		return false;
+	}
+
+	return true;
+}
+
+int pcap_demux::subscribe(uint16_t port, bool repeat) {
+	boost::mutex::scoped_lock lock(d_mutex);
+
+	subscriber sub;
+	sub.port = port;
+	sub.repeat = repeat;
+	sub.done = false;
+	sub.active = true;
+	sub.waiting_for_wrap = false;
+
+	d_subscribers.push_back(sub);
+	int subscriber_id = d_subscribers.size() - 1;
+	d_port_map.insert(std::make_pair(port, subscriber_id));
+
+	return subscriber_id;
+}
+
+void pcap_demux::unsubscribe(int subscriber_id) {
+	boost::mutex::scoped_lock lock(d_mutex);
+
+	if ((subscriber_id < 0) || (subscriber_id >= (int)d_subscribers.size()))
+		return;
+
+	// Keep the slot so the other IDs stay valid.  Just stop routing to it.
+	subscriber &sub = d_subscribers[subscriber_id];
+	sub.active = false;
+	sub.done = true;
+	sub.queue.clear();
+
+	auto range = d_port_map.equal_range(sub.port);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == subscriber_id) {
+			d_port_map.erase(it);
+			break;
+		}
+	}
+}
+
+void pcap_demux::request_start_offset(size_t file_offset) {
+	boost::mutex::scoped_lock lock(d_mutex);
+
+	if (d_reading_started)
+		return;
+
+	if (!d_start_requested || (file_offset < d_start_offset))
+		d_start_offset = file_offset;
+
+	d_start_requested = true;
+}
+
+void pcap_demux::end_pass(int subscriber_id) {
+	boost::mutex::scoped_lock lock(d_mutex);
+
+	if ((subscriber_id < 0) || (subscriber_id >= (int)d_subscribers.size()))
+		return;
+
+	subscriber &sub = d_subscribers[subscriber_id];
+	sub.queue.clear();
+
+	if (sub.repeat)
+		sub.waiting_for_wrap = true;
+	else
+		sub.done = true;
+}
+
+void pcap_demux::wrap() {
+	if (d_start_offset > 0)
+		d_reader.seek(d_start_offset);
+	else
+		d_reader.rewind();
+
+	for (size_t s=0;s<d_subscribers.size();s++)
+		d_subscribers[s].waiting_for_wrap = false;
+
+	d_routed_this_pass = 0;
+}
+
+bool pcap_demux::others_backed_up(int subscriber_id) {
+	for (size_t i=0;i<d_subscribers.size();i++) {
+		if (((int)i != subscriber_id) && d_subscribers[i].active && (d_subscribers[i].queue.size() >= d_max_queued))
+			return true;
+	}
+
+	return false;
+}
+
+void pcap_demux::read_forward(int max_records) {
+	if (!d_reading_started) {
+		if (d_start_offset > 0)
+			d_reader.seek(d_start_offset);
+
+		d_reading_started = true;
+	}
+
+	pcap_record rec;
+	uint16_t port;
+	pcap_payload payload;
+
+	// If everyone still reading is past the end of their window, there's no point reading on.
+	bool all_waiting = true;
+	bool any_active = false;
+
+	for (size_t s=0;s<d_subscribers.size();s++) {
+		if (!d_subscribers[s].active || d_subscribers[s].done)
+			continue;
+
+		any_active = true;
+
+		if (!d_subscribers[s].waiting_for_wrap)
+			all_waiting = false;
+	}
+
+	if (any_active && all_waiting) {
+		wrap();
+		return;
+	}
+
+	for (int i=0;i<max_records;i++) {
+		if (!d_reader.next(rec)) {
+			// End of the file.  Anyone not repeating is finished.  If someone is,
+			// go around again for everybody still here.
+			bool any_repeat = false;
+
+			for (size_t s=0;s<d_subscribers.size();s++) {
+				if (!d_subscribers[s].active || d_subscribers[s].done)
+					continue;
+
+				if (d_subscribers[s].repeat)
+					any_repeat = true;
+				else
+					d_subscribers[s].done = true;
+			}
+
+			if (any_repeat && (d_routed_this_pass == 0)) {
+				// Nothing in the file for anyone.  Don't spin on it forever.
+				for (size_t s=0;s<d_subscribers.size();s++)
+					d_subscribers[s].done = true;
+
+				any_repeat = false;
+			}
+
+			if (any_repeat)
+				wrap();
+
+			d_routed_this_pass = 0;
+
+			return;
+		}
+
+		if (rec.len != rec.caplen)
+			continue;
+
+		if (!pcap_mmap_reader::udp_payload(rec.data, rec.caplen, port, payload.data, payload.len))
+			continue;
+
+		auto range = d_port_map.equal_range(port);
+
+		if (range.first == range.second)
+			continue;
+
+		payload.timestamp_ns = rec.timestamp_ns;
+
+		for (auto it = range.first; it != range.second; ++it) {
+			subscriber &sub = d_subscribers[it->second];
+
+			if (!sub.done && !sub.waiting_for_wrap) {
+				sub.queue.push_back(payload);
+				d_routed_this_pass++;
+			}
+		}
+	}
+}
+
+bool pcap_demux::next(int subscriber_id, pcap_payload &payload, bool &end_of_file) {
+	boost::mutex::scoped_lock lock(d_mutex);
+
+	end_of_file = false;
+
+	if ((subscriber_id < 0) || (subscriber_id >= (int)d_subscribers.size()))
+		return false;
+
+	subscriber &sub = d_subscribers[subscriber_id];
+
+	while (sub.queue.empty()) {
+		if (sub.done) {
+			end_of_file = true;
+			return false;
+		}
+
+		// Don't run away from someone who isn't keeping up.  They'll read for us when they catch up.
+		if (others_backed_up(subscriber_id))
+			return false;
+
+		read_forward(DEMUX_READ_BATCH);
+	}
+
+	payload = sub.queue.front();
+	sub.queue.pop_front();
+
+	return true;
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,122 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_PCAP_DEMUX_H
+#define INCLUDED_ATA_PCAP_DEMUX_H
+
+#include "pcap_mmap_reader.h"
+
+#include <boost/thread/mutex.hpp>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gr {
+namespace ata {
+
+// A UDP payload inside the shared mapping.
+struct pcap_payload {
+	const unsigned char *data;
+	size_t len;
+	uint64_t timestamp_ns;
+};
+
+/*
+ * Reads a capture file once and fans the UDP payloads out by destination port to every
+ * source subscribed to that port.  There is one of these per capture file per process,
+ * so N SNAP sources replaying the same multi-antenna capture cost one pass over the file
+ * instead of N.
+ *
+ * There is no reader thread.  Whichever subscriber runs dry reads the file forward for
+ * everyone.  If some other subscriber falls too far behind, reading pauses until it
+ * catches up, so memory stays bounded while the sources run at different rates.
+ */
+class pcap_demux {
+protected:
+	struct subscriber {
+		uint16_t port;
+		bool repeat;
+		bool done;
+		bool active;
+		// Finished with this pass over the file (past its end sample) and waiting for the top.
+		bool waiting_for_wrap;
+		std::deque<pcap_payload> queue;
+	};
+
+	std::string d_filename;
+	pcap_mmap_reader d_reader;
+	boost::mutex d_mutex;
+
+	std::vector<subscriber> d_subscribers;
+	// Subscriber indices by port.  More than one source can listen on a port.
+	std::multimap<uint16_t, int> d_port_map;
+
+	bool d_reading_started;
+	bool d_start_requested;
+	size_t d_start_offset;
+	size_t d_max_queued;
+
+	// Payloads routed since the last time we started at the top of the file.
+	size_t d_routed_this_pass;
+
+	// Reads up to max_records records and routes them, restarting the file at the
+	// end for any subscribers that repeat.
+	void read_forward(int max_records);
+	void wrap();
+	bool others_backed_up(int subscriber_id);
+
+public:
+	pcap_demux(const std::string &filename);
+	virtual ~pcap_demux();
+
+	// Returns the shared demux for this file, opening it if needed.  Returns an empty
+	// pointer (and sets error) if the file can't be mapped.
+	static std::shared_ptr<pcap_demux> get(const std::string &filename, std::string &error);
+
+	bool open(std::string &error);
+
+	int subscribe(uint16_t port, bool repeat);
+	void unsubscribe(int subscriber_id);
+
+	// Start reading (and restart on repeat) from this file offset.  Every source asks for
+	// its own offset (0 for the top of the file), and the earliest one wins.  Has no
+	// effect once reading has started.
+	void request_start_offset(size_t file_offset);
+
+	// A subscriber is past the end of its window.  If it repeats, it gets nothing more
+	// until the file starts over, and if every subscriber is in the same spot the file
+	// starts over right away rather than reading on to the end.  Otherwise it's done.
+	void end_pass(int subscriber_id);
+
+	// Returns the next payload for this subscriber.  If there isn't one, end_of_file tells
+	// whether that's because the file is finished for this subscriber, or just because
+	// another subscriber needs to catch up first.
+	bool next(int subscriber_id, pcap_payload &payload, bool &end_of_file);
+
+	uint32_t link_type() { return d_reader.link_type(); };
+	const std::string & filename() { return d_filename; };
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_PCAP_DEMUX_H */
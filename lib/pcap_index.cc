@@ -0,0 +1,281 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap_index.h"
+#include "pcap_mmap_reader.h"
+
+#include <endian.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+
+// The SNAP voltage header is 8 bytes of version/type/channels/feng_id followed
+// by the big-endian 64-bit sample number.  The spectrometer header is a single
+// big-endian 64-bit word.
+#define VOLTAGE_HEADER_SIZE 16
+#define SPECT_HEADER_SIZE 8
+
+#define PCAP_INDEX_MAGIC "SNAPIDX1"
+
+namespace gr {
+namespace ata {
+
+// On-disk layout.  Everything is little-endian.
+struct pcap_index_file_header {
+	char magic[8];
+	uint64_t stride;
+	uint64_t capture_size;
+	int64_t capture_mtime;
+	uint32_t num_ports;
+	// Indexes written before spectrometer support have 0 here, and are voltage.
+	uint32_t packet_type;
+};
+
+struct pcap_index_port_header {
+	uint16_t port;
+	uint16_t reserved1;
+	uint32_t reserved2;
+	uint64_t num_entries;
+};
+
+pcap_index::pcap_index() {
+	d_stride = PCAP_INDEX_DEFAULT_STRIDE;
+	d_capture_size = 0;
+	d_capture_mtime = 0;
+	d_packet_type = SNAP_PACKETTYPE_VOLTAGE;
+}
+
+pcap_index::~pcap_index() {
+}
+
+bool pcap_index::capture_stat(const std::string &capture_file, uint64_t &size, int64_t &mtime) {
+	struct stat st;
+
+	if (stat(capture_file.c_str(), &st) != 0)
+		return false;
+
+	size = st.st_size;
+	mtime = st.st_mtime;
+
+	return true;
+}
+
+bool pcap_index::build(const std::string &capture_file, uint64_t stride, int packet_type) {
+	pcap_mmap_reader reader;
+
+	if (!reader.open(capture_file)) {
+		d_last_error = reader.last_error();
+		return false;
+	}
+
+	if (!capture_stat(capture_file, d_capture_size, d_capture_mtime)) {
+		d_last_error = "Unable to stat " + capture_file;
+		return false;
+	}
+
+	if (stride < 1)
+		stride = 1;
+
+	d_stride = stride;
+	d_packet_type = packet_type;
+	d_ports.clear();
+
+	size_t header_size = (d_packet_type == SNAP_PACKETTYPE_VOLTAGE) ? VOLTAGE_HEADER_SIZE : SPECT_HEADER_SIZE;
+
+	// Next sample_number that gets an index point, per port.
+	std::map<uint16_t, uint64_t> next_point;
+
+	pcap_record rec;
+	uint16_t port;
+	const unsigned char *payload;
+	size_t payload_len;
+
+	while (reader.next(rec)) {
+		if (!pcap_mmap_reader::udp_payload(rec.data, rec.caplen, port, payload, payload_len))
+			continue;
+
+		if (payload_len < header_size)
+			continue;
+
+		snap_header hdr;
+
+		if (d_packet_type == SNAP_PACKETTYPE_VOLTAGE)
+			parse_voltage_header(hdr, payload);
+		else
+			parse_spect_header(hdr, payload);
+
+		uint64_t sample_number = hdr.sample_number;
+
+		auto np = next_point.find(port);
+
+		if ((np == next_point.end()) || (sample_number >= np->second)) {
+			pcap_index_entry entry;
+			entry.sample_number = sample_number;
+			entry.file_offset = rec.file_offset;
+			d_ports[port].push_back(entry);
+
+			next_point[port] = sample_number + d_stride;
+		}
+	}
+
+	return true;
+}
+
+bool pcap_index::load(const std::string &index_file) {
+	FILE *fp = fopen(index_file.c_str(), "rb");
+
+	if (!fp) {
+		d_last_error = "Unable to open " + index_file;
+		return false;
+	}
+
+	pcap_index_file_header hdr;
+
+	if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) || (memcmp(hdr.magic, PCAP_INDEX_MAGIC, 8) != 0)) {
+		d_last_error = index_file + " is not a SNAP capture index.";
+		fclose(fp);
+		return false;
+	}
+
+	d_stride = hdr.stride;
+	d_capture_size = hdr.capture_size;
+	d_capture_mtime = hdr.capture_mtime;
+	d_packet_type = (hdr.packet_type == SNAP_PACKETTYPE_NONE) ? SNAP_PACKETTYPE_VOLTAGE : hdr.packet_type;
+	d_ports.clear();
+
+	for (uint32_t i=0;i<hdr.num_ports;i++) {
+		pcap_index_port_header port_hdr;
+
+		if (fread(&port_hdr, sizeof(port_hdr), 1, fp) != 1) {
+			d_last_error = index_file + " is truncated.";
+			d_ports.clear();
+			fclose(fp);
+			return false;
+		}
+
+		std::vector<pcap_index_entry> &entries = d_ports[port_hdr.port];
+		entries.resize(port_hdr.num_entries);
+
+		if ((port_hdr.num_entries > 0) &&
+				(fread(&entries[0], sizeof(pcap_index_entry), port_hdr.num_entries, fp) != port_hdr.num_entries)) {
+			d_last_error = index_file + " is truncated.";
+			d_ports.clear();
+			fclose(fp);
+			return false;
+		}
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+bool pcap_index::save(const std::string &index_file) {
+	// Write to a temp file and rename so a concurrent reader never sees half an index.
+	std::string tmp_file = index_file + ".tmp";
+
+	FILE *fp = fopen(tmp_file.c_str(), "wb");
+
+	if (!fp) {
+		d_last_error = "Unable to write " + tmp_file;
+		return false;
+	}
+
+	pcap_index_file_header hdr;
+	memset(&hdr, 0x00, sizeof(hdr));
+	memcpy(hdr.magic, PCAP_INDEX_MAGIC, 8);
+	hdr.stride = d_stride;
+	hdr.capture_size = d_capture_size;
+	hdr.capture_mtime = d_capture_mtime;
+	hdr.num_ports = d_ports.size();
+	hdr.packet_type = d_packet_type;
+
+	bool ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+
+	for (auto it = d_ports.begin(); ok && (it != d_ports.end()); ++it) {
+		pcap_index_port_header port_hdr;
+		memset(&port_hdr, 0x00, sizeof(port_hdr));
+		port_hdr.port = it->first;
+		port_hdr.num_entries = it->second.size();
+
+		ok = (fwrite(&port_hdr, sizeof(port_hdr), 1, fp) == 1);
+
+		if (ok && !it->second.empty())
+			ok = (fwrite(&it->second[0], sizeof(pcap_index_entry), it->second.size(), fp) == it->second.size());
+	}
+
+	if (fclose(fp) != 0)
+		ok = false;
+
+	if (!ok || (rename(tmp_file.c_str(), index_file.c_str()) != 0)) {
+		d_last_error = "Unable to write " + index_file;
+		remove(tmp_file.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool pcap_index::matches(const std::string &capture_file) {
+	uint64_t size;
+	int64_t mtime;
+
+	if (!capture_stat(capture_file, size, mtime))
+		return false;
+
+	return (size == d_capture_size) && (mtime == d_capture_mtime);
+}
+
+bool pcap_index::find(uint16_t port, uint64_t sample_number, uint64_t &file_offset) {
+	auto it = d_ports.find(port);
+
+	if ((it == d_ports.end()) || it->second.empty())
+		return false;
+
+	const std::vector<pcap_index_entry> &entries = it->second;
+
+	// Binary search for the last entry with entry.sample_number <= sample_number.
+	size_t lo = 0;
+	size_t hi = entries.size();
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (entries[mid].sample_number <= sample_number)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		file_offset = entries[0].file_offset;
+	else
+		file_offset = entries[lo - 1].file_offset;
+
+	return true;
+}
+
+} /* namespace ata */
+} /* namespace gr */
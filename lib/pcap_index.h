@@ -0,0 +1,95 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_PCAP_INDEX_H
+#define INCLUDED_ATA_PCAP_INDEX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <stddef.h>
+#include <ata/snap_headers.h>
+
+namespace gr {
+namespace ata {
+
+// Default distance between index points, in SNAP sample_number units.
+// 65536 samples is about 0.26 seconds.
+#define PCAP_INDEX_DEFAULT_STRIDE 65536
+// Spectrometer sample_numbers count whole spectra rather than samples.
+#define PCAP_INDEX_DEFAULT_SPECT_STRIDE 64
+
+struct pcap_index_entry {
+	uint64_t sample_number;
+	uint64_t file_offset;
+};
+
+/*
+ * Sidecar index for a voltage or spectrometer capture.  For each UDP port it records the file offset of
+ * the first packet at or past every stride samples, so a reader can jump close to a given
+ * sample_number instead of parsing everything in front of it.  The index is written next
+ * to the capture as <capture>.snapidx, and remembers the size and modification time of
+ * the capture it was built from so a stale index can be detected.
+ */
+class pcap_index {
+protected:
+	uint64_t d_stride;
+	uint64_t d_capture_size;
+	int64_t d_capture_mtime;
+	int d_packet_type;
+
+	std::map<uint16_t, std::vector<pcap_index_entry>> d_ports;
+
+	std::string d_last_error;
+
+	static bool capture_stat(const std::string &capture_file, uint64_t &size, int64_t &mtime);
+
+public:
+	pcap_index();
+	virtual ~pcap_index();
+
+	static std::string index_filename(const std::string &capture_file) { return capture_file + ".snapidx"; };
+
+	// Walks the whole capture.  Packets on any UDP port are indexed, with their
+	// sample_number read from a packet_type (SNAP_PACKETTYPE_*) header.
+	bool build(const std::string &capture_file, uint64_t stride=PCAP_INDEX_DEFAULT_STRIDE,
+			int packet_type=SNAP_PACKETTYPE_VOLTAGE);
+
+	bool load(const std::string &index_file);
+	bool save(const std::string &index_file);
+
+	// True if this index was built from the capture as it is on disk now.
+	bool matches(const std::string &capture_file);
+
+	// Finds the last index point at or before sample_number for this port.  If
+	// sample_number is before the first one, the first one is returned.
+	bool find(uint16_t port, uint64_t sample_number, uint64_t &file_offset);
+
+	uint64_t stride() { return d_stride; };
+	int packet_type() { return d_packet_type; };
+	const std::map<uint16_t, std::vector<pcap_index_entry>> & ports() { return d_ports; };
+	const std::string & last_error() { return d_last_error; };
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_PCAP_INDEX_H */
@@ -0,0 +1,131 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap_loop_cache.h"
+
+#include <string.h>
+#include <new>
+
+namespace gr {
+namespace ata {
+
+pcap_loop_cache::pcap_loop_cache() {
+	d_buffer = NULL;
+	d_capacity = 0;
+	d_used = 0;
+	d_ready = false;
+	d_pos = 0;
+	d_loop = 0;
+	d_sample_span = 0;
+}
+
+pcap_loop_cache::~pcap_loop_cache() {
+	release();
+}
+
+bool pcap_loop_cache::allocate(size_t capacity) {
+	release();
+
+	d_buffer = new (std::nothrow) unsigned char[capacity];
+
+	if (!d_buffer)
+		return false;
+
+	d_capacity = capacity;
+
+	return true;
+}
+
+void pcap_loop_cache::release() {
+	if (d_buffer) {
+		delete[] d_buffer;
+		d_buffer = NULL;
+	}
+
+	d_capacity = 0;
+	d_used = 0;
+	d_entries.clear();
+	d_ready = false;
+	d_pos = 0;
+	d_loop = 0;
+	d_sample_span = 0;
+}
+
+unsigned char *pcap_loop_cache::append(const unsigned char *data, size_t len, uint64_t time_ns, uint64_t sample_number) {
+	if (!d_buffer || d_ready || (d_used + len > d_capacity))
+		return NULL;
+
+	entry e;
+	e.offset = d_used;
+	e.len = len;
+	e.time_ns = time_ns;
+	e.sample_number = sample_number;
+
+	memcpy(d_buffer + d_used, data, len);
+	d_used += len;
+
+	d_entries.push_back(e);
+
+	return d_buffer + e.offset;
+}
+
+void pcap_loop_cache::finish(uint64_t samples_per_packet) {
+	if (d_entries.empty())
+		return;
+
+	uint64_t first = d_entries.front().sample_number;
+	uint64_t last = d_entries.back().sample_number;
+
+	if (last >= first)
+		d_sample_span = last - first + samples_per_packet;
+	else
+		d_sample_span = 0;
+
+	// The first pass has already been played, so the next one is loop 1.
+	d_pos = 0;
+	d_loop = 1;
+	d_ready = true;
+}
+
+bool pcap_loop_cache::next(unsigned char *&data, size_t &len, uint64_t &time_ns, uint64_t &sample_offset) {
+	if (!d_ready || d_entries.empty())
+		return false;
+
+	if (d_pos >= d_entries.size()) {
+		d_pos = 0;
+		d_loop++;
+	}
+
+	const entry &e = d_entries[d_pos++];
+
+	data = d_buffer + e.offset;
+	len = e.len;
+	time_ns = e.time_ns;
+	sample_offset = d_loop * d_sample_span;
+
+	return true;
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,85 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_PCAP_LOOP_CACHE_H
+#define INCLUDED_ATA_PCAP_LOOP_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace gr {
+namespace ata {
+
+/*
+ * Holds one pass of SNAP payloads back to back in a single allocation, so a repeated
+ * capture can be played from memory after the first pass instead of going back to the
+ * file.  The buffer is sized up front and never moves, so pointers into it stay valid
+ * for as long as the cache exists.
+ */
+class pcap_loop_cache {
+protected:
+	struct entry {
+		size_t offset;
+		size_t len;
+		uint64_t time_ns;
+		uint64_t sample_number;
+	};
+
+	unsigned char *d_buffer;
+	size_t d_capacity;
+	size_t d_used;
+
+	std::vector<entry> d_entries;
+
+	bool d_ready;
+	size_t d_pos;
+	uint64_t d_loop;
+	uint64_t d_sample_span;
+
+public:
+	pcap_loop_cache();
+	virtual ~pcap_loop_cache();
+
+	// Reserves capacity bytes.  Returns false if the memory isn't available.
+	bool allocate(size_t capacity);
+	void release();
+
+	bool allocated() { return d_buffer != NULL; };
+
+	// Copies a payload in and returns where it landed, or NULL if there's no room.
+	unsigned char *append(const unsigned char *data, size_t len, uint64_t time_ns, uint64_t sample_number);
+
+	// The pass is complete.  One loop covers (last - first + samples_per_packet) sample numbers.
+	void finish(uint64_t samples_per_packet);
+
+	bool ready() { return d_ready; };
+	size_t size() { return d_entries.size(); };
+	size_t bytes() { return d_used; };
+
+	// Returns the next payload, starting over at the end.  sample_offset is how far to
+	// move the payload's sample_number so time keeps running forward across loops.
+	bool next(unsigned char *&data, size_t &len, uint64_t &time_ns, uint64_t &sample_offset);
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_PCAP_LOOP_CACHE_H */
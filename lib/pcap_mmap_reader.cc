@@ -0,0 +1,587 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "pcap_mmap_reader.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sstream>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+// Classic pcap magic numbers as read in host order.
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_USEC_SWAPPED 0xd4c3b2a1
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_MAGIC_NSEC_SWAPPED 0x4d3cb2a1
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+// pcapng block types
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_SIMPLE_PACKET 0x00000003
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+// How much of the file to ask the kernel to read ahead of us at a time.
+#define READ_AHEAD_BYTES (64UL*1024UL*1024UL)
+
+// How many headers in a row have to check out before find_record_boundary() trusts an offset.
+#define BOUNDARY_CHAIN_LENGTH 4
+// No record is bigger than this (same limit libpcap uses).
+#define MAX_RECORD_BYTES 262144
+// Records within a file are assumed to be within this many seconds of the first one.
+#define MAX_CAPTURE_SPAN_SEC (30*86400)
+
+namespace gr {
+namespace ata {
+
+pcap_mmap_reader::pcap_mmap_reader() {
+	d_fd = -1;
+	d_map = NULL;
+	d_file_size = 0;
+	d_first_record = 0;
+	d_offset = 0;
+	d_advised_until = 0;
+	d_pcapng = false;
+	d_swapped = false;
+	d_link_type = 0;
+	d_nanosecond = false;
+}
+
+pcap_mmap_reader::~pcap_mmap_reader() {
+	close();
+}
+
+bool pcap_mmap_reader::open(const std::string &filename) {
+	close();
+
+	d_filename = filename;
+
+	d_fd = ::open(filename.c_str(), O_RDONLY);
+
+	if (d_fd < 0) {
+		std::stringstream msg;
+		msg << "Unable to open " << filename << ": " << strerror(errno);
+		d_last_error = msg.str();
+		return false;
+	}
+
+	struct stat st;
+	if ((fstat(d_fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size < PCAP_FILE_HEADER_SIZE)) {
+		d_last_error = filename + " is not a regular capture file.";
+		close();
+		return false;
+	}
+
+	d_file_size = st.st_size;
+
+	void *map = mmap(NULL, d_file_size, PROT_READ, MAP_PRIVATE, d_fd, 0);
+
+	if (map == MAP_FAILED) {
+		std::stringstream msg;
+		msg << "Unable to map " << filename << ": " << strerror(errno);
+		d_last_error = msg.str();
+		d_map = NULL;
+		close();
+		return false;
+	}
+
+	d_map = (const unsigned char *)map;
+
+	// We walk the file front to back, so let the kernel read ahead aggressively
+	// and drop pages behind us.
+	madvise(map, d_file_size, MADV_SEQUENTIAL);
+
+	if (!parse_file_header()) {
+		close();
+		return false;
+	}
+
+	d_offset = d_first_record;
+	d_advised_until = d_offset;
+
+	return true;
+}
+
+void pcap_mmap_reader::close() {
+	if (d_map) {
+		munmap((void *)d_map, d_file_size);
+		d_map = NULL;
+	}
+
+	if (d_fd >= 0) {
+		::close(d_fd);
+		d_fd = -1;
+	}
+
+	d_file_size = 0;
+	d_offset = 0;
+	d_first_record = 0;
+	d_advised_until = 0;
+	d_if_link_types.clear();
+	d_if_ts_units.clear();
+}
+
+bool pcap_mmap_reader::parse_file_header() {
+	uint32_t magic;
+	memcpy_raw(&magic, 0, sizeof(magic));
+
+	d_pcapng = false;
+	d_swapped = false;
+	d_nanosecond = false;
+
+	switch (magic) {
+	case PCAP_MAGIC_USEC:
+		break;
+	case PCAP_MAGIC_USEC_SWAPPED:
+		d_swapped = true;
+		break;
+	case PCAP_MAGIC_NSEC:
+		d_nanosecond = true;
+		break;
+	case PCAP_MAGIC_NSEC_SWAPPED:
+		d_swapped = true;
+		d_nanosecond = true;
+		break;
+	case PCAPNG_SECTION_HEADER:
+		d_pcapng = true;
+		break;
+	default:
+		d_last_error = d_filename + " is not a pcap or pcapng file.";
+		return false;
+	}
+
+	if (d_pcapng) {
+		if (!parse_pcapng_section_header(0))
+			return false;
+
+		d_first_record = 0;
+		return true;
+	}
+
+	d_link_type = read32(20);
+	d_first_record = PCAP_FILE_HEADER_SIZE;
+
+	return true;
+}
+
+bool pcap_mmap_reader::parse_pcapng_section_header(size_t offset) {
+	if (offset + 12 > d_file_size) {
+		d_last_error = d_filename + " has a truncated pcapng section header.";
+		return false;
+	}
+
+	uint32_t bom;
+	memcpy_raw(&bom, offset + 8, sizeof(bom));
+
+	if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+		d_swapped = false;
+	}
+	else if (bom == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+		d_swapped = true;
+	}
+	else {
+		d_last_error = d_filename + " has a bad pcapng byte-order magic.";
+		return false;
+	}
+
+	// Interface IDs are scoped to the section.
+	d_if_link_types.clear();
+	d_if_ts_units.clear();
+
+	return true;
+}
+
+void pcap_mmap_reader::parse_pcapng_interface(size_t offset, uint32_t block_len) {
+	uint32_t link_type = read16(offset + 8);
+	uint64_t ts_units = 1000000;
+
+	// Options start after type, length, linktype, reserved, and snaplen.
+	size_t opt = offset + 16;
+	size_t opt_end = offset + block_len - 4;
+
+	while (opt + 4 <= opt_end) {
+		uint16_t code = read16(opt);
+		uint16_t len = read16(opt + 2);
+
+		if (code == 0)
+			break;
+
+		if ((code == PCAPNG_OPT_IF_TSRESOL) && (len >= 1) && (opt + 5 <= opt_end)) {
+			uint8_t tsresol = d_map[opt + 4];
+
+			ts_units = 1;
+			if (tsresol & 0x80) {
+				for (int i=0;i<(tsresol & 0x7f);i++)
+					ts_units *= 2;
+			}
+			else {
+				for (int i=0;i<tsresol;i++)
+					ts_units *= 10;
+			}
+		}
+
+		opt += 4 + ((len + 3) & ~3);
+	}
+
+	d_if_link_types.push_back(link_type);
+	d_if_ts_units.push_back(ts_units);
+
+	if (d_if_link_types.size() == 1)
+		d_link_type = link_type;
+}
+
+uint64_t pcap_mmap_reader::pcapng_timestamp_ns(uint32_t interface_id, uint32_t ts_high, uint32_t ts_low) {
+	uint64_t ts = ((uint64_t)ts_high << 32) | ts_low;
+	uint64_t units = 1000000;
+
+	if (interface_id < d_if_ts_units.size())
+		units = d_if_ts_units[interface_id];
+
+	if (units == 1000000000)
+		return ts;
+
+	return (ts / units) * 1000000000ULL + ((ts % units) * 1000000000ULL) / units;
+}
+
+void pcap_mmap_reader::read_ahead() {
+	// Keep the kernel a window ahead of where we're reading.
+	if (d_offset + READ_AHEAD_BYTES / 2 < d_advised_until)
+		return;
+
+	size_t page_size = 4096;
+	size_t start = d_advised_until & ~(page_size - 1);
+
+	if (start >= d_file_size)
+		return;
+
+	size_t len = READ_AHEAD_BYTES;
+	if (start + len > d_file_size)
+		len = d_file_size - start;
+
+	madvise((void *)(d_map + start), len, MADV_WILLNEED);
+
+	d_advised_until = start + len;
+}
+
+bool pcap_mmap_reader::seek(size_t file_offset) {
+	if (!d_map || (file_offset < d_first_record) || (file_offset >= d_file_size))
+		return false;
+
+	if (d_pcapng) {
+		// The interface descriptions (timestamp resolution) come before the first packet,
+		// so walk up to it to pick them up before jumping.
+		d_offset = d_first_record;
+		pcap_record rec;
+		next_pcapng_record(rec);
+	}
+
+	d_offset = file_offset;
+	d_advised_until = d_offset;
+
+	return true;
+}
+
+bool pcap_mmap_reader::plausible_pcap_record(size_t offset, size_t &next_offset) {
+	if (offset + PCAP_RECORD_HEADER_SIZE > d_file_size)
+		return false;
+
+	uint32_t ts_sec = read32(offset);
+	uint32_t ts_frac = read32(offset + 4);
+	uint32_t caplen = read32(offset + 8);
+	uint32_t len = read32(offset + 12);
+
+	if ((caplen == 0) || (caplen > len) || (len > MAX_RECORD_BYTES))
+		return false;
+
+	if (ts_frac >= (d_nanosecond ? 1000000000U : 1000000U))
+		return false;
+
+	// Compare against the first record in the file.
+	uint32_t first_sec = read32(d_first_record);
+	uint32_t diff = (ts_sec > first_sec) ? (ts_sec - first_sec) : (first_sec - ts_sec);
+
+	if (diff > MAX_CAPTURE_SPAN_SEC)
+		return false;
+
+	next_offset = offset + PCAP_RECORD_HEADER_SIZE + caplen;
+
+	return next_offset <= d_file_size;
+}
+
+bool pcap_mmap_reader::plausible_pcapng_block(size_t offset, size_t &next_offset) {
+	if (offset + 12 > d_file_size)
+		return false;
+
+	uint32_t block_type = read32(offset);
+
+	switch (block_type) {
+	case PCAPNG_INTERFACE_DESCRIPTION:
+	case PCAPNG_SIMPLE_PACKET:
+	case PCAPNG_ENHANCED_PACKET:
+	case 4: // name resolution
+	case 5: // interface statistics
+		break;
+	default:
+		return false;
+	}
+
+	uint32_t block_len = read32(offset + 4);
+
+	if ((block_len < 12) || (block_len % 4) || (offset + block_len > d_file_size))
+		return false;
+
+	// Every block carries its length at both ends.
+	if (read32(offset + block_len - 4) != block_len)
+		return false;
+
+	next_offset = offset + block_len;
+
+	return true;
+}
+
+size_t pcap_mmap_reader::find_record_boundary(size_t file_offset) {
+	if (!d_map)
+		return 0;
+
+	if (file_offset <= d_first_record)
+		return d_first_record;
+
+	// pcapng blocks are 32-bit aligned.  pcap records can start anywhere.
+	size_t step = 1;
+
+	if (d_pcapng) {
+		step = 4;
+		file_offset = (file_offset + 3) & ~(size_t)3;
+	}
+
+	for (size_t candidate = file_offset; candidate < d_file_size; candidate += step) {
+		size_t offset = candidate;
+		int good = 0;
+
+		while (good < BOUNDARY_CHAIN_LENGTH) {
+			size_t next_offset;
+
+			if (d_pcapng ? !plausible_pcapng_block(offset, next_offset) : !plausible_pcap_record(offset, next_offset))
+				break;
+
+			good++;
+			offset = next_offset;
+
+			// Running exactly into the end of the file counts as a complete chain.
+			if (offset == d_file_size) {
+				good = BOUNDARY_CHAIN_LENGTH;
+				break;
+			}
+		}
+
+		if (good == BOUNDARY_CHAIN_LENGTH)
+			return candidate;
+	}
+
+	return d_file_size;
+}
+
+bool pcap_mmap_reader::udp_payload(const unsigned char *pkt, uint32_t caplen, uint16_t &dest_port,
+		const unsigned char *&payload, size_t &payload_len) {
+	if (caplen < sizeof(ether_header) + sizeof(iphdr) + sizeof(udphdr))
+		return false;
+
+	const unsigned char *p = pkt;
+	auto eth = reinterpret_cast<const ether_header *>(p);
+
+	// jump over and ignore vlan tag
+	if (ntohs(eth->ether_type) == ETHERTYPE_VLAN) {
+		p += 4;
+		eth = reinterpret_cast<const ether_header *>(p);
+	}
+
+	if (ntohs(eth->ether_type) != ETHERTYPE_IP)
+		return false;
+
+	auto ip = reinterpret_cast<const iphdr *>(p + sizeof(ether_header));
+
+	if ((ip->version != 4) || (ip->protocol != IPPROTO_UDP))
+		return false;
+
+	size_t header_size = (p - pkt) + sizeof(ether_header) + ip->ihl * 4;
+
+	if (header_size + sizeof(udphdr) > caplen)
+		return false;
+
+	auto udp = reinterpret_cast<const udphdr *>(pkt + header_size);
+
+	size_t udp_len = ntohs(udp->len);
+
+	if ((udp_len < sizeof(udphdr)) || (header_size + udp_len > caplen))
+		return false;
+
+	dest_port = ntohs(udp->dest);
+	payload = pkt + header_size + sizeof(udphdr);
+	payload_len = udp_len - sizeof(udphdr);
+
+	return true;
+}
+
+bool pcap_mmap_reader::next(pcap_record &rec) {
+	if (!d_map)
+		return false;
+
+	read_ahead();
+
+	if (d_pcapng)
+		return next_pcapng_record(rec);
+	else
+		return next_pcap_record(rec);
+}
+
+bool pcap_mmap_reader::next_pcap_record(pcap_record &rec) {
+	if (d_offset + PCAP_RECORD_HEADER_SIZE > d_file_size)
+		return false;
+
+	uint32_t ts_sec = read32(d_offset);
+	uint32_t ts_frac = read32(d_offset + 4);
+	uint32_t caplen = read32(d_offset + 8);
+	uint32_t len = read32(d_offset + 12);
+
+	size_t data_offset = d_offset + PCAP_RECORD_HEADER_SIZE;
+
+	if (data_offset + caplen > d_file_size) {
+		// Truncated last record (capture was killed mid-write).
+		d_offset = d_file_size;
+		return false;
+	}
+
+	rec.data = d_map + data_offset;
+	rec.caplen = caplen;
+	rec.len = len;
+	rec.timestamp_ns = (uint64_t)ts_sec * 1000000000ULL + (d_nanosecond ? ts_frac : (uint64_t)ts_frac * 1000ULL);
+	rec.file_offset = d_offset;
+
+	d_offset = data_offset + caplen;
+
+	// Pull in the next record's header and the start of its payload while
+	// the caller works on this one.
+	__builtin_prefetch(d_map + d_offset);
+	__builtin_prefetch(d_map + d_offset + 64);
+
+	return true;
+}
+
+bool pcap_mmap_reader::next_pcapng_record(pcap_record &rec) {
+	while (d_offset + 12 <= d_file_size) {
+		uint32_t block_type;
+		memcpy_raw(&block_type, d_offset, sizeof(block_type));
+
+		// The section header's type is a palindrome, so it reads the same in either byte
+		// order, and it tells us the byte order for everything after it.
+		if (block_type == PCAPNG_SECTION_HEADER) {
+			if (!parse_pcapng_section_header(d_offset))
+				return false;
+		}
+		else {
+			block_type = swap32(block_type);
+		}
+
+		uint32_t block_len = read32(d_offset + 4);
+
+		if ((block_len < 12) || (d_offset + block_len > d_file_size)) {
+			d_offset = d_file_size;
+			return false;
+		}
+
+		size_t block_start = d_offset;
+		d_offset += block_len;
+
+		__builtin_prefetch(d_map + d_offset);
+		__builtin_prefetch(d_map + d_offset + 64);
+
+		switch (block_type) {
+		case PCAPNG_INTERFACE_DESCRIPTION:
+			parse_pcapng_interface(block_start, block_len);
+			break;
+
+		case PCAPNG_ENHANCED_PACKET: {
+			if (block_len < 32)
+				break;
+
+			uint32_t interface_id = read32(block_start + 8);
+			uint32_t ts_high = read32(block_start + 12);
+			uint32_t ts_low = read32(block_start + 16);
+			uint32_t caplen = read32(block_start + 20);
+			uint32_t len = read32(block_start + 24);
+
+			// caplen comes straight from the file, so check it without 32-bit wraparound.
+			if ((caplen > MAX_RECORD_BYTES) || (caplen > block_len - 32))
+				break;
+
+			rec.data = d_map + block_start + 28;
+			rec.caplen = caplen;
+			rec.len = len;
+			rec.timestamp_ns = pcapng_timestamp_ns(interface_id, ts_high, ts_low);
+			rec.file_offset = block_start;
+			return true;
+		}
+
+		case PCAPNG_SIMPLE_PACKET: {
+			if (block_len < 16)
+				break;
+
+			uint32_t len = read32(block_start + 8);
+			uint32_t caplen = block_len - 16;
+
+			if (len < caplen)
+				caplen = len;
+
+			if (caplen > MAX_RECORD_BYTES)
+				break;
+
+			rec.data = d_map + block_start + 12;
+			rec.caplen = caplen;
+			rec.len = len;
+			// Simple packet blocks don't carry a timestamp.
+			rec.timestamp_ns = 0;
+			rec.file_offset = block_start;
+			return true;
+		}
+
+		default:
+			// Name resolution, statistics, custom blocks, etc.  Not needed here.
+			break;
+		}
+	}
+
+	return false;
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,135 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_PCAP_MMAP_READER_H
+#define INCLUDED_ATA_PCAP_MMAP_READER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace gr {
+namespace ata {
+
+// One record in the capture.  data points straight into the file mapping, so it is
+// only valid until the reader is closed.
+struct pcap_record {
+	const unsigned char *data;
+	uint32_t caplen;
+	uint32_t len;
+	uint64_t timestamp_ns;
+	size_t file_offset;
+};
+
+/*
+ * Reads classic pcap (micro- or nanosecond, either byte order) and pcapng captures
+ * by mapping the whole file and walking the records in place.  Nothing is copied,
+ * and the pages ahead of the read position are prefetched as we go.
+ */
+class pcap_mmap_reader {
+protected:
+	std::string d_filename;
+	std::string d_last_error;
+
+	int d_fd;
+	const unsigned char *d_map;
+	size_t d_file_size;
+
+	// Where the first record starts and where the next read will happen.
+	size_t d_first_record;
+	size_t d_offset;
+
+	// How far ahead of d_offset the kernel has been asked to read.
+	size_t d_advised_until;
+
+	bool d_pcapng;
+	bool d_swapped;
+	uint32_t d_link_type;
+
+	// Classic pcap timestamp resolution.
+	bool d_nanosecond;
+
+	// pcapng: per-interface link types and timestamp resolution (units per second).
+	std::vector<uint32_t> d_if_link_types;
+	std::vector<uint64_t> d_if_ts_units;
+
+	uint16_t swap16(uint16_t val) { return d_swapped ? __builtin_bswap16(val) : val; };
+	uint32_t swap32(uint32_t val) { return d_swapped ? __builtin_bswap32(val) : val; };
+
+	uint16_t read16(size_t offset) { uint16_t val; memcpy_raw(&val, offset, sizeof(val)); return swap16(val); };
+	uint32_t read32(size_t offset) { uint32_t val; memcpy_raw(&val, offset, sizeof(val)); return swap32(val); };
+
+	void memcpy_raw(void *dest, size_t offset, size_t len) { memcpy(dest, d_map + offset, len); };
+
+	void read_ahead();
+
+	bool parse_file_header();
+	bool parse_pcapng_section_header(size_t offset);
+	void parse_pcapng_interface(size_t offset, uint32_t block_len);
+	uint64_t pcapng_timestamp_ns(uint32_t interface_id, uint32_t ts_high, uint32_t ts_low);
+
+	bool next_pcap_record(pcap_record &rec);
+	bool next_pcapng_record(pcap_record &rec);
+
+	// Does a plausible record start here?  Used to find record boundaries mid-file.
+	bool plausible_pcap_record(size_t offset, size_t &next_offset);
+	bool plausible_pcapng_block(size_t offset, size_t &next_offset);
+
+public:
+	pcap_mmap_reader();
+	virtual ~pcap_mmap_reader();
+
+	bool open(const std::string &filename);
+	void close();
+	bool is_open() { return d_map != NULL; };
+
+	// Returns false at the end of the file.
+	bool next(pcap_record &rec);
+
+	// Start over at the first record.  The mapping (and any record pointers) stay valid.
+	void rewind() { d_offset = d_first_record; d_advised_until = d_offset; };
+
+	// Position the reader on a record boundary previously returned in pcap_record::file_offset.
+	bool seek(size_t file_offset);
+
+	// Finds the first record that starts at or after file_offset, so a capture can be split
+	// into chunks for several readers.  Nothing in a pcap file marks where records start, so
+	// this looks for a run of consecutive headers that all make sense.  Returns file_size()
+	// if there isn't one.
+	size_t find_record_boundary(size_t file_offset);
+
+	// Finds the UDP payload in an Ethernet frame (optionally VLAN tagged, IPv4 only).
+	// Returns false if the packet isn't UDP or is truncated.
+	static bool udp_payload(const unsigned char *pkt, uint32_t caplen, uint16_t &dest_port,
+			const unsigned char *&payload, size_t &payload_len);
+
+	size_t file_size() { return d_file_size; };
+	size_t position() { return d_offset; };
+	bool is_pcapng() { return d_pcapng; };
+	uint32_t link_type() { return d_link_type; };
+	const std::string & last_error() { return d_last_error; };
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_PCAP_MMAP_READER_H */
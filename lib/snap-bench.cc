@@ -0,0 +1,475 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <deque>
+#include <set>
+#include <string.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLE_COUNTER
+#endif
+
+#include "snap_source_impl.h"
+#include "snap_packet_generator.h"
+#include "snap_unpack.h"
+
+using namespace gr::ata;
+
+/*
+ * Microbenchmarks for the SNAP source's per-packet work, fed from the synthetic packet
+ * generator so nothing depends on a network, a capture file or a SNAP board.  Each stage
+ * runs the same code (or the same sequence of steps) as snap_source_impl over a pool of
+ * packets bigger than the caches, for each channel count asked for.
+ *
+ * Throughput is in packet bytes, so the stages line up against line rate.  For gap fill,
+ * that's the bytes of the packets the zero frames stand in for.  Cycles are read from the
+ * time stamp counter, which runs at the CPU's nominal clock.
+ */
+
+#define STAGE_HEADER "header"
+#define STAGE_UNPACK "unpack"
+#define STAGE_UNPACK_PACKED "unpack-packed"
+// Unpack while counting 4-bit codes, as with a quantization stats interval.
+#define STAGE_UNPACK_QUANT "unpack-quant"
+#define STAGE_ASSEMBLE "assemble"
+#define STAGE_GAP_FILL "gapfill"
+#define STAGE_TAGS "tags"
+#define STAGE_SPECT "spect"
+
+// Vectors handed to "work()" at a time in the assemble and gap fill stages.
+#define BENCH_OUTPUT_ITEMS 256
+
+struct bench_result {
+	uint64_t packets = 0;
+	uint64_t bytes = 0;
+	double seconds = 0.0;
+	uint64_t cycles = 0;
+};
+
+// Results go here so the compiler can't throw the work away.
+static volatile uint64_t g_sink = 0;
+
+double min_seconds = 1.0;
+size_t pool_mb = 64;
+bool csv_output = false;
+
+static inline uint64_t read_cycles() {
+#ifdef HAVE_CYCLE_COUNTER
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Runs one pass over the pool (pass_packets packets) until min_seconds have gone by.
+template <typename F>
+static bench_result run_stage(F pass, uint64_t pass_packets, size_t packet_size) {
+	bench_result result;
+
+	// One pass to warm up the caches and the allocator.
+	pass();
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t start_cycles = read_cycles();
+	double elapsed = 0.0;
+
+	do {
+		pass();
+		result.packets += pass_packets;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < min_seconds);
+
+	result.cycles = read_cycles() - start_cycles;
+	result.seconds = elapsed;
+	result.bytes = result.packets * packet_size;
+
+	return result;
+}
+
+static void report(const std::string &stage, int channels, const bench_result &r) {
+	double packets_per_sec = r.packets / r.seconds;
+	double mb_per_sec = r.bytes / r.seconds / (1024.0 * 1024.0);
+	double ns_per_packet = r.seconds * 1e9 / r.packets;
+
+	if (csv_output) {
+		std::cout << stage << "," << channels << "," << std::fixed << std::setprecision(0) << packets_per_sec << "," <<
+				std::setprecision(1) << mb_per_sec << "," << std::setprecision(2) << ns_per_packet << ",";
+#ifdef HAVE_CYCLE_COUNTER
+		std::cout << std::setprecision(1) << ((double)r.cycles / r.packets);
+#endif
+		std::cout << std::endl;
+		return;
+	}
+
+	std::cout << std::left << std::setw(15) << stage << std::right << std::setw(9) << channels <<
+			std::fixed << std::setprecision(0) << std::setw(15) << packets_per_sec <<
+			std::setprecision(1) << std::setw(12) << mb_per_sec <<
+			std::setprecision(2) << std::setw(12) << ns_per_packet;
+#ifdef HAVE_CYCLE_COUNTER
+	std::cout << std::setprecision(1) << std::setw(14) << ((double)r.cycles / r.packets);
+#else
+	std::cout << std::setw(14) << "-";
+#endif
+	std::cout << std::endl;
+}
+
+static void make_lut(char *lut) {
+	for (int i=0;i<8;i++) {
+		lut[i] = i;
+	}
+
+	lut[8] = 0; // 1000 is a special case: -0 (as opposed to 0000 = +0)
+	for (int i=9;i<16;i++) {
+		lut[i] = i - 16;
+	}
+}
+
+// Queues one frame the way queue_voltage_data() does.
+static void queue_frame(char *x_buffer, char *y_buffer, int veclen, uint64_t sample_number,
+		std::deque<data_vector<char>> &x_queue, std::deque<data_vector<char>> &y_queue, std::deque<uint64_t> &seq_queue) {
+	for (int t=0;t<16;t++) {
+		data_vector<char> x_cur_vector(&x_buffer[t * veclen], veclen);
+		x_queue.push_back(x_cur_vector);
+		data_vector<char> y_cur_vector(&y_buffer[t * veclen], veclen);
+		y_queue.push_back(y_cur_vector);
+		seq_queue.push_back(sample_number);
+	}
+}
+
+// Hands queued vectors out the way the end of work_volt_mode() does.
+static void drain(char *x_out, char *y_out, int veclen, std::deque<data_vector<char>> &x_queue,
+		std::deque<data_vector<char>> &y_queue, std::deque<uint64_t> &seq_queue) {
+	while (x_queue.size() >= BENCH_OUTPUT_ITEMS) {
+		for (int i=0;i<BENCH_OUTPUT_ITEMS;i++) {
+			memcpy(&x_out[i * veclen], x_queue.front().data_pointer(), veclen);
+			x_queue.pop_front();
+			memcpy(&y_out[i * veclen], y_queue.front().data_pointer(), veclen);
+			y_queue.pop_front();
+			g_sink += seq_queue.front();
+			seq_queue.pop_front();
+		}
+	}
+}
+
+static void bench_voltage(int channels, const std::set<std::string> &stages) {
+	snap_packet_generator generator(SNAP_PACKETTYPE_VOLTAGE, 0, channels - 1);
+
+	size_t packet_size = generator.packet_size();
+	int packets_per_frame = generator.packets_per_frame();
+	int veclen = channels * 2;
+
+	size_t num_frames = (pool_mb * 1024 * 1024) / (packet_size * packets_per_frame);
+
+	if (num_frames < 16)
+		num_frames = 16;
+
+	size_t num_packets = num_frames * packets_per_frame;
+	std::vector<unsigned char> pool(num_packets * packet_size);
+	generator.fill(&pool[0], num_packets);
+
+	char lut[16];
+	make_lut(lut);
+
+	std::vector<char> x_frame(16 * veclen);
+	std::vector<char> y_frame(16 * veclen);
+	std::vector<char> x_out((size_t)BENCH_OUTPUT_ITEMS * veclen);
+	std::vector<char> y_out((size_t)BENCH_OUTPUT_ITEMS * veclen);
+
+	if (stages.count(STAGE_HEADER)) {
+		bench_result r = run_stage([&]() {
+			uint64_t sum = 0;
+			snap_header hdr;
+
+			for (size_t p=0;p<num_packets;p++) {
+				parse_voltage_header(hdr, &pool[p * packet_size]);
+				sum += hdr.sample_number + hdr.channel_id;
+			}
+
+			g_sink += sum;
+		}, num_packets, packet_size);
+
+		report(STAGE_HEADER, channels, r);
+	}
+
+	for (int packed=0;packed<2;packed++) {
+		const char *stage = packed ? STAGE_UNPACK_PACKED : STAGE_UNPACK;
+
+		if (!stages.count(stage))
+			continue;
+
+		bench_result r = run_stage([&]() {
+			for (size_t p=0;p<num_packets;p++) {
+				const unsigned char (*data)[16][2] = (const unsigned char (*)[16][2])&pool[p * packet_size + 16];
+				int channel_offset = (p % packets_per_frame) * 256 * 2;
+				unpack_voltage_packet(data, &x_frame[0], &y_frame[0], veclen, channel_offset, packed, lut);
+			}
+
+			g_sink += x_frame[0];
+		}, num_packets, packet_size);
+
+		report(stage, channels, r);
+	}
+
+	if (stages.count(STAGE_UNPACK_QUANT)) {
+		snap_quantization_stats quant;
+		quant.resize(channels);
+
+		bench_result r = run_stage([&]() {
+			for (size_t p=0;p<num_packets;p++) {
+				const unsigned char (*data)[16][2] = (const unsigned char (*)[16][2])&pool[p * packet_size + 16];
+				int channel_index = (p % packets_per_frame) * 256;
+				unpack_voltage_packet(data, &x_frame[0], &y_frame[0], veclen, channel_index * 2, false, lut, quant.counter());
+				quant.packet_done(channel_index, p);
+			}
+
+			g_sink += x_frame[0] + quant.packets();
+			quant.clear();
+		}, num_packets, packet_size);
+
+		report(STAGE_UNPACK_QUANT, channels, r);
+	}
+
+	if (stages.count(STAGE_ASSEMBLE)) {
+		std::deque<data_vector<char>> x_queue;
+		std::deque<data_vector<char>> y_queue;
+		std::deque<uint64_t> seq_queue;
+
+		bench_result r = run_stage([&]() {
+			uint64_t last_timestamp = 0;
+			snap_header hdr;
+
+			// Same steps as work_volt_mode() for multi-packet frames.
+			for (size_t p=0;p<num_packets;p++) {
+				const unsigned char *packet = &pool[p * packet_size];
+				parse_voltage_header(hdr, packet);
+
+				if (hdr.sample_number != last_timestamp) {
+					if (p > 0)
+						queue_frame(&x_frame[0], &y_frame[0], veclen, last_timestamp, x_queue, y_queue, seq_queue);
+
+					memset(&x_frame[0], 0x00, x_frame.size());
+					memset(&y_frame[0], 0x00, y_frame.size());
+					last_timestamp = hdr.sample_number;
+				}
+
+				const unsigned char (*data)[16][2] = (const unsigned char (*)[16][2])(packet + 16);
+				unpack_voltage_packet(data, &x_frame[0], &y_frame[0], veclen, hdr.channel_id * 2, false, lut);
+
+				drain(&x_out[0], &y_out[0], veclen, x_queue, y_queue, seq_queue);
+			}
+
+			queue_frame(&x_frame[0], &y_frame[0], veclen, last_timestamp, x_queue, y_queue, seq_queue);
+		}, num_packets, packet_size);
+
+		report(STAGE_ASSEMBLE, channels, r);
+	}
+
+	if (stages.count(STAGE_GAP_FILL)) {
+		std::deque<data_vector<char>> x_queue;
+		std::deque<data_vector<char>> y_queue;
+		std::deque<uint64_t> seq_queue;
+
+		bench_result r = run_stage([&]() {
+			// Every frame in the pool missed: the zero frames work_volt_mode() queues instead.
+			for (size_t f=0;f<num_frames;f++) {
+				for (int i=0;i<16;i++) {
+					data_vector<char> x_cur_vector(veclen);
+					x_queue.push_back(x_cur_vector);
+					data_vector<char> y_cur_vector(veclen);
+					y_queue.push_back(y_cur_vector);
+					seq_queue.push_back(f * 16);
+				}
+
+				drain(&x_out[0], &y_out[0], veclen, x_queue, y_queue, seq_queue);
+			}
+		}, num_packets, packet_size);
+
+		report(STAGE_GAP_FILL, channels, r);
+	}
+
+	if (stages.count(STAGE_TAGS)) {
+		pmt::pmt_t key = pmt::string_to_symbol("sample_num");
+		pmt::pmt_t srcid = pmt::string_to_symbol("snap-bench");
+		std::vector<gr::tag_t> tags;
+		tags.reserve(BENCH_OUTPUT_ITEMS * 2);
+		uint64_t offset = 0;
+
+		bench_result r = run_stage([&]() {
+			// A sample_num tag on every vector, on both outputs, as work_volt_mode() adds them.
+			for (size_t f=0;f<num_frames;f++) {
+				for (int i=0;i<16;i++) {
+					pmt::pmt_t pmt_sequence_number = pmt::from_uint64(f * 16);
+
+					for (int port=0;port<2;port++) {
+						gr::tag_t tag;
+						tag.offset = offset;
+						tag.key = key;
+						tag.value = pmt_sequence_number;
+						tag.srcid = srcid;
+						tags.push_back(tag);
+					}
+
+					offset++;
+				}
+
+				if (tags.size() >= BENCH_OUTPUT_ITEMS * 2) {
+					g_sink += tags.size();
+					tags.clear();
+				}
+			}
+		}, num_packets, packet_size);
+
+		report(STAGE_TAGS, channels, r);
+	}
+}
+
+static void bench_spect() {
+	snap_packet_generator generator(SNAP_PACKETTYPE_SPECT);
+
+	size_t packet_size = generator.packet_size();
+	size_t num_packets = (pool_mb * 1024 * 1024) / packet_size;
+	num_packets -= num_packets % generator.packets_per_frame();
+
+	std::vector<unsigned char> pool(num_packets * packet_size);
+	generator.fill(&pool[0], num_packets);
+
+	std::vector<float> xx(4096);
+	std::vector<float> yy(4096);
+	std::vector<float> xy_real(4096);
+	std::vector<float> xy_imag(4096);
+
+	bench_result r = run_stage([&]() {
+		snap_header hdr;
+
+		for (size_t p=0;p<num_packets;p++) {
+			const unsigned char *packet = &pool[p * packet_size];
+			parse_spect_header(hdr, packet);
+
+			const float (*data)[4] = (const float (*)[4])(packet + 8);
+			deinterleave_spect_packet(data, &xx[hdr.channel_id], &yy[hdr.channel_id], &xy_real[hdr.channel_id], &xy_imag[hdr.channel_id]);
+		}
+
+		g_sink += (uint64_t)xx[0];
+	}, num_packets, packet_size);
+
+	report(STAGE_SPECT, 4096, r);
+}
+
+int
+main (int argc, char **argv)
+{
+	std::vector<int> channel_counts = {256, 512, 1024, 2048, 4096};
+	std::set<std::string> stages = {STAGE_HEADER, STAGE_UNPACK, STAGE_UNPACK_PACKED, STAGE_UNPACK_QUANT, STAGE_ASSEMBLE,
+			STAGE_GAP_FILL, STAGE_TAGS, STAGE_SPECT};
+
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-bench [options]" << std::endl;
+			std::cout << "Times the SNAP source's per-packet stages on synthetic packets." << std::endl;
+			std::cout << "--stages=<stage>[,<stage>...] = stages to run.  Default is all of: " << STAGE_HEADER << ", " << STAGE_UNPACK << ", " <<
+						 STAGE_UNPACK_PACKED << ", " << STAGE_UNPACK_QUANT << ", " << STAGE_ASSEMBLE << ", " << STAGE_GAP_FILL << ", " << STAGE_TAGS << ", " << STAGE_SPECT << std::endl <<
+						 "--channels=<n>[,<n>...] = voltage channel counts (multiples of 256).  Default is 256,512,1024,2048,4096." << std::endl <<
+						 "    Spectrometer packets always cover 4096 channels." << std::endl <<
+						 "--seconds=<s> = minimum run time per stage.  Default is 1." << std::endl <<
+						 "--pool-mb=<n> = MB of packets to cycle through.  Default is 64, which is bigger than most caches." << std::endl <<
+						 "--csv = print CSV (stage,channels,packets/s,MB/s,ns/packet,cycles/packet) instead of a table." << std::endl;
+			std::cout << std::endl;
+			std::cout << "MB/s counts packet bytes (header and payload).  Gap fill counts the packets the zero frames replace." << std::endl;
+			std::cout << "Cycles are time stamp counter cycles, which run at the CPU's nominal clock." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--stages") != std::string::npos) {
+			boost::replace_all(param,"--stages=","");
+			std::stringstream ss(param);
+			std::string item;
+
+			stages.clear();
+
+			while (std::getline(ss, item, ','))
+				stages.insert(item);
+		}
+		else if (param.find("--channels") != std::string::npos) {
+			boost::replace_all(param,"--channels=","");
+			std::stringstream ss(param);
+			std::string item;
+
+			channel_counts.clear();
+
+			while (std::getline(ss, item, ',')) {
+				int channels = atoi(item.c_str());
+
+				if ((channels < 256) || ((channels % 256) != 0)) {
+					std::cout << "ERROR: Channel counts must be multiples of 256: " << item << std::endl;
+					exit(1);
+				}
+
+				channel_counts.push_back(channels);
+			}
+		}
+		else if (param.find("--seconds") != std::string::npos) {
+			boost::replace_all(param,"--seconds=","");
+			min_seconds = atof(param.c_str());
+		}
+		else if (param.find("--pool-mb") != std::string::npos) {
+			boost::replace_all(param,"--pool-mb=","");
+			pool_mb = atoi(param.c_str());
+
+			if (pool_mb < 1)
+				pool_mb = 1;
+		}
+		else if (param == "--csv") {
+			csv_output = true;
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	if (csv_output) {
+		std::cout << "stage,channels,packets_per_sec,mb_per_sec,ns_per_packet,cycles_per_packet" << std::endl;
+	}
+	else {
+		std::cout << std::left << std::setw(15) << "stage" << std::right << std::setw(9) << "channels" << std::setw(15) << "packets/s" <<
+				std::setw(12) << "MB/s" << std::setw(12) << "ns/packet" << std::setw(14) << "cycles/packet" << std::endl;
+	}
+
+	for (size_t c=0;c<channel_counts.size();c++)
+		bench_voltage(channel_counts[c], stages);
+
+	if (stages.count(STAGE_SPECT))
+		bench_spect();
+
+	return 0;
+}
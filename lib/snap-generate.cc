@@ -0,0 +1,341 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string.h>
+#include <signal.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "snap_packet_generator.h"
+#include "pacing_clock.h"
+
+// A SNAP board sends a voltage frame every 16 samples x 4 us.
+#define SNAP_VOLTAGE_FRAMES_PER_SEC 15625.0
+
+using namespace gr::ata;
+
+static bool stop_generate = false;
+
+static void sig_handler(int signo) {
+	stop_generate = true;
+}
+
+// Splits "a,b,c" into doubles.
+static std::vector<double> parse_list(const std::string &param) {
+	std::vector<double> values;
+	std::stringstream ss(param);
+	std::string item;
+
+	while (std::getline(ss, item, ','))
+		values.push_back(atof(item.c_str()));
+
+	return values;
+}
+
+int
+main (int argc, char **argv)
+{
+	int packet_type = SNAP_PACKETTYPE_VOLTAGE;
+	std::string dest_ip = "127.0.0.1";
+	std::string mcast_interface = "";
+	int port = 10000;
+	int antenna_id = 0;
+	int starting_channel = 0;
+	int num_channels = 256;
+	uint64_t seed = 1;
+	uint64_t start_sample = 0;
+	bool tone = false;
+	int tone_channel = 0;
+	double tone_amplitude = 5.0;
+	double tone_cycles_per_sample = 0.0625;
+	double speedup = 0.0;
+	double pps = 0.0;
+	uint64_t max_packets = 0;
+	double max_seconds = 0.0;
+	int batch_size = 64;
+	int ttl = 1;
+	double report_interval = 1.0;
+	snap_generator_faults faults;
+
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-generate [options]" << std::endl;
+			std::cout << "Sends synthetic SNAP voltage (v2.0) or spectrometer packets to a unicast or multicast destination, with optional faults." << std::endl;
+			std::cout << "--type=volt|spec = packet type.  Default is volt." << std::endl <<
+						 "--dest=<ip> = destination IPv4 address.  Multicast groups are detected automatically.  Default is 127.0.0.1." << std::endl <<
+						 "--port=<port> = destination UDP port.  Default is 10000." << std::endl <<
+						 "--antenna=<id> = F-engine ID in the headers.  Default is 0." << std::endl <<
+						 "--starting-channel=<n> = first voltage channel.  Default is 0." << std::endl <<
+						 "--channels=<n> = voltage channels per frame, in multiples of 256.  Default is 256." << std::endl <<
+						 "--start-sample=<n> = sample_number of the first frame.  Default is 0." << std::endl <<
+						 "--seed=<n> = seed for the noise and the faults.  The same seed sends the same packets.  Default is 1." << std::endl <<
+						 "--tone=<channel>[,<amplitude>[,<cycles per sample>]] = send one tone instead of noise.  Voltage amplitude is in" << std::endl <<
+						 "    4-bit counts (max 7), default 5, turning 0.0625 cycles per sample.  Spectrometer power is amplitude^2." << std::endl <<
+						 "--speedup=<N> = send voltage at N times a SNAP board's packet rate." << std::endl <<
+						 "--pps=<packets/sec> = send at a fixed packet rate.  With neither, packets go as fast as possible." << std::endl <<
+						 "--packets=<N> = stop after N packets." << std::endl <<
+						 "--seconds=<N> = stop after N seconds." << std::endl <<
+						 "--batch=<N> = packets per sendmmsg call.  Default is 64." << std::endl <<
+						 "--loss=<p> = drop each packet with probability p." << std::endl <<
+						 "--reorder=<p> = send each packet after the one that follows it with probability p." << std::endl <<
+						 "--duplicate=<p> = send each packet twice with probability p." << std::endl <<
+						 "--bad-channel=<p> = move each voltage packet's channel ID out of range with probability p." << std::endl <<
+						 "--jump=<p>[,<frames>] = skip sample_number ahead <frames> frames (default 100) with probability p per frame." << std::endl <<
+						 "--ttl=<N> = multicast TTL.  Default is 1." << std::endl <<
+						 "--interface=<ip> = local address to send multicast from." << std::endl <<
+						 "--report=<seconds> = how often to print the transmit rate.  0 only prints the summary.  Default is 1." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--type") != std::string::npos) {
+			boost::replace_all(param,"--type=","");
+
+			if (param == "volt")
+				packet_type = SNAP_PACKETTYPE_VOLTAGE;
+			else if (param == "spec")
+				packet_type = SNAP_PACKETTYPE_SPECT;
+			else {
+				std::cout << "ERROR: Unknown packet type: " << param << std::endl;
+				exit(1);
+			}
+		}
+		else if (param.find("--dest") != std::string::npos) {
+			boost::replace_all(param,"--dest=","");
+			dest_ip = param;
+		}
+		else if (param.find("--port") != std::string::npos) {
+			boost::replace_all(param,"--port=","");
+			port = atoi(param.c_str());
+		}
+		else if (param.find("--antenna") != std::string::npos) {
+			boost::replace_all(param,"--antenna=","");
+			antenna_id = atoi(param.c_str());
+		}
+		else if (param.find("--starting-channel") != std::string::npos) {
+			boost::replace_all(param,"--starting-channel=","");
+			starting_channel = atoi(param.c_str());
+		}
+		else if (param.find("--channels") != std::string::npos) {
+			boost::replace_all(param,"--channels=","");
+			num_channels = atoi(param.c_str());
+		}
+		else if (param.find("--start-sample") != std::string::npos) {
+			boost::replace_all(param,"--start-sample=","");
+			start_sample = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--seed") != std::string::npos) {
+			boost::replace_all(param,"--seed=","");
+			seed = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--tone") != std::string::npos) {
+			boost::replace_all(param,"--tone=","");
+			std::vector<double> values = parse_list(param);
+
+			if (values.empty()) {
+				std::cout << "ERROR: --tone needs a channel." << std::endl;
+				exit(1);
+			}
+
+			tone = true;
+			tone_channel = (int)values[0];
+
+			if (values.size() > 1)
+				tone_amplitude = values[1];
+
+			if (values.size() > 2)
+				tone_cycles_per_sample = values[2];
+		}
+		else if (param.find("--speedup") != std::string::npos) {
+			boost::replace_all(param,"--speedup=","");
+			speedup = atof(param.c_str());
+		}
+		else if (param.find("--pps") != std::string::npos) {
+			boost::replace_all(param,"--pps=","");
+			pps = atof(param.c_str());
+		}
+		else if (param.find("--packets") != std::string::npos) {
+			boost::replace_all(param,"--packets=","");
+			max_packets = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--seconds") != std::string::npos) {
+			boost::replace_all(param,"--seconds=","");
+			max_seconds = atof(param.c_str());
+		}
+		else if (param.find("--batch") != std::string::npos) {
+			boost::replace_all(param,"--batch=","");
+			batch_size = atoi(param.c_str());
+		}
+		else if (param.find("--loss") != std::string::npos) {
+			boost::replace_all(param,"--loss=","");
+			faults.loss = atof(param.c_str());
+		}
+		else if (param.find("--reorder") != std::string::npos) {
+			boost::replace_all(param,"--reorder=","");
+			faults.reorder = atof(param.c_str());
+		}
+		else if (param.find("--duplicate") != std::string::npos) {
+			boost::replace_all(param,"--duplicate=","");
+			faults.duplicate = atof(param.c_str());
+		}
+		else if (param.find("--bad-channel") != std::string::npos) {
+			boost::replace_all(param,"--bad-channel=","");
+			faults.bad_channel = atof(param.c_str());
+		}
+		else if (param.find("--jump") != std::string::npos) {
+			boost::replace_all(param,"--jump=","");
+			std::vector<double> values = parse_list(param);
+
+			if (!values.empty())
+				faults.timestamp_jump = values[0];
+
+			if (values.size() > 1)
+				faults.jump_frames = (int)values[1];
+		}
+		else if (param.find("--ttl") != std::string::npos) {
+			boost::replace_all(param,"--ttl=","");
+			ttl = atoi(param.c_str());
+		}
+		else if (param.find("--interface") != std::string::npos) {
+			boost::replace_all(param,"--interface=","");
+			mcast_interface = param;
+		}
+		else if (param.find("--report") != std::string::npos) {
+			boost::replace_all(param,"--report=","");
+			report_interval = atof(param.c_str());
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	if ((packet_type == SNAP_PACKETTYPE_VOLTAGE) && ((num_channels < 256) || (num_channels % 256 != 0))) {
+		std::cout << "ERROR: --channels must be a multiple of 256." << std::endl;
+		exit(1);
+	}
+
+	if ((speedup > 0.0) && (packet_type != SNAP_PACKETTYPE_VOLTAGE)) {
+		std::cout << "ERROR: --speedup is only for voltage packets.  Use --pps for the spectrometer." << std::endl;
+		exit(1);
+	}
+
+	snap_packet_generator generator(packet_type, starting_channel, starting_channel + num_channels - 1, antenna_id, seed, start_sample);
+
+	if (tone)
+		generator.set_tone(tone_channel, tone_amplitude, tone_cycles_per_sample);
+
+	generator.set_faults(faults);
+
+	if (speedup > 0.0)
+		pps = speedup * SNAP_VOLTAGE_FRAMES_PER_SEC * generator.packets_per_frame();
+
+	snap_packet_sender sender(generator, batch_size);
+
+	if (!sender.open(dest_ip, port, mcast_interface, ttl)) {
+		std::cout << "ERROR: " << sender.last_error() << std::endl;
+		exit(3);
+	}
+
+	sender.set_rate(pps);
+
+	signal(SIGINT, sig_handler);
+
+	std::cout << "Sending " << (packet_type == SNAP_PACKETTYPE_VOLTAGE ? "voltage" : "spectrometer") << " packets (" <<
+			(tone ? "tone" : "noise") << ") to " << dest_ip << ":" << port;
+
+	if (pps > 0.0)
+		std::cout << " at " << pps << " packets/sec";
+	else
+		std::cout << " as fast as possible";
+
+	std::cout << ".  Ctrl-C to stop." << std::endl;
+
+	// Send in slices so the rate can be reported as it goes.
+	uint64_t slice = (pps > 0.0) ? std::max((uint64_t)1, (uint64_t)(pps / 20.0)) : 16384;
+
+	int64_t start_ns = pacing_clock::now_ns();
+	int64_t last_report_ns = start_ns;
+	uint64_t last_report_packets = 0;
+	uint64_t last_report_bytes = 0;
+	uint64_t packets_generated = 0;
+
+	while (!stop_generate) {
+		uint64_t this_slice = slice;
+
+		if (max_packets > 0) {
+			if (packets_generated >= max_packets)
+				break;
+
+			this_slice = std::min(this_slice, max_packets - packets_generated);
+		}
+
+		packets_generated += sender.send(this_slice, stop_generate);
+
+		int64_t now = pacing_clock::now_ns();
+
+		if ((max_seconds > 0.0) && ((double)(now - start_ns) / 1.0e9 >= max_seconds))
+			break;
+
+		if ((report_interval > 0.0) && ((double)(now - last_report_ns) / 1.0e9 >= report_interval)) {
+			double secs = (double)(now - last_report_ns) / 1.0e9;
+			double pkt_rate = (double)(sender.packets_sent() - last_report_packets) / secs;
+			double gbps = (double)(sender.bytes_sent() - last_report_bytes) * 8.0 / secs / 1.0e9;
+
+			std::cout << std::fixed << std::setprecision(2) << "[" << (double)(now - start_ns) / 1.0e9 << " s] " <<
+					pkt_rate << " packets/sec, " << gbps << " Gbps payload, " << sender.packets_sent() << " packets sent" << std::endl;
+
+			last_report_ns = now;
+			last_report_packets = sender.packets_sent();
+			last_report_bytes = sender.bytes_sent();
+		}
+	}
+
+	double elapsed = (double)(pacing_clock::now_ns() - start_ns) / 1.0e9;
+	const snap_generator_fault_counts &counts = generator.fault_counts();
+
+	std::cout << std::fixed << std::setprecision(2) << std::endl;
+	std::cout << "Sent " << sender.packets_sent() << " packets (" << (double)sender.bytes_sent() / (1024.0*1024.0) << " MB) in " << elapsed << " seconds." << std::endl;
+
+	if (elapsed > 0.0) {
+		std::cout << "Average rate: " << (double)sender.packets_sent() / elapsed << " packets/sec, " <<
+				(double)sender.bytes_sent() * 8.0 / elapsed / 1.0e9 << " Gbps payload" << std::endl;
+	}
+
+	std::cout << "Next sample_number: " << generator.sample_number() << std::endl;
+	std::cout << "Faults: " << counts.lost << " lost, " << counts.reordered << " reordered, " << counts.duplicated << " duplicated, " <<
+			counts.bad_channel << " bad channel, " << counts.timestamp_jumps << " timestamp jumps (" << counts.frames_skipped << " frames skipped)" << std::endl;
+
+	if (sender.send_errors() > 0)
+		std::cout << "Send errors: " << sender.send_errors() << std::endl;
+
+	sender.close();
+
+	return 0;
+}
@@ -0,0 +1,401 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+#include <signal.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "snap_loopback_harness.h"
+#include "snap_packet_generator.h"
+
+using namespace gr::ata;
+
+/*
+ * End-to-end throughput and loss harness for the SNAP source.  Senders play synthetic
+ * SNAP packets at the sources over UDP (loopback, or a multicast group with loopback
+ * enabled) through snap_loopback_harness.  The rate is stepped up until packets go missing
+ * or the receive queue starts to back up, then narrowed down between the last good rate
+ * and the first bad one.
+ */
+
+static volatile bool stop_harness = false;
+
+snap_loopback_config config;
+std::vector<int> source_counts = {1};
+double start_rate = 10000.0;
+double rate_factor = 1.5;
+double max_rate = 1000000.0;
+int refine_steps = 3;
+bool csv_output = false;
+
+static void sig_handler(int signo) {
+	stop_harness = true;
+}
+
+static std::unique_ptr<snap_loopback_harness> harness;
+
+static std::string configuration_name(int num_sources) {
+	std::stringstream name;
+
+	if (config.packet_type == SNAP_PACKETTYPE_SPECT)
+		name << "spectrometer";
+	else
+		name << "voltage " << config.num_channels << " channels" << (config.packed_output ? " packed" : "");
+
+	name << ", " << num_sources << (num_sources == 1 ? " source" : " sources") << ", ";
+
+	if (config.mcast_group.length() > 0)
+		name << "multicast " << config.mcast_group;
+	else
+		name << "UDP loopback";
+
+	if (config.sync_threads > 0)
+		name << ", into a synchronizer";
+
+	if (config.pin_threads)
+		name << ", pinned";
+
+	return name.str();
+}
+
+static void print_step(const snap_loopback_result &r) {
+	if (csv_output) {
+		if (r.error.length() > 0)
+			std::cerr << "ERROR: " << r.error << std::endl;
+
+		return;
+	}
+
+	std::cout << "  " << std::fixed << std::setprecision(0) << std::setw(10) << r.packets_per_sec << " packets/s per source: ";
+
+	if (r.error.length() > 0) {
+		std::cout << "ERROR: " << r.error << std::endl;
+		return;
+	}
+
+	std::cout << "sent " << r.sent_packets_per_sec << " packets/s, loss " << std::setprecision(4) << (r.loss * 100.0) << "%, " <<
+			std::setprecision(2) << r.received_gbps << " Gbps, queue p99 " << std::setprecision(0) << r.queue_p99 <<
+			", latency p99 " << std::setprecision(1) << r.latency_p99_us << " us";
+
+	if (r.passed)
+		std::cout << "  ok" << std::endl;
+	else
+		std::cout << "  FAILED (" << snap_loopback_harness::limit_name(r.limit) << ")" << std::endl;
+}
+
+static void print_configuration(int num_sources, const snap_loopback_result &best, bool have_best, int limit) {
+	double packets_per_sec = have_best ? best.packets_per_sec : 0.0;
+	size_t packet_size = (config.packet_type == SNAP_PACKETTYPE_SPECT) ? SNAP_GENERATOR_SPECT_PACKET_SIZE : SNAP_GENERATOR_VOLTAGE_PACKET_SIZE;
+
+	if (csv_output) {
+		std::cout << (config.packet_type == SNAP_PACKETTYPE_SPECT ? "spectrometer" : "voltage") << "," <<
+				(config.packet_type == SNAP_PACKETTYPE_SPECT ? 4096 : config.num_channels) << "," << num_sources << "," <<
+				(config.mcast_group.length() > 0 ? "multicast" : "loopback") << "," << snap_loopback_harness::limit_name(limit) << "," <<
+				std::fixed << std::setprecision(0) << packets_per_sec << "," << (packets_per_sec * num_sources) << "," <<
+				std::setprecision(3) << best.received_gbps << "," << best.receive_cores << "," << best.work_cores << "," <<
+				best.cores_per_gbps << "," << std::setprecision(0) << best.queue_p50 << "," << best.queue_p99 << "," <<
+				best.queue_max << "," << std::setprecision(1) << best.latency_p50_us << "," << best.latency_p99_us << "," <<
+				best.latency_p999_us << "," << best.latency_max_us << std::endl;
+		return;
+	}
+
+	std::cout << std::endl << "Configuration: " << configuration_name(num_sources) << std::endl;
+
+	if (!have_best) {
+		std::cout << "No rate tried was sustainable (limited by " << snap_loopback_harness::limit_name(limit) << ").  Try a lower --rate." << std::endl << std::endl;
+		return;
+	}
+
+	std::cout << "Max sustainable rate: " << std::fixed << std::setprecision(0) << packets_per_sec << " packets/s per source, " <<
+			(packets_per_sec * num_sources) << " packets/s total (" << std::setprecision(2) <<
+			(packets_per_sec * num_sources * packet_size * 8.0 / 1e9) << " Gbps)" << std::endl;
+	std::cout << "Limited by: " << snap_loopback_harness::limit_name(limit) << std::endl;
+	std::cout << "Receive CPU: " << best.receive_cores << " cores (" << std::setprecision(3) << best.cores_per_gbps <<
+			" cores per Gbps), work() threads " << std::setprecision(2) << best.work_cores << " cores" << std::endl;
+	std::cout << "Queue depth (packets): p50 " << std::setprecision(0) << best.queue_p50 << ", p99 " << best.queue_p99 <<
+			", max " << best.queue_max << std::endl;
+	std::cout << "Latency (us): p50 " << std::setprecision(1) << best.latency_p50_us << ", p99 " << best.latency_p99_us <<
+			", p99.9 " << best.latency_p999_us << ", max " << best.latency_max_us << std::endl << std::endl;
+}
+
+// Steps the rate up until a step fails, then bisects between the last good rate and the first bad one.
+static bool run_configuration(int num_sources) {
+	snap_loopback_result best;
+	snap_loopback_result failed;
+	bool have_best = false;
+	bool have_failed = false;
+
+	if (!csv_output)
+		std::cout << "Sweeping " << configuration_name(num_sources) << std::endl;
+
+	double rate = start_rate;
+
+	while (!stop_harness) {
+		snap_loopback_result r = harness->run(num_sources, rate);
+		print_step(r);
+
+		if (r.error.length() > 0)
+			return false;
+
+		if (r.passed) {
+			best = r;
+			have_best = true;
+
+			if (rate >= max_rate)
+				break;
+
+			rate = std::min(rate * rate_factor, max_rate);
+		}
+		else {
+			failed = r;
+			have_failed = true;
+			break;
+		}
+	}
+
+	if (have_best && have_failed) {
+		double low = best.packets_per_sec;
+		double high = failed.packets_per_sec;
+
+		for (int i=0;(i<refine_steps) && !stop_harness && ((high - low) > 0.02 * low);i++) {
+			double mid = (low + high) / 2.0;
+
+			snap_loopback_result r = harness->run(num_sources, mid);
+			print_step(r);
+
+			if (r.error.length() > 0)
+				return false;
+
+			if (r.passed) {
+				best = r;
+				low = mid;
+			}
+			else {
+				failed = r;
+				high = mid;
+			}
+		}
+	}
+
+	if (stop_harness)
+		return false;
+
+	print_configuration(num_sources, best, have_best, have_failed ? failed.limit : LOOPBACK_LIMIT_NONE);
+
+	return true;
+}
+
+int
+main (int argc, char **argv)
+{
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-loopback [options]" << std::endl;
+			std::cout << "Sends synthetic SNAP packets to SNAP sources on this host at increasing rates to find the highest rate they sustain without loss." << std::endl;
+			std::cout << "--type=<voltage|spectrometer> = packet type.  Default is voltage." << std::endl <<
+						 "--start-channel=<channel> = first voltage channel.  Default is 1792." << std::endl <<
+						 "--num-channels=<n> = voltage channels per source (a multiple of 256).  Default is 1024." << std::endl <<
+						 "--packed = have the sources output packed 4-bit IQ." << std::endl <<
+						 "--sources=<n>[,<n>...] = number of sources to run at once, one configuration each.  Default is 1." << std::endl <<
+						 "--port=<port> = UDP port of the first source.  The rest use the ports after it.  Default is 10000." << std::endl <<
+						 "--mcast-group=<IPv4 group> = send to a multicast group (with loopback on) rather than 127.0.0.1." << std::endl <<
+						 "--mcast-if=<IPv4 address> = interface to send multicast from.  Default is the system's choice." << std::endl <<
+						 "--rate=<packets/s> = starting rate per source.  Default is 10000." << std::endl <<
+						 "--rate-factor=<x> = rate multiplier between steps.  Default is 1.5." << std::endl <<
+						 "--max-rate=<packets/s> = highest rate per source to try.  Default is 1000000." << std::endl <<
+						 "--refine=<n> = bisection steps between the last good and first bad rate.  Default is 3." << std::endl <<
+						 "--seconds=<s> = measured time per step.  Default is 2." << std::endl <<
+						 "--warmup=<s> = time per step before measuring starts.  Default is 0.5." << std::endl <<
+						 "--loss=<fraction> = highest loss that still counts as sustained.  Default is 0." << std::endl <<
+						 "--max-backlog-ms=<ms> = fail a step if a receive queue holds more than this much traffic.  Default is 100." << std::endl <<
+						 "--batch=<n> = packets per sendmmsg call (max " << LOOPBACK_MAX_BATCH << ").  Default is 32." << std::endl <<
+						 "--pin = pin each source's receive and work() threads to neighbouring CPUs on one NUMA node." << std::endl <<
+						 "--synchronizer=<threads> = feed the sources' outputs to a SNAPSynchronizerV3 with this many copy threads.  Voltage only." << std::endl <<
+						 "--csv = print one CSV line per configuration instead of a report." << std::endl;
+			std::cout << std::endl;
+			std::cout << "Receive CPU is the whole process less the sender threads: the sources' receive threads, the work() loops" << std::endl <<
+						 "and whatever kernel receive work is charged to them.  On loopback much of the kernel's receive path runs" << std::endl <<
+						 "in the sender's sendmmsg call, so the receive cost on a real NIC will be higher." << std::endl;
+			std::cout << "Multicast on a single host needs a route for the group, for example: ip route add 224.0.0.0/4 dev lo" << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--type") != std::string::npos) {
+			boost::replace_all(param,"--type=","");
+
+			if (param == "voltage") {
+				config.packet_type = SNAP_PACKETTYPE_VOLTAGE;
+			}
+			else if ((param == "spectrometer") || (param == "spect")) {
+				config.packet_type = SNAP_PACKETTYPE_SPECT;
+			}
+			else {
+				std::cout << "ERROR: Unknown packet type: " << param << std::endl;
+				exit(1);
+			}
+		}
+		else if (param.find("--start-channel") != std::string::npos) {
+			boost::replace_all(param,"--start-channel=","");
+			config.starting_channel = atoi(param.c_str());
+		}
+		else if (param.find("--num-channels") != std::string::npos) {
+			boost::replace_all(param,"--num-channels=","");
+			config.num_channels = atoi(param.c_str());
+		}
+		else if (param == "--packed") {
+			config.packed_output = true;
+		}
+		else if (param.find("--sources") != std::string::npos) {
+			boost::replace_all(param,"--sources=","");
+			std::stringstream ss(param);
+			std::string item;
+
+			source_counts.clear();
+
+			while (std::getline(ss, item, ',')) {
+				int count = atoi(item.c_str());
+
+				if (count < 1) {
+					std::cout << "ERROR: Source counts must be at least 1: " << item << std::endl;
+					exit(1);
+				}
+
+				source_counts.push_back(count);
+			}
+		}
+		else if (param.find("--port") != std::string::npos) {
+			boost::replace_all(param,"--port=","");
+			config.base_port = atoi(param.c_str());
+		}
+		else if (param.find("--mcast-group") != std::string::npos) {
+			boost::replace_all(param,"--mcast-group=","");
+			config.mcast_group = param;
+		}
+		else if (param.find("--mcast-if") != std::string::npos) {
+			boost::replace_all(param,"--mcast-if=","");
+			config.mcast_if = param;
+		}
+		else if (param.find("--rate-factor") != std::string::npos) {
+			boost::replace_all(param,"--rate-factor=","");
+			rate_factor = atof(param.c_str());
+		}
+		else if (param.find("--max-rate") != std::string::npos) {
+			boost::replace_all(param,"--max-rate=","");
+			max_rate = atof(param.c_str());
+		}
+		else if (param.find("--rate") != std::string::npos) {
+			boost::replace_all(param,"--rate=","");
+			start_rate = atof(param.c_str());
+		}
+		else if (param.find("--refine") != std::string::npos) {
+			boost::replace_all(param,"--refine=","");
+			refine_steps = atoi(param.c_str());
+		}
+		else if (param.find("--seconds") != std::string::npos) {
+			boost::replace_all(param,"--seconds=","");
+			config.step_seconds = atof(param.c_str());
+		}
+		else if (param.find("--warmup") != std::string::npos) {
+			boost::replace_all(param,"--warmup=","");
+			config.warmup_seconds = atof(param.c_str());
+		}
+		else if (param.find("--max-backlog-ms") != std::string::npos) {
+			boost::replace_all(param,"--max-backlog-ms=","");
+			config.max_backlog_ms = atof(param.c_str());
+		}
+		else if (param.find("--loss") != std::string::npos) {
+			boost::replace_all(param,"--loss=","");
+			config.loss_threshold = atof(param.c_str());
+		}
+		else if (param.find("--batch") != std::string::npos) {
+			boost::replace_all(param,"--batch=","");
+			config.send_batch = atoi(param.c_str());
+
+			if (config.send_batch < 1)
+				config.send_batch = 1;
+			else if (config.send_batch > LOOPBACK_MAX_BATCH)
+				config.send_batch = LOOPBACK_MAX_BATCH;
+		}
+		else if (param == "--pin") {
+			config.pin_threads = true;
+		}
+		else if (param.find("--synchronizer") != std::string::npos) {
+			boost::replace_all(param,"--synchronizer=","");
+			config.sync_threads = atoi(param.c_str());
+		}
+		else if (param == "--csv") {
+			csv_output = true;
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	if (config.packet_type == SNAP_PACKETTYPE_SPECT) {
+		if (config.sync_threads > 0) {
+			std::cout << "ERROR: --synchronizer only works with voltage packets." << std::endl;
+			exit(1);
+		}
+
+		// Spectrometer packets always cover every channel.
+		config.starting_channel = 0;
+		config.num_channels = 4096;
+	}
+	else if ((config.num_channels < 256) || ((config.num_channels % 256) != 0)) {
+		std::cout << "ERROR: --num-channels must be a multiple of 256." << std::endl;
+		exit(1);
+	}
+
+	if ((start_rate <= 0.0) || (max_rate < start_rate) || (rate_factor <= 1.0) || (config.step_seconds <= 0.0)) {
+		std::cout << "ERROR: Rates and step time must be positive, --max-rate at least --rate, and --rate-factor more than 1." << std::endl;
+		exit(1);
+	}
+
+	signal(SIGINT, sig_handler);
+
+	harness.reset(new snap_loopback_harness(config, stop_harness));
+
+	if (csv_output) {
+		std::cout << "type,channels,sources,transport,limit,max_packets_per_sec_per_source,max_packets_per_sec_total,gbps," <<
+				"receive_cores,work_cores,cores_per_gbps,queue_p50,queue_p99,queue_max,latency_p50_us,latency_p99_us," <<
+				"latency_p999_us,latency_max_us" << std::endl;
+	}
+
+	for (size_t i=0;i<source_counts.size();i++) {
+		if (!run_configuration(source_counts[i]))
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <chrono>
+#include <string.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "pcap_index.h"
+
+int
+main (int argc, char **argv)
+{
+	std::string capture_file = "";
+	std::string index_file = "";
+	uint64_t stride = 0;
+	int packet_type = SNAP_PACKETTYPE_VOLTAGE;
+	bool print_entries = false;
+
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-pcap-index [--type=volt|spect] [--stride=<samples>] [--output=<index file>] [--print] <capture file>" << std::endl;
+			std::cout << "Builds the sidecar timestamp index the SNAP source uses to seek to start_sample in a PCAP/pcapng capture." << std::endl;
+			std::cout << "--type = packet type in the capture, volt or spect.  Default is volt." << std::endl <<
+						 "--stride = sample_number distance between index points.  Default is " << PCAP_INDEX_DEFAULT_STRIDE << " for voltage and " <<
+						 PCAP_INDEX_DEFAULT_SPECT_STRIDE << " for spectrometer captures." << std::endl <<
+						 "--output = index file to write.  Default is <capture file>.snapidx, which is where the SNAP source looks for it." << std::endl <<
+						 "--print = list every index point." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--type") != std::string::npos) {
+			boost::replace_all(param,"--type=","");
+
+			if (param == "volt") {
+				packet_type = SNAP_PACKETTYPE_VOLTAGE;
+			}
+			else if (param == "spect") {
+				packet_type = SNAP_PACKETTYPE_SPECT;
+			}
+			else {
+				std::cout << "ERROR: Unknown packet type " << param << ".  Use volt or spect." << std::endl;
+				exit(1);
+			}
+		}
+		else if (param.find("--stride") != std::string::npos) {
+			boost::replace_all(param,"--stride=","");
+			stride = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--output") != std::string::npos) {
+			boost::replace_all(param,"--output=","");
+			index_file = param;
+		}
+		else if (param.find("--print") != std::string::npos) {
+			print_entries = true;
+		}
+		else if (param.find("--") == 0) {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+		else {
+			capture_file = param;
+		}
+	}
+
+	if (capture_file.length() == 0) {
+		std::cout << "ERROR: Please provide a capture file.  Run with --help for usage." << std::endl;
+		exit(1);
+	}
+
+	if (index_file.length() == 0)
+		index_file = gr::ata::pcap_index::index_filename(capture_file);
+
+	if (stride == 0)
+		stride = (packet_type == SNAP_PACKETTYPE_VOLTAGE) ? PCAP_INDEX_DEFAULT_STRIDE : PCAP_INDEX_DEFAULT_SPECT_STRIDE;
+
+	gr::ata::pcap_index index;
+
+	std::chrono::time_point<std::chrono::steady_clock> start, end;
+	start = std::chrono::steady_clock::now();
+
+	if (!index.build(capture_file, stride, packet_type)) {
+		std::cout << "ERROR: " << index.last_error() << std::endl;
+		exit(2);
+	}
+
+	end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end-start;
+
+	std::cout << "Indexed " << capture_file << " in " << elapsed_seconds.count() << " seconds" << std::endl;
+
+	const std::map<uint16_t, std::vector<gr::ata::pcap_index_entry>> &ports = index.ports();
+
+	for (auto it = ports.begin(); it != ports.end(); ++it) {
+		std::cout << "Port " << it->first << ": " << it->second.size() << " index points, sample_number " <<
+				it->second.front().sample_number << " to at least " << it->second.back().sample_number << std::endl;
+
+		if (print_entries) {
+			for (size_t i=0;i<it->second.size();i++) {
+				std::cout << "    " << it->second[i].sample_number << " @ " << it->second[i].file_offset << std::endl;
+			}
+		}
+	}
+
+	if (!index.save(index_file)) {
+		std::cout << "ERROR: " << index.last_error() << std::endl;
+		exit(3);
+	}
+
+	std::cout << "Wrote " << index_file << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,546 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <set>
+#include <map>
+#include <vector>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "pcap_mmap_reader.h"
+#include "pacing_clock.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#define PACE_NONE 0
+#define PACE_CAPTURE 1
+#define PACE_SNAP 2
+#define PACE_PPS 3
+
+// Each voltage sample_number is one 4 microsecond SNAP time frame.
+#define SNAP_NS_PER_SAMPLE 4000
+#define VOLTAGE_TIMESTAMP_OFFSET 8
+#define VOLTAGE_HEADER_SIZE 16
+
+#define MAX_BATCH 1024
+// A GSO send is one UDP datagram as far as the socket is concerned, so it has to fit in 64K.
+#define MAX_GSO_BYTES 65000
+#define MAX_GSO_SEGMENTS 64
+
+using namespace gr::ata;
+
+static bool stop_replay = false;
+
+static void sig_handler(int signo) {
+	stop_replay = true;
+}
+
+struct pending_packet {
+	const unsigned char *data;
+	size_t len;
+	uint16_t dest_port;
+};
+
+class replay_sender {
+protected:
+	int d_socket;
+	struct sockaddr_in d_dest;
+	bool d_gso;
+
+	struct mmsghdr d_msgs[MAX_BATCH];
+	struct iovec d_iovecs[MAX_BATCH];
+	struct sockaddr_in d_addrs[MAX_BATCH];
+	char d_cmsg_buf[MAX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+
+public:
+	uint64_t packets_sent = 0;
+	uint64_t bytes_sent = 0;
+	uint64_t send_errors = 0;
+
+	replay_sender(int sock, const struct sockaddr_in &dest, bool gso) {
+		d_socket = sock;
+		d_dest = dest;
+		d_gso = gso;
+	};
+
+	bool gso() { return d_gso; };
+
+	// Sends everything pending.  Consecutive packets for the same port and of the same
+	// size go out as one GSO message if GSO is on.
+	void send(const pending_packet *pkts, int count) {
+		int num_msgs = 0;
+		int i = 0;
+
+		while (i < count) {
+			int segs = 1;
+
+			if (d_gso) {
+				size_t total = pkts[i].len;
+
+				while ((i + segs < count) && (segs < MAX_GSO_SEGMENTS) &&
+						(pkts[i + segs].dest_port == pkts[i].dest_port) && (pkts[i + segs].len == pkts[i].len) &&
+						(total + pkts[i + segs].len <= MAX_GSO_BYTES)) {
+					total += pkts[i + segs].len;
+					segs++;
+				}
+			}
+
+			for (int s=0;s<segs;s++) {
+				d_iovecs[i + s].iov_base = (void *)pkts[i + s].data;
+				d_iovecs[i + s].iov_len = pkts[i + s].len;
+			}
+
+			d_addrs[num_msgs] = d_dest;
+			d_addrs[num_msgs].sin_port = htons(pkts[i].dest_port);
+
+			struct msghdr &hdr = d_msgs[num_msgs].msg_hdr;
+			memset(&hdr, 0x00, sizeof(hdr));
+			hdr.msg_name = &d_addrs[num_msgs];
+			hdr.msg_namelen = sizeof(struct sockaddr_in);
+			hdr.msg_iov = &d_iovecs[i];
+			hdr.msg_iovlen = segs;
+
+			if (segs > 1) {
+				hdr.msg_control = d_cmsg_buf[num_msgs];
+				hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+				struct cmsghdr *cm = CMSG_FIRSTHDR(&hdr);
+				cm->cmsg_level = SOL_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				uint16_t gso_size = pkts[i].len;
+				memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+			}
+
+			d_msgs[num_msgs].msg_len = 0;
+
+			num_msgs++;
+			i += segs;
+		}
+
+		int sent_msgs = 0;
+
+		while ((sent_msgs < num_msgs) && !stop_replay) {
+			int retval = sendmmsg(d_socket, &d_msgs[sent_msgs], num_msgs - sent_msgs, 0);
+
+			if (retval < 0) {
+				if ((errno == EINTR) || (errno == EAGAIN) || (errno == ENOBUFS)) {
+					// Loopback or the NIC queue is full.  Try again.
+					continue;
+				}
+
+				if (d_gso && ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT))) {
+					std::cout << "WARNING: UDP GSO was rejected (" << strerror(errno) << ").  Sending without it." << std::endl;
+					d_gso = false;
+					// Rebuild this batch without GSO.
+					int resend_from = 0;
+
+					for (int m=0;m<sent_msgs;m++)
+						resend_from += d_msgs[m].msg_hdr.msg_iovlen;
+
+					send(&pkts[resend_from], count - resend_from);
+					return;
+				}
+
+				send_errors++;
+				// Skip the message that failed.
+				sent_msgs++;
+				continue;
+			}
+
+			for (int m=sent_msgs;m<sent_msgs + retval;m++) {
+				packets_sent += d_msgs[m].msg_hdr.msg_iovlen;
+
+				for (size_t v=0;v<d_msgs[m].msg_hdr.msg_iovlen;v++)
+					bytes_sent += d_msgs[m].msg_hdr.msg_iov[v].iov_len;
+			}
+
+			sent_msgs += retval;
+		}
+	};
+};
+
+int
+main (int argc, char **argv)
+{
+	std::string capture_file = "";
+	std::string dest_ip = "127.0.0.1";
+	std::string mcast_interface = "";
+	std::set<uint16_t> ports;
+	std::map<uint16_t, uint16_t> port_map;
+	int pace_mode = PACE_NONE;
+	double speedup = 1.0;
+	double pps = 0.0;
+	long loops = 1;
+	long batch_size = 64;
+	bool use_gso = false;
+	int ttl = 1;
+	double report_interval = 1.0;
+	uint64_t max_packets = 0;
+
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-replay [options] <capture file>" << std::endl;
+			std::cout << "Replays the UDP payloads in a PCAP/pcapng capture to a unicast or multicast destination." << std::endl;
+			std::cout << "--dest=<ip> = destination IPv4 address.  Multicast groups are detected automatically.  Default is 127.0.0.1." << std::endl <<
+						 "--ports=<port>[,<port>...] = only replay packets sent to these UDP ports.  Default is all." << std::endl <<
+						 "--map=<port>:<new port>[,...] = send packets captured on one port to a different port." << std::endl <<
+						 "--pace=none|capture|snap = as fast as possible (default), at the capture timestamps, or at the SNAP sample clock (sample_number x 4 us)." << std::endl <<
+						 "--speedup=<N> = run capture or snap pacing N times faster.  Default is 1.0." << std::endl <<
+						 "--pps=<packets/sec> = send at a fixed packet rate instead." << std::endl <<
+						 "--loop=<N> = play the capture N times.  0 loops forever.  Default is 1." << std::endl <<
+						 "--packets=<N> = stop after N packets." << std::endl <<
+						 "--batch=<N> = packets per sendmmsg call (max " << MAX_BATCH << ").  Default is 64." << std::endl <<
+						 "--gso = use UDP generic segmentation offload where consecutive packets allow it." << std::endl <<
+						 "--ttl=<N> = multicast TTL.  Default is 1." << std::endl <<
+						 "--interface=<ip> = local address to send multicast from." << std::endl <<
+						 "--report=<seconds> = how often to print the transmit rate.  0 only prints the summary.  Default is 1." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--dest") != std::string::npos) {
+			boost::replace_all(param,"--dest=","");
+			dest_ip = param;
+		}
+		else if (param.find("--ports") != std::string::npos) {
+			boost::replace_all(param,"--ports=","");
+			std::stringstream ss(param);
+			std::string item;
+
+			while (std::getline(ss, item, ','))
+				ports.insert(atoi(item.c_str()));
+		}
+		else if (param.find("--map") != std::string::npos) {
+			boost::replace_all(param,"--map=","");
+			std::stringstream ss(param);
+			std::string item;
+
+			while (std::getline(ss, item, ',')) {
+				size_t colon = item.find(':');
+
+				if (colon == std::string::npos) {
+					std::cout << "ERROR: Port mappings look like <port>:<new port>.  Got " << item << std::endl;
+					exit(1);
+				}
+
+				port_map[atoi(item.substr(0, colon).c_str())] = atoi(item.substr(colon + 1).c_str());
+			}
+		}
+		else if (param.find("--pace") != std::string::npos) {
+			boost::replace_all(param,"--pace=","");
+
+			if (param == "none")
+				pace_mode = PACE_NONE;
+			else if (param == "capture")
+				pace_mode = PACE_CAPTURE;
+			else if (param == "snap")
+				pace_mode = PACE_SNAP;
+			else {
+				std::cout << "ERROR: Unknown pacing mode: " << param << std::endl;
+				exit(1);
+			}
+		}
+		else if (param.find("--speedup") != std::string::npos) {
+			boost::replace_all(param,"--speedup=","");
+			speedup = atof(param.c_str());
+		}
+		else if (param.find("--pps") != std::string::npos) {
+			boost::replace_all(param,"--pps=","");
+			pps = atof(param.c_str());
+		}
+		else if (param.find("--loop") != std::string::npos) {
+			boost::replace_all(param,"--loop=","");
+			loops = atol(param.c_str());
+		}
+		else if (param.find("--packets") != std::string::npos) {
+			boost::replace_all(param,"--packets=","");
+			max_packets = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--batch") != std::string::npos) {
+			boost::replace_all(param,"--batch=","");
+			batch_size = atol(param.c_str());
+		}
+		else if (param.find("--gso") != std::string::npos) {
+			use_gso = true;
+		}
+		else if (param.find("--ttl") != std::string::npos) {
+			boost::replace_all(param,"--ttl=","");
+			ttl = atoi(param.c_str());
+		}
+		else if (param.find("--interface") != std::string::npos) {
+			boost::replace_all(param,"--interface=","");
+			mcast_interface = param;
+		}
+		else if (param.find("--report") != std::string::npos) {
+			boost::replace_all(param,"--report=","");
+			report_interval = atof(param.c_str());
+		}
+		else if (param.find("--") == 0) {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+		else {
+			capture_file = param;
+		}
+	}
+
+	if (capture_file.length() == 0) {
+		std::cout << "ERROR: Please provide a capture file.  Run with --help for usage." << std::endl;
+		exit(1);
+	}
+
+	if (pps > 0.0)
+		pace_mode = PACE_PPS;
+
+	if (speedup <= 0.0) {
+		std::cout << "ERROR: --speedup must be greater than 0." << std::endl;
+		exit(1);
+	}
+
+	if (batch_size < 1)
+		batch_size = 1;
+
+	if (batch_size > MAX_BATCH)
+		batch_size = MAX_BATCH;
+
+	pcap_mmap_reader reader;
+
+	if (!reader.open(capture_file)) {
+		std::cout << "ERROR: " << reader.last_error() << std::endl;
+		exit(2);
+	}
+
+	struct sockaddr_in dest;
+	memset(&dest, 0x00, sizeof(dest));
+	dest.sin_family = AF_INET;
+
+	if (inet_pton(AF_INET, dest_ip.c_str(), &dest.sin_addr) != 1) {
+		std::cout << "ERROR: " << dest_ip << " is not an IPv4 address." << std::endl;
+		exit(1);
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (sock < 0) {
+		std::cout << "ERROR: Unable to create socket: " << strerror(errno) << std::endl;
+		exit(3);
+	}
+
+	int sndbuf = 64 * 1024 * 1024;
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	bool is_mcast = IN_MULTICAST(ntohl(dest.sin_addr.s_addr));
+
+	if (is_mcast) {
+		unsigned char mcast_ttl = ttl;
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &mcast_ttl, sizeof(mcast_ttl));
+
+		// Let receivers on this host (e.g. a SNAP source under test) hear it too.
+		unsigned char mcast_loop = 1;
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &mcast_loop, sizeof(mcast_loop));
+
+		if (mcast_interface.length() > 0) {
+			struct in_addr iface;
+
+			if ((inet_pton(AF_INET, mcast_interface.c_str(), &iface) != 1) ||
+					(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) != 0)) {
+				std::cout << "ERROR: Unable to send multicast from " << mcast_interface << std::endl;
+				exit(3);
+			}
+		}
+	}
+
+	signal(SIGINT, sig_handler);
+
+	replay_sender sender(sock, dest, use_gso);
+	pacing_clock clock(pace_mode == PACE_PPS ? 1.0 : speedup);
+
+	std::cout << "Replaying " << capture_file << " to " << dest_ip << (is_mcast ? " (multicast)" : "");
+
+	switch (pace_mode) {
+	case PACE_CAPTURE:
+		std::cout << " at " << speedup << "x capture time";
+		break;
+	case PACE_SNAP:
+		std::cout << " at " << speedup << "x the SNAP sample clock";
+		break;
+	case PACE_PPS:
+		std::cout << " at " << pps << " packets/sec";
+		break;
+	default:
+		std::cout << " as fast as possible";
+	}
+
+	std::cout << ".  Ctrl-C to stop." << std::endl;
+
+	std::vector<pending_packet> batch(batch_size);
+	int batch_count = 0;
+
+	pcap_record rec;
+	uint16_t port;
+	const unsigned char *payload;
+	size_t payload_len;
+	uint64_t packet_index = 0;
+	uint64_t packets_in_loop = 0;
+	long loop = 0;
+
+	int64_t start_ns = pacing_clock::now_ns();
+	int64_t last_report_ns = start_ns;
+	uint64_t last_report_packets = 0;
+	uint64_t last_report_bytes = 0;
+
+	while (!stop_replay) {
+		if (!reader.next(rec)) {
+			// End of the file.
+			if (batch_count > 0) {
+				sender.send(&batch[0], batch_count);
+				batch_count = 0;
+			}
+
+			loop++;
+
+			if ((packets_in_loop == 0) || ((loops > 0) && (loop >= loops)))
+				break;
+
+			packets_in_loop = 0;
+			reader.rewind();
+			continue;
+		}
+
+		if (rec.len != rec.caplen)
+			continue;
+
+		if (!pcap_mmap_reader::udp_payload(rec.data, rec.caplen, port, payload, payload_len))
+			continue;
+
+		if (!ports.empty() && (ports.find(port) == ports.end()))
+			continue;
+
+		packets_in_loop++;
+
+		if (pace_mode != PACE_NONE) {
+			uint64_t stream_time_ns;
+
+			if (pace_mode == PACE_SNAP) {
+				if (payload_len < VOLTAGE_HEADER_SIZE)
+					continue;
+
+				uint64_t sample_number;
+				memcpy(&sample_number, payload + VOLTAGE_TIMESTAMP_OFFSET, sizeof(sample_number));
+				stream_time_ns = be64toh(sample_number) * SNAP_NS_PER_SAMPLE;
+			}
+			else if (pace_mode == PACE_PPS) {
+				stream_time_ns = (uint64_t)((double)packet_index * 1.0e9 / pps);
+			}
+			else {
+				stream_time_ns = rec.timestamp_ns;
+			}
+
+			// Don't sit on packets we already have while waiting for this one.
+			if ((batch_count > 0) && !clock.is_due(stream_time_ns)) {
+				sender.send(&batch[0], batch_count);
+				batch_count = 0;
+			}
+
+			if (!clock.wait_until_due(stream_time_ns, stop_replay))
+				break;
+		}
+
+		auto mapped = port_map.find(port);
+
+		batch[batch_count].data = payload;
+		batch[batch_count].len = payload_len;
+		batch[batch_count].dest_port = (mapped != port_map.end()) ? mapped->second : port;
+		batch_count++;
+		packet_index++;
+
+		if (batch_count >= batch_size) {
+			sender.send(&batch[0], batch_count);
+			batch_count = 0;
+		}
+
+		if ((max_packets > 0) && (packet_index >= max_packets))
+			break;
+
+		if ((report_interval > 0.0) && ((packet_index & 0xFF) == 0)) {
+			int64_t now = pacing_clock::now_ns();
+
+			if ((double)(now - last_report_ns) / 1.0e9 >= report_interval) {
+				double secs = (double)(now - last_report_ns) / 1.0e9;
+				double pkt_rate = (double)(sender.packets_sent - last_report_packets) / secs;
+				double gbps = (double)(sender.bytes_sent - last_report_bytes) * 8.0 / secs / 1.0e9;
+
+				std::cout << std::fixed << std::setprecision(2) << "[" << (double)(now - start_ns) / 1.0e9 << " s] " <<
+						pkt_rate << " packets/sec, " << gbps << " Gbps payload, " << sender.packets_sent << " packets sent" << std::endl;
+
+				last_report_ns = now;
+				last_report_packets = sender.packets_sent;
+				last_report_bytes = sender.bytes_sent;
+			}
+		}
+	}
+
+	if (batch_count > 0)
+		sender.send(&batch[0], batch_count);
+
+	double elapsed = (double)(pacing_clock::now_ns() - start_ns) / 1.0e9;
+
+	std::cout << std::fixed << std::setprecision(2) << std::endl;
+	std::cout << "Sent " << sender.packets_sent << " packets (" << (double)sender.bytes_sent / (1024.0*1024.0) << " MB) in " << elapsed << " seconds." << std::endl;
+
+	if (elapsed > 0.0) {
+		std::cout << "Average rate: " << (double)sender.packets_sent / elapsed << " packets/sec, " <<
+				(double)sender.bytes_sent * 8.0 / elapsed / 1.0e9 << " Gbps payload" << std::endl;
+	}
+
+	if (pace_mode != PACE_NONE)
+		std::cout << "Latest packet: " << (double)clock.max_late_ns() / 1000.0 << " us behind schedule" << std::endl;
+
+	if (sender.send_errors > 0)
+		std::cout << "Send errors: " << sender.send_errors << std::endl;
+
+	if (use_gso && !sender.gso())
+		std::cout << "UDP GSO was not available, so packets were sent individually." << std::endl;
+
+	close(sock);
+	reader.close();
+
+	return 0;
+}
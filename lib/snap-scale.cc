@@ -0,0 +1,445 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+#include <signal.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "snap_loopback_harness.h"
+#include "snap_packet_generator.h"
+
+using namespace gr::ata;
+
+/*
+ * Multi-source scaling benchmark.  Runs 1, 2, 4 ... N SNAP sources in one process, each
+ * fed at a fixed rate over UDP by snap_loopback_harness, with and without CPU pinning and
+ * optionally into a synchronizer the way the array flowgraph would.  For each step it
+ * reports aggregate throughput, CPU per thread role and cross-node memory traffic, and
+ * marks the first source count where adding a source costs more than it should.
+ */
+
+// Contention means a step's per packet cost or latency grew past these multiples of the single source step's.
+#define COST_GROWTH_LIMIT 1.25
+#define LATENCY_GROWTH_LIMIT 2.0
+
+static volatile bool stop_harness = false;
+
+snap_loopback_config config;
+std::vector<int> source_counts = {1, 2, 4, 8, 12, 16, 24, 32};
+// Per source.  Zero for the real SNAP rate.
+double rate = 0.0;
+bool run_unpinned = true;
+bool run_pinned = true;
+bool csv_output = false;
+
+static void sig_handler(int signo) {
+	stop_harness = true;
+}
+
+static std::string contention_reason(const snap_loopback_result &r, const snap_loopback_result &baseline) {
+	std::stringstream reason;
+
+	if (!r.passed) {
+		reason << snap_loopback_harness::limit_name(r.limit);
+	}
+	else if ((baseline.receive_ns_per_packet > 0.0) && (r.receive_ns_per_packet > COST_GROWTH_LIMIT * baseline.receive_ns_per_packet)) {
+		reason << "ns/packet x" << std::fixed << std::setprecision(2) << (r.receive_ns_per_packet / baseline.receive_ns_per_packet);
+	}
+	else if ((baseline.latency_p99_us > 0.0) && (r.latency_p99_us > LATENCY_GROWTH_LIMIT * baseline.latency_p99_us)) {
+		reason << "latency x" << std::fixed << std::setprecision(1) << (r.latency_p99_us / baseline.latency_p99_us);
+	}
+
+	return reason.str();
+}
+
+static void print_header(bool have_node_counters) {
+	if (csv_output) {
+		std::cout << "type,channels,transport,synchronizer_threads,pinned,sources,packets_per_sec_per_source,sent_packets_per_sec," <<
+				"delivered_packets_per_sec,loss,gbps,receive_cores,receive_ns_per_packet";
+
+		for (int role=0;role<LOOPBACK_NUM_ROLES;role++) {
+			std::string name = snap_loopback_harness::role_name(role);
+			boost::replace_all(name, " ", "_");
+			std::cout << "," << name << "_threads," << name << "_cores," << name << "_max_thread_cores";
+		}
+
+		std::cout << ",sync_items_per_sec,queue_p99,latency_p50_us,latency_p99_us,node_loads_per_sec,remote_loads_per_sec," <<
+				"off_node_pages_per_sec,limit,contention" << std::endl;
+		return;
+	}
+
+	std::cout << std::setw(7) << "sources" << std::setw(5) << "pin" << std::setw(13) << "delivered/s" << std::setw(9) << "loss %" <<
+			std::setw(7) << "Gbps" << std::setw(10) << "ns/pkt" << std::setw(16) << "receive thr" << std::setw(16) << "work thr";
+
+	if (config.sync_threads > 0)
+		std::cout << std::setw(16) << "sync+workers";
+
+	std::cout << std::setw(11) << "p99 us" << std::setw(15) << (have_node_counters ? "remote ld/s" : "off-node pg/s") << "  notes" << std::endl;
+}
+
+// Cores for a role as "total (max per thread)".
+static std::string role_cores(const snap_loopback_result &r, int role) {
+	std::stringstream cores;
+	cores << std::fixed << std::setprecision(2) << r.roles[role].cores << " (" << r.roles[role].max_thread_cores << ")";
+
+	return cores.str();
+}
+
+static void print_step(const snap_loopback_result &r, bool pinned, const std::string &contention, bool have_node_counters) {
+	if (r.error.length() > 0) {
+		if (csv_output)
+			std::cerr << "ERROR: " << r.error << std::endl;
+		else
+			std::cout << std::setw(7) << r.num_sources << std::setw(5) << (pinned ? "on" : "off") << "  ERROR: " << r.error << std::endl;
+
+		return;
+	}
+
+	double delivered = r.sent_packets_per_sec * (1.0 - r.loss);
+
+	if (csv_output) {
+		std::cout << (config.packet_type == SNAP_PACKETTYPE_SPECT ? "spectrometer" : "voltage") << "," << config.num_channels << "," <<
+				(config.mcast_group.length() > 0 ? "multicast" : "loopback") << "," << config.sync_threads << "," <<
+				(pinned ? 1 : 0) << "," << r.num_sources << "," << std::fixed << std::setprecision(0) << r.packets_per_sec << "," <<
+				r.sent_packets_per_sec << "," << delivered << "," << std::setprecision(6) << r.loss << "," << std::setprecision(3) <<
+				r.received_gbps << "," << r.receive_cores << "," << std::setprecision(1) << r.receive_ns_per_packet;
+
+		for (int role=0;role<LOOPBACK_NUM_ROLES;role++) {
+			std::cout << "," << r.roles[role].threads << "," << std::setprecision(3) << r.roles[role].cores << "," <<
+					r.roles[role].max_thread_cores;
+		}
+
+		std::cout << "," << std::setprecision(0) << r.sync_items_per_sec << "," << r.queue_p99 << "," << std::setprecision(1) <<
+				r.latency_p50_us << "," << r.latency_p99_us << "," << std::setprecision(0) <<
+				(r.have_node_counters ? r.node_loads_per_sec : -1.0) << "," << (r.have_node_counters ? r.remote_loads_per_sec : -1.0) << "," <<
+				(r.have_numastat ? r.off_node_pages_per_sec : -1.0) << "," << snap_loopback_harness::limit_name(r.limit) << "," <<
+				contention << std::endl;
+		return;
+	}
+
+	std::cout << std::setw(7) << r.num_sources << std::setw(5) << (pinned ? "on" : "off") << std::fixed << std::setprecision(0) <<
+			std::setw(13) << delivered << std::setprecision(3) << std::setw(9) << (r.loss * 100.0) << std::setprecision(2) <<
+			std::setw(7) << r.received_gbps << std::setprecision(0) << std::setw(10) << r.receive_ns_per_packet <<
+			std::setw(16) << role_cores(r, LOOPBACK_ROLE_RECEIVE) << std::setw(16) << role_cores(r, LOOPBACK_ROLE_WORK);
+
+	if (config.sync_threads > 0) {
+		snap_loopback_result combined = r;
+		combined.roles[LOOPBACK_ROLE_SYNC].cores += r.roles[LOOPBACK_ROLE_SYNC_WORKER].cores;
+		combined.roles[LOOPBACK_ROLE_SYNC].max_thread_cores = std::max(r.roles[LOOPBACK_ROLE_SYNC].max_thread_cores,
+				r.roles[LOOPBACK_ROLE_SYNC_WORKER].max_thread_cores);
+		std::cout << std::setw(16) << role_cores(combined, LOOPBACK_ROLE_SYNC);
+	}
+
+	std::cout << std::setprecision(1) << std::setw(11) << r.latency_p99_us << std::setprecision(0) << std::setw(15);
+
+	if (have_node_counters)
+		std::cout << r.remote_loads_per_sec;
+	else if (r.have_numastat)
+		std::cout << r.off_node_pages_per_sec;
+	else
+		std::cout << "-";
+
+	std::cout << "  ";
+
+	if (!r.passed)
+		std::cout << "FAILED (" << snap_loopback_harness::limit_name(r.limit) << ") ";
+
+	if (contention.length() > 0)
+		std::cout << "<- contention begins (" << contention << ")";
+
+	std::cout << std::endl;
+}
+
+// Runs every source count with pinning on or off.  Returns false if interrupted or a step couldn't run.
+static bool run_sweep(snap_loopback_harness &harness, bool pinned, double packets_per_sec) {
+	snap_loopback_result baseline;
+	bool have_baseline = false;
+	int contention_at = 0;
+	std::string contention_why;
+
+	for (size_t i=0;i<source_counts.size();i++) {
+		if (stop_harness)
+			return false;
+
+		snap_loopback_result r = harness.run(source_counts[i], packets_per_sec);
+
+		std::string contention;
+
+		if ((r.error.length() == 0) && (contention_at == 0)) {
+			if (!have_baseline) {
+				// The smallest count is the baseline.  If even that fails, it's where contention starts.
+				baseline = r;
+				have_baseline = true;
+
+				if (!r.passed)
+					contention = snap_loopback_harness::limit_name(r.limit);
+			}
+			else {
+				contention = contention_reason(r, baseline);
+			}
+
+			if (contention.length() > 0) {
+				contention_at = r.num_sources;
+				contention_why = contention;
+			}
+		}
+
+		print_step(r, pinned, contention, harness.have_node_counters());
+
+		if (r.error.length() > 0)
+			return false;
+	}
+
+	if (!csv_output) {
+		if (contention_at > 0)
+			std::cout << "Pinning " << (pinned ? "on" : "off") << ": contention begins at " << contention_at << " sources (" << contention_why << ")." << std::endl;
+		else
+			std::cout << "Pinning " << (pinned ? "on" : "off") << ": no contention up to " << source_counts.back() << " sources." << std::endl;
+
+		std::cout << std::endl;
+	}
+
+	return true;
+}
+
+int
+main (int argc, char **argv)
+{
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-scale [options]" << std::endl;
+			std::cout << "Runs increasing numbers of SNAP sources in one process at a fixed rate each and shows where adding sources starts to cost more than it should." << std::endl;
+			std::cout << "--type=<voltage|spectrometer> = packet type.  Default is voltage." << std::endl <<
+						 "--start-channel=<channel> = first voltage channel.  Default is 1792." << std::endl <<
+						 "--num-channels=<n> = voltage channels per source (a multiple of 256).  Default is 1024." << std::endl <<
+						 "--packed = have the sources output packed 4-bit IQ." << std::endl <<
+						 "--sources=<n>[,<n>...] = source counts to step through, smallest first.  Default is 1,2,4,8,12,16,24,32." << std::endl <<
+						 "--rate=<packets/s> = rate per source.  Default is a real SNAP's: 15625 frames/s for voltage, 10000 packets/s for spectrometer." << std::endl <<
+						 "--pin=<off|on|both> = run with threads unpinned, pinned, or both.  Default is both." << std::endl <<
+						 "--synchronizer=<threads> = feed the sources' outputs to a SNAPSynchronizerV3 with this many copy threads.  Voltage only." << std::endl <<
+						 "--port=<port> = UDP port of the first source.  The rest use the ports after it.  Default is 10000." << std::endl <<
+						 "--mcast-group=<IPv4 group> = send to a multicast group (with loopback on) rather than 127.0.0.1." << std::endl <<
+						 "--mcast-if=<IPv4 address> = interface to send multicast from.  Default is the system's choice." << std::endl <<
+						 "--seconds=<s> = measured time per step.  Default is 2." << std::endl <<
+						 "--warmup=<s> = time per step before measuring starts.  Default is 0.5." << std::endl <<
+						 "--loss=<fraction> = highest loss that still counts as sustained.  Default is 0." << std::endl <<
+						 "--max-backlog-ms=<ms> = fail a step if a receive queue holds more than this much traffic.  Default is 100." << std::endl <<
+						 "--batch=<n> = packets per sendmmsg call (max " << LOOPBACK_MAX_BATCH << ").  Default is 32." << std::endl <<
+						 "--csv = print CSV instead of a table." << std::endl;
+			std::cout << std::endl;
+			std::cout << "Contention begins at the first source count that loses packets, backs up a queue, costs more than " <<
+						 COST_GROWTH_LIMIT << "x" << std::endl << "the smallest count's receive ns per packet, or has more than " <<
+						 LATENCY_GROWTH_LIMIT << "x its p99 latency." << std::endl;
+			std::cout << "Thread CPU is shown as total cores for the role, with the busiest single thread in brackets.  Cross-node" << std::endl <<
+						 "memory traffic comes from the node-load-misses counter where perf allows it, otherwise from the" << std::endl <<
+						 "system-wide numastat other_node count (multi-node hosts only)." << std::endl;
+			std::cout << "Senders run in the same process, so past the host's core count they compete with the sources for CPU." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--type") != std::string::npos) {
+			boost::replace_all(param,"--type=","");
+
+			if (param == "voltage") {
+				config.packet_type = SNAP_PACKETTYPE_VOLTAGE;
+			}
+			else if ((param == "spectrometer") || (param == "spect")) {
+				config.packet_type = SNAP_PACKETTYPE_SPECT;
+			}
+			else {
+				std::cout << "ERROR: Unknown packet type: " << param << std::endl;
+				exit(1);
+			}
+		}
+		else if (param.find("--start-channel") != std::string::npos) {
+			boost::replace_all(param,"--start-channel=","");
+			config.starting_channel = atoi(param.c_str());
+		}
+		else if (param.find("--num-channels") != std::string::npos) {
+			boost::replace_all(param,"--num-channels=","");
+			config.num_channels = atoi(param.c_str());
+		}
+		else if (param == "--packed") {
+			config.packed_output = true;
+		}
+		else if (param.find("--sources") != std::string::npos) {
+			boost::replace_all(param,"--sources=","");
+			std::stringstream ss(param);
+			std::string item;
+
+			source_counts.clear();
+
+			while (std::getline(ss, item, ',')) {
+				int count = atoi(item.c_str());
+
+				if (count < 1) {
+					std::cout << "ERROR: Source counts must be at least 1: " << item << std::endl;
+					exit(1);
+				}
+
+				source_counts.push_back(count);
+			}
+
+			std::sort(source_counts.begin(), source_counts.end());
+		}
+		else if (param.find("--rate") != std::string::npos) {
+			boost::replace_all(param,"--rate=","");
+			rate = atof(param.c_str());
+		}
+		else if (param.find("--pin") != std::string::npos) {
+			boost::replace_all(param,"--pin=","");
+
+			if (param == "off") {
+				run_pinned = false;
+			}
+			else if (param == "on") {
+				run_unpinned = false;
+			}
+			else if (param != "both") {
+				std::cout << "ERROR: --pin takes off, on or both: " << param << std::endl;
+				exit(1);
+			}
+		}
+		else if (param.find("--synchronizer") != std::string::npos) {
+			boost::replace_all(param,"--synchronizer=","");
+			config.sync_threads = atoi(param.c_str());
+		}
+		else if (param.find("--port") != std::string::npos) {
+			boost::replace_all(param,"--port=","");
+			config.base_port = atoi(param.c_str());
+		}
+		else if (param.find("--mcast-group") != std::string::npos) {
+			boost::replace_all(param,"--mcast-group=","");
+			config.mcast_group = param;
+		}
+		else if (param.find("--mcast-if") != std::string::npos) {
+			boost::replace_all(param,"--mcast-if=","");
+			config.mcast_if = param;
+		}
+		else if (param.find("--seconds") != std::string::npos) {
+			boost::replace_all(param,"--seconds=","");
+			config.step_seconds = atof(param.c_str());
+		}
+		else if (param.find("--warmup") != std::string::npos) {
+			boost::replace_all(param,"--warmup=","");
+			config.warmup_seconds = atof(param.c_str());
+		}
+		else if (param.find("--max-backlog-ms") != std::string::npos) {
+			boost::replace_all(param,"--max-backlog-ms=","");
+			config.max_backlog_ms = atof(param.c_str());
+		}
+		else if (param.find("--loss") != std::string::npos) {
+			boost::replace_all(param,"--loss=","");
+			config.loss_threshold = atof(param.c_str());
+		}
+		else if (param.find("--batch") != std::string::npos) {
+			boost::replace_all(param,"--batch=","");
+			config.send_batch = atoi(param.c_str());
+
+			if (config.send_batch < 1)
+				config.send_batch = 1;
+			else if (config.send_batch > LOOPBACK_MAX_BATCH)
+				config.send_batch = LOOPBACK_MAX_BATCH;
+		}
+		else if (param == "--csv") {
+			csv_output = true;
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	if (config.packet_type == SNAP_PACKETTYPE_SPECT) {
+		if (config.sync_threads > 0) {
+			std::cout << "ERROR: --synchronizer only works with voltage packets." << std::endl;
+			exit(1);
+		}
+
+		config.starting_channel = 0;
+		config.num_channels = 4096;
+	}
+	else if ((config.num_channels < 256) || ((config.num_channels % 256) != 0)) {
+		std::cout << "ERROR: --num-channels must be a multiple of 256." << std::endl;
+		exit(1);
+	}
+
+	if (rate <= 0.0) {
+		if (config.packet_type == SNAP_PACKETTYPE_SPECT) {
+			rate = 10000.0;
+		}
+		else {
+			snap_packet_generator generator(config.packet_type, config.starting_channel,
+					config.starting_channel + config.num_channels - 1, 0, 1);
+			rate = 15625.0 * generator.packets_per_frame();
+		}
+	}
+
+	if (config.step_seconds <= 0.0) {
+		std::cout << "ERROR: --seconds must be positive." << std::endl;
+		exit(1);
+	}
+
+	signal(SIGINT, sig_handler);
+
+	snap_loopback_harness harness(config, stop_harness);
+
+	if (csv_output) {
+		print_header(harness.have_node_counters());
+	}
+	else {
+		std::cout << "Scaling " << (config.packet_type == SNAP_PACKETTYPE_SPECT ? "spectrometer" : "voltage") << " sources at " <<
+				std::fixed << std::setprecision(0) << rate << " packets/s each over " <<
+				(config.mcast_group.length() > 0 ? "multicast " + config.mcast_group : std::string("UDP loopback"));
+
+		if (config.sync_threads > 0)
+			std::cout << " into a synchronizer (" << config.sync_threads << " copy threads)";
+
+		std::cout << ", " << harness.num_cpus() << " CPUs available." << std::endl;
+
+		if (!harness.have_node_counters())
+			std::cout << "Node load counters aren't available here, so cross-node traffic is from numastat." << std::endl;
+
+		std::cout << std::endl;
+		print_header(harness.have_node_counters());
+	}
+
+	if (run_unpinned && !run_sweep(harness, false, rate))
+		return 1;
+
+	if (run_pinned && !run_sweep(harness, true, rate))
+		return 1;
+
+	return 0;
+}
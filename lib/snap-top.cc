@@ -0,0 +1,380 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "snap_stats_shm.h"
+#include "snap_stats.h"
+#include <ata/snap_headers.h>
+
+using namespace gr::ata;
+
+/*
+ * Live view of every SNAP source and synchronizer running on this host.  Each block
+ * publishes its counters to a shared memory segment (see snap_stats_shm.h), so this
+ * needs nothing from the flowgraph: no ControlPort, no Python, and no cost on the data
+ * path.  Rates are worked out from the change in the counters between refreshes.
+ */
+
+// A segment that hasn't been updated in this many publish periods is flagged.
+#define STALE_PERIODS 8
+
+static volatile bool stop_monitor = false;
+
+double interval = 1.0;
+bool run_once = false;
+bool show_exited = false;
+bool clean_exited = false;
+pid_t only_pid = 0;
+
+static void sig_handler(int signo) {
+	stop_monitor = true;
+}
+
+struct segment_state {
+	std::unique_ptr<snap_stats_shm_reader> reader;
+	snap_stats_shm_snapshot last;
+	bool have_last = false;
+};
+
+// Per second change in a counter.  Counters only go backwards if a thread they came from
+// has gone, so that counts as no change.
+static double rate(const snap_stats_shm_snapshot &now, const snap_stats_shm_snapshot &then, int value) {
+	if (now.update_ns <= then.update_ns)
+		return 0.0;
+
+	if (now.values[value] < then.values[value])
+		return 0.0;
+
+	return (double)(now.values[value] - then.values[value]) * 1e9 / (double)(now.update_ns - then.update_ns);
+}
+
+static uint64_t delta(const snap_stats_shm_snapshot &now, const snap_stats_shm_snapshot &then, int value) {
+	return (now.values[value] >= then.values[value]) ? now.values[value] - then.values[value] : 0;
+}
+
+// CPU time counters are in ns, so their rate is a share of one core.
+static std::string cpu_percent(const snap_stats_shm_snapshot &now, const snap_stats_shm_snapshot *then, int value) {
+	if (!then || (now.values[value] == 0))
+		return "-";
+
+	std::stringstream s;
+	s << std::fixed << std::setprecision(1) << rate(now, *then, value) / 1e7;
+
+	return s.str();
+}
+
+static std::string fixed(double value, int precision) {
+	std::stringstream s;
+	s << std::fixed << std::setprecision(precision) << value;
+
+	return s.str();
+}
+
+static std::string status(const snap_stats_shm_snapshot &snap, bool alive) {
+	if (!alive)
+		return "exited";
+
+	if (snap_source_stats::now_ns() - snap.update_ns > (uint64_t)STALE_PERIODS * SNAP_STATS_SHM_PUBLISH_MS * 1000000ULL)
+		return "stale";
+
+	return "";
+}
+
+static void print_sources(const std::vector<std::pair<snap_stats_shm_snapshot, segment_state *>> &sources) {
+	std::cout << std::setw(8) << "pid" << "  " << std::left << std::setw(24) << "block" << std::right << std::setw(7) << "port" <<
+			std::setw(5) << "ant" << std::setw(6) << "type" << std::setw(11) << "pkts/s" << std::setw(8) << "Gbps" <<
+			std::setw(9) << "loss %" << std::setw(10) << "kdrops/s" << std::setw(10) << "qdrops/s" << std::setw(7) << "late" << std::setw(7) << "gaps" <<
+			std::setw(14) << "queue (max)" << std::setw(10) << "sock max%" << std::setw(9) << "rx cpu%" << std::setw(10) << "work cpu%" << std::setw(10) << "work p99" << std::setw(10) << "lat p99" << "  status" << std::endl;
+
+	for (size_t i=0;i<sources.size();i++) {
+		const snap_stats_shm_snapshot &now = sources[i].first;
+		const snap_stats_shm_snapshot *then = sources[i].second->have_last ? &sources[i].second->last : NULL;
+		bool alive = snap_stats_shm_reader::owner_alive(now.pid);
+
+		std::string block_name = now.block_name.substr(0, 23);
+		std::string port = (now.port >= 0) ? std::to_string(now.port) : "file";
+		std::string antenna = now.values[SNAP_SHM_SRC_ANTENNA_ID] ? std::to_string(now.values[SNAP_SHM_SRC_ANTENNA_ID] - 1) : "-";
+		std::string queue = std::to_string(now.values[SNAP_SHM_SRC_QUEUE_DEPTH]) + " (" + std::to_string(now.values[SNAP_SHM_SRC_QUEUE_DEPTH_MAX]) + ")";
+
+		std::cout << std::setw(8) << now.pid << "  " << std::left << std::setw(24) << block_name << std::right << std::setw(7) << port <<
+				std::setw(5) << antenna << std::setw(6) << (now.packet_type == SNAP_PACKETTYPE_SPECT ? "spec" : "volt");
+
+		if (then) {
+			double pps = rate(now, *then, SNAP_SHM_SRC_PACKETS_RECEIVED);
+			uint64_t missed = delta(now, *then, SNAP_SHM_SRC_MISSED_PACKETS);
+			uint64_t queued = delta(now, *then, SNAP_SHM_SRC_PACKETS_QUEUED);
+			double loss = (missed + queued > 0) ? 100.0 * missed / (double)(missed + queued) : 0.0;
+
+			std::cout << std::setw(11) << fixed(pps, 0) << std::setw(8) << fixed(pps * now.packet_size * 8.0 / 1e9, 3) <<
+					std::setw(9) << fixed(loss, 3) << std::setw(10) << fixed(rate(now, *then, SNAP_SHM_SRC_KERNEL_DROPS), 0) <<
+					std::setw(10) << fixed(rate(now, *then, SNAP_SHM_SRC_QUEUE_FULL_DROPS), 0) <<
+					std::setw(7) << delta(now, *then, SNAP_SHM_SRC_LATE_PACKETS) << std::setw(7) << delta(now, *then, SNAP_SHM_SRC_GAP_FRAMES);
+		}
+		else {
+			std::cout << std::setw(11) << "-" << std::setw(8) << "-" << std::setw(9) << "-" << std::setw(10) << "-" << std::setw(10) << "-" <<
+					std::setw(7) << "-" << std::setw(7) << "-";
+		}
+
+		// How full the socket buffer has been.  Near 100 means the kernel is about to drop, or has.
+		std::string socket_peak = now.values[SNAP_SHM_SRC_RCVBUF] ?
+				fixed(100.0 * now.values[SNAP_SHM_SRC_SOCKET_BACKLOG_MAX] / now.values[SNAP_SHM_SRC_RCVBUF], 1) : "-";
+
+		std::cout << std::setw(14) << queue << std::setw(10) << socket_peak << std::setw(9) << cpu_percent(now, then, SNAP_SHM_SRC_RECEIVE_CPU_NS) <<
+				std::setw(10) << cpu_percent(now, then, SNAP_SHM_SRC_WORK_CPU_NS) <<
+				std::setw(10) << (fixed(now.values[SNAP_SHM_SRC_WORK_NS_P99] / 1000.0, 0) + "us");
+
+		// Only sources running with rx_timestamps have a latency.
+		std::string latency = now.values[SNAP_SHM_SRC_LATENCY_P99] ? fixed(now.values[SNAP_SHM_SRC_LATENCY_P99] / 1000.0, 0) + "us" : "-";
+
+		std::cout << std::setw(10) << latency << "  " << status(now, alive) << std::endl;
+	}
+}
+
+static void print_synchronizers(const std::vector<std::pair<snap_stats_shm_snapshot, segment_state *>> &synchronizers) {
+	std::cout << std::setw(8) << "pid" << "  " << std::left << std::setw(24) << "block" << std::right << std::setw(7) << "inputs" <<
+			std::setw(12) << "items/s" << std::setw(8) << "Gbps" << std::setw(14) << "dropped" << std::setw(7) << "syncs" <<
+			std::setw(9) << "resyncs" << std::setw(8) << "state" << std::setw(10) << "work cpu%" << std::setw(10) << "copy cpu%" << "  status" << std::endl;
+
+	for (size_t i=0;i<synchronizers.size();i++) {
+		const snap_stats_shm_snapshot &now = synchronizers[i].first;
+		const snap_stats_shm_snapshot *then = synchronizers[i].second->have_last ? &synchronizers[i].second->last : NULL;
+		bool alive = snap_stats_shm_reader::owner_alive(now.pid);
+
+		std::cout << std::setw(8) << now.pid << "  " << std::left << std::setw(24) << now.block_name.substr(0, 23) << std::right <<
+				std::setw(7) << now.num_inputs;
+
+		if (then) {
+			double items = rate(now, *then, SNAP_SHM_SYNC_ITEMS_OUT);
+			// packet_size is the item size for a synchronizer.
+			std::cout << std::setw(12) << fixed(items, 0) << std::setw(8) << fixed(items * now.packet_size * now.num_inputs * 8.0 / 1e9, 3);
+		}
+		else {
+			std::cout << std::setw(12) << "-" << std::setw(8) << "-";
+		}
+
+		std::cout << std::setw(14) << now.values[SNAP_SHM_SYNC_ITEMS_DROPPED] << std::setw(7) << now.values[SNAP_SHM_SYNC_SYNCS] <<
+				std::setw(9) << now.values[SNAP_SHM_SYNC_RESYNCS] << std::setw(8) << (now.values[SNAP_SHM_SYNC_SYNCHRONIZED] ? "synced" : "align") <<
+				std::setw(10) << cpu_percent(now, then, SNAP_SHM_SYNC_WORK_CPU_NS) <<
+				std::setw(10) << cpu_percent(now, then, SNAP_SHM_SYNC_COPY_CPU_NS) << "  " << status(now, alive) << std::endl;
+	}
+}
+
+// Removes segments whose process is gone.
+static int clean() {
+	std::vector<std::string> names = snap_stats_shm_reader::list();
+	int removed = 0;
+
+	for (size_t i=0;i<names.size();i++) {
+		snap_stats_shm_reader reader;
+		snap_stats_shm_snapshot snap;
+
+		if (!reader.open(names[i]) || !reader.snapshot(snap))
+			continue;
+
+		if (snap_stats_shm_reader::owner_alive(snap.pid))
+			continue;
+
+		if (snap_stats_shm_reader::remove(names[i])) {
+			std::cout << "Removed " << names[i] << " (" << snap.block_name << ", pid " << snap.pid << ")" << std::endl;
+			removed++;
+		}
+		else {
+			std::cout << "ERROR: Unable to remove " << names[i] << ": " << strerror(errno) << std::endl;
+		}
+	}
+
+	std::cout << removed << " segment(s) removed." << std::endl;
+
+	return removed;
+}
+
+int
+main (int argc, char **argv)
+{
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-top [options]" << std::endl;
+			std::cout << "Shows live rates, loss, queue depth and thread CPU for every SNAP source and synchronizer running on this host." << std::endl;
+			std::cout << "--interval=<s> = seconds between refreshes.  Default is 1." << std::endl <<
+						 "--once = print one refresh (after one interval, so rates can be worked out) and exit." << std::endl <<
+						 "--pid=<pid> = only show blocks in this process." << std::endl <<
+						 "--all = include segments left behind by processes that have exited." << std::endl <<
+						 "--clean = remove segments left behind by processes that have exited, then exit." << std::endl;
+			std::cout << std::endl;
+			std::cout << "Sources: pkts/s and Gbps are what the receive thread took in.  loss % is missed packets out of all the" << std::endl <<
+						 "packets the source should have output.  kdrops/s are packets the kernel dropped because the socket buffer" << std::endl <<
+						 "was full (raise net.core.rmem_max), and qdrops/s are packets lost to a full receive queue (the flowgraph" << std::endl <<
+						 "isn't keeping up).  sock max% is the most the socket buffer has held, as a share of its size.  late and gaps" << std::endl <<
+						 "are packets that arrived after their frame went out and whole frames that never arrived, since the last" << std::endl <<
+						 "refresh.  CPU is a percentage of one core.  lat p99 is from the kernel receiving a frame's first packet to" << std::endl <<
+						 "the frame leaving work(), for sources running with rx_timestamps." << std::endl;
+			std::cout << "Blocks publish " << (1000 / SNAP_STATS_SHM_PUBLISH_MS) << " times a second.  One that hasn't for " <<
+						 (STALE_PERIODS * SNAP_STATS_SHM_PUBLISH_MS / 1000.0) << " seconds is marked stale." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--interval") != std::string::npos) {
+			boost::replace_all(param,"--interval=","");
+			interval = atof(param.c_str());
+
+			if (interval < 0.1) {
+				std::cout << "ERROR: The interval must be at least 0.1 seconds." << std::endl;
+				exit(1);
+			}
+		}
+		else if (param == "--once") {
+			run_once = true;
+		}
+		else if (param.find("--pid") != std::string::npos) {
+			boost::replace_all(param,"--pid=","");
+			only_pid = atoi(param.c_str());
+		}
+		else if (param == "--all") {
+			show_exited = true;
+		}
+		else if (param == "--clean") {
+			clean_exited = true;
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	if (clean_exited) {
+		clean();
+		exit(0);
+	}
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	bool clear_screen = isatty(STDOUT_FILENO) && !run_once;
+	std::map<std::string, segment_state> segments;
+	bool first_pass = true;
+
+	while (!stop_monitor) {
+		std::vector<std::string> names = snap_stats_shm_reader::list();
+		std::map<std::string, segment_state> current;
+
+		for (size_t i=0;i<names.size();i++) {
+			auto it = segments.find(names[i]);
+
+			if (it != segments.end()) {
+				current[names[i]] = std::move(it->second);
+			}
+			else {
+				segment_state state;
+				state.reader.reset(new snap_stats_shm_reader());
+
+				if (!state.reader->open(names[i]))
+					continue;
+
+				current[names[i]] = std::move(state);
+			}
+		}
+
+		segments = std::move(current);
+
+		std::vector<std::pair<snap_stats_shm_snapshot, segment_state *>> sources;
+		std::vector<std::pair<snap_stats_shm_snapshot, segment_state *>> synchronizers;
+
+		for (auto it = segments.begin(); it != segments.end(); ++it) {
+			snap_stats_shm_snapshot snap;
+
+			if (!it->second.reader->snapshot(snap))
+				continue;
+
+			if (only_pid && (snap.pid != only_pid))
+				continue;
+
+			if (!show_exited && !snap_stats_shm_reader::owner_alive(snap.pid))
+				continue;
+
+			if (snap.kind == SNAP_STATS_SHM_KIND_SOURCE)
+				sources.push_back(std::make_pair(snap, &it->second));
+			else if (snap.kind == SNAP_STATS_SHM_KIND_SYNCHRONIZER)
+				synchronizers.push_back(std::make_pair(snap, &it->second));
+		}
+
+		// --once needs two passes to have rates, and only prints the second.
+		if (!(run_once && first_pass)) {
+			if (clear_screen)
+				std::cout << "\033[H\033[2J";
+
+			std::cout << "snap-top: " << sources.size() << " source(s), " << synchronizers.size() << " synchronizer(s)" << std::endl << std::endl;
+
+			if (!sources.empty()) {
+				print_sources(sources);
+				std::cout << std::endl;
+			}
+
+			if (!synchronizers.empty()) {
+				print_synchronizers(synchronizers);
+				std::cout << std::endl;
+			}
+
+			if (sources.empty() && synchronizers.empty())
+				std::cout << "No SNAP sources or synchronizers are running." << std::endl << std::endl;
+
+			std::cout << std::flush;
+
+			if (run_once)
+				break;
+		}
+
+		for (size_t i=0;i<sources.size();i++) {
+			sources[i].second->last = sources[i].first;
+			sources[i].second->have_last = true;
+		}
+
+		for (size_t i=0;i<synchronizers.size();i++) {
+			synchronizers[i].second->last = synchronizers[i].first;
+			synchronizers[i].second->have_last = true;
+		}
+
+		first_pass = false;
+
+		// Sleep in short steps so Ctrl-C is quick.
+		for (int step=0;(step < (int)(interval * 10)) && !stop_monitor;step++)
+			usleep(100000);
+	}
+
+	return 0;
+}
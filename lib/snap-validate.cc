@@ -0,0 +1,352 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string.h>
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "snap_capture_validator.h"
+
+using namespace gr::ata;
+
+// Exit codes, so a script can gate on the result.
+#define EXIT_CLEAN 0
+#define EXIT_USAGE 1
+#define EXIT_READ_ERROR 2
+#define EXIT_PROBLEMS 3
+
+static std::string json_escape(const std::string &in) {
+	std::string out;
+
+	for (size_t i=0;i<in.length();i++) {
+		char c = in[i];
+
+		if ((c == '"') || (c == '\\')) {
+			out += '\\';
+			out += c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		}
+		else {
+			out += c;
+		}
+	}
+
+	return out;
+}
+
+static void write_event_text(std::ostream &out, const validator_event &ev) {
+	out << "    " << snap_capture_validator::event_name(ev.type) << " at sample_number " << ev.sample_number;
+
+	switch (ev.type) {
+	case VALIDATOR_EVENT_GAP:
+		out << ": " << ev.count << " frames missing";
+		break;
+	case VALIDATOR_EVENT_PARTIAL_FRAME:
+		out << ": " << ev.count << " packets missing";
+		break;
+	case VALIDATOR_EVENT_DUPLICATE:
+		out << ": " << ev.count << " extra copies";
+		break;
+	case VALIDATOR_EVENT_OUT_OF_RANGE:
+		out << ": channel " << ev.from;
+		break;
+	case VALIDATOR_EVENT_FIRMWARE_CHANGE:
+		out << ": " << ev.from << " -> " << ev.to;
+		break;
+	}
+
+	out << std::endl;
+}
+
+static void write_text(std::ostream &out, snap_capture_validator &validator, double elapsed, size_t events_to_print) {
+	const std::vector<validator_stream_stats> &results = validator.results();
+
+	out << "Scanned " << validator.packets_scanned() << " SNAP packets (" << validator.bytes_scanned() / (1024*1024) << " MB) in " <<
+			validator.files().size() << " file(s), " << validator.num_chunks() << " chunk(s), " << elapsed << " seconds." << std::endl;
+
+	if (validator.non_snap_packets() > 0)
+		out << validator.non_snap_packets() << " UDP packets were too short to be SNAP packets." << std::endl;
+
+	for (size_t i=0;i<results.size();i++) {
+		const validator_stream_stats &s = results[i];
+
+		out << std::endl << "Port " << s.port << " antenna " << s.antenna << (s.clean() ? ": OK" : ": PROBLEMS") << std::endl;
+		out << "  packets: " << s.packets << ", sample_number " << s.first_sample << " to " << s.last_sample << std::endl;
+		out << "  frames: " << s.complete_frames << " complete, " << s.partial_frames << " partial (" << s.missing_packets << " packets missing), " <<
+				s.missing_frames << " missing in " << s.gaps << " gap(s)" << std::endl;
+		out << "  duplicates: " << s.duplicates << ", reordered: " << s.reordered << " (" << s.late << " too late to place), out of range channel blocks: " <<
+				s.out_of_range << ", wrong size: " << s.wrong_size << std::endl;
+		out << "  firmware versions:";
+
+		for (auto v = s.firmware_versions.begin(); v != s.firmware_versions.end(); ++v)
+			out << " " << *v;
+
+		out << " (" << s.firmware_changes << " change(s))" << std::endl;
+
+		size_t n = s.events.size();
+
+		if (n > events_to_print)
+			n = events_to_print;
+
+		for (size_t e=0;e<n;e++)
+			write_event_text(out, s.events[e]);
+
+		if (s.events.size() + s.events_dropped > n)
+			out << "    ... " << (s.events.size() + s.events_dropped - n) << " more" << std::endl;
+	}
+}
+
+static void write_json(std::ostream &out, snap_capture_validator &validator, double elapsed, bool clean) {
+	const std::vector<validator_stream_stats> &results = validator.results();
+
+	out << "{" << std::endl;
+	out << "  \"ok\": " << (clean ? "true" : "false") << "," << std::endl;
+	out << "  \"files\": [";
+
+	for (size_t i=0;i<validator.files().size();i++)
+		out << (i ? ", " : "") << "\"" << json_escape(validator.files()[i]) << "\"";
+
+	out << "]," << std::endl;
+	out << "  \"packets\": " << validator.packets_scanned() << "," << std::endl;
+	out << "  \"non_snap_packets\": " << validator.non_snap_packets() << "," << std::endl;
+	out << "  \"bytes\": " << validator.bytes_scanned() << "," << std::endl;
+	out << "  \"seconds\": " << elapsed << "," << std::endl;
+	out << "  \"streams\": [";
+
+	for (size_t i=0;i<results.size();i++) {
+		const validator_stream_stats &s = results[i];
+
+		out << (i ? "," : "") << std::endl << "    {" << std::endl;
+		out << "      \"port\": " << s.port << "," << std::endl;
+		out << "      \"antenna\": " << s.antenna << "," << std::endl;
+		out << "      \"ok\": " << (s.clean() ? "true" : "false") << "," << std::endl;
+		out << "      \"packets\": " << s.packets << "," << std::endl;
+		out << "      \"first_sample\": " << s.first_sample << "," << std::endl;
+		out << "      \"last_sample\": " << s.last_sample << "," << std::endl;
+		out << "      \"complete_frames\": " << s.complete_frames << "," << std::endl;
+		out << "      \"partial_frames\": " << s.partial_frames << "," << std::endl;
+		out << "      \"missing_packets\": " << s.missing_packets << "," << std::endl;
+		out << "      \"missing_frames\": " << s.missing_frames << "," << std::endl;
+		out << "      \"gaps\": " << s.gaps << "," << std::endl;
+		out << "      \"duplicates\": " << s.duplicates << "," << std::endl;
+		out << "      \"reordered\": " << s.reordered << "," << std::endl;
+		out << "      \"late\": " << s.late << "," << std::endl;
+		out << "      \"out_of_range\": " << s.out_of_range << "," << std::endl;
+		out << "      \"wrong_size\": " << s.wrong_size << "," << std::endl;
+		out << "      \"firmware_versions\": [";
+
+		bool first = true;
+		for (auto v = s.firmware_versions.begin(); v != s.firmware_versions.end(); ++v) {
+			out << (first ? "" : ", ") << *v;
+			first = false;
+		}
+
+		out << "]," << std::endl;
+		out << "      \"firmware_changes\": " << s.firmware_changes << "," << std::endl;
+		out << "      \"events_dropped\": " << s.events_dropped << "," << std::endl;
+		out << "      \"events\": [";
+
+		for (size_t e=0;e<s.events.size();e++) {
+			const validator_event &ev = s.events[e];
+
+			out << (e ? "," : "") << std::endl << "        {\"type\": \"" << snap_capture_validator::event_name(ev.type) <<
+					"\", \"sample_number\": " << ev.sample_number << ", \"count\": " << ev.count;
+
+			if (ev.type == VALIDATOR_EVENT_OUT_OF_RANGE)
+				out << ", \"channel\": " << ev.from;
+			else if (ev.type == VALIDATOR_EVENT_FIRMWARE_CHANGE)
+				out << ", \"from\": " << ev.from << ", \"to\": " << ev.to;
+
+			out << "}";
+		}
+
+		out << (s.events.empty() ? "" : "\n      ") << "]" << std::endl;
+		out << "    }";
+	}
+
+	out << (results.empty() ? "" : "\n  ") << "]" << std::endl;
+	out << "}" << std::endl;
+}
+
+int
+main (int argc, char **argv)
+{
+	validator_config config;
+	config.num_threads = boost::thread::hardware_concurrency();
+
+	std::string json_file = "";
+	size_t events_to_print = 10;
+	std::vector<std::string> files;
+
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: snap-validate [options] <capture file> [<capture file>...]" << std::endl;
+			std::cout << "Checks SNAP captures for lost, duplicated and out of order packets, per port and antenna." << std::endl;
+			std::cout << "Multiple files are treated as one recording, in the order given." << std::endl;
+			std::cout << "--type=voltage|spectrometer = packet type.  Default is voltage." << std::endl <<
+						 "--ports=<port>[,<port>...] = only check these UDP ports.  Default is all." << std::endl <<
+						 "--start-channel=<n> --num-channels=<n> = the expected channel range.  Without these, a frame" << std::endl <<
+						 "    is expected to have every channel block the antenna sent at any point." << std::endl <<
+						 "--sample-step=<n> = sample_number step between frames.  Default is 16 for voltage, 1 for spectrometer." << std::endl <<
+						 "--threads=<n> = scanning threads.  Default is the number of cores." << std::endl <<
+						 "--window=<frames> = how far out of order a packet can be and still count toward its frame.  Default is 4096." << std::endl <<
+						 "--max-events=<n> = individual events to keep per stream.  Default is 100." << std::endl <<
+						 "--print-events=<n> = events to print per stream in the text report.  Default is 10." << std::endl <<
+						 "--json=<file> = also write the report as JSON.  Use - for stdout (and no text report)." << std::endl;
+			std::cout << std::endl;
+			std::cout << "Exits with " << EXIT_CLEAN << " if every stream is clean, " << EXIT_PROBLEMS << " if anything was found, and " <<
+					EXIT_READ_ERROR << " if a file couldn't be read." << std::endl;
+			std::cout << std::endl;
+			exit(EXIT_CLEAN);
+		}
+		else if (param.find("--type") != std::string::npos) {
+			boost::replace_all(param,"--type=","");
+
+			if (param == "voltage")
+				config.packet_type = SNAP_PACKETTYPE_VOLTAGE;
+			else if (param == "spectrometer")
+				config.packet_type = SNAP_PACKETTYPE_SPECT;
+			else {
+				std::cout << "ERROR: Unknown packet type: " << param << std::endl;
+				exit(EXIT_USAGE);
+			}
+		}
+		else if (param.find("--ports") != std::string::npos) {
+			boost::replace_all(param,"--ports=","");
+			std::stringstream ss(param);
+			std::string item;
+
+			while (std::getline(ss, item, ','))
+				config.ports.insert(atoi(item.c_str()));
+		}
+		else if (param.find("--start-channel") != std::string::npos) {
+			boost::replace_all(param,"--start-channel=","");
+			config.start_channel = atoi(param.c_str());
+		}
+		else if (param.find("--num-channels") != std::string::npos) {
+			boost::replace_all(param,"--num-channels=","");
+			config.num_channels = atoi(param.c_str());
+		}
+		else if (param.find("--sample-step") != std::string::npos) {
+			boost::replace_all(param,"--sample-step=","");
+			config.sample_step = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--threads") != std::string::npos) {
+			boost::replace_all(param,"--threads=","");
+			config.num_threads = atoi(param.c_str());
+		}
+		else if (param.find("--window") != std::string::npos) {
+			boost::replace_all(param,"--window=","");
+			config.window_frames = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--max-events") != std::string::npos) {
+			boost::replace_all(param,"--max-events=","");
+			config.max_events = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--print-events") != std::string::npos) {
+			boost::replace_all(param,"--print-events=","");
+			events_to_print = strtoull(param.c_str(), NULL, 10);
+		}
+		else if (param.find("--json") != std::string::npos) {
+			boost::replace_all(param,"--json=","");
+			json_file = param;
+		}
+		else if (param.find("--") == 0) {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(EXIT_USAGE);
+		}
+		else {
+			files.push_back(param);
+		}
+	}
+
+	if (files.empty()) {
+		std::cout << "ERROR: Please provide a capture file.  Run with --help for usage." << std::endl;
+		exit(EXIT_USAGE);
+	}
+
+	if ((config.start_channel >= 0) != (config.num_channels > 0)) {
+		std::cout << "ERROR: --start-channel and --num-channels go together." << std::endl;
+		exit(EXIT_USAGE);
+	}
+
+	snap_capture_validator validator(config);
+
+	for (size_t i=0;i<files.size();i++)
+		validator.add_file(files[i]);
+
+	std::chrono::time_point<std::chrono::steady_clock> start, end;
+	start = std::chrono::steady_clock::now();
+
+	if (!validator.run()) {
+		std::cout << "ERROR: " << validator.last_error() << std::endl;
+		exit(EXIT_READ_ERROR);
+	}
+
+	end = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end-start;
+
+	bool clean = true;
+
+	for (size_t i=0;i<validator.results().size();i++) {
+		if (!validator.results()[i].clean())
+			clean = false;
+	}
+
+	if (validator.results().empty())
+		clean = false;
+
+	if (json_file == "-") {
+		write_json(std::cout, validator, elapsed_seconds.count(), clean);
+	}
+	else {
+		write_text(std::cout, validator, elapsed_seconds.count(), events_to_print);
+
+		if (json_file.length() > 0) {
+			std::ofstream json_out(json_file.c_str());
+
+			if (!json_out) {
+				std::cout << "ERROR: Unable to write " << json_file << std::endl;
+				exit(EXIT_READ_ERROR);
+			}
+
+			write_json(json_out, validator, elapsed_seconds.count(), clean);
+		}
+
+		std::cout << std::endl << (clean ? "No problems found." : "Problems found.") << std::endl;
+	}
+
+	return clean ? EXIT_CLEAN : EXIT_PROBLEMS;
+}
@@ -0,0 +1,673 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_capture_validator.h"
+#include "pcap_mmap_reader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <boost/thread/thread.hpp>
+
+#define NO_FRAME UINT64_MAX
+// Channel blocks per frame we can track (a 32-bit mask).
+#define MAX_BLOCKS 32
+
+// Don't bother splitting files into chunks smaller than this.
+#define CHUNK_MIN_BYTES (64UL*1024UL*1024UL)
+// More chunks than threads so a slow chunk doesn't hold everyone up at the end.
+#define CHUNKS_PER_THREAD 4
+
+#define VOLTAGE_HEADER_SIZE 16
+#define VOLTAGE_PAYLOAD_SIZE (VOLTAGE_HEADER_SIZE + 8192)
+#define VOLTAGE_BLOCK_CHANNELS 256
+#define SPECT_HEADER_SIZE 8
+#define SPECT_BLOCK_CHANNELS 512
+
+namespace gr {
+namespace ata {
+
+static long add_event(validator_stream_stats &stats, const validator_event &ev, size_t max_events) {
+	if (stats.events.size() >= max_events) {
+		stats.events_dropped++;
+		return -1;
+	}
+
+	stats.events.push_back(ev);
+
+	return stats.events.size() - 1;
+}
+
+// Frame-accounting bookkeeping that has to carry across chunks.
+struct final_frames {
+	uint64_t first = NO_FRAME;
+	uint64_t last = NO_FRAME;
+};
+
+// Writes off count frames starting at frame.  Only a missing run can have count > 1.
+static void finalize_frames(validator_stream_stats &stats, final_frames &ff, uint64_t frame, uint64_t count,
+		uint32_t mask, uint32_t full_mask, uint64_t step, size_t max_events) {
+	if (ff.first == NO_FRAME)
+		ff.first = frame;
+
+	if ((ff.last == NO_FRAME) || (frame + count - 1 > ff.last))
+		ff.last = frame + count - 1;
+
+	if (mask == 0) {
+		stats.missing_frames += count;
+
+		if (stats.gap_open && (frame == stats.gap_next_frame)) {
+			if (stats.gap_event >= 0)
+				stats.events[stats.gap_event].count += count;
+		}
+		else {
+			stats.gaps++;
+
+			validator_event ev = {VALIDATOR_EVENT_GAP, frame * step, count, 0, 0};
+			stats.gap_event = add_event(stats, ev, max_events);
+		}
+
+		stats.gap_open = true;
+		stats.gap_next_frame = frame + count;
+
+		return;
+	}
+
+	stats.gap_open = false;
+
+	uint32_t missing = __builtin_popcount(full_mask & ~mask);
+
+	if (missing > 0) {
+		stats.partial_frames++;
+		stats.missing_packets += missing;
+
+		validator_event ev = {VALIDATOR_EVENT_PARTIAL_FRAME, frame * step, missing, 0, 0};
+		add_event(stats, ev, max_events);
+	}
+	else {
+		stats.complete_frames++;
+	}
+}
+
+/*
+ * Tracks one antenna on one port within one chunk.  Frames sit in a ring until the
+ * stream moves a full window past them, then they're written off as complete, partial or
+ * missing.  Frames near the start of the chunk go into head instead, and whatever is
+ * still in the ring at the end goes into tail, so the neighbouring chunks can fill them in.
+ */
+class stream_tracker {
+protected:
+	size_t d_window;
+	uint64_t d_step;
+	uint32_t d_block_size;
+	uint32_t d_expected_mask;
+	size_t d_max_events;
+
+	std::vector<uint64_t> d_slot_frame;
+	std::vector<uint32_t> d_slot_mask;
+
+	bool d_started = false;
+	uint64_t d_chunk_first_frame = 0;
+	uint64_t d_max_frame = 0;
+
+	uint32_t full_mask() { return d_expected_mask ? d_expected_mask : seen_blocks; };
+	bool in_head_zone(uint64_t frame) { return frame < d_chunk_first_frame + d_window; };
+
+	void evict(size_t slot) {
+		uint64_t frame = d_slot_frame[slot];
+
+		if (frame == NO_FRAME)
+			return;
+
+		if (in_head_zone(frame))
+			head[frame] = d_slot_mask[slot];
+		else
+			finalize_frames(stats, finalized, frame, 1, d_slot_mask[slot], full_mask(), d_step, d_max_events);
+
+		d_slot_frame[slot] = NO_FRAME;
+		d_slot_mask[slot] = 0;
+	};
+
+	void missing_range(uint64_t first, uint64_t count) {
+		// Anything in the head zone waits for the merge like everything else there.
+		while ((count > 0) && in_head_zone(first)) {
+			head[first] = 0;
+			first++;
+			count--;
+		}
+
+		if (count > 0)
+			finalize_frames(stats, finalized, first, count, 0, full_mask(), d_step, d_max_events);
+	};
+
+	void add_to_frame(uint64_t frame, uint32_t bit, uint32_t &mask) {
+		if (mask & bit) {
+			stats.duplicates++;
+
+			validator_event ev = {VALIDATOR_EVENT_DUPLICATE, frame * d_step, 1, 0, 0};
+			add_event(stats, ev, d_max_events);
+		}
+
+		mask |= bit;
+	};
+
+public:
+	validator_stream_stats stats;
+	final_frames finalized;
+	uint32_t seen_blocks = 0;
+
+	int first_fw = -1;
+	uint64_t first_fw_sample = 0;
+	int last_fw = -1;
+
+	std::map<uint64_t, uint32_t> head;
+	std::map<uint64_t, uint32_t> tail;
+
+	stream_tracker(const validator_config &config, uint64_t step, uint32_t block_size, uint32_t expected_mask) {
+		d_window = config.window_frames;
+		d_step = step;
+		d_block_size = block_size;
+		d_expected_mask = expected_mask;
+		d_max_events = config.max_events;
+
+		d_slot_frame.assign(d_window, NO_FRAME);
+		d_slot_mask.assign(d_window, 0);
+	};
+
+	void add(const snap_header &hdr, bool wrong_size) {
+		stats.packets++;
+
+		if (wrong_size)
+			stats.wrong_size++;
+
+		if (hdr.sample_number < stats.first_sample)
+			stats.first_sample = hdr.sample_number;
+
+		if (hdr.sample_number > stats.last_sample)
+			stats.last_sample = hdr.sample_number;
+
+		int fw = hdr.firmware_version;
+		stats.firmware_versions.insert(fw);
+
+		if (last_fw < 0) {
+			first_fw = fw;
+			first_fw_sample = hdr.sample_number;
+		}
+		else if (fw != last_fw) {
+			stats.firmware_changes++;
+
+			validator_event ev = {VALIDATOR_EVENT_FIRMWARE_CHANGE, hdr.sample_number, 1, last_fw, fw};
+			add_event(stats, ev, d_max_events);
+		}
+
+		last_fw = fw;
+
+		uint32_t block = hdr.channel_id / d_block_size;
+		uint32_t bit = (block < MAX_BLOCKS) ? (1U << block) : 0;
+
+		if ((hdr.channel_id % d_block_size) || (bit == 0) || (d_expected_mask && !(d_expected_mask & bit))) {
+			stats.out_of_range++;
+
+			validator_event ev = {VALIDATOR_EVENT_OUT_OF_RANGE, hdr.sample_number, 1, hdr.channel_id, 0};
+			add_event(stats, ev, d_max_events);
+			return;
+		}
+
+		seen_blocks |= bit;
+
+		uint64_t frame = hdr.sample_number / d_step;
+
+		if (!d_started) {
+			d_started = true;
+			d_chunk_first_frame = frame;
+			d_max_frame = frame;
+
+			size_t slot = frame % d_window;
+			d_slot_frame[slot] = frame;
+			d_slot_mask[slot] = bit;
+			return;
+		}
+
+		if (frame > d_max_frame) {
+			uint64_t first_new = d_max_frame + 1;
+
+			if (frame - d_max_frame >= d_window) {
+				// Jumped a whole window.  Everything in the ring is done (oldest first).
+				uint64_t oldest = (d_max_frame + 1 > d_window) ? (d_max_frame + 1 - d_window) : 0;
+
+				for (uint64_t f=oldest;f<=d_max_frame;f++)
+					evict(f % d_window);
+
+				uint64_t window_start = frame - d_window + 1;
+
+				if (window_start > first_new) {
+					// These never even got a slot.
+					missing_range(first_new, window_start - first_new);
+					first_new = window_start;
+				}
+			}
+
+			for (uint64_t f=first_new;f<=frame;f++) {
+				size_t slot = f % d_window;
+				evict(slot);
+				d_slot_frame[slot] = f;
+				d_slot_mask[slot] = 0;
+			}
+
+			d_max_frame = frame;
+			d_slot_mask[frame % d_window] = bit;
+
+			return;
+		}
+
+		if (frame < d_max_frame)
+			stats.reordered++;
+
+		if (frame + d_window > d_max_frame) {
+			// Still in the window.
+			size_t slot = frame % d_window;
+
+			if (d_slot_frame[slot] != frame) {
+				// Only happens for frames from before this chunk's first packet.
+				evict(slot);
+				d_slot_frame[slot] = frame;
+			}
+
+			add_to_frame(frame, bit, d_slot_mask[slot]);
+			return;
+		}
+
+		auto it = head.find(frame);
+
+		if (it != head.end()) {
+			add_to_frame(frame, bit, it->second);
+		}
+		else if (frame < d_chunk_first_frame) {
+			head[frame] = bit;
+		}
+		else {
+			// Its frame has already been written off.
+			stats.late++;
+		}
+	};
+
+	void finish() {
+		for (size_t s=0;s<d_window;s++) {
+			if (d_slot_frame[s] != NO_FRAME)
+				tail[d_slot_frame[s]] = d_slot_mask[s];
+		}
+	};
+};
+
+snap_capture_validator::snap_capture_validator(const validator_config &config) {
+	d_config = config;
+
+	if (d_config.num_threads < 1)
+		d_config.num_threads = 1;
+
+	if (d_config.window_frames < 16)
+		d_config.window_frames = 16;
+
+	if (d_config.sample_step == 0)
+		d_config.sample_step = (d_config.packet_type == SNAP_PACKETTYPE_VOLTAGE) ? 16 : 1;
+}
+
+snap_capture_validator::~snap_capture_validator() {
+}
+
+const char *snap_capture_validator::event_name(int event_type) {
+	switch (event_type) {
+	case VALIDATOR_EVENT_GAP:
+		return "gap";
+	case VALIDATOR_EVENT_PARTIAL_FRAME:
+		return "partial_frame";
+	case VALIDATOR_EVENT_DUPLICATE:
+		return "duplicate";
+	case VALIDATOR_EVENT_OUT_OF_RANGE:
+		return "out_of_range_channel";
+	case VALIDATOR_EVENT_FIRMWARE_CHANGE:
+		return "firmware_change";
+	}
+
+	return "unknown";
+}
+
+bool snap_capture_validator::plan_chunks() {
+	d_chunks.clear();
+	d_bytes = 0;
+
+	for (size_t i=0;i<d_files.size();i++) {
+		pcap_mmap_reader reader;
+
+		if (!reader.open(d_files[i])) {
+			d_last_error = reader.last_error();
+			return false;
+		}
+
+		size_t file_size = reader.file_size();
+		d_bytes += file_size;
+
+		size_t num_chunks = d_config.num_threads * CHUNKS_PER_THREAD;
+
+		if (num_chunks > file_size / CHUNK_MIN_BYTES)
+			num_chunks = file_size / CHUNK_MIN_BYTES;
+
+		if (num_chunks < 1)
+			num_chunks = 1;
+
+		std::vector<size_t> bounds;
+		bounds.push_back(reader.find_record_boundary(0));
+
+		for (size_t c=1;c<num_chunks;c++) {
+			size_t boundary = reader.find_record_boundary(file_size / num_chunks * c);
+
+			if (boundary > bounds.back())
+				bounds.push_back(boundary);
+		}
+
+		bounds.push_back(file_size);
+
+		for (size_t c=0;c+1<bounds.size();c++) {
+			chunk new_chunk;
+			new_chunk.file_index = i;
+			new_chunk.begin = bounds[c];
+			new_chunk.end = bounds[c+1];
+			d_chunks.push_back(new_chunk);
+		}
+	}
+
+	return true;
+}
+
+void snap_capture_validator::scan_chunk(chunk &c) {
+	pcap_mmap_reader reader;
+
+	if (!reader.open(d_files[c.file_index])) {
+		c.error = reader.last_error();
+		return;
+	}
+
+	if ((c.begin >= c.end) || !reader.seek(c.begin))
+		return;
+
+	bool voltage = (d_config.packet_type == SNAP_PACKETTYPE_VOLTAGE);
+	size_t header_size = voltage ? VOLTAGE_HEADER_SIZE : SPECT_HEADER_SIZE;
+	uint32_t block_size = voltage ? VOLTAGE_BLOCK_CHANNELS : SPECT_BLOCK_CHANNELS;
+
+	uint32_t expected_mask = 0;
+
+	if ((d_config.start_channel >= 0) && (d_config.num_channels > 0)) {
+		uint32_t first_block = d_config.start_channel / block_size;
+		uint32_t last_block = (d_config.start_channel + d_config.num_channels - 1) / block_size;
+
+		for (uint32_t b=first_block;(b<=last_block) && (b<MAX_BLOCKS);b++)
+			expected_mask |= (1U << b);
+	}
+
+	pcap_record rec;
+	uint16_t port;
+	const unsigned char *payload;
+	size_t payload_len;
+	snap_header hdr;
+
+	while ((reader.position() < c.end) && reader.next(rec)) {
+		if (rec.caplen != rec.len)
+			continue;
+
+		if (!pcap_mmap_reader::udp_payload(rec.data, rec.caplen, port, payload, payload_len))
+			continue;
+
+		if (!d_config.ports.empty() && (d_config.ports.find(port) == d_config.ports.end()))
+			continue;
+
+		if (payload_len < header_size) {
+			c.non_snap++;
+			continue;
+		}
+
+		c.packets++;
+
+		if (voltage)
+			parse_voltage_header(hdr, payload);
+		else
+			parse_spect_header(hdr, payload);
+
+		uint32_t key = ((uint32_t)port << 16) | hdr.antenna_id;
+
+		std::shared_ptr<stream_tracker> &tracker = c.trackers[key];
+
+		if (!tracker) {
+			tracker = std::make_shared<stream_tracker>(d_config, d_config.sample_step, block_size, expected_mask);
+			tracker->stats.port = port;
+			tracker->stats.antenna = hdr.antenna_id;
+		}
+
+		tracker->add(hdr, voltage && (payload_len != VOLTAGE_PAYLOAD_SIZE));
+	}
+
+	for (auto it = c.trackers.begin(); it != c.trackers.end(); ++it)
+		it->second->finish();
+}
+
+void snap_capture_validator::merge() {
+	struct stream_total {
+		validator_stream_stats stats;
+		final_frames finalized;
+		uint32_t full_mask = 0;
+		int last_fw = -1;
+		std::map<uint64_t, uint32_t> carry;
+	};
+
+	std::map<uint32_t, stream_total> totals;
+
+	uint64_t step = d_config.sample_step;
+	size_t max_events = d_config.max_events;
+
+	// Without a configured channel range, a frame is complete when it has every block the
+	// stream ever sent.
+	for (size_t c=0;c<d_chunks.size();c++) {
+		for (auto it = d_chunks[c].trackers.begin(); it != d_chunks[c].trackers.end(); ++it)
+			totals[it->first].full_mask |= it->second->seen_blocks;
+	}
+
+	// Writes off frames that were held back for the merge, filling in anything between them
+	// that nobody saw.
+	auto finalize_held = [&](stream_total &total, const std::map<uint64_t, uint32_t> &frames) {
+		for (auto f = frames.begin(); f != frames.end(); ++f) {
+			if ((total.finalized.last != NO_FRAME) && (f->first > total.finalized.last + 1))
+				finalize_frames(total.stats, total.finalized, total.finalized.last + 1, f->first - total.finalized.last - 1, 0, total.full_mask, step, max_events);
+
+			finalize_frames(total.stats, total.finalized, f->first, 1, f->second, total.full_mask, step, max_events);
+		}
+	};
+
+	for (size_t c=0;c<d_chunks.size();c++) {
+		for (auto it = d_chunks[c].trackers.begin(); it != d_chunks[c].trackers.end(); ++it) {
+			stream_tracker &t = *it->second;
+			stream_total &total = totals[it->first];
+			validator_stream_stats &s = total.stats;
+
+			s.port = t.stats.port;
+			s.antenna = t.stats.antenna;
+
+			// Firmware version across the chunk boundary.
+			if ((total.last_fw >= 0) && (t.first_fw >= 0) && (t.first_fw != total.last_fw)) {
+				s.firmware_changes++;
+
+				validator_event ev = {VALIDATOR_EVENT_FIRMWARE_CHANGE, t.first_fw_sample, 1, total.last_fw, t.first_fw};
+				add_event(s, ev, max_events);
+			}
+
+			if (t.last_fw >= 0)
+				total.last_fw = t.last_fw;
+
+			// Join the end of the last chunk with the start of this one.
+			for (auto h = t.head.begin(); h != t.head.end(); ++h) {
+				auto existing = total.carry.find(h->first);
+
+				if (existing != total.carry.end()) {
+					uint32_t overlap = existing->second & h->second;
+
+					if (overlap) {
+						s.duplicates += __builtin_popcount(overlap);
+
+						validator_event ev = {VALIDATOR_EVENT_DUPLICATE, h->first * step, (uint64_t)__builtin_popcount(overlap), 0, 0};
+						add_event(s, ev, max_events);
+					}
+
+					existing->second |= h->second;
+				}
+				else {
+					total.carry[h->first] = h->second;
+				}
+			}
+
+			finalize_held(total, total.carry);
+			total.carry = t.tail;
+
+			// Then everything this chunk settled on its own.
+			const validator_stream_stats &ts = t.stats;
+
+			if (t.finalized.first != NO_FRAME) {
+				if ((total.finalized.last != NO_FRAME) && (t.finalized.first > total.finalized.last + 1))
+					finalize_frames(s, total.finalized, total.finalized.last + 1, t.finalized.first - total.finalized.last - 1, 0, total.full_mask, step, max_events);
+			}
+
+			s.packets += ts.packets;
+			s.wrong_size += ts.wrong_size;
+			s.complete_frames += ts.complete_frames;
+			s.partial_frames += ts.partial_frames;
+			s.missing_packets += ts.missing_packets;
+			s.missing_frames += ts.missing_frames;
+			s.gaps += ts.gaps;
+			s.duplicates += ts.duplicates;
+			s.reordered += ts.reordered;
+			s.late += ts.late;
+			s.out_of_range += ts.out_of_range;
+			s.firmware_changes += ts.firmware_changes;
+			s.events_dropped += ts.events_dropped;
+			s.firmware_versions.insert(ts.firmware_versions.begin(), ts.firmware_versions.end());
+
+			if (ts.first_sample < s.first_sample)
+				s.first_sample = ts.first_sample;
+
+			if (ts.last_sample > s.last_sample)
+				s.last_sample = ts.last_sample;
+
+			size_t first_event = 0;
+
+			if (!ts.events.empty() && (ts.events[0].type == VALIDATOR_EVENT_GAP) && s.gap_open &&
+					(ts.events[0].sample_number == s.gap_next_frame * step)) {
+				// One outage that happened to straddle the chunk boundary.
+				if (s.gap_event >= 0)
+					s.events[s.gap_event].count += ts.events[0].count;
+
+				s.gaps--;
+				first_event = 1;
+			}
+
+			// Where the chunk's open gap (if it ends on one) lands in the merged events.
+			long open_gap_event = ((first_event == 1) && (ts.gap_event == 0)) ? s.gap_event : -1;
+
+			for (size_t e=first_event;e<ts.events.size();e++) {
+				long index = add_event(s, ts.events[e], max_events);
+
+				if ((long)e == ts.gap_event)
+					open_gap_event = index;
+			}
+
+			if (t.finalized.first != NO_FRAME) {
+				s.gap_open = ts.gap_open;
+				s.gap_next_frame = ts.gap_next_frame;
+				s.gap_event = ts.gap_open ? open_gap_event : -1;
+
+				if ((total.finalized.last == NO_FRAME) || (t.finalized.last > total.finalized.last))
+					total.finalized.last = t.finalized.last;
+
+				if (total.finalized.first == NO_FRAME)
+					total.finalized.first = t.finalized.first;
+			}
+		}
+	}
+
+	d_results.clear();
+
+	for (auto it = totals.begin(); it != totals.end(); ++it) {
+		finalize_held(it->second, it->second.carry);
+
+		// Frames are settled a window late, so put the events back in stream order.
+		std::vector<validator_event> &events = it->second.stats.events;
+		std::stable_sort(events.begin(), events.end(), [](const validator_event &a, const validator_event &b) {
+			return a.sample_number < b.sample_number;
+		});
+		it->second.stats.gap_event = -1;
+
+		d_results.push_back(it->second.stats);
+	}
+}
+
+bool snap_capture_validator::run() {
+	d_results.clear();
+	d_packets = 0;
+	d_non_snap = 0;
+
+	if (!plan_chunks())
+		return false;
+
+	std::atomic<size_t> next_chunk(0);
+
+	auto worker = [&]() {
+		size_t c;
+
+		while ((c = next_chunk++) < d_chunks.size())
+			scan_chunk(d_chunks[c]);
+	};
+
+	boost::thread_group threads;
+
+	for (int i=0;i<d_config.num_threads;i++)
+		threads.create_thread(worker);
+
+	threads.join_all();
+
+	for (size_t c=0;c<d_chunks.size();c++) {
+		if (d_chunks[c].error.length() > 0) {
+			d_last_error = d_chunks[c].error;
+			return false;
+		}
+
+		d_packets += d_chunks[c].packets;
+		d_non_snap += d_chunks[c].non_snap;
+	}
+
+	merge();
+
+	// The trackers aren't needed once everything is merged.
+	d_num_chunks = d_chunks.size();
+	d_chunks.clear();
+
+	return true;
+}
+
+} /* namespace ata */
+} /* namespace gr */
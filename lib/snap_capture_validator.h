@@ -0,0 +1,174 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_CAPTURE_VALIDATOR_H
+#define INCLUDED_ATA_SNAP_CAPTURE_VALIDATOR_H
+
+#include <ata/snap_headers.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#define VALIDATOR_EVENT_GAP 0
+#define VALIDATOR_EVENT_PARTIAL_FRAME 1
+#define VALIDATOR_EVENT_DUPLICATE 2
+#define VALIDATOR_EVENT_OUT_OF_RANGE 3
+#define VALIDATOR_EVENT_FIRMWARE_CHANGE 4
+
+namespace gr {
+namespace ata {
+
+struct validator_event {
+	int type;
+	uint64_t sample_number;
+	// GAP: frames missing.  PARTIAL_FRAME: packets missing.  DUPLICATE: copies.
+	uint64_t count;
+	// OUT_OF_RANGE: channel_id in from.  FIRMWARE_CHANGE: old and new version.
+	int from;
+	int to;
+};
+
+// Everything we found for one antenna on one port.
+struct validator_stream_stats {
+	uint16_t port = 0;
+	uint16_t antenna = 0;
+
+	uint64_t packets = 0;
+	uint64_t wrong_size = 0;
+	uint64_t first_sample = UINT64_MAX;
+	uint64_t last_sample = 0;
+
+	// A frame is one sample_number's worth of channel blocks.
+	uint64_t complete_frames = 0;
+	uint64_t partial_frames = 0;
+	uint64_t missing_packets = 0;
+	uint64_t missing_frames = 0;
+	uint64_t gaps = 0;
+	uint64_t duplicates = 0;
+	uint64_t reordered = 0;
+	// Arrived so far out of order that its frame had already been written off as missing.
+	uint64_t late = 0;
+	uint64_t out_of_range = 0;
+
+	std::set<int> firmware_versions;
+	uint64_t firmware_changes = 0;
+
+	std::vector<validator_event> events;
+	uint64_t events_dropped = 0;
+
+	// Bookkeeping so a run of missing frames is one gap.
+	bool gap_open = false;
+	uint64_t gap_next_frame = 0;
+	long gap_event = -1;
+
+	bool clean() const {
+		return (missing_frames == 0) && (missing_packets == 0) && (duplicates == 0) && (reordered == 0) &&
+				(out_of_range == 0) && (firmware_changes == 0) && (wrong_size == 0);
+	};
+};
+
+struct validator_config {
+	int packet_type = SNAP_PACKETTYPE_VOLTAGE;
+
+	// If set, channel blocks outside [start_channel, start_channel + num_channels) are out
+	// of range.  Otherwise the expected blocks are whatever shows up.
+	int start_channel = -1;
+	int num_channels = -1;
+
+	// sample_number step between frames.  0 uses 16 for voltage (16 time samples per
+	// packet) and 1 for spectrometer.
+	uint64_t sample_step = 0;
+
+	// Only look at these ports (empty = all).
+	std::set<uint16_t> ports;
+
+	int num_threads = 1;
+
+	// How far out of order (in frames) a packet can arrive and still be put back in its frame.
+	size_t window_frames = 4096;
+
+	// Stop recording individual events after this many per stream.  The counts are still kept.
+	size_t max_events = 100;
+};
+
+class stream_tracker;
+
+/*
+ * Scans SNAP captures for loss and reordering.  Each file is split into chunks on record
+ * boundaries and the chunks are scanned in parallel.  Each chunk keeps its first and last
+ * window of frames unresolved so they can be joined up with its neighbours afterwards.
+ * Files are treated as one continuous recording, in the order they're added.
+ */
+class snap_capture_validator {
+protected:
+	struct chunk {
+		size_t file_index;
+		size_t begin;
+		size_t end;
+		std::map<uint32_t, std::shared_ptr<stream_tracker>> trackers;
+		uint64_t packets = 0;
+		uint64_t non_snap = 0;
+		std::string error;
+	};
+
+	validator_config d_config;
+	std::vector<std::string> d_files;
+	std::vector<chunk> d_chunks;
+
+	std::vector<validator_stream_stats> d_results;
+	uint64_t d_packets = 0;
+	uint64_t d_non_snap = 0;
+	uint64_t d_bytes = 0;
+	size_t d_num_chunks = 0;
+	std::string d_last_error;
+
+	bool plan_chunks();
+	void scan_chunk(chunk &c);
+	void merge();
+
+public:
+	snap_capture_validator(const validator_config &config);
+	virtual ~snap_capture_validator();
+
+	void add_file(const std::string &filename) { d_files.push_back(filename); };
+
+	// Returns false if a file couldn't be read.
+	bool run();
+
+	const std::vector<validator_stream_stats> & results() { return d_results; };
+	const std::vector<std::string> & files() { return d_files; };
+	uint64_t packets_scanned() { return d_packets; };
+	// UDP packets on the selected ports that were too short to be SNAP packets.
+	uint64_t non_snap_packets() { return d_non_snap; };
+	uint64_t bytes_scanned() { return d_bytes; };
+	size_t num_chunks() { return d_num_chunks; };
+	const std::string & last_error() { return d_last_error; };
+
+	static const char *event_name(int event_type);
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_CAPTURE_VALIDATOR_H */
@@ -0,0 +1,503 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_chunk_decoder.h"
+#include "snap_unpack.h"
+
+#include <boost/bind/bind.hpp>
+#include <string.h>
+
+// Output bytes per polarization per slice.
+#define DECODER_SLICE_BYTES (4 * 1024 * 1024)
+// How long read() waits for the next slice when asked to block.
+#define DECODER_READ_WAIT_MS 50
+
+namespace gr {
+namespace ata {
+
+snap_chunk_decoder::snap_chunk_decoder(int starting_channel, int ending_channel, bool packed_output, int num_threads,
+		bool repeat, uint64_t start_sample, uint64_t end_sample, uint64_t max_fill_frames) {
+	d_starting_channel = starting_channel;
+	d_ending_packet_channel = ending_channel - (VOLTAGE_CHANNELS_PER_PACKET - 1);
+	d_packets_per_frame = (ending_channel - starting_channel + 1) / VOLTAGE_CHANNELS_PER_PACKET;
+	d_veclen = (ending_channel - starting_channel + 1) * 2;
+	d_packed_output = packed_output;
+	d_num_threads = (num_threads > 0) ? num_threads : 1;
+	d_repeat = repeat;
+	d_start_sample = start_sample;
+	d_end_sample = end_sample;
+	d_max_fill_frames = max_fill_frames;
+
+	for (int i=0;i<8;i++) {
+		d_lut[i] = i;
+	}
+
+	d_lut[8] = 0; // 1000 is a special case: -0 (as opposed to 0000 = +0)
+	for (int i=9;i<16;i++) {
+		d_lut[i] = i - 16;
+	}
+
+	d_frames_per_slice = DECODER_SLICE_BYTES / (VOLTAGE_SAMPLES_PER_FRAME * d_veclen);
+
+	if (d_frames_per_slice < 1)
+		d_frames_per_slice = 1;
+
+	// Enough for every worker to be a slice or two ahead of the one being read.
+	d_max_buffered_slices = d_num_threads * 2 + 2;
+
+	d_opened = false;
+	d_opened = false;
+	d_stop = false;
+	d_cursor_region = 0;
+	d_cursor_slice = 0;
+	d_slices_this_pass = 0;
+	d_handout_done = false;
+	d_next_seq = 0;
+	d_emit_seq = 0;
+	d_current_pos = 0;
+	d_have_first_header = false;
+	memset(&d_first_header, 0x00, sizeof(d_first_header));
+
+	d_packets = 0;
+	d_duplicates = 0;
+	d_out_of_range = 0;
+	d_misaligned = 0;
+}
+
+snap_chunk_decoder::~snap_chunk_decoder() {
+	stop();
+}
+
+bool snap_chunk_decoder::layout_regions(const std::vector<index_point> &points, size_t points_per_region) {
+	d_regions.clear();
+
+	if (d_packets_per_frame < 1) {
+		d_last_error = "The channel range must cover at least one 256 channel block.";
+		return false;
+	}
+
+	size_t num_points = points.size();
+
+	// Start from the index point at or before the start sample.
+	size_t first = 0;
+
+	if (d_start_sample > 0) {
+		while ((first + 1 < num_points) && (points[first + 1].sample_number <= d_start_sample))
+			first++;
+	}
+
+	for (size_t i=first;i<num_points;i+=points_per_region) {
+		size_t j = i + points_per_region;
+
+		region r;
+		r.sample_begin = points[i].sample_number;
+
+		if ((i == first) && (d_start_sample > r.sample_begin)) {
+			// Stay on the stream's frame boundaries.
+			r.sample_begin += ((d_start_sample - r.sample_begin + VOLTAGE_SAMPLES_PER_FRAME - 1) / VOLTAGE_SAMPLES_PER_FRAME) *
+					VOLTAGE_SAMPLES_PER_FRAME;
+		}
+
+		r.open_end = (j >= num_points);
+		r.sample_end = r.open_end ? UINT64_MAX : points[j].sample_number;
+
+		if ((d_end_sample > 0) && (d_end_sample <= r.sample_end)) {
+			r.sample_end = d_end_sample;
+			r.open_end = true;
+		}
+
+		if (r.sample_begin >= r.sample_end)
+			break;
+
+		// Packets can show up a little out of order, so read from the index point before
+		// this region to the one after it.  Index points are far enough apart that this
+		// is a lot more reordering than a SNAP ever produces.
+		r.position_begin = points[(i > 0) ? i - 1 : 0].position;
+		r.position_end = (j + 1 < num_points) ? points[j + 1].position : UINT64_MAX;
+
+		d_regions.push_back(r);
+
+		if (r.open_end)
+			break;
+	}
+
+	if (d_regions.empty()) {
+		d_last_error = "No packets in the requested sample window.";
+		return false;
+	}
+
+	return true;
+}
+
+bool snap_chunk_decoder::start() {
+	if (!d_opened) {
+		d_last_error = "The source is not open.";
+		return false;
+	}
+
+	stop();
+
+	d_stop = false;
+	d_cursor_region = 0;
+	d_cursor_slice = 0;
+	d_slices_this_pass = 0;
+	d_handout_done = false;
+	d_next_seq = 0;
+	d_emit_seq = 0;
+	d_current.reset();
+	d_current_pos = 0;
+
+	for (int i=0;i<d_num_threads;i++) {
+		d_threads.create_thread(boost::bind(&snap_chunk_decoder::run_worker, this, i));
+	}
+
+	return true;
+}
+
+void snap_chunk_decoder::stop() {
+	{
+		boost::unique_lock<boost::mutex> lock(d_mutex);
+		d_stop = true;
+		d_work_cond.notify_all();
+		d_ready_cond.notify_all();
+	}
+
+	d_threads.join_all();
+
+	d_ready.clear();
+	d_current.reset();
+
+	for (size_t i=0;i<d_regions.size();i++) {
+		d_regions[i].scanned = false;
+		d_regions[i].scanning = false;
+		d_regions[i].slices_out = 0;
+		std::vector<const unsigned char *>().swap(d_regions[i].frames);
+		d_regions[i].storage.clear();
+	}
+}
+
+void snap_chunk_decoder::release_region(size_t region_index) {
+	// Caller holds d_mutex.
+	region &r = d_regions[region_index];
+
+	if (!r.scanned || (r.slices_out > 0) || (region_index == d_cursor_region))
+		return;
+
+	r.scanned = false;
+	std::vector<const unsigned char *>().swap(r.frames);
+	r.storage.clear();
+}
+
+void snap_chunk_decoder::run_worker(int worker_id) {
+	// Reused from region to region.
+	std::vector<const unsigned char *> packets;
+
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+
+	while (!d_stop && !d_handout_done) {
+		if (d_cursor_region >= d_regions.size()) {
+			if (d_repeat && (d_slices_this_pass > 0)) {
+				d_cursor_region = 0;
+				d_cursor_slice = 0;
+				d_slices_this_pass = 0;
+			}
+			else {
+				d_handout_done = true;
+				d_work_cond.notify_all();
+				d_ready_cond.notify_all();
+				break;
+			}
+		}
+
+		size_t region_index = d_cursor_region;
+		region &r = d_regions[region_index];
+
+		if (r.scanned) {
+			if (d_cursor_slice >= r.num_slices) {
+				// Everything in this region has been handed out.
+				d_cursor_region++;
+				d_cursor_slice = 0;
+				release_region(region_index);
+				continue;
+			}
+
+			if ((d_next_seq - d_emit_seq) < d_max_buffered_slices) {
+				uint64_t slice_index = d_cursor_slice++;
+				uint64_t seq = d_next_seq++;
+				r.slices_out++;
+				d_slices_this_pass++;
+
+				lock.unlock();
+				std::shared_ptr<slice> s(new slice());
+				decode_slice(r, slice_index, *s);
+				lock.lock();
+
+				r.slices_out--;
+				d_ready[seq] = s;
+				release_region(region_index);
+				d_ready_cond.notify_all();
+				continue;
+			}
+		}
+		else if (!r.scanning) {
+			r.scanning = true;
+
+			lock.unlock();
+			scan_region(worker_id, r, packets);
+			lock.lock();
+
+			r.scanning = false;
+			r.scanned = true;
+			d_work_cond.notify_all();
+			continue;
+		}
+
+		// Nothing to decode right now.  Get a region ahead of the cursor ready instead.
+		bool scanned_ahead = false;
+
+		for (size_t i=region_index + 1;(i < d_regions.size()) && (i <= region_index + d_num_threads);i++) {
+			region &ahead = d_regions[i];
+
+			if (!ahead.scanned && !ahead.scanning) {
+				ahead.scanning = true;
+
+				lock.unlock();
+				scan_region(worker_id, ahead, packets);
+				lock.lock();
+
+				ahead.scanning = false;
+				ahead.scanned = true;
+				d_work_cond.notify_all();
+				scanned_ahead = true;
+				break;
+			}
+		}
+
+		if (!scanned_ahead)
+			d_work_cond.wait(lock);
+	}
+}
+
+void snap_chunk_decoder::scan_region(int worker_id, region &r, std::vector<const unsigned char *> &packets) {
+	uint64_t num_packets = 0;
+	uint64_t duplicates = 0;
+	uint64_t out_of_range = 0;
+	uint64_t misaligned = 0;
+
+	r.frames.clear();
+	r.storage.clear();
+
+	if (!r.open_end) {
+		uint64_t frames = (r.sample_end - r.sample_begin + VOLTAGE_SAMPLES_PER_FRAME - 1) / VOLTAGE_SAMPLES_PER_FRAME;
+		r.frames.assign(frames * d_packets_per_frame, NULL);
+	}
+
+	bool have_packets = false;
+	uint64_t last_frame = 0;
+
+	packets.clear();
+	collect_packets(worker_id, r, packets);
+
+	for (size_t i=0;i<packets.size();i++) {
+		const unsigned char *payload = packets[i];
+
+		snap_header hdr;
+		parse_voltage_header(hdr, payload);
+
+		if ((hdr.sample_number < r.sample_begin) || (hdr.sample_number >= r.sample_end))
+			continue;
+
+		uint64_t sample_offset = hdr.sample_number - r.sample_begin;
+
+		if ((sample_offset % VOLTAGE_SAMPLES_PER_FRAME) != 0) {
+			misaligned++;
+			continue;
+		}
+
+		if ((hdr.channel_id < d_starting_channel) || (hdr.channel_id > d_ending_packet_channel) ||
+				(((hdr.channel_id - d_starting_channel) % VOLTAGE_CHANNELS_PER_PACKET) != 0)) {
+			out_of_range++;
+			continue;
+		}
+
+		uint64_t frame = sample_offset / VOLTAGE_SAMPLES_PER_FRAME;
+		size_t slot = frame * d_packets_per_frame + (hdr.channel_id - d_starting_channel) / VOLTAGE_CHANNELS_PER_PACKET;
+
+		if (slot >= r.frames.size())
+			r.frames.resize((frame + 1) * d_packets_per_frame, NULL);
+
+		if (r.frames[slot]) {
+			duplicates++;
+			continue;
+		}
+
+		r.frames[slot] = payload;
+		num_packets++;
+
+		if (!have_packets || (frame > last_frame))
+			last_frame = frame;
+
+		have_packets = true;
+	}
+
+	if (!have_packets) {
+		r.num_frames = 0;
+	}
+	else if (r.open_end) {
+		// Don't pad out past the last packet at the end of the capture or window.
+		r.num_frames = last_frame + 1;
+	}
+	else {
+		r.num_frames = r.frames.size() / d_packets_per_frame;
+
+		// A trailing gap longer than the live path would fill just gets dropped.
+		if (r.num_frames - 1 - last_frame > d_max_fill_frames)
+			r.num_frames = last_frame + 1;
+	}
+
+	r.frames.resize(r.num_frames * d_packets_per_frame);
+	r.num_slices = (r.num_frames + d_frames_per_slice - 1) / d_frames_per_slice;
+
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+	d_packets += num_packets;
+	d_duplicates += duplicates;
+	d_out_of_range += out_of_range;
+	d_misaligned += misaligned;
+}
+
+void snap_chunk_decoder::decode_slice(region &r, uint64_t slice_index, slice &out) {
+	uint64_t first_frame = slice_index * d_frames_per_slice;
+	uint64_t num_frames = d_frames_per_slice;
+
+	if (first_frame + num_frames > r.num_frames)
+		num_frames = r.num_frames - first_frame;
+
+	size_t frame_bytes = (size_t)VOLTAGE_SAMPLES_PER_FRAME * d_veclen;
+
+	out.first_sample = r.sample_begin + first_frame * VOLTAGE_SAMPLES_PER_FRAME;
+	out.num_vectors = num_frames * VOLTAGE_SAMPLES_PER_FRAME;
+	out.missing_packets = 0;
+	out.has_header = false;
+
+	// Zeroed, so missing packets come out as zeros.
+	out.x.assign(num_frames * frame_bytes, 0);
+
+	if (!d_packed_output)
+		out.y.assign(num_frames * frame_bytes, 0);
+
+	for (uint64_t f=0;f<num_frames;f++) {
+		const unsigned char **packets = &r.frames[(first_frame + f) * d_packets_per_frame];
+		char *x_rows = &out.x[f * frame_bytes];
+		char *y_rows = d_packed_output ? NULL : &out.y[f * frame_bytes];
+
+		for (int p=0;p<d_packets_per_frame;p++) {
+			if (!packets[p]) {
+				out.missing_packets++;
+				continue;
+			}
+
+			if (!out.has_header) {
+				parse_voltage_header(out.header, packets[p]);
+				out.has_header = true;
+			}
+
+			const unsigned char (*data)[16][2] = (const unsigned char (*)[16][2])(packets[p] + VOLTAGE_HEADER_SIZE);
+			unpack_voltage_packet(data, x_rows, y_rows, d_veclen, p * VOLTAGE_CHANNELS_PER_PACKET * 2, d_packed_output, d_lut);
+		}
+	}
+}
+
+int snap_chunk_decoder::read(char *x_out, char *y_out, int max_vectors, uint64_t &sample_number, int &first_row,
+		int &missing_packets, bool block) {
+	missing_packets = 0;
+
+	if (!d_current) {
+		boost::unique_lock<boost::mutex> lock(d_mutex);
+
+		auto next = d_ready.find(d_emit_seq);
+
+		if ((next == d_ready.end()) && block && !d_stop && !(d_handout_done && (d_emit_seq == d_next_seq))) {
+			d_ready_cond.timed_wait(lock, boost::posix_time::milliseconds(DECODER_READ_WAIT_MS));
+			next = d_ready.find(d_emit_seq);
+		}
+
+		if (next == d_ready.end())
+			return 0;
+
+		d_current = next->second;
+		d_ready.erase(next);
+		d_current_pos = 0;
+
+		missing_packets = d_current->missing_packets;
+
+		if (!d_have_first_header && d_current->has_header) {
+			d_first_header = d_current->header;
+			d_have_first_header = true;
+		}
+	}
+
+	int num_vectors = d_current->num_vectors - d_current_pos;
+
+	if (num_vectors > max_vectors)
+		num_vectors = max_vectors;
+
+	size_t offset = (size_t)d_current_pos * d_veclen;
+	memcpy(x_out, &d_current->x[offset], (size_t)num_vectors * d_veclen);
+
+	if (!d_packed_output && y_out)
+		memcpy(y_out, &d_current->y[offset], (size_t)num_vectors * d_veclen);
+
+	sample_number = d_current->first_sample + (d_current_pos / VOLTAGE_SAMPLES_PER_FRAME) * VOLTAGE_SAMPLES_PER_FRAME;
+	first_row = d_current_pos % VOLTAGE_SAMPLES_PER_FRAME;
+
+	d_current_pos += num_vectors;
+
+	if (d_current_pos >= d_current->num_vectors) {
+		boost::unique_lock<boost::mutex> lock(d_mutex);
+		d_current.reset();
+		d_emit_seq++;
+		// Frees up room for another slice.
+		d_work_cond.notify_all();
+	}
+
+	return num_vectors;
+}
+
+bool snap_chunk_decoder::finished() {
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+	return d_handout_done && (d_emit_seq == d_next_seq) && !d_current;
+}
+
+bool snap_chunk_decoder::first_header(snap_header &hdr) {
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+
+	if (!d_have_first_header)
+		return false;
+
+	hdr = d_first_header;
+	return true;
+}
+
+} /* namespace ata */
+} /* namespace gr */
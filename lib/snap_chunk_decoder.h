@@ -0,0 +1,203 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_CHUNK_DECODER_H
+#define INCLUDED_ATA_SNAP_CHUNK_DECODER_H
+
+#include <ata/snap_headers.h>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace gr {
+namespace ata {
+
+/*
+ * Decodes a stream of voltage packets into output vectors on a pool of threads, for
+ * offline runs where the single reader thread and serial unpack of the SNAP source
+ * can't keep the rest of the flowgraph busy.  Subclasses supply the packets: see
+ * pcap_chunk_decoder and snap_record_chunk_decoder.
+ *
+ * The source's index splits the stream into regions of a few index points each.  A
+ * worker collects a region's packets from just before its first index point to just
+ * past its last (so packets that arrived a little out of order still land in the right
+ * region) and builds a table of packet pointers by frame.  The region is then unpacked
+ * in slices of a few MB, each by whichever worker is free, and the slices are handed
+ * out in order.  Only a couple of slices per thread are ever buffered, so memory stays
+ * flat no matter how long the capture is.
+ *
+ * Frames with missing packets have those channels zeroed, and gaps of up to
+ * max_fill_frames whole frames are filled with zeros, the same as the live path.
+ */
+class snap_chunk_decoder {
+protected:
+	struct region {
+		uint64_t sample_begin;
+		uint64_t sample_end;
+		// Read range in the source's own terms (file offset, chunk number, ...).  Wider
+		// than the region itself to catch stragglers.
+		uint64_t position_begin;
+		uint64_t position_end;
+		// Frame count isn't known ahead of time (end of the capture or the window).
+		bool open_end;
+
+		bool scanned = false;
+		bool scanning = false;
+		uint64_t num_frames = 0;
+		uint64_t num_slices = 0;
+		// packets_per_frame pointers per frame, NULL where a packet is missing.
+		std::vector<const unsigned char *> frames;
+		// Anything the subclass had to decompress or copy for the frame table to point into.
+		std::vector<std::shared_ptr<std::vector<unsigned char>>> storage;
+		// Slices handed out and not finished yet.
+		int slices_out = 0;
+	};
+
+	struct index_point {
+		uint64_t sample_number;
+		uint64_t position;
+	};
+
+	struct slice {
+		std::vector<char> x;
+		std::vector<char> y;
+		uint64_t first_sample;
+		int num_vectors;
+		int missing_packets;
+		bool has_header;
+		snap_header header;
+	};
+
+	int d_starting_channel;
+	int d_ending_packet_channel;
+	int d_packets_per_frame;
+	int d_veclen;
+	bool d_packed_output;
+	int d_num_threads;
+	bool d_repeat;
+	uint64_t d_start_sample;
+	uint64_t d_end_sample;
+	uint64_t d_max_fill_frames;
+
+	char d_lut[16];
+
+	uint64_t d_frames_per_slice;
+	size_t d_max_buffered_slices;
+
+	std::string d_last_error;
+
+	// Set by the subclass once its source is open and the regions are laid out.
+	bool d_opened;
+	std::vector<region> d_regions;
+
+	boost::mutex d_mutex;
+	boost::condition_variable d_work_cond;
+	boost::condition_variable d_ready_cond;
+	boost::thread_group d_threads;
+	bool d_stop;
+
+	// Next slice to hand out.
+	size_t d_cursor_region;
+	uint64_t d_cursor_slice;
+	uint64_t d_slices_this_pass;
+	bool d_handout_done;
+
+	// Slices are numbered in output order.
+	uint64_t d_next_seq;
+	uint64_t d_emit_seq;
+	std::map<uint64_t, std::shared_ptr<slice>> d_ready;
+	std::shared_ptr<slice> d_current;
+	int d_current_pos;
+
+	bool d_have_first_header;
+	snap_header d_first_header;
+
+	// Counters.
+	uint64_t d_packets;
+	uint64_t d_duplicates;
+	uint64_t d_out_of_range;
+	uint64_t d_misaligned;
+
+	// Lays out regions of points_per_region index points from the one at or before the
+	// start sample.  Points must be in increasing sample order.  Returns false (see
+	// last_error()) if nothing falls in the sample window.
+	bool layout_regions(const std::vector<index_point> &points, size_t points_per_region);
+
+	// Appends the voltage payloads (VOLTAGE_PACKET_SIZE bytes each) in the region's read
+	// range to packets, in any order.  Called from the worker threads, each with its own
+	// worker_id.  Packets outside the region's samples may be included or left out.
+	virtual void collect_packets(int worker_id, region &r, std::vector<const unsigned char *> &packets) = 0;
+
+	void run_worker(int worker_id);
+	void scan_region(int worker_id, region &r, std::vector<const unsigned char *> &packets);
+	void decode_slice(region &r, uint64_t slice_index, slice &out);
+	void release_region(size_t region_index);
+
+public:
+	snap_chunk_decoder(int starting_channel, int ending_channel, bool packed_output, int num_threads, bool repeat,
+			uint64_t start_sample=0, uint64_t end_sample=0, uint64_t max_fill_frames=20000);
+	virtual ~snap_chunk_decoder();
+
+	bool start();
+	void stop();
+
+	// Copies up to max_vectors output vectors, all from the same slice, and returns how
+	// many.  y_out is ignored for packed output.  The first vector copied is row first_row
+	// (0-15) of the frame at sample_number, and missing_packets counts the packets missing
+	// from the slice the first time it's read from.  If block is set, waits a little while
+	// for the next slice rather than returning 0 straight away.
+	int read(char *x_out, char *y_out, int max_vectors, uint64_t &sample_number, int &first_row,
+			int &missing_packets, bool block);
+
+	// True once everything has been read.  Never true when repeating.
+	bool finished();
+
+	// Header of the first packet handed out.
+	bool first_header(snap_header &hdr);
+
+	size_t num_regions() { return d_regions.size(); };
+	uint64_t packets_decoded() { return d_packets; };
+	uint64_t duplicates() { return d_duplicates; };
+	uint64_t out_of_range() { return d_out_of_range; };
+	uint64_t misaligned() { return d_misaligned; };
+	const std::string & last_error() { return d_last_error; };
+};
+
+// v2.0 voltage packets: 16 byte header and 256 channels x 16 times x 2 pols of 4-bit IQ.
+#define VOLTAGE_HEADER_SIZE 16
+#define VOLTAGE_PACKET_SIZE (VOLTAGE_HEADER_SIZE + 8192)
+#define VOLTAGE_CHANNELS_PER_PACKET 256
+// sample_number steps by the 16 time samples in each packet.
+#define VOLTAGE_SAMPLES_PER_FRAME 16
+
+// Index points per region.  Regions are read a little past both ends, so fewer
+// points means more re-reading and more points means more memory per region.
+#define DECODER_INDEX_POINTS_PER_REGION 4
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_CHUNK_DECODER_H */
@@ -0,0 +1,1076 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_loopback_harness.h"
+#include "snap_source_impl.h"
+#include "SNAPSynchronizerV3_impl.h"
+#include "snap_packet_generator.h"
+#include "pacing_clock.h"
+#include "snap_stats.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
+#include <boost/thread/thread.hpp>
+
+#define MAX_BATCH LOOPBACK_MAX_BATCH
+// Frames of generated content each sender cycles through, restamping headers as it goes.
+#define POOL_FRAMES 64
+// Send times are kept for this many frames per source for matching against work() output.
+#define LATENCY_RING_FRAMES (1 << 20)
+// Frames' worth of vectors asked for per work() call.
+#define WORK_FRAMES 16
+// Blocks of work() output queued between each source and the synchronizer.
+#define SYNC_RING_BLOCKS 8
+// Never fail a step on backlog for less than this many queued packets.
+#define MIN_BACKLOG_PACKETS 1024
+
+#define PHASE_WARMUP 0
+#define PHASE_MEASURE 1
+// The window's closed.  Senders keep going so no work() call is left waiting on packets.
+#define PHASE_STOP 2
+#define PHASE_DONE 3
+
+namespace gr {
+namespace ata {
+
+static int64_t process_cpu_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static std::vector<pid_t> list_threads() {
+	std::vector<pid_t> tids;
+	DIR *dir = opendir("/proc/self/task");
+
+	if (!dir)
+		return tids;
+
+	struct dirent *entry;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.')
+			tids.push_back(atoi(entry->d_name));
+	}
+
+	closedir(dir);
+	std::sort(tids.begin(), tids.end());
+
+	return tids;
+}
+
+// Threads in after that weren't in before.  Both sorted.
+static std::vector<pid_t> new_threads(const std::vector<pid_t> &before, const std::vector<pid_t> &after) {
+	std::vector<pid_t> added;
+	std::set_difference(after.begin(), after.end(), before.begin(), before.end(), std::back_inserter(added));
+
+	return added;
+}
+
+static std::map<pid_t, int64_t> all_thread_cpu_ns() {
+	std::map<pid_t, int64_t> cpu;
+	std::vector<pid_t> tids = list_threads();
+
+	for (size_t i=0;i<tids.size();i++) {
+		int64_t ns = snap_stats_thread_cpu_ns(tids[i]);
+
+		if (ns >= 0)
+			cpu[tids[i]] = ns;
+	}
+
+	return cpu;
+}
+
+// Pages placed off the node that asked for them, summed over nodes.  False on a single node.
+static bool read_off_node_pages(uint64_t &pages) {
+	pages = 0;
+	int nodes = 0;
+
+	for (int node=0;node<1024;node++) {
+		std::stringstream path;
+		path << "/sys/devices/system/node/node" << node << "/numastat";
+
+		std::ifstream numastat(path.str());
+
+		if (!numastat)
+			break;
+
+		nodes++;
+
+		std::string name;
+		uint64_t value;
+
+		while (numastat >> name >> value) {
+			if (name == "other_node")
+				pages += value;
+		}
+	}
+
+	return nodes > 1;
+}
+
+static uint64_t read_counter(int fd) {
+	uint64_t count = 0;
+
+	if ((fd < 0) || (read(fd, &count, sizeof(count)) != sizeof(count)))
+		return 0;
+
+	return count;
+}
+
+// v must already be sorted.
+template <typename T>
+static double percentile(const std::vector<T> &v, double p) {
+	if (v.size() == 0)
+		return 0.0;
+
+	size_t index = (size_t)(p / 100.0 * (v.size() - 1) + 0.5);
+
+	return (double)v[index];
+}
+
+/*
+ * When each frame went out, indexed by frame.  One sender writes, one work() thread
+ * reads.  Each slot is a tiny seqlock: the sample_number is invalidated while the time is
+ * rewritten, so a reader never pairs a time with the wrong frame.
+ */
+class loopback_latency_ring {
+protected:
+	struct slot {
+		std::atomic<uint64_t> sample_number;
+		std::atomic<int64_t> time_ns;
+	};
+
+	std::unique_ptr<slot[]> d_slots;
+	uint64_t d_first_sample;
+	uint64_t d_sample_step;
+
+	slot & slot_for(uint64_t sample_number) {
+		return d_slots[((sample_number - d_first_sample) / d_sample_step) & (LATENCY_RING_FRAMES - 1)];
+	};
+
+public:
+	loopback_latency_ring(uint64_t first_sample, uint64_t sample_step) : d_slots(new slot[LATENCY_RING_FRAMES]) {
+		d_first_sample = first_sample;
+		d_sample_step = sample_step;
+
+		for (size_t i=0;i<LATENCY_RING_FRAMES;i++) {
+			d_slots[i].sample_number.store(UINT64_MAX, std::memory_order_relaxed);
+			d_slots[i].time_ns.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	void stamp(uint64_t sample_number, int64_t time_ns) {
+		slot &s = slot_for(sample_number);
+
+		s.sample_number.store(UINT64_MAX, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		s.time_ns.store(time_ns, std::memory_order_relaxed);
+		s.sample_number.store(sample_number, std::memory_order_release);
+	};
+
+	bool lookup(uint64_t sample_number, int64_t &time_ns) {
+		if (sample_number < d_first_sample)
+			return false;
+
+		slot &s = slot_for(sample_number);
+
+		if (s.sample_number.load(std::memory_order_acquire) != sample_number)
+			return false;
+
+		time_ns = s.time_ns.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		return s.sample_number.load(std::memory_order_relaxed) == sample_number;
+	};
+};
+
+// Whole blocks of one source's x output on their way to the synchronizer.  One producer, one consumer.
+class loopback_block_ring {
+protected:
+	std::vector<std::vector<char>> d_blocks;
+	std::atomic<uint64_t> d_produced;
+	std::atomic<uint64_t> d_consumed;
+
+public:
+	loopback_block_ring(size_t block_bytes) : d_blocks(SYNC_RING_BLOCKS, std::vector<char>(block_bytes, 0)),
+		d_produced(0), d_consumed(0) {
+	};
+
+	bool full() {
+		return d_produced.load(std::memory_order_relaxed) - d_consumed.load(std::memory_order_acquire) >= d_blocks.size();
+	};
+
+	char *write_block() { return &d_blocks[d_produced.load(std::memory_order_relaxed) % d_blocks.size()][0]; };
+	void publish() { d_produced.fetch_add(1, std::memory_order_release); };
+
+	bool readable() {
+		return d_produced.load(std::memory_order_acquire) > d_consumed.load(std::memory_order_relaxed);
+	};
+
+	const char *read_block() { return &d_blocks[d_consumed.load(std::memory_order_relaxed) % d_blocks.size()][0]; };
+	void release() { d_consumed.fetch_add(1, std::memory_order_release); };
+};
+
+class loopback_sender {
+protected:
+	snap_loopback_harness &d_harness;
+	int d_index;
+	int d_socket;
+	snap_packet_generator d_generator;
+	std::vector<unsigned char> d_pool;
+	size_t d_pool_packets;
+	uint64_t d_first_sample;
+	loopback_latency_ring &d_ring;
+
+	struct mmsghdr d_msgs[MAX_BATCH];
+	struct iovec d_iovecs[MAX_BATCH];
+
+public:
+	// Counted over the measurement window.
+	uint64_t packets_sent;
+	uint64_t send_errors;
+
+	std::string last_error;
+
+	loopback_sender(snap_loopback_harness &harness, int source_index, uint64_t first_sample, loopback_latency_ring &ring) :
+		d_harness(harness), d_index(source_index),
+		d_generator(harness.config().packet_type, harness.config().starting_channel,
+				harness.config().starting_channel + harness.config().num_channels - 1, source_index, source_index + 1),
+		d_first_sample(first_sample), d_ring(ring) {
+		d_socket = -1;
+		packets_sent = 0;
+		send_errors = 0;
+
+		int packets_per_frame = d_generator.packets_per_frame();
+		int pool_frames = POOL_FRAMES;
+
+		if (pool_frames * packets_per_frame < MAX_BATCH)
+			pool_frames = (MAX_BATCH + packets_per_frame - 1) / packets_per_frame;
+
+		d_pool_packets = pool_frames * packets_per_frame;
+		d_pool.resize(d_pool_packets * d_generator.packet_size());
+		d_generator.fill(&d_pool[0], d_pool_packets);
+
+		memset(d_msgs, 0, sizeof(d_msgs));
+
+		for (int i=0;i<MAX_BATCH;i++) {
+			d_iovecs[i].iov_len = d_generator.packet_size();
+			d_msgs[i].msg_hdr.msg_iov = &d_iovecs[i];
+			d_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	};
+
+	virtual ~loopback_sender() {
+		if (d_socket >= 0)
+			close(d_socket);
+	};
+
+	bool open(int port) {
+		const snap_loopback_config &config = d_harness.config();
+
+		d_socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+		if (d_socket < 0) {
+			last_error = std::string("Unable to create socket: ") + strerror(errno);
+			return false;
+		}
+
+		int send_buffer = 16 * 1024 * 1024;
+		setsockopt(d_socket, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+
+		struct sockaddr_in dest;
+		memset(&dest, 0, sizeof(dest));
+		dest.sin_family = AF_INET;
+		dest.sin_port = htons(port);
+
+		if (config.mcast_group.length() > 0) {
+			if (inet_pton(AF_INET, config.mcast_group.c_str(), &dest.sin_addr) != 1) {
+				last_error = "Bad multicast group " + config.mcast_group;
+				return false;
+			}
+
+			// Have the group's traffic come back to this host.
+			unsigned char loop = 1;
+			setsockopt(d_socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+			if (config.mcast_if.length() > 0) {
+				struct in_addr if_addr;
+
+				if (inet_pton(AF_INET, config.mcast_if.c_str(), &if_addr) != 1) {
+					last_error = "Bad multicast interface address " + config.mcast_if;
+					return false;
+				}
+
+				setsockopt(d_socket, IPPROTO_IP, IP_MULTICAST_IF, &if_addr, sizeof(if_addr));
+			}
+		}
+		else {
+			dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		}
+
+		if (connect(d_socket, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+			last_error = std::string("Unable to connect socket: ") + strerror(errno);
+			return false;
+		}
+
+		return true;
+	};
+
+	void run(double packets_per_sec) {
+		d_harness.register_thread(LOOPBACK_ROLE_SENDER);
+
+		if (d_harness.config().pin_threads)
+			d_harness.pin_current_thread(d_harness.sender_cpu(d_index));
+
+		pacing_clock clock;
+		double ns_per_packet = 1e9 / packets_per_sec;
+
+		// Keep a batch to about 100 us of packets so slow rates still go out smoothly.
+		int batch = std::min(d_harness.config().send_batch, (int)(packets_per_sec / 10000.0));
+		if (batch < 1)
+			batch = 1;
+		else if (batch > MAX_BATCH)
+			batch = MAX_BATCH;
+
+		size_t packet_size = d_generator.packet_size();
+		int packets_per_frame = d_generator.packets_per_frame();
+		uint64_t sample_step = d_generator.sample_step();
+
+		uint64_t packet_index = 0;
+		bool measuring = false;
+		uint64_t sent_total = 0;
+		uint64_t errors_total = 0;
+		uint64_t sent_start = 0;
+		uint64_t errors_start = 0;
+
+		while (!d_harness.stop_flag()) {
+			int phase = d_harness.phase();
+
+			if ((phase == PHASE_MEASURE) && !measuring) {
+				measuring = true;
+				sent_start = sent_total;
+				errors_start = errors_total;
+			}
+			else if ((phase >= PHASE_STOP) && measuring) {
+				measuring = false;
+				packets_sent = sent_total - sent_start;
+				send_errors = errors_total - errors_start;
+			}
+
+			if (phase == PHASE_DONE)
+				break;
+
+			for (int b=0;b<batch;b++) {
+				uint64_t p = packet_index + b;
+				unsigned char *packet = &d_pool[(p % d_pool_packets) * packet_size];
+
+				d_generator.restamp(packet, d_first_sample + (p / packets_per_frame) * sample_step);
+				d_iovecs[b].iov_base = packet;
+			}
+
+			if (!clock.wait_until_due((uint64_t)(packet_index * ns_per_packet), d_harness.stop_flag()))
+				break;
+
+			// Stamped before the send, since on loopback the receiver can have a frame out of
+			// work() before sendmmsg returns.
+			int64_t now = pacing_clock::now_ns();
+
+			for (int b=0;b<batch;b++) {
+				uint64_t p = packet_index + b;
+
+				if (((p + 1) % packets_per_frame) == 0)
+					d_ring.stamp(d_first_sample + (p / packets_per_frame) * sample_step, now);
+			}
+
+			int sent = 0;
+
+			while (sent < batch) {
+				int retval = sendmmsg(d_socket, &d_msgs[sent], batch - sent, 0);
+
+				if (retval < 0) {
+					if (errno == EINTR)
+						continue;
+
+					// Whatever's left of the batch is lost.
+					errors_total += batch - sent;
+					break;
+				}
+
+				sent += retval;
+			}
+
+			sent_total += sent;
+			packet_index += batch;
+		}
+	};
+};
+
+class loopback_receiver {
+protected:
+	snap_loopback_harness &d_harness;
+	int d_index;
+	int d_noutput_items;
+	size_t d_vector_bytes;
+	std::vector<std::vector<unsigned char>> d_buffers;
+	gr_vector_const_void_star d_inputs;
+	gr_vector_void_star d_outputs;
+	loopback_latency_ring &d_ring;
+	size_t d_backlog_limit;
+
+	// If feeding the synchronizer, x output goes straight into the current block.
+	loopback_block_ring *d_sync_ring;
+	int d_block_filled;
+
+public:
+	std::unique_ptr<snap_source_impl> source;
+
+	// Filled in over the measurement window.
+	std::vector<uint32_t> queue_depths;
+	std::vector<int64_t> latencies_ns;
+	uint64_t missed_packets;
+	size_t final_queue_depth;
+
+	std::atomic<bool> backlog_exceeded;
+
+	loopback_receiver(snap_loopback_harness &harness, int source_index, snap_source_impl *snap_source,
+			loopback_latency_ring &ring, size_t backlog_limit, loopback_block_ring *sync_ring) :
+		d_harness(harness), d_index(source_index), d_ring(ring), d_backlog_limit(backlog_limit),
+		d_sync_ring(sync_ring), d_block_filled(0), source(snap_source), backlog_exceeded(false) {
+		missed_packets = 0;
+		final_queue_depth = 0;
+
+		d_noutput_items = items_per_block(harness.config());
+		d_vector_bytes = vector_bytes(harness.config());
+
+		// Voltage uses 1 or 2 outputs and spectrometer 4.  Giving everything 4 keeps it simple.
+		d_buffers.resize(4);
+
+		for (int i=0;i<4;i++) {
+			d_buffers[i].resize(d_noutput_items * d_vector_bytes);
+			d_outputs.push_back((void *)&d_buffers[i][0]);
+		}
+	};
+
+	static int items_per_block(const snap_loopback_config &config) {
+		return (config.packet_type == SNAP_PACKETTYPE_SPECT) ? WORK_FRAMES : WORK_FRAMES * 16;
+	};
+
+	static size_t vector_bytes(const snap_loopback_config &config) {
+		return (config.packet_type == SNAP_PACKETTYPE_SPECT) ? 4096 * sizeof(float) : config.num_channels * 2;
+	};
+
+	void run() {
+		d_harness.register_thread(LOOPBACK_ROLE_WORK);
+
+		if (d_harness.config().pin_threads)
+			d_harness.pin_current_thread(d_harness.work_cpu(d_index));
+
+		bool measuring = false;
+		uint64_t missed_start = 0;
+
+		while (!d_harness.stop_flag()) {
+			int phase = d_harness.phase();
+
+			if (phase >= PHASE_STOP)
+				break;
+
+			if ((phase == PHASE_MEASURE) && !measuring) {
+				measuring = true;
+				missed_start = source->missed_packets();
+			}
+
+			int noutput_items = d_noutput_items;
+
+			if (d_sync_ring) {
+				if (d_sync_ring->full()) {
+					// The synchronizer's behind.  Hold off, the same as the scheduler would.
+					usleep(20);
+					continue;
+				}
+
+				d_outputs[0] = (void *)(d_sync_ring->write_block() + d_block_filled * d_vector_bytes);
+				noutput_items = d_noutput_items - d_block_filled;
+			}
+
+			size_t queue_depth = source->packets_available();
+
+			if (queue_depth > d_backlog_limit)
+				backlog_exceeded = true;
+
+			int items_returned = source->work_test(noutput_items, d_inputs, d_outputs);
+
+			if (d_sync_ring && (items_returned > 0)) {
+				d_block_filled += items_returned;
+
+				if (d_block_filled >= d_noutput_items) {
+					d_sync_ring->publish();
+					d_block_filled = 0;
+				}
+			}
+
+			if (measuring) {
+				queue_depths.push_back(queue_depth);
+
+				int64_t sent_ns;
+
+				if ((items_returned > 0) && d_ring.lookup(source->last_sample_out(), sent_ns))
+					latencies_ns.push_back(pacing_clock::now_ns() - sent_ns);
+			}
+		}
+
+		if (measuring) {
+			missed_packets = source->missed_packets() - missed_start;
+			final_queue_depth = source->packets_available();
+		}
+	};
+};
+
+class loopback_sync {
+protected:
+	snap_loopback_harness &d_harness;
+	int d_cpu;
+	std::vector<loopback_block_ring *> d_rings;
+	int d_items;
+	std::vector<std::vector<char>> d_outputs;
+
+public:
+	std::unique_ptr<SNAPSynchronizerV3_impl> sync;
+	// Per input, over the measurement window.
+	uint64_t items_synced;
+
+	loopback_sync(snap_loopback_harness &harness, int cpu, std::vector<loopback_block_ring *> rings) :
+		d_harness(harness), d_cpu(cpu), d_rings(rings) {
+		items_synced = 0;
+		d_items = loopback_receiver::items_per_block(harness.config());
+
+		size_t block_bytes = d_items * loopback_receiver::vector_bytes(harness.config());
+		d_outputs.resize(d_rings.size(), std::vector<char>(block_bytes, 0));
+
+		sync.reset(new SNAPSynchronizerV3_impl(d_rings.size(), harness.config().num_channels, false, 0,
+				harness.config().sync_threads));
+		// Only publishes its stats segment, so snap-top can watch a run.
+		sync->start();
+	};
+
+	void run() {
+		d_harness.register_thread(LOOPBACK_ROLE_SYNC);
+
+		if (d_harness.config().pin_threads)
+			d_harness.pin_current_thread(d_cpu);
+
+		gr_vector_const_void_star inputs(d_rings.size());
+		gr_vector_void_star outputs(d_rings.size());
+
+		for (size_t i=0;i<d_rings.size();i++)
+			outputs[i] = (void *)&d_outputs[i][0];
+
+		bool measuring = false;
+		bool workers_started = false;
+		uint64_t synced_total = 0;
+		uint64_t synced_start = 0;
+
+		while (!d_harness.stop_flag() && (d_harness.phase() < PHASE_STOP)) {
+			if ((d_harness.phase() == PHASE_MEASURE) && !measuring) {
+				measuring = true;
+				synced_start = synced_total;
+			}
+
+			bool ready = true;
+
+			for (size_t i=0;ready && (i<d_rings.size());i++)
+				ready = d_rings[i]->readable();
+
+			if (!ready) {
+				usleep(20);
+				continue;
+			}
+
+			for (size_t i=0;i<d_rings.size();i++)
+				inputs[i] = (const void *)d_rings[i]->read_block();
+
+			// The copy workers start on the first call.
+			std::vector<pid_t> before;
+
+			if (!workers_started)
+				before = list_threads();
+
+			sync->work_test_copy(d_items, inputs, outputs);
+
+			if (!workers_started) {
+				std::vector<pid_t> workers = new_threads(before, list_threads());
+
+				for (size_t i=0;i<workers.size();i++)
+					d_harness.register_thread(LOOPBACK_ROLE_SYNC_WORKER, workers[i]);
+
+				workers_started = true;
+			}
+
+			for (size_t i=0;i<d_rings.size();i++)
+				d_rings[i]->release();
+
+			synced_total += d_items;
+		}
+
+		if (measuring)
+			items_synced = synced_total - synced_start;
+	};
+};
+
+snap_loopback_harness::snap_loopback_harness(const snap_loopback_config &config, const volatile bool &stop) :
+		d_config(config), d_stop(stop), d_phase(PHASE_WARMUP) {
+	d_node_loads_fd = -1;
+	d_node_misses_fd = -1;
+
+	if (d_config.packet_type == SNAP_PACKETTYPE_SPECT) {
+		// Spectrometer packets always cover every channel, and the synchronizer only takes voltage.
+		d_config.starting_channel = 0;
+		d_config.num_channels = 4096;
+		d_config.sync_threads = 0;
+	}
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		for (int cpu=0;cpu<CPU_SETSIZE;cpu++) {
+			if (CPU_ISSET(cpu, &allowed))
+				d_cpus.push_back(cpu);
+		}
+	}
+
+	if (d_cpus.empty())
+		d_cpus.push_back(0);
+
+#ifdef HAVE_NUMA
+	if (numa_available() >= 0) {
+		std::stable_sort(d_cpus.begin(), d_cpus.end(), [](int a, int b) {
+			return numa_node_of_cpu(a) < numa_node_of_cpu(b);
+		});
+	}
+#endif
+
+	// Before any threads start, so every thread run() creates is counted.
+	open_node_counters();
+}
+
+snap_loopback_harness::~snap_loopback_harness() {
+	if (d_node_loads_fd >= 0)
+		close(d_node_loads_fd);
+
+	if (d_node_misses_fd >= 0)
+		close(d_node_misses_fd);
+}
+
+void snap_loopback_harness::open_node_counters() {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+	// Child threads' counts are added in as they exit.
+	attr.inherit = 1;
+	// User space only, so it works at the default perf_event_paranoid level.
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	d_node_loads_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+
+	attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	d_node_misses_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+
+	if ((d_node_loads_fd < 0) || (d_node_misses_fd < 0)) {
+		if (d_node_loads_fd >= 0)
+			close(d_node_loads_fd);
+
+		if (d_node_misses_fd >= 0)
+			close(d_node_misses_fd);
+
+		d_node_loads_fd = -1;
+		d_node_misses_fd = -1;
+	}
+}
+
+void snap_loopback_harness::register_thread(int role, pid_t tid) {
+	boost::mutex::scoped_lock lock(d_roles_mutex);
+	d_thread_roles[tid ? tid : snap_stats_thread_id()] = role;
+}
+
+void snap_loopback_harness::pin_current_thread(int cpu) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+// Each source's receive and work() threads share a pair of neighbouring CPUs, filling
+// one node before moving to the next.  Senders fill in from the other end.
+int snap_loopback_harness::receive_cpu(int source_index) {
+	return d_cpus[(2 * source_index) % d_cpus.size()];
+}
+
+int snap_loopback_harness::work_cpu(int source_index) {
+	return d_cpus[(2 * source_index + 1) % d_cpus.size()];
+}
+
+int snap_loopback_harness::sender_cpu(int source_index) {
+	return d_cpus[d_cpus.size() - 1 - (source_index % d_cpus.size())];
+}
+
+int snap_loopback_harness::sync_cpu(int num_sources) {
+	return d_cpus[(2 * num_sources) % d_cpus.size()];
+}
+
+const char *snap_loopback_harness::limit_name(int limit) {
+	switch (limit) {
+	case LOOPBACK_LIMIT_LOSS:
+		return "loss";
+	case LOOPBACK_LIMIT_BACKLOG:
+		return "backlog";
+	case LOOPBACK_LIMIT_SENDER:
+		return "sender";
+	default:
+		return "none";
+	}
+}
+
+const char *snap_loopback_harness::role_name(int role) {
+	switch (role) {
+	case LOOPBACK_ROLE_SENDER:
+		return "sender";
+	case LOOPBACK_ROLE_RECEIVE:
+		return "receive";
+	case LOOPBACK_ROLE_WORK:
+		return "work";
+	case LOOPBACK_ROLE_SYNC:
+		return "sync";
+	case LOOPBACK_ROLE_SYNC_WORKER:
+		return "sync worker";
+	default:
+		return "other";
+	}
+}
+
+// Sleeps for seconds, or until a source's queue backs up too far or we're interrupted.
+static bool wait_step(double seconds, std::vector<std::unique_ptr<loopback_receiver>> &receivers, const volatile bool &stop) {
+	int64_t end_ns = pacing_clock::now_ns() + (int64_t)(seconds * 1e9);
+
+	while (!stop && (pacing_clock::now_ns() < end_ns)) {
+		for (size_t i=0;i<receivers.size();i++) {
+			if (receivers[i]->backlog_exceeded)
+				return false;
+		}
+
+		usleep(10000);
+	}
+
+	return true;
+}
+
+snap_loopback_result snap_loopback_harness::run(int num_sources, double packets_per_sec) {
+	snap_loopback_result result;
+	result.num_sources = num_sources;
+	result.packets_per_sec = packets_per_sec;
+
+	int ending_channel = d_config.starting_channel + d_config.num_channels - 1;
+	int data_size = sizeof(char);
+	int data_source = d_config.mcast_group.length() > 0 ? 2 : 1;
+	size_t packet_size = SNAP_GENERATOR_VOLTAGE_PACKET_SIZE;
+	uint64_t sample_step = 16;
+
+	if (d_config.packet_type == SNAP_PACKETTYPE_SPECT) {
+		data_size = sizeof(float);
+		packet_size = SNAP_GENERATOR_SPECT_PACKET_SIZE;
+		sample_step = 1;
+	}
+
+	// Start well clear of zero, which the source treats as "no frame yet".
+	uint64_t first_sample = 1024 * sample_step;
+
+	size_t backlog_limit = (size_t)(packets_per_sec * d_config.max_backlog_ms / 1000.0);
+	if (backlog_limit < MIN_BACKLOG_PACKETS)
+		backlog_limit = MIN_BACKLOG_PACKETS;
+
+	std::vector<std::unique_ptr<loopback_latency_ring>> rings;
+	std::vector<std::unique_ptr<loopback_block_ring>> sync_rings;
+	std::vector<std::unique_ptr<loopback_receiver>> receivers;
+	std::vector<std::unique_ptr<loopback_sender>> senders;
+	std::unique_ptr<loopback_sync> synchronizer;
+
+	d_phase = PHASE_WARMUP;
+
+	{
+		boost::mutex::scoped_lock lock(d_roles_mutex);
+		d_thread_roles.clear();
+	}
+
+	uint64_t node_loads_start = read_counter(d_node_loads_fd);
+	uint64_t node_misses_start = read_counter(d_node_misses_fd);
+	uint64_t off_node_start;
+	result.have_numastat = read_off_node_pages(off_node_start);
+	int64_t step_start = pacing_clock::now_ns();
+
+	cpu_set_t main_cpus;
+	pthread_getaffinity_np(pthread_self(), sizeof(main_cpus), &main_cpus);
+
+	for (int i=0;i<num_sources;i++) {
+		rings.push_back(std::unique_ptr<loopback_latency_ring>(new loopback_latency_ring(first_sample, sample_step)));
+
+		if (d_config.sync_threads > 0) {
+			sync_rings.push_back(std::unique_ptr<loopback_block_ring>(new loopback_block_ring(
+					loopback_receiver::items_per_block(d_config) * loopback_receiver::vector_bytes(d_config))));
+		}
+
+		// The source's receive thread takes this thread's affinity, and its buffers are
+		// first touched here, so both end up on the receive CPU's node.
+		if (d_config.pin_threads)
+			pin_current_thread(receive_cpu(i));
+
+		snap_source_impl *source;
+
+		try {
+			source = new snap_source_impl(d_config.base_port + i, d_config.packet_type, false, false, false,
+					d_config.starting_channel, ending_channel, data_size, data_source, "", false,
+					d_config.packed_output, d_config.mcast_group);
+		}
+		catch (const std::exception &ex) {
+			pthread_setaffinity_np(pthread_self(), sizeof(main_cpus), &main_cpus);
+			result.error = std::string("Unable to create source: ") + ex.what();
+			return result;
+		}
+
+		receivers.push_back(std::unique_ptr<loopback_receiver>(new loopback_receiver(*this, i, source, *rings[i],
+				backlog_limit, (d_config.sync_threads > 0) ? sync_rings[i].get() : NULL)));
+
+		std::vector<pid_t> before = list_threads();
+
+		try {
+			source->start();
+		}
+		catch (const std::exception &ex) {
+			pthread_setaffinity_np(pthread_self(), sizeof(main_cpus), &main_cpus);
+			result.error = std::string("Unable to start source: ") + ex.what();
+			return result;
+		}
+
+		std::vector<pid_t> started = new_threads(before, list_threads());
+
+		for (size_t t=0;t<started.size();t++)
+			register_thread(LOOPBACK_ROLE_RECEIVE, started[t]);
+
+		if (d_config.pin_threads)
+			pthread_setaffinity_np(pthread_self(), sizeof(main_cpus), &main_cpus);
+
+		senders.push_back(std::unique_ptr<loopback_sender>(new loopback_sender(*this, i, first_sample, *rings[i])));
+
+		if (!senders[i]->open(d_config.base_port + i)) {
+			result.error = senders[i]->last_error;
+			return result;
+		}
+	}
+
+	if (d_config.sync_threads > 0) {
+		std::vector<loopback_block_ring *> ring_pointers;
+
+		for (int i=0;i<num_sources;i++)
+			ring_pointers.push_back(sync_rings[i].get());
+
+		synchronizer.reset(new loopback_sync(*this, sync_cpu(num_sources), ring_pointers));
+	}
+
+	boost::thread_group receive_threads;
+	boost::thread_group send_threads;
+
+	for (int i=0;i<num_sources;i++)
+		receive_threads.create_thread(boost::bind(&loopback_receiver::run, receivers[i].get()));
+
+	if (synchronizer)
+		receive_threads.create_thread(boost::bind(&loopback_sync::run, synchronizer.get()));
+
+	for (int i=0;i<num_sources;i++)
+		send_threads.create_thread(boost::bind(&loopback_sender::run, senders[i].get(), packets_per_sec));
+
+	bool completed = wait_step(d_config.warmup_seconds, receivers, d_stop);
+
+	for (int i=0;completed && (i<num_sources);i++) {
+		if (!receivers[i]->source->packets_aligned()) {
+			std::stringstream msg;
+			msg << "No packets reached the source on port " << (d_config.base_port + i) << " during warm up";
+
+			if (d_config.mcast_group.length() > 0)
+				msg << ".  Check there's a route for " << d_config.mcast_group << " (for example: ip route add 224.0.0.0/4 dev lo)";
+
+			result.error = msg.str();
+			completed = false;
+		}
+	}
+
+	int64_t wall_start = pacing_clock::now_ns();
+	int64_t cpu_start = process_cpu_ns();
+	std::map<pid_t, int64_t> threads_start = all_thread_cpu_ns();
+
+	if (completed) {
+		d_phase = PHASE_MEASURE;
+		completed = wait_step(d_config.step_seconds, receivers, d_stop);
+	}
+
+	// Before the threads are told to stop, so none have gone by the time they're read.
+	int64_t wall_end = pacing_clock::now_ns();
+	int64_t cpu_end = process_cpu_ns();
+	std::map<pid_t, int64_t> threads_end = all_thread_cpu_ns();
+
+	d_phase = PHASE_STOP;
+
+	// work() can't be interrupted, so the sources are only stopped once nothing's calling it.
+	receive_threads.join_all();
+
+	d_phase = PHASE_DONE;
+	send_threads.join_all();
+
+	for (int i=0;i<num_sources;i++)
+		receivers[i]->source->stop();
+
+	if (synchronizer)
+		synchronizer->sync->stop();
+
+	uint64_t node_loads_end = read_counter(d_node_loads_fd);
+	uint64_t node_misses_end = read_counter(d_node_misses_fd);
+	uint64_t off_node_end;
+	read_off_node_pages(off_node_end);
+	double step_seconds = (pacing_clock::now_ns() - step_start) / 1e9;
+
+	if (result.error.length() > 0)
+		return result;
+
+	result.seconds = (wall_end - wall_start) / 1e9;
+
+	size_t final_queue_depth = 0;
+	bool backlog = false;
+	std::vector<uint32_t> queue_depths;
+	std::vector<int64_t> latencies_ns;
+
+	for (int i=0;i<num_sources;i++) {
+		result.packets_sent += senders[i]->packets_sent;
+		result.send_errors += senders[i]->send_errors;
+
+		result.missed_packets += receivers[i]->missed_packets;
+		final_queue_depth = std::max(final_queue_depth, receivers[i]->final_queue_depth);
+
+		if (receivers[i]->backlog_exceeded || (receivers[i]->final_queue_depth > backlog_limit))
+			backlog = true;
+
+		queue_depths.insert(queue_depths.end(), receivers[i]->queue_depths.begin(), receivers[i]->queue_depths.end());
+		latencies_ns.insert(latencies_ns.end(), receivers[i]->latencies_ns.begin(), receivers[i]->latencies_ns.end());
+	}
+
+	if (result.seconds > 0.0) {
+		for (auto it=threads_end.begin();it!=threads_end.end();it++) {
+			auto start = threads_start.find(it->first);
+			int64_t used_ns = it->second - ((start != threads_start.end()) ? start->second : 0);
+			double cores = used_ns / 1e9 / result.seconds;
+
+			auto role = d_thread_roles.find(it->first);
+			snap_loopback_role_cpu &role_cpu = result.roles[(role != d_thread_roles.end()) ? role->second : LOOPBACK_ROLE_OTHER];
+
+			role_cpu.threads++;
+			role_cpu.cores += cores;
+			role_cpu.max_thread_cores = std::max(role_cpu.max_thread_cores, cores);
+		}
+
+		uint64_t received = result.packets_sent - std::min(result.missed_packets, result.packets_sent);
+
+		result.sent_packets_per_sec = result.packets_sent / result.seconds;
+		result.received_gbps = received * packet_size * 8.0 / result.seconds / 1e9;
+		result.receive_cores = std::max(0.0, (cpu_end - cpu_start) / 1e9 / result.seconds - result.roles[LOOPBACK_ROLE_SENDER].cores);
+		result.work_cores = result.roles[LOOPBACK_ROLE_WORK].cores;
+
+		if (result.received_gbps > 0.0)
+			result.cores_per_gbps = result.receive_cores / result.received_gbps;
+
+		if (received > 0)
+			result.receive_ns_per_packet = result.receive_cores * 1e9 / (received / result.seconds);
+
+		if (synchronizer)
+			result.sync_items_per_sec = synchronizer->items_synced / result.seconds;
+	}
+
+	if (step_seconds > 0.0) {
+		if (d_node_loads_fd >= 0) {
+			result.have_node_counters = true;
+			result.node_loads_per_sec = (node_loads_end - node_loads_start) / step_seconds;
+			result.remote_loads_per_sec = (node_misses_end - node_misses_start) / step_seconds;
+		}
+
+		if (result.have_numastat)
+			result.off_node_pages_per_sec = (off_node_end - off_node_start) / step_seconds;
+	}
+
+	if (result.packets_sent > 0)
+		result.loss = (double)result.missed_packets / result.packets_sent;
+
+	std::sort(queue_depths.begin(), queue_depths.end());
+	std::sort(latencies_ns.begin(), latencies_ns.end());
+
+	result.queue_p50 = percentile(queue_depths, 50.0);
+	result.queue_p99 = percentile(queue_depths, 99.0);
+	result.queue_max = std::max(percentile(queue_depths, 100.0), (double)final_queue_depth);
+	result.latency_p50_us = percentile(latencies_ns, 50.0) / 1000.0;
+	result.latency_p99_us = percentile(latencies_ns, 99.0) / 1000.0;
+	result.latency_p999_us = percentile(latencies_ns, 99.9) / 1000.0;
+	result.latency_max_us = percentile(latencies_ns, 100.0) / 1000.0;
+
+	// A backed up queue can end the step early, before the senders' numbers mean anything.
+	// Past that, a sender that can't hold the rate makes the rest of the step meaningless.
+	if (backlog)
+		result.limit = LOOPBACK_LIMIT_BACKLOG;
+	else if ((result.send_errors > 0) || (result.sent_packets_per_sec < 0.95 * packets_per_sec * num_sources))
+		result.limit = LOOPBACK_LIMIT_SENDER;
+	else if (result.loss > d_config.loss_threshold)
+		result.limit = LOOPBACK_LIMIT_LOSS;
+
+	result.passed = !d_stop && (result.limit == LOOPBACK_LIMIT_NONE);
+
+	return result;
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,192 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_LOOPBACK_HARNESS_H
+#define INCLUDED_ATA_SNAP_LOOPBACK_HARNESS_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <boost/thread/mutex.hpp>
+
+#include <ata/snap_headers.h>
+
+// Most packets a sender hands to one sendmmsg call.
+#define LOOPBACK_MAX_BATCH 256
+
+// Why a step didn't pass.
+#define LOOPBACK_LIMIT_NONE 0
+#define LOOPBACK_LIMIT_LOSS 1
+#define LOOPBACK_LIMIT_BACKLOG 2
+#define LOOPBACK_LIMIT_SENDER 3
+
+// What a thread in the process is doing, for the per-thread CPU numbers.
+#define LOOPBACK_ROLE_SENDER 0
+#define LOOPBACK_ROLE_RECEIVE 1
+#define LOOPBACK_ROLE_WORK 2
+#define LOOPBACK_ROLE_SYNC 3
+#define LOOPBACK_ROLE_SYNC_WORKER 4
+#define LOOPBACK_ROLE_OTHER 5
+#define LOOPBACK_NUM_ROLES 6
+
+namespace gr {
+namespace ata {
+
+struct snap_loopback_config {
+	int packet_type = SNAP_PACKETTYPE_VOLTAGE;
+	int starting_channel = 1792;
+	int num_channels = 1024;
+	bool packed_output = false;
+
+	int base_port = 10000;
+	// Empty for 127.0.0.1.
+	std::string mcast_group;
+	std::string mcast_if;
+	int send_batch = 32;
+
+	double warmup_seconds = 0.5;
+	double step_seconds = 2.0;
+	// Highest loss fraction that still passes.
+	double loss_threshold = 0.0;
+	// A step fails if a receive queue holds more than this much traffic.
+	double max_backlog_ms = 100.0;
+
+	// Pin each source's receive and work() threads to neighbouring CPUs on one NUMA node,
+	// and the senders to CPUs from the other end of the list.
+	bool pin_threads = false;
+	// If more than zero, the sources' x outputs feed a SNAPSynchronizerV3 with this many
+	// copy threads, the way they would in the array flowgraph.  Voltage only.
+	int sync_threads = 0;
+};
+
+struct snap_loopback_role_cpu {
+	int threads = 0;
+	double cores = 0.0;
+	double max_thread_cores = 0.0;
+};
+
+struct snap_loopback_result {
+	int num_sources = 0;
+	double packets_per_sec = 0.0;
+	bool passed = false;
+	int limit = LOOPBACK_LIMIT_NONE;
+	std::string error;
+
+	double seconds = 0.0;
+	uint64_t packets_sent = 0;
+	uint64_t missed_packets = 0;
+	uint64_t send_errors = 0;
+	double loss = 0.0;
+	double sent_packets_per_sec = 0.0;
+	double received_gbps = 0.0;
+
+	// Everything but the senders: the sources' receive threads, the work() loops, the
+	// synchronizer and whatever kernel receive work is charged to them.
+	double receive_cores = 0.0;
+	double work_cores = 0.0;
+	double cores_per_gbps = 0.0;
+	double receive_ns_per_packet = 0.0;
+	snap_loopback_role_cpu roles[LOOPBACK_NUM_ROLES];
+
+	double queue_p50 = 0.0;
+	double queue_p99 = 0.0;
+	double queue_max = 0.0;
+	double latency_p50_us = 0.0;
+	double latency_p99_us = 0.0;
+	double latency_p999_us = 0.0;
+	double latency_max_us = 0.0;
+
+	// Vectors per second through the synchronizer, per input.
+	double sync_items_per_sec = 0.0;
+
+	// Memory accesses that left the core's own node, from the node-loads and
+	// node-load-misses counters, over the whole step.  Not every CPU or kernel has them.
+	bool have_node_counters = false;
+	double node_loads_per_sec = 0.0;
+	double remote_loads_per_sec = 0.0;
+	// Pages the kernel placed on a node other than the one asking, system wide.
+	bool have_numastat = false;
+	double off_node_pages_per_sec = 0.0;
+};
+
+/*
+ * Runs SNAP sources on this host against synthetic senders over UDP and measures what
+ * they sustain.  Each source gets a sender thread that plays generated SNAP packets at it
+ * at a fixed packet rate, and a thread calling work() in a tight loop the way the
+ * scheduler would.  Optionally the sources feed a synchronizer.
+ *
+ * Every run() starts from fresh sources, and nothing is counted until a warm up period has
+ * gone by, so alignment and the first socket buffer fill don't skew the numbers.  Loss is
+ * what the sources themselves report as missed.  Latency is from the moment a sender
+ * handed a frame's last packet to the kernel to the moment work() returned that frame.
+ */
+class snap_loopback_harness {
+protected:
+	snap_loopback_config d_config;
+	const volatile bool &d_stop;
+
+	std::atomic<int> d_phase;
+
+	// CPUs we may run on, grouped by NUMA node when libnuma is available.
+	std::vector<int> d_cpus;
+
+	boost::mutex d_roles_mutex;
+	std::map<pid_t, int> d_thread_roles;
+
+	int d_node_loads_fd;
+	int d_node_misses_fd;
+
+	void open_node_counters();
+
+public:
+	snap_loopback_harness(const snap_loopback_config &config, const volatile bool &stop);
+	virtual ~snap_loopback_harness();
+
+	const snap_loopback_config & config() { return d_config; };
+	int num_cpus() { return d_cpus.size(); };
+	bool have_node_counters() { return d_node_loads_fd >= 0; };
+
+	// One step: num_sources sources, each sent packets_per_sec.
+	snap_loopback_result run(int num_sources, double packets_per_sec);
+
+	// For the threads run() starts.
+	int phase() { return d_phase.load(std::memory_order_relaxed); };
+	const volatile bool & stop_flag() { return d_stop; };
+	// tid 0 is the calling thread.
+	void register_thread(int role, pid_t tid=0);
+	void pin_current_thread(int cpu);
+	int sender_cpu(int source_index);
+	int receive_cpu(int source_index);
+	int work_cpu(int source_index);
+	int sync_cpu(int num_sources);
+
+	static const char *limit_name(int limit);
+	static const char *role_name(int role);
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_LOOPBACK_HARNESS_H */
@@ -0,0 +1,429 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_packet_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+namespace gr {
+namespace ata {
+
+snap_packet_generator::snap_packet_generator(int packet_type, int starting_channel, int ending_channel, int antenna_id,
+		uint64_t seed, uint64_t first_sample) {
+	d_packet_type = packet_type;
+	d_antenna_id = antenna_id;
+	d_firmware_version = 2;
+
+	if (d_packet_type == SNAP_PACKETTYPE_SPECT) {
+		d_starting_channel = 0;
+		d_ending_channel = 4095;
+		d_channels_per_packet = 512;
+		d_packet_size = SNAP_GENERATOR_SPECT_PACKET_SIZE;
+		d_sample_step = 1;
+	}
+	else {
+		d_packet_type = SNAP_PACKETTYPE_VOLTAGE;
+		d_starting_channel = starting_channel;
+		d_ending_channel = ending_channel;
+		d_channels_per_packet = 256;
+		d_packet_size = SNAP_GENERATOR_VOLTAGE_PACKET_SIZE;
+		d_sample_step = 16;
+	}
+
+	d_packets_per_frame = (d_ending_channel - d_starting_channel + 1) / d_channels_per_packet;
+
+	if (d_packets_per_frame < 1)
+		d_packets_per_frame = 1;
+
+	// xorshift can't start from 0.
+	d_rng = seed ? seed : 1;
+	// Faults get their own stream so turning them on doesn't change the content.
+	d_fault_rng = (d_rng * 0x9E3779B97F4A7C15ULL) | 1;
+	d_packet_in_frame = 0;
+	d_sample_number = first_sample;
+
+	d_content = SNAP_GENERATOR_NOISE;
+	d_tone_channel = d_starting_channel;
+	d_tone_amplitude = 0.0;
+	d_tone_cycles_per_sample = 0.0;
+
+	d_have_held = false;
+}
+
+snap_packet_generator::~snap_packet_generator() {
+}
+
+void snap_packet_generator::set_sample_number(uint64_t sample_number) {
+	d_sample_number = sample_number;
+	d_packet_in_frame = 0;
+	d_have_held = false;
+	d_pending.clear();
+}
+
+void snap_packet_generator::set_noise() {
+	d_content = SNAP_GENERATOR_NOISE;
+}
+
+void snap_packet_generator::set_tone(int channel, double amplitude, double cycles_per_sample) {
+	d_content = SNAP_GENERATOR_TONE;
+	d_tone_channel = channel;
+	d_tone_amplitude = amplitude;
+	d_tone_cycles_per_sample = cycles_per_sample;
+}
+
+void snap_packet_generator::set_faults(const snap_generator_faults &faults) {
+	d_faults = faults;
+
+	if (d_faults.jump_frames < 1)
+		d_faults.jump_frames = 1;
+}
+
+void snap_packet_generator::write_voltage(unsigned char *packet, int channel) {
+	uint16_t n_chans = htobe16(d_channels_per_packet);
+	uint16_t chan = htobe16(channel);
+	uint16_t feng_id = htobe16(d_antenna_id);
+	uint64_t timestamp = htobe64(d_sample_number);
+
+	packet[0] = d_firmware_version;
+	packet[1] = 0;
+	memcpy(packet + 2, &n_chans, sizeof(n_chans));
+	memcpy(packet + 4, &chan, sizeof(chan));
+	memcpy(packet + 6, &feng_id, sizeof(feng_id));
+	memcpy(packet + 8, &timestamp, sizeof(timestamp));
+
+	if (d_content == SNAP_GENERATOR_NOISE) {
+		// Every nibble is an independent 4-bit I or Q value.
+		for (size_t i=16;i<d_packet_size;i+=sizeof(uint64_t)) {
+			uint64_t r = next_random();
+			memcpy(packet + i, &r, sizeof(r));
+		}
+
+		return;
+	}
+
+	memset(packet + 16, 0x00, d_packet_size - 16);
+
+	int tone_offset = d_tone_channel - channel;
+
+	if ((tone_offset < 0) || (tone_offset >= d_channels_per_packet))
+		return;
+
+	// v2.0 order: data[channel][time][pol], I in the high nibble and Q in the low one.
+	// -8 isn't a valid sample, so the levels are held to +/-7.
+	unsigned char *data = packet + 16 + tone_offset * 16 * 2;
+
+	for (int t=0;t<16;t++) {
+		double phase = 2.0 * M_PI * std::fmod(d_tone_cycles_per_sample * (double)(d_sample_number + t), 1.0);
+		int i_level = std::max(-7, std::min(7, (int)std::lround(d_tone_amplitude * std::cos(phase))));
+		int q_level = std::max(-7, std::min(7, (int)std::lround(d_tone_amplitude * std::sin(phase))));
+		unsigned char sample = ((i_level & 0x0F) << 4) | (q_level & 0x0F);
+
+		data[t * 2] = sample;
+		data[t * 2 + 1] = sample;
+	}
+}
+
+void snap_packet_generator::write_spect(unsigned char *packet, int channel) {
+	uint64_t header = ((uint64_t)d_firmware_version << 56) | ((d_sample_number & 0x1fffffffffffULL) << 11) |
+			((uint64_t)((channel / 512) & 0x07) << 8) | (d_antenna_id & 0xff);
+	header = htobe64(header);
+	memcpy(packet, &header, sizeof(header));
+
+	// The source passes the floats through as they are, so these are host order.
+	float *data = (float *)(packet + 8);
+
+	if (d_content == SNAP_GENERATOR_TONE) {
+		memset(data, 0x00, 512 * 4 * sizeof(float));
+
+		int tone_offset = d_tone_channel - channel;
+
+		if ((tone_offset >= 0) && (tone_offset < 512)) {
+			// Same tone in both polarizations, so the cross power is all real.
+			float power = (float)(d_tone_amplitude * d_tone_amplitude);
+
+			data[tone_offset * 4 + 0] = power;
+			data[tone_offset * 4 + 1] = power;
+			data[tone_offset * 4 + 2] = power;
+		}
+
+		return;
+	}
+
+	for (int c=0;c<512;c++) {
+		uint64_t r = next_random();
+		// Auto powers are positive, cross terms either sign.
+		data[c * 4 + 0] = (float)(r & 0xffff) / 65536.0f;
+		data[c * 4 + 1] = (float)((r >> 16) & 0xffff) / 65536.0f;
+		data[c * 4 + 2] = (float)((r >> 32) & 0xffff) / 32768.0f - 1.0f;
+		data[c * 4 + 3] = (float)((r >> 48) & 0xffff) / 32768.0f - 1.0f;
+	}
+}
+
+void snap_packet_generator::next(unsigned char *packet) {
+	int channel = d_starting_channel + d_packet_in_frame * d_channels_per_packet;
+
+	if (d_packet_type == SNAP_PACKETTYPE_SPECT)
+		write_spect(packet, channel);
+	else
+		write_voltage(packet, channel);
+
+	d_packet_in_frame++;
+
+	if (d_packet_in_frame >= d_packets_per_frame) {
+		d_packet_in_frame = 0;
+		d_sample_number += d_sample_step;
+	}
+}
+
+void snap_packet_generator::fill(unsigned char *buffer, size_t num_packets) {
+	for (size_t i=0;i<num_packets;i++)
+		next(buffer + i * d_packet_size);
+}
+
+size_t snap_packet_generator::generate(unsigned char *buffer, size_t max_packets) {
+	size_t count = 0;
+
+	while (count < max_packets) {
+		unsigned char *packet = buffer + count * d_packet_size;
+
+		if (!d_pending.empty()) {
+			memcpy(packet, &d_pending.front()[0], d_packet_size);
+			d_pending.pop_front();
+			count++;
+			continue;
+		}
+
+		if ((d_packet_in_frame == 0) && fault(d_faults.timestamp_jump)) {
+			d_sample_number += (uint64_t)d_faults.jump_frames * d_sample_step;
+			d_fault_counts.timestamp_jumps++;
+			d_fault_counts.frames_skipped += d_faults.jump_frames;
+		}
+
+		next(packet);
+
+		if (fault(d_faults.loss)) {
+			// The next packet goes in this slot.
+			d_fault_counts.lost++;
+			continue;
+		}
+
+		if ((d_packet_type == SNAP_PACKETTYPE_VOLTAGE) && fault(d_faults.bad_channel)) {
+			uint16_t chan = htobe16(d_starting_channel + d_packets_per_frame * d_channels_per_packet);
+			memcpy(packet + 4, &chan, sizeof(chan));
+			d_fault_counts.bad_channel++;
+		}
+
+		if (!d_have_held && fault(d_faults.reorder)) {
+			d_held.assign(packet, packet + d_packet_size);
+			d_have_held = true;
+			d_fault_counts.reordered++;
+			continue;
+		}
+
+		count++;
+
+		if (fault(d_faults.duplicate)) {
+			d_pending.push_back(std::vector<unsigned char>(packet, packet + d_packet_size));
+			d_fault_counts.duplicated++;
+		}
+
+		if (d_have_held) {
+			// This is the packet the held one was supposed to go out before.
+			d_pending.push_back(d_held);
+			d_have_held = false;
+		}
+	}
+
+	return count;
+}
+
+void snap_packet_generator::restamp(unsigned char *packet, uint64_t sample_number) {
+	if (d_packet_type == SNAP_PACKETTYPE_SPECT) {
+		uint64_t header;
+		memcpy(&header, packet, sizeof(header));
+		header = be64toh(header);
+
+		header = (header & ~(0x1fffffffffffULL << 11)) | ((sample_number & 0x1fffffffffffULL) << 11);
+
+		header = htobe64(header);
+		memcpy(packet, &header, sizeof(header));
+	}
+	else {
+		uint64_t timestamp = htobe64(sample_number);
+		memcpy(packet + 8, &timestamp, sizeof(timestamp));
+	}
+}
+
+snap_packet_sender::snap_packet_sender(snap_packet_generator &generator, int batch) : d_generator(generator) {
+	d_socket = -1;
+	d_batch = std::max(1, batch);
+
+	d_buffer.resize(d_batch * d_generator.packet_size());
+	d_msgs.resize(d_batch);
+	d_iovecs.resize(d_batch);
+
+	memset(&d_msgs[0], 0, d_batch * sizeof(struct mmsghdr));
+
+	for (int i=0;i<d_batch;i++) {
+		d_iovecs[i].iov_base = &d_buffer[i * d_generator.packet_size()];
+		d_iovecs[i].iov_len = d_generator.packet_size();
+		d_msgs[i].msg_hdr.msg_iov = &d_iovecs[i];
+		d_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	d_packets_per_sec = 0.0;
+	d_scheduled_packets = 0;
+	d_packets_sent = 0;
+	d_bytes_sent = 0;
+	d_send_errors = 0;
+}
+
+snap_packet_sender::~snap_packet_sender() {
+	close();
+}
+
+bool snap_packet_sender::open(const std::string &dest_ip, int port, const std::string &mcast_interface, int ttl) {
+	close();
+
+	struct sockaddr_in dest;
+	memset(&dest, 0, sizeof(dest));
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons(port);
+
+	if (inet_pton(AF_INET, dest_ip.c_str(), &dest.sin_addr) != 1) {
+		d_last_error = dest_ip + " is not an IPv4 address.";
+		return false;
+	}
+
+	d_socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (d_socket < 0) {
+		d_last_error = std::string("Unable to create socket: ") + strerror(errno);
+		return false;
+	}
+
+	int send_buffer = 16 * 1024 * 1024;
+	setsockopt(d_socket, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+
+	if (IN_MULTICAST(ntohl(dest.sin_addr.s_addr))) {
+		unsigned char mcast_ttl = ttl;
+		setsockopt(d_socket, IPPROTO_IP, IP_MULTICAST_TTL, &mcast_ttl, sizeof(mcast_ttl));
+
+		// Let a SNAP source on this host hear it too.
+		unsigned char loop = 1;
+		setsockopt(d_socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+		if (mcast_interface.length() > 0) {
+			struct in_addr if_addr;
+
+			if ((inet_pton(AF_INET, mcast_interface.c_str(), &if_addr) != 1) ||
+					(setsockopt(d_socket, IPPROTO_IP, IP_MULTICAST_IF, &if_addr, sizeof(if_addr)) != 0)) {
+				d_last_error = "Unable to send multicast from " + mcast_interface;
+				close();
+				return false;
+			}
+		}
+	}
+
+	if (connect(d_socket, (struct sockaddr *)&dest, sizeof(dest)) < 0) {
+		d_last_error = std::string("Unable to connect socket: ") + strerror(errno);
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void snap_packet_sender::close() {
+	if (d_socket >= 0) {
+		::close(d_socket);
+		d_socket = -1;
+	}
+}
+
+void snap_packet_sender::set_rate(double packets_per_sec) {
+	d_packets_per_sec = packets_per_sec;
+	d_scheduled_packets = 0;
+	d_clock.reset();
+}
+
+uint64_t snap_packet_sender::send(uint64_t num_packets, const volatile bool &stop) {
+	if (d_socket < 0)
+		return 0;
+
+	size_t packet_size = d_generator.packet_size();
+	uint64_t sent_total = 0;
+
+	// Keep a batch to about 100 us of packets so slow rates still go out smoothly.
+	int batch = d_batch;
+
+	if (d_packets_per_sec > 0.0)
+		batch = std::max(1, std::min(d_batch, (int)(d_packets_per_sec / 10000.0)));
+
+	while ((sent_total < num_packets) && !stop) {
+		int this_batch = (int)std::min((uint64_t)batch, num_packets - sent_total);
+		int count = d_generator.generate(&d_buffer[0], this_batch);
+
+		if (d_packets_per_sec > 0.0) {
+			if (!d_clock.wait_until_due((uint64_t)((double)d_scheduled_packets * 1e9 / d_packets_per_sec), stop))
+				break;
+		}
+
+		d_scheduled_packets += this_batch;
+
+		int sent = 0;
+
+		while ((sent < count) && !stop) {
+			int retval = sendmmsg(d_socket, &d_msgs[sent], count - sent, 0);
+
+			if (retval < 0) {
+				if ((errno == EINTR) || (errno == EAGAIN) || (errno == ENOBUFS))
+					continue;
+
+				// Skip the message that failed.
+				d_send_errors++;
+				sent++;
+				continue;
+			}
+
+			d_packets_sent += retval;
+			d_bytes_sent += retval * packet_size;
+			sent += retval;
+		}
+
+		sent_total += this_batch;
+	}
+
+	return sent_total;
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,220 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_PACKET_GENERATOR_H
+#define INCLUDED_ATA_SNAP_PACKET_GENERATOR_H
+
+#include <ata/snap_headers.h>
+#include "pacing_clock.h"
+#include <deque>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// v2.0 voltage packets: 16 byte header and 256 channels x 16 times x 2 pols of 4-bit IQ.
+#define SNAP_GENERATOR_VOLTAGE_PACKET_SIZE (16 + 8192)
+// Spectrometer packets: 8 byte header and 512 channels x 4 floats.
+#define SNAP_GENERATOR_SPECT_PACKET_SIZE (8 + 8192)
+
+#define SNAP_GENERATOR_NOISE 0
+#define SNAP_GENERATOR_TONE 1
+
+namespace gr {
+namespace ata {
+
+/*
+ * Faults generate() adds to the stream.  Each is a probability: per packet, except
+ * timestamp jumps, which are per frame.
+ */
+struct snap_generator_faults {
+	double loss = 0.0;
+	// The packet is held back and sent after the one that follows it.
+	double reorder = 0.0;
+	double duplicate = 0.0;
+	// The channel ID is moved past the end of the range.  Voltage only, since every
+	// spectrometer channel ID is valid.
+	double bad_channel = 0.0;
+	// sample_number skips ahead jump_frames frames.
+	double timestamp_jump = 0.0;
+	int jump_frames = 100;
+};
+
+// What generate() actually did.
+struct snap_generator_fault_counts {
+	uint64_t lost = 0;
+	uint64_t reordered = 0;
+	uint64_t duplicated = 0;
+	uint64_t bad_channel = 0;
+	uint64_t timestamp_jumps = 0;
+	uint64_t frames_skipped = 0;
+};
+
+/*
+ * Builds SNAP payloads in memory, exactly as they come off the wire, for benchmarks and
+ * tests that don't have a SNAP board (or a capture) to hand.  Packets come out in frame
+ * order: every channel block of one frame, then the next frame.  Voltage frames step
+ * sample_number by 16 and spectrometer frames by 1, the same as the hardware.
+ *
+ * The content is either noise from a seeded generator or a single tone, and faults come
+ * from a second seeded generator, so a given seed always produces the same packets with
+ * the same faults in the same places.
+ */
+class snap_packet_generator {
+protected:
+	int d_packet_type;
+	int d_starting_channel;
+	int d_ending_channel;
+	uint16_t d_antenna_id;
+	uint8_t d_firmware_version;
+
+	int d_channels_per_packet;
+	int d_packets_per_frame;
+	size_t d_packet_size;
+	uint64_t d_sample_step;
+
+	uint64_t d_sample_number;
+	int d_packet_in_frame;
+	uint64_t d_rng;
+
+	int d_content;
+	int d_tone_channel;
+	double d_tone_amplitude;
+	double d_tone_cycles_per_sample;
+
+	snap_generator_faults d_faults;
+	snap_generator_fault_counts d_fault_counts;
+	uint64_t d_fault_rng;
+	// A packet held back to be reordered, and packets owed to the next generate() call.
+	std::vector<unsigned char> d_held;
+	bool d_have_held;
+	std::deque<std::vector<unsigned char>> d_pending;
+
+	static uint64_t xorshift(uint64_t &state) {
+		// xorshift64*
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1DULL;
+	};
+
+	uint64_t next_random() { return xorshift(d_rng); };
+
+	bool fault(double probability) {
+		if (probability <= 0.0)
+			return false;
+
+		return (double)(xorshift(d_fault_rng) >> 11) * (1.0 / 9007199254740992.0) < probability;
+	};
+
+	void write_voltage(unsigned char *packet, int channel);
+	void write_spect(unsigned char *packet, int channel);
+
+public:
+	// Spectrometer packets always cover all 4096 channels, so the channel range only
+	// applies to voltage.
+	snap_packet_generator(int packet_type, int starting_channel=0, int ending_channel=4095, int antenna_id=0,
+			uint64_t seed=1, uint64_t first_sample=0);
+	virtual ~snap_packet_generator();
+
+	int packet_type() { return d_packet_type; };
+	size_t packet_size() { return d_packet_size; };
+	int packets_per_frame() { return d_packets_per_frame; };
+	int channels_per_packet() { return d_channels_per_packet; };
+
+	// sample_number of the next packet.
+	uint64_t sample_number() { return d_sample_number; };
+	uint64_t sample_step() { return d_sample_step; };
+	void set_sample_number(uint64_t sample_number);
+
+	// Writes the next packet_size() byte packet.
+	void next(unsigned char *packet);
+	// Writes num_packets packets back to back.
+	void fill(unsigned char *buffer, size_t num_packets);
+
+	// Noise in every channel (the default).
+	void set_noise();
+	// A tone in one channel (both polarizations) and nothing anywhere else.  For voltage,
+	// amplitude is in 4-bit counts (up to 7) and the tone turns cycles_per_sample of a
+	// cycle per time sample.  For the spectrometer, amplitude^2 is the channel's power.
+	void set_tone(int channel, double amplitude=5.0, double cycles_per_sample=0.0625);
+	int content() { return d_content; };
+
+	void set_faults(const snap_generator_faults &faults);
+	const snap_generator_faults & faults() { return d_faults; };
+	const snap_generator_fault_counts & fault_counts() { return d_fault_counts; };
+
+	// Writes up to max_packets packets with the faults applied and returns how many it
+	// wrote.  Without faults this is the same as fill().
+	size_t generate(unsigned char *buffer, size_t max_packets);
+
+	// Rewrites the sample_number in a packet this generator made, so a pool of packets
+	// can go out again as later frames without generating new content.
+	void restamp(unsigned char *packet, uint64_t sample_number);
+};
+
+/*
+ * Sends a generator's packets over UDP with sendmmsg at a steady packet rate, to drive a
+ * SNAP source from another process or host.  Multicast groups are detected from the
+ * address and loop back to this host.
+ */
+class snap_packet_sender {
+protected:
+	snap_packet_generator &d_generator;
+	int d_socket;
+	int d_batch;
+
+	std::vector<unsigned char> d_buffer;
+	std::vector<struct mmsghdr> d_msgs;
+	std::vector<struct iovec> d_iovecs;
+
+	double d_packets_per_sec;
+	pacing_clock d_clock;
+	uint64_t d_scheduled_packets;
+
+	uint64_t d_packets_sent;
+	uint64_t d_bytes_sent;
+	uint64_t d_send_errors;
+	std::string d_last_error;
+
+public:
+	snap_packet_sender(snap_packet_generator &generator, int batch=64);
+	virtual ~snap_packet_sender();
+
+	bool open(const std::string &dest_ip, int port, const std::string &mcast_interface="", int ttl=1);
+	void close();
+
+	// 0 sends as fast as the socket takes them.  Starts a new schedule.
+	void set_rate(double packets_per_sec);
+	// Sends num_packets packets, carrying on the schedule from the last call.  Returns
+	// early if stop goes true.
+	uint64_t send(uint64_t num_packets, const volatile bool &stop);
+
+	uint64_t packets_sent() { return d_packets_sent; };
+	uint64_t bytes_sent() { return d_bytes_sent; };
+	uint64_t send_errors() { return d_send_errors; };
+	const std::string & last_error() { return d_last_error; };
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_PACKET_GENERATOR_H */
@@ -0,0 +1,128 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_record_chunk_decoder.h"
+
+#include <sstream>
+
+namespace gr {
+namespace ata {
+
+snap_record_chunk_decoder::snap_record_chunk_decoder(const std::string &filename, int starting_channel, int ending_channel,
+		bool packed_output, int num_threads, bool repeat, uint64_t start_sample, uint64_t end_sample,
+		uint64_t max_fill_frames)
+	: snap_chunk_decoder(starting_channel, ending_channel, packed_output, num_threads, repeat, start_sample, end_sample,
+			max_fill_frames) {
+	d_filename = filename;
+	d_damaged_chunks = 0;
+}
+
+snap_record_chunk_decoder::~snap_record_chunk_decoder() {
+	// Frame tables point into the reader's mapping, so the workers have to be done first.
+	stop();
+}
+
+bool snap_record_chunk_decoder::open() {
+	stop();
+
+	d_opened = false;
+	d_damaged_chunks = 0;
+
+	if (!d_reader.open(d_filename)) {
+		d_last_error = d_reader.last_error();
+		return false;
+	}
+
+	if ((d_reader.packet_type() != SNAP_PACKETTYPE_VOLTAGE) || (d_reader.packet_size() != VOLTAGE_PACKET_SIZE)) {
+		d_last_error = d_filename + " is not a voltage recording.";
+		d_reader.close();
+		return false;
+	}
+
+	// One point per chunk, at its lowest sample.  A chunk that starts earlier than the
+	// one before it (the SNAP restarted) can't be a region boundary, but its packets are
+	// still read as part of the region around it.
+	std::vector<index_point> points;
+
+	for (size_t i=0;i<d_reader.num_chunks();i++) {
+		const snap_record_index_entry &entry = d_reader.chunk_entry(i);
+
+		if (entry.num_packets == 0)
+			continue;
+
+		if (!points.empty() && (entry.first_sample <= points.back().sample_number))
+			continue;
+
+		index_point p;
+		p.sample_number = entry.first_sample;
+		p.position = i;
+		points.push_back(p);
+	}
+
+	if (!layout_regions(points, DECODER_INDEX_POINTS_PER_REGION)) {
+		d_reader.close();
+		return false;
+	}
+
+	d_opened = true;
+
+	return true;
+}
+
+void snap_record_chunk_decoder::collect_packets(int worker_id, region &r, std::vector<const unsigned char *> &packets) {
+	uint64_t position_end = r.position_end;
+
+	if (position_end > d_reader.num_chunks())
+		position_end = d_reader.num_chunks();
+
+	size_t packet_size = d_reader.packet_size();
+
+	for (uint64_t chunk=r.position_begin;chunk<position_end;chunk++) {
+		const snap_record_index_entry &entry = d_reader.chunk_entry(chunk);
+
+		// Skip neighbors that don't reach into this region.
+		if ((entry.num_packets == 0) || (entry.last_sample < r.sample_begin) || (entry.first_sample >= r.sample_end))
+			continue;
+
+		std::shared_ptr<std::vector<unsigned char>> buffer(new std::vector<unsigned char>());
+		uint32_t num_packets;
+		const unsigned char *data = d_reader.chunk_packets(chunk, *buffer, num_packets);
+
+		if (!data) {
+			boost::unique_lock<boost::mutex> lock(d_mutex);
+			d_damaged_chunks++;
+			continue;
+		}
+
+		for (uint32_t i=0;i<num_packets;i++)
+			packets.push_back(data + (size_t)i * packet_size);
+
+		// Uncompressed chunks are used straight from the mapping.
+		if (!buffer->empty())
+			r.storage.push_back(buffer);
+	}
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,63 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_RECORD_CHUNK_DECODER_H
+#define INCLUDED_ATA_SNAP_RECORD_CHUNK_DECODER_H
+
+#include "snap_chunk_decoder.h"
+#include "snap_record_reader.h"
+
+#include <string>
+#include <vector>
+
+namespace gr {
+namespace ata {
+
+/*
+ * Parallel decode of a voltage recording.  The recording's chunk index gives the regions,
+ * so each worker decompresses the chunks for its own region, and a chunk next to a
+ * region is only decompressed if it actually holds some of the region's packets.
+ */
+class snap_record_chunk_decoder : public snap_chunk_decoder {
+protected:
+	std::string d_filename;
+	// Shared by the workers.  Reading chunks doesn't change it.
+	snap_record_reader d_reader;
+	uint64_t d_damaged_chunks;
+
+	virtual void collect_packets(int worker_id, region &r, std::vector<const unsigned char *> &packets);
+
+public:
+	snap_record_chunk_decoder(const std::string &filename, int starting_channel, int ending_channel,
+			bool packed_output, int num_threads, bool repeat, uint64_t start_sample=0, uint64_t end_sample=0,
+			uint64_t max_fill_frames=20000);
+	virtual ~snap_record_chunk_decoder();
+
+	// Opens the recording and lays out the regions.  Returns false (see last_error()) if it
+	// can't be read or isn't a voltage recording.
+	bool open();
+
+	uint64_t damaged_chunks() { return d_damaged_chunks; };
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_RECORD_CHUNK_DECODER_H */
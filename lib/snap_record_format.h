@@ -0,0 +1,117 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_RECORD_FORMAT_H
+#define INCLUDED_ATA_SNAP_RECORD_FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * SNAP recording (.snaprec) layout.  Everything is little-endian, and everything starts
+ * on a SNAP_RECORD_BLOCK_SIZE boundary so the file can be written with O_DIRECT.
+ *
+ *   file header, padded to one block
+ *   chunk: chunk header + packet data (compressed or not), padded to a block
+ *   chunk ...
+ *   index: index header + one entry per chunk, padded to a block
+ *   footer, padded to one block (always the last block in the file)
+ *
+ * A chunk's packet data is num_packets SNAP payloads of packet_size bytes back to back,
+ * exactly as they came off the wire, before compression.  If a recording wasn't closed
+ * cleanly there's no index or footer, but the chunks can still be found by walking the
+ * chunk headers from the first block on.
+ */
+
+#define SNAP_RECORD_MAGIC "SNAPREC1"
+#define SNAP_RECORD_CHUNK_MAGIC "SNAPCHNK"
+#define SNAP_RECORD_INDEX_MAGIC "SNAPRIDX"
+#define SNAP_RECORD_FOOTER_MAGIC "SNAPREND"
+
+#define SNAP_RECORD_VERSION 1
+#define SNAP_RECORD_BLOCK_SIZE 4096
+
+#define SNAP_RECORD_CODEC_NONE 0
+#define SNAP_RECORD_CODEC_LZ4 1
+#define SNAP_RECORD_CODEC_ZSTD 2
+
+namespace gr {
+namespace ata {
+
+struct snap_record_file_header {
+	char magic[8];
+	uint32_t version;
+	// SNAP_PACKETTYPE_*
+	uint32_t packet_type;
+	uint32_t packet_size;
+	uint16_t port;
+	uint16_t reserved1;
+	// Codec asked for.  Individual chunks that don't compress are stored as-is.
+	uint32_t codec;
+	uint32_t chunk_bytes;
+	// Wall clock when the recording started.
+	uint64_t start_time_ns;
+};
+
+struct snap_record_chunk_header {
+	char magic[8];
+	uint64_t sequence;
+	uint32_t codec;
+	uint32_t num_packets;
+	uint64_t raw_bytes;
+	uint64_t stored_bytes;
+	// Lowest and highest sample_number in the chunk.
+	uint64_t first_sample;
+	uint64_t last_sample;
+	// Arrival time (wall clock, or capture time for PCAP playback) of the first and last packet.
+	uint64_t first_time_ns;
+	uint64_t last_time_ns;
+};
+
+struct snap_record_index_entry {
+	uint64_t offset;
+	uint32_t num_packets;
+	uint32_t reserved;
+	uint64_t first_sample;
+	uint64_t last_sample;
+	uint64_t first_time_ns;
+	uint64_t last_time_ns;
+};
+
+struct snap_record_index_header {
+	char magic[8];
+	uint64_t num_entries;
+};
+
+struct snap_record_footer {
+	char magic[8];
+	uint64_t index_offset;
+	uint64_t num_chunks;
+	uint64_t num_packets;
+};
+
+// Bytes a chunk takes on disk with its header, rounded up to a whole block.
+inline uint64_t snap_record_padded_size(uint64_t bytes) {
+	return ((bytes + SNAP_RECORD_BLOCK_SIZE - 1) / SNAP_RECORD_BLOCK_SIZE) * SNAP_RECORD_BLOCK_SIZE;
+}
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_RECORD_FORMAT_H */
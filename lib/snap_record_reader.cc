@@ -0,0 +1,424 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_record_reader.h"
+
+#include <boost/bind/bind.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace gr {
+namespace ata {
+
+// Same as the recorder: packet data starts after the chunk header, rounded up to 64 bytes.
+static const size_t RECORD_HEADER_ROOM = ((sizeof(snap_record_chunk_header) + 63) / 64) * 64;
+
+snap_record_reader::snap_record_reader() {
+	d_fd = -1;
+	d_map = NULL;
+	d_file_size = 0;
+	d_closed_cleanly = false;
+	memset(&d_header, 0x00, sizeof(d_header));
+}
+
+snap_record_reader::~snap_record_reader() {
+	close();
+}
+
+bool snap_record_reader::is_recording(const std::string &filename) {
+	std::ifstream infile(filename.c_str(), std::ios::binary);
+
+	char magic[8];
+
+	if (!infile.read(magic, sizeof(magic)))
+		return false;
+
+	return memcmp(magic, SNAP_RECORD_MAGIC, sizeof(magic)) == 0;
+}
+
+bool snap_record_reader::open(const std::string &filename) {
+	close();
+
+	d_filename = filename;
+
+	d_fd = ::open(filename.c_str(), O_RDONLY);
+
+	if (d_fd < 0) {
+		std::stringstream msg;
+		msg << "Unable to open " << filename << ": " << strerror(errno);
+		d_last_error = msg.str();
+		return false;
+	}
+
+	struct stat st;
+	if ((fstat(d_fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size < SNAP_RECORD_BLOCK_SIZE)) {
+		d_last_error = filename + " is not a SNAP recording.";
+		close();
+		return false;
+	}
+
+	d_file_size = st.st_size;
+
+	void *map = mmap(NULL, d_file_size, PROT_READ, MAP_PRIVATE, d_fd, 0);
+
+	if (map == MAP_FAILED) {
+		std::stringstream msg;
+		msg << "Unable to map " << filename << ": " << strerror(errno);
+		d_last_error = msg.str();
+		close();
+		return false;
+	}
+
+	d_map = (const unsigned char *)map;
+
+	memcpy(&d_header, d_map, sizeof(d_header));
+
+	if (memcmp(d_header.magic, SNAP_RECORD_MAGIC, sizeof(d_header.magic)) != 0) {
+		d_last_error = filename + " is not a SNAP recording.";
+		close();
+		return false;
+	}
+
+	if (d_header.version != SNAP_RECORD_VERSION) {
+		std::stringstream msg;
+		msg << filename << " is recording format version " << d_header.version << ", this build reads version " << SNAP_RECORD_VERSION << ".";
+		d_last_error = msg.str();
+		close();
+		return false;
+	}
+
+	if (d_header.packet_size == 0) {
+		d_last_error = filename + " has a damaged file header.";
+		close();
+		return false;
+	}
+
+	d_closed_cleanly = load_index();
+
+	if (!d_closed_cleanly)
+		walk_chunks();
+
+	// Chunks are read front to back, but by several threads at a time.
+	madvise(map, d_file_size, MADV_WILLNEED);
+
+	return true;
+}
+
+void snap_record_reader::close() {
+	if (d_map) {
+		munmap((void *)d_map, d_file_size);
+		d_map = NULL;
+	}
+
+	if (d_fd >= 0) {
+		::close(d_fd);
+		d_fd = -1;
+	}
+
+	d_file_size = 0;
+	d_index.clear();
+	d_closed_cleanly = false;
+}
+
+bool snap_record_reader::load_index() {
+	if (d_file_size < 3 * SNAP_RECORD_BLOCK_SIZE)
+		return false;
+
+	snap_record_footer footer;
+	memcpy(&footer, d_map + d_file_size - SNAP_RECORD_BLOCK_SIZE, sizeof(footer));
+
+	if (memcmp(footer.magic, SNAP_RECORD_FOOTER_MAGIC, sizeof(footer.magic)) != 0)
+		return false;
+
+	if ((footer.index_offset < SNAP_RECORD_BLOCK_SIZE) || (footer.index_offset + sizeof(snap_record_index_header) > d_file_size))
+		return false;
+
+	snap_record_index_header index_header;
+	memcpy(&index_header, d_map + footer.index_offset, sizeof(index_header));
+
+	if ((memcmp(index_header.magic, SNAP_RECORD_INDEX_MAGIC, sizeof(index_header.magic)) != 0) ||
+			(index_header.num_entries != footer.num_chunks))
+		return false;
+
+	uint64_t entries_start = footer.index_offset + sizeof(index_header);
+
+	if (index_header.num_entries > (d_file_size - entries_start) / sizeof(snap_record_index_entry))
+		return false;
+
+	d_index.resize(index_header.num_entries);
+
+	if (!d_index.empty())
+		memcpy(&d_index[0], d_map + entries_start, d_index.size() * sizeof(snap_record_index_entry));
+
+	for (size_t i = 0; i < d_index.size(); i++) {
+		if (d_index[i].offset + RECORD_HEADER_ROOM > footer.index_offset) {
+			d_index.clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void snap_record_reader::walk_chunks() {
+	d_index.clear();
+
+	uint64_t offset = SNAP_RECORD_BLOCK_SIZE;
+
+	while (offset + RECORD_HEADER_ROOM <= d_file_size) {
+		snap_record_chunk_header hdr;
+		memcpy(&hdr, d_map + offset, sizeof(hdr));
+
+		if (memcmp(hdr.magic, SNAP_RECORD_CHUNK_MAGIC, sizeof(hdr.magic)) != 0)
+			break;
+
+		uint64_t size = snap_record_padded_size(RECORD_HEADER_ROOM + hdr.stored_bytes);
+
+		// A chunk cut short by a crash is left out.
+		if (offset + size > d_file_size)
+			break;
+
+		snap_record_index_entry entry;
+		memset(&entry, 0x00, sizeof(entry));
+		entry.offset = offset;
+		entry.num_packets = hdr.num_packets;
+		entry.first_sample = hdr.first_sample;
+		entry.last_sample = hdr.last_sample;
+		entry.first_time_ns = hdr.first_time_ns;
+		entry.last_time_ns = hdr.last_time_ns;
+		d_index.push_back(entry);
+
+		offset += size;
+	}
+}
+
+const unsigned char *snap_record_reader::chunk_packets(size_t chunk, std::vector<unsigned char> &buffer, uint32_t &num_packets) {
+	num_packets = 0;
+
+	if (!d_map || (chunk >= d_index.size()))
+		return NULL;
+
+	uint64_t offset = d_index[chunk].offset;
+
+	snap_record_chunk_header hdr;
+	memcpy(&hdr, d_map + offset, sizeof(hdr));
+
+	if (memcmp(hdr.magic, SNAP_RECORD_CHUNK_MAGIC, sizeof(hdr.magic)) != 0)
+		return NULL;
+
+	uint64_t raw_bytes = (uint64_t)hdr.num_packets * d_header.packet_size;
+
+	if ((hdr.raw_bytes != raw_bytes) || (offset + RECORD_HEADER_ROOM + hdr.stored_bytes > d_file_size))
+		return NULL;
+
+	const unsigned char *stored = d_map + offset + RECORD_HEADER_ROOM;
+
+	switch (hdr.codec) {
+	case SNAP_RECORD_CODEC_NONE:
+		if (hdr.stored_bytes != raw_bytes)
+			return NULL;
+
+		num_packets = hdr.num_packets;
+		return stored;
+#ifdef HAVE_LZ4
+	case SNAP_RECORD_CODEC_LZ4: {
+		if (buffer.size() < raw_bytes)
+			buffer.resize(raw_bytes);
+
+		int result = LZ4_decompress_safe((const char *)stored, (char *)&buffer[0], hdr.stored_bytes, raw_bytes);
+
+		if ((result < 0) || ((uint64_t)result != raw_bytes))
+			return NULL;
+
+		num_packets = hdr.num_packets;
+		return &buffer[0];
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case SNAP_RECORD_CODEC_ZSTD: {
+		if (buffer.size() < raw_bytes)
+			buffer.resize(raw_bytes);
+
+		size_t result = ZSTD_decompress(&buffer[0], raw_bytes, stored, hdr.stored_bytes);
+
+		if (ZSTD_isError(result) || (result != raw_bytes))
+			return NULL;
+
+		num_packets = hdr.num_packets;
+		return &buffer[0];
+	}
+#endif
+	default:
+		// A codec this build wasn't compiled with.
+		return NULL;
+	}
+}
+
+size_t snap_record_reader::find_chunk(uint64_t sample_number) {
+	for (size_t i = 0; i < d_index.size(); i++) {
+		if ((d_index[i].num_packets > 0) && (d_index[i].last_sample >= sample_number))
+			return i;
+	}
+
+	return d_index.size();
+}
+
+/*
+ * snap_record_prefetcher
+ */
+snap_record_prefetcher::snap_record_prefetcher(snap_record_reader &reader, size_t first_chunk, int num_threads)
+	: d_reader(reader), d_first_chunk(first_chunk), d_num_threads(num_threads) {
+	if (d_num_threads < 1)
+		d_num_threads = 1;
+
+	d_max_ahead = d_num_threads * 2;
+	d_stop = true;
+	d_next_claim = d_first_chunk;
+	d_next_emit = d_first_chunk;
+	d_damaged = 0;
+}
+
+snap_record_prefetcher::~snap_record_prefetcher() {
+	stop();
+}
+
+void snap_record_prefetcher::start() {
+	stop();
+
+	d_stop = false;
+	d_next_claim = d_first_chunk;
+	d_next_emit = d_first_chunk;
+	d_ready.clear();
+
+	for (int i = 0; i < d_num_threads; i++)
+		d_threads.create_thread(boost::bind(&snap_record_prefetcher::run_worker, this));
+}
+
+void snap_record_prefetcher::stop() {
+	{
+		boost::mutex::scoped_lock lock(d_mutex);
+		d_stop = true;
+	}
+
+	d_work_cond.notify_all();
+	d_ready_cond.notify_all();
+	d_threads.join_all();
+
+	d_ready.clear();
+}
+
+void snap_record_prefetcher::run_worker() {
+	std::vector<unsigned char> buffer;
+
+	while (true) {
+		size_t chunk;
+
+		{
+			boost::mutex::scoped_lock lock(d_mutex);
+
+			while (!d_stop && (d_next_claim < d_reader.num_chunks()) && (d_next_claim - d_next_emit >= d_max_ahead))
+				d_work_cond.wait(lock);
+
+			if (d_stop || (d_next_claim >= d_reader.num_chunks()))
+				return;
+
+			chunk = d_next_claim++;
+		}
+
+		std::shared_ptr<snap_record_chunk_data> data(new snap_record_chunk_data());
+		const snap_record_index_entry &entry = d_reader.chunk_entry(chunk);
+
+		data->chunk = chunk;
+		data->first_time_ns = entry.first_time_ns;
+		data->last_time_ns = entry.last_time_ns;
+		data->packets = d_reader.chunk_packets(chunk, buffer, data->num_packets);
+
+		// The buffer goes with the chunk.  Uncompressed chunks point into the mapping and
+		// leave it here for the next one.
+		if (data->packets && !buffer.empty() && (data->packets == &buffer[0])) {
+			data->buffer.swap(buffer);
+			data->packets = &data->buffer[0];
+		}
+
+		{
+			boost::mutex::scoped_lock lock(d_mutex);
+
+			if (!data->packets) {
+				data->num_packets = 0;
+				d_damaged++;
+			}
+
+			d_ready[chunk] = data;
+		}
+
+		d_ready_cond.notify_all();
+	}
+}
+
+bool snap_record_prefetcher::next(std::shared_ptr<snap_record_chunk_data> &chunk, bool &end_of_file, int wait_ms) {
+	end_of_file = false;
+
+	boost::mutex::scoped_lock lock(d_mutex);
+
+	if (d_next_emit >= d_reader.num_chunks()) {
+		end_of_file = true;
+		return false;
+	}
+
+	auto it = d_ready.find(d_next_emit);
+
+	if (it == d_ready.end()) {
+		d_ready_cond.timed_wait(lock, boost::posix_time::milliseconds(wait_ms));
+		it = d_ready.find(d_next_emit);
+
+		if (it == d_ready.end())
+			return false;
+	}
+
+	chunk = it->second;
+	d_ready.erase(it);
+	d_next_emit++;
+
+	lock.unlock();
+	d_work_cond.notify_all();
+
+	return true;
+}
+
+} // namespace ata
+} // namespace gr
@@ -0,0 +1,146 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_RECORD_READER_H
+#define INCLUDED_ATA_SNAP_RECORD_READER_H
+
+#include "snap_record_format.h"
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gr {
+namespace ata {
+
+/*
+ * Reads a .snaprec recording (see snap_record_format.h) through a file mapping.  The
+ * chunk index comes from the footer, or if the recording wasn't closed cleanly, from
+ * walking the chunk headers.  Uncompressed chunks are used in place.  Compressed ones
+ * are decompressed into a buffer the caller provides, so any number of threads can
+ * read chunks at once.
+ */
+class snap_record_reader {
+protected:
+	std::string d_filename;
+	std::string d_last_error;
+
+	int d_fd;
+	const unsigned char *d_map;
+	size_t d_file_size;
+
+	snap_record_file_header d_header;
+	std::vector<snap_record_index_entry> d_index;
+	bool d_closed_cleanly;
+
+	bool load_index();
+	void walk_chunks();
+
+public:
+	snap_record_reader();
+	virtual ~snap_record_reader();
+
+	// True if the file starts with the recording magic.
+	static bool is_recording(const std::string &filename);
+
+	bool open(const std::string &filename);
+	void close();
+	bool is_open() { return d_map != NULL; };
+
+	size_t num_chunks() { return d_index.size(); };
+	const snap_record_index_entry & chunk_entry(size_t chunk) { return d_index[chunk]; };
+
+	// Returns the chunk's packets (num_packets of packet_size() bytes back to back), or
+	// NULL if the chunk is damaged.  buffer is only used if the chunk is compressed.
+	const unsigned char *chunk_packets(size_t chunk, std::vector<unsigned char> &buffer, uint32_t &num_packets);
+
+	// First chunk that holds anything at or past sample_number.  Chunks are in arrival
+	// order, so this allows for a little reordering around the boundary.
+	size_t find_chunk(uint64_t sample_number);
+
+	int packet_type() { return d_header.packet_type; };
+	size_t packet_size() { return d_header.packet_size; };
+	uint16_t port() { return d_header.port; };
+	int codec() { return d_header.codec; };
+	bool closed_cleanly() { return d_closed_cleanly; };
+	const std::string & filename() { return d_filename; };
+	const std::string & last_error() { return d_last_error; };
+};
+
+// One chunk's packets, ready to use.
+struct snap_record_chunk_data {
+	size_t chunk;
+	const unsigned char *packets;
+	uint32_t num_packets;
+	uint64_t first_time_ns;
+	uint64_t last_time_ns;
+	std::vector<unsigned char> buffer;
+};
+
+/*
+ * Decompresses chunks ahead of a single in-order consumer on a pool of threads.  Used
+ * by the SNAP source's standard playback path, so a compressed recording plays back as
+ * fast as an uncompressed one.
+ */
+class snap_record_prefetcher {
+protected:
+	snap_record_reader &d_reader;
+	size_t d_first_chunk;
+	int d_num_threads;
+	size_t d_max_ahead;
+
+	boost::mutex d_mutex;
+	boost::condition_variable d_work_cond;
+	boost::condition_variable d_ready_cond;
+	boost::thread_group d_threads;
+	bool d_stop;
+
+	size_t d_next_claim;
+	size_t d_next_emit;
+	std::map<size_t, std::shared_ptr<snap_record_chunk_data>> d_ready;
+
+	uint64_t d_damaged;
+
+	void run_worker();
+
+public:
+	snap_record_prefetcher(snap_record_reader &reader, size_t first_chunk, int num_threads);
+	virtual ~snap_record_prefetcher();
+
+	void start();
+	void stop();
+
+	// The next chunk in file order.  Returns false if it isn't ready within wait_ms, and
+	// sets end_of_file if there are no more.
+	bool next(std::shared_ptr<snap_record_chunk_data> &chunk, bool &end_of_file, int wait_ms);
+
+	uint64_t damaged_chunks() { return d_damaged; };
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_RECORD_READER_H */
@@ -0,0 +1,546 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_recorder.h"
+#include <ata/snap_headers.h>
+
+#include <boost/bind/bind.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sstream>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Fast settings.  The point is keeping up with the network, not the best ratio.
+#define RECORDER_ZSTD_LEVEL 1
+
+namespace gr {
+namespace ata {
+
+static unsigned char *alloc_blocks(size_t bytes) {
+	void *p = NULL;
+
+	if (posix_memalign(&p, SNAP_RECORD_BLOCK_SIZE, bytes) != 0)
+		return NULL;
+
+	return (unsigned char *)p;
+}
+
+snap_recorder::snap_recorder(const std::string &filename, int packet_type, size_t packet_size, uint16_t port,
+		int codec, int num_threads, size_t chunk_bytes) {
+	d_filename = filename;
+	d_packet_type = packet_type;
+	d_packet_size = packet_size;
+	d_port = port;
+	d_codec = codec;
+	d_num_threads = (num_threads > 0) ? num_threads : 1;
+
+	d_packets_per_chunk = chunk_bytes / d_packet_size;
+
+	if (d_packets_per_chunk < 1)
+		d_packets_per_chunk = 1;
+
+	d_chunk_bytes = d_packets_per_chunk * d_packet_size;
+	d_header_room = ((sizeof(snap_record_chunk_header) + 63) / 64) * 64;
+
+	d_fd = -1;
+	d_direct_io = false;
+	d_file_offset = 0;
+
+	d_current = NULL;
+	d_next_sequence = 0;
+	d_next_write = 0;
+	d_stopping = false;
+
+	d_packets = 0;
+	d_dropped = 0;
+	d_raw_bytes = 0;
+	d_stored_bytes = 0;
+	d_write_failed = false;
+}
+
+snap_recorder::~snap_recorder() {
+	close();
+
+	for (size_t i=0;i<d_chunks.size();i++) {
+		free(d_chunks[i]->raw);
+		free(d_chunks[i]->out);
+		delete d_chunks[i];
+	}
+
+	d_chunks.clear();
+	d_free.clear();
+}
+
+bool snap_recorder::codec_available(int codec) {
+	switch (codec) {
+	case SNAP_RECORD_CODEC_NONE:
+		return true;
+	case SNAP_RECORD_CODEC_LZ4:
+#ifdef HAVE_LZ4
+		return true;
+#else
+		return false;
+#endif
+	case SNAP_RECORD_CODEC_ZSTD:
+#ifdef HAVE_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char *snap_recorder::codec_name(int codec) {
+	switch (codec) {
+	case SNAP_RECORD_CODEC_NONE:
+		return "none";
+	case SNAP_RECORD_CODEC_LZ4:
+		return "lz4";
+	case SNAP_RECORD_CODEC_ZSTD:
+		return "zstd";
+	default:
+		return "unknown";
+	}
+}
+
+bool snap_recorder::open() {
+	if (d_fd >= 0)
+		return true;
+
+	if (!codec_available(d_codec)) {
+		std::stringstream msg;
+		msg << "This build doesn't support " << codec_name(d_codec) << " compression.";
+		d_last_error = msg.str();
+		return false;
+	}
+
+	// Some filesystems (tmpfs for one) don't do O_DIRECT.  Buffered writes work anywhere.
+	d_fd = ::open(d_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	d_direct_io = (d_fd >= 0);
+
+	if (d_fd < 0)
+		d_fd = ::open(d_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (d_fd < 0) {
+		d_last_error = "Unable to create " + d_filename + ": " + strerror(errno);
+		return false;
+	}
+
+	// Chunk buffers.  Enough for every compressor to have one in hand and a few more
+	// filling or waiting for the disk.
+	size_t num_chunks = (d_codec == SNAP_RECORD_CODEC_NONE) ? 6 : (d_num_threads * 2 + 4);
+	size_t out_bound = 0;
+
+#ifdef HAVE_LZ4
+	if (d_codec == SNAP_RECORD_CODEC_LZ4)
+		out_bound = LZ4_compressBound(d_chunk_bytes);
+#endif
+#ifdef HAVE_ZSTD
+	if (d_codec == SNAP_RECORD_CODEC_ZSTD)
+		out_bound = ZSTD_compressBound(d_chunk_bytes);
+#endif
+
+	for (size_t i=d_chunks.size();i<num_chunks;i++) {
+		chunk *c = new chunk();
+		c->raw_capacity = snap_record_padded_size(d_header_room + d_chunk_bytes);
+		c->raw = alloc_blocks(c->raw_capacity);
+
+		if (out_bound > 0) {
+			c->out_capacity = snap_record_padded_size(d_header_room + out_bound);
+			c->out = alloc_blocks(c->out_capacity);
+		}
+
+		d_chunks.push_back(c);
+
+		if (!c->raw || ((out_bound > 0) && !c->out)) {
+			d_last_error = "Unable to allocate recording buffers.";
+			::close(d_fd);
+			d_fd = -1;
+			return false;
+		}
+	}
+
+	d_free = d_chunks;
+	d_to_compress.clear();
+	d_to_write.clear();
+	d_index.clear();
+	d_current = NULL;
+	d_next_sequence = 0;
+	d_next_write = 0;
+	d_stopping = false;
+	d_file_offset = 0;
+	d_packets = 0;
+	d_dropped = 0;
+	d_raw_bytes = 0;
+	d_stored_bytes = 0;
+	d_write_failed = false;
+
+	unsigned char *block = alloc_blocks(SNAP_RECORD_BLOCK_SIZE);
+	memset(block, 0x00, SNAP_RECORD_BLOCK_SIZE);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	snap_record_file_header hdr;
+	memset(&hdr, 0x00, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_RECORD_MAGIC, 8);
+	hdr.version = SNAP_RECORD_VERSION;
+	hdr.packet_type = d_packet_type;
+	hdr.packet_size = d_packet_size;
+	hdr.port = d_port;
+	hdr.codec = d_codec;
+	hdr.chunk_bytes = d_chunk_bytes;
+	hdr.start_time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	memcpy(block, &hdr, sizeof(hdr));
+
+	bool ok = write_block(block, SNAP_RECORD_BLOCK_SIZE);
+	free(block);
+
+	if (!ok) {
+		::close(d_fd);
+		d_fd = -1;
+		return false;
+	}
+
+	if (d_codec != SNAP_RECORD_CODEC_NONE) {
+		for (int i=0;i<d_num_threads;i++)
+			d_threads.create_thread(boost::bind(&snap_recorder::run_compressor, this));
+	}
+
+	d_threads.create_thread(boost::bind(&snap_recorder::run_writer, this));
+
+	return true;
+}
+
+void snap_recorder::close() {
+	if (d_fd < 0)
+		return;
+
+	// The receive thread is done with the partial chunk by now.
+	if (d_current) {
+		if (d_current->header.num_packets > 0) {
+			hand_off(d_current);
+		}
+		else {
+			boost::unique_lock<boost::mutex> lock(d_mutex);
+			d_free.push_back(d_current);
+		}
+
+		d_current = NULL;
+	}
+
+	{
+		boost::unique_lock<boost::mutex> lock(d_mutex);
+		d_stopping = true;
+		d_compress_cond.notify_all();
+		d_write_cond.notify_all();
+	}
+
+	d_threads.join_all();
+
+	// Index, then the footer in the last block.
+	size_t index_bytes = snap_record_padded_size(sizeof(snap_record_index_header) + d_index.size() * sizeof(snap_record_index_entry));
+	unsigned char *block = alloc_blocks(index_bytes + SNAP_RECORD_BLOCK_SIZE);
+
+	if (block) {
+		memset(block, 0x00, index_bytes + SNAP_RECORD_BLOCK_SIZE);
+
+		snap_record_index_header index_hdr;
+		memset(&index_hdr, 0x00, sizeof(index_hdr));
+		memcpy(index_hdr.magic, SNAP_RECORD_INDEX_MAGIC, 8);
+		index_hdr.num_entries = d_index.size();
+		memcpy(block, &index_hdr, sizeof(index_hdr));
+
+		if (!d_index.empty())
+			memcpy(block + sizeof(index_hdr), &d_index[0], d_index.size() * sizeof(snap_record_index_entry));
+
+		snap_record_footer footer;
+		memset(&footer, 0x00, sizeof(footer));
+		memcpy(footer.magic, SNAP_RECORD_FOOTER_MAGIC, 8);
+		footer.index_offset = d_file_offset;
+		footer.num_chunks = d_index.size();
+		footer.num_packets = d_packets;
+		memcpy(block + index_bytes, &footer, sizeof(footer));
+
+		write_block(block, index_bytes + SNAP_RECORD_BLOCK_SIZE);
+		free(block);
+	}
+
+	::close(d_fd);
+	d_fd = -1;
+}
+
+snap_recorder::chunk *snap_recorder::take_free_chunk() {
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+
+	if (d_free.empty())
+		return NULL;
+
+	chunk *c = d_free.back();
+	d_free.pop_back();
+
+	memset(&c->header, 0x00, sizeof(c->header));
+	memcpy(c->header.magic, SNAP_RECORD_CHUNK_MAGIC, 8);
+	c->header.first_sample = UINT64_MAX;
+
+	return c;
+}
+
+void snap_recorder::write(const unsigned char *packet, uint64_t time_ns) {
+	if (d_fd < 0)
+		return;
+
+	if (!d_current) {
+		d_current = take_free_chunk();
+
+		if (!d_current) {
+			// Everything is still waiting on the compressors or the disk.
+			d_dropped++;
+			return;
+		}
+
+		d_current->header.first_time_ns = time_ns;
+	}
+
+	snap_record_chunk_header &hdr = d_current->header;
+	memcpy(d_current->raw + d_header_room + (size_t)hdr.num_packets * d_packet_size, packet, d_packet_size);
+
+	snap_header snap_hdr;
+
+	if (d_packet_type == SNAP_PACKETTYPE_VOLTAGE)
+		parse_voltage_header(snap_hdr, packet);
+	else
+		parse_spect_header(snap_hdr, packet);
+
+	if (snap_hdr.sample_number < hdr.first_sample)
+		hdr.first_sample = snap_hdr.sample_number;
+
+	if (snap_hdr.sample_number > hdr.last_sample)
+		hdr.last_sample = snap_hdr.sample_number;
+
+	hdr.last_time_ns = time_ns;
+	hdr.num_packets++;
+	d_packets++;
+
+	if (hdr.num_packets == d_packets_per_chunk) {
+		hand_off(d_current);
+		d_current = NULL;
+	}
+}
+
+void snap_recorder::hand_off(chunk *c) {
+	c->header.raw_bytes = (uint64_t)c->header.num_packets * d_packet_size;
+
+	if (d_codec == SNAP_RECORD_CODEC_NONE)
+		finish_chunk(c, SNAP_RECORD_CODEC_NONE, NULL);
+
+	boost::unique_lock<boost::mutex> lock(d_mutex);
+	c->sequence = d_next_sequence++;
+	c->header.sequence = c->sequence;
+
+	if (d_codec == SNAP_RECORD_CODEC_NONE) {
+		d_to_write[c->sequence] = c;
+		d_write_cond.notify_one();
+	}
+	else {
+		d_to_compress.push_back(c);
+		d_compress_cond.notify_one();
+	}
+}
+
+void snap_recorder::finish_chunk(chunk *c, int worker_codec, void *codec_context) {
+	size_t raw_bytes = c->header.raw_bytes;
+	size_t stored_bytes = 0;
+
+#ifdef HAVE_LZ4
+	if (worker_codec == SNAP_RECORD_CODEC_LZ4) {
+		int result = LZ4_compress_default((const char *)c->raw + d_header_room, (char *)c->out + d_header_room,
+				raw_bytes, c->out_capacity - d_header_room);
+
+		if (result > 0)
+			stored_bytes = result;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (worker_codec == SNAP_RECORD_CODEC_ZSTD) {
+		size_t result = ZSTD_compressCCtx((ZSTD_CCtx *)codec_context, c->out + d_header_room, c->out_capacity - d_header_room,
+				c->raw + d_header_room, raw_bytes, RECORDER_ZSTD_LEVEL);
+
+		if (!ZSTD_isError(result))
+			stored_bytes = result;
+	}
+#endif
+
+	if ((stored_bytes > 0) && (stored_bytes < raw_bytes)) {
+		c->stored = c->out;
+		c->header.codec = worker_codec;
+	}
+	else {
+		// Didn't compress (or wasn't asked to).  Store it as it came.
+		c->stored = c->raw;
+		c->header.codec = SNAP_RECORD_CODEC_NONE;
+		stored_bytes = raw_bytes;
+	}
+
+	c->header.stored_bytes = stored_bytes;
+
+	size_t used = d_header_room + stored_bytes;
+	c->stored_size = snap_record_padded_size(used);
+
+	memset(c->stored, 0x00, d_header_room);
+	memset(c->stored + used, 0x00, c->stored_size - used);
+}
+
+void snap_recorder::run_compressor() {
+	void *codec_context = NULL;
+
+#ifdef HAVE_ZSTD
+	if (d_codec == SNAP_RECORD_CODEC_ZSTD)
+		codec_context = ZSTD_createCCtx();
+#endif
+
+	while (true) {
+		chunk *c;
+
+		{
+			boost::unique_lock<boost::mutex> lock(d_mutex);
+
+			while (!d_stopping && d_to_compress.empty())
+				d_compress_cond.wait(lock);
+
+			if (d_to_compress.empty())
+				break;
+
+			c = d_to_compress.front();
+			d_to_compress.pop_front();
+		}
+
+		finish_chunk(c, d_codec, codec_context);
+
+		{
+			boost::unique_lock<boost::mutex> lock(d_mutex);
+			d_to_write[c->sequence] = c;
+			d_write_cond.notify_one();
+		}
+	}
+
+#ifdef HAVE_ZSTD
+	if (codec_context)
+		ZSTD_freeCCtx((ZSTD_CCtx *)codec_context);
+#endif
+}
+
+void snap_recorder::run_writer() {
+	while (true) {
+		chunk *c;
+
+		{
+			boost::unique_lock<boost::mutex> lock(d_mutex);
+
+			// Chunks can finish compressing out of order.  Write them in order.
+			while (d_to_write.find(d_next_write) == d_to_write.end()) {
+				if (d_stopping && (d_next_write == d_next_sequence))
+					return;
+
+				d_write_cond.wait(lock);
+			}
+
+			auto next = d_to_write.find(d_next_write);
+			c = next->second;
+			d_to_write.erase(next);
+			d_next_write++;
+		}
+
+		snap_record_index_entry entry;
+		memset(&entry, 0x00, sizeof(entry));
+		entry.offset = d_file_offset;
+		entry.num_packets = c->header.num_packets;
+		entry.first_sample = c->header.first_sample;
+		entry.last_sample = c->header.last_sample;
+		entry.first_time_ns = c->header.first_time_ns;
+		entry.last_time_ns = c->header.last_time_ns;
+
+		memcpy(c->stored, &c->header, sizeof(c->header));
+
+		if (!d_write_failed) {
+			if (write_block(c->stored, c->stored_size)) {
+				d_index.push_back(entry);
+				d_raw_bytes += c->header.raw_bytes;
+				d_stored_bytes += c->stored_size;
+			}
+			else {
+				d_write_failed = true;
+			}
+		}
+
+		boost::unique_lock<boost::mutex> lock(d_mutex);
+		d_free.push_back(c);
+	}
+}
+
+bool snap_recorder::write_block(const unsigned char *data, size_t len) {
+	size_t written = 0;
+
+	while (written < len) {
+		ssize_t result = pwrite(d_fd, data + written, len - written, d_file_offset + written);
+
+		if ((result < 0) && (errno == EINTR))
+			continue;
+
+		if ((result < 0) && (errno == EINVAL) && d_direct_io) {
+			// Opened with O_DIRECT but the filesystem won't actually do it.
+			int flags = fcntl(d_fd, F_GETFL);
+			fcntl(d_fd, F_SETFL, flags & ~O_DIRECT);
+			d_direct_io = false;
+			continue;
+		}
+
+		if (result <= 0) {
+			d_last_error = "Unable to write to " + d_filename + ": " + strerror(errno);
+			return false;
+		}
+
+		written += result;
+	}
+
+	d_file_offset += len;
+
+	return true;
+}
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,144 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_RECORDER_H
+#define INCLUDED_ATA_SNAP_RECORDER_H
+
+#include "snap_record_format.h"
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// Default packet data per chunk before compression.
+#define SNAP_RECORD_DEFAULT_CHUNK_BYTES (8 * 1024 * 1024)
+
+namespace gr {
+namespace ata {
+
+/*
+ * Writes SNAP payloads to a chunked .snaprec file (see snap_record_format.h) from a
+ * receive thread without ever holding it up.  Packets are copied into the current chunk
+ * buffer.  Full chunks are compressed (optionally) on a pool of worker threads, and one
+ * writer thread puts them on disk in order, with O_DIRECT where the filesystem allows it
+ * so a long recording doesn't churn the page cache.  If the disk or the compressors fall
+ * behind and every chunk buffer is in use, packets are dropped and counted rather than
+ * stalling the receiver.
+ */
+class snap_recorder {
+protected:
+	struct chunk {
+		uint64_t sequence;
+		// Block aligned.  Packet data starts after room for the chunk header.
+		unsigned char *raw = NULL;
+		size_t raw_capacity = 0;
+		// Compressed copy with its own header room, if compressing.
+		unsigned char *out = NULL;
+		size_t out_capacity = 0;
+
+		snap_record_chunk_header header;
+		// Which buffer holds the finished chunk, header and all.
+		unsigned char *stored = NULL;
+		size_t stored_size = 0;
+	};
+
+	std::string d_filename;
+	int d_packet_type;
+	size_t d_packet_size;
+	uint16_t d_port;
+	int d_codec;
+	int d_num_threads;
+	size_t d_chunk_bytes;
+	size_t d_packets_per_chunk;
+	size_t d_header_room;
+
+	int d_fd;
+	bool d_direct_io;
+	uint64_t d_file_offset;
+	std::string d_last_error;
+
+	std::vector<chunk *> d_chunks;
+	std::vector<chunk *> d_free;
+	std::deque<chunk *> d_to_compress;
+	std::map<uint64_t, chunk *> d_to_write;
+
+	// Filled by the receive thread.  Not shared until it's handed off.
+	chunk *d_current;
+	uint64_t d_next_sequence;
+	uint64_t d_next_write;
+
+	boost::mutex d_mutex;
+	boost::condition_variable d_compress_cond;
+	boost::condition_variable d_write_cond;
+	boost::thread_group d_threads;
+	bool d_stopping;
+
+	std::vector<snap_record_index_entry> d_index;
+
+	uint64_t d_packets;
+	uint64_t d_dropped;
+	uint64_t d_raw_bytes;
+	uint64_t d_stored_bytes;
+	bool d_write_failed;
+
+	chunk *take_free_chunk();
+	void hand_off(chunk *c);
+	void finish_chunk(chunk *c, int worker_codec, void *codec_context);
+	bool write_block(const unsigned char *data, size_t len);
+
+	void run_compressor();
+	void run_writer();
+
+public:
+	snap_recorder(const std::string &filename, int packet_type, size_t packet_size, uint16_t port,
+			int codec=SNAP_RECORD_CODEC_NONE, int num_threads=2, size_t chunk_bytes=SNAP_RECORD_DEFAULT_CHUNK_BYTES);
+	virtual ~snap_recorder();
+
+	// Creates the file (replacing any that's there) and starts the threads.
+	bool open();
+	// Writes out anything buffered, then the index and footer.
+	void close();
+	bool is_open() { return d_fd >= 0; };
+
+	// Receive thread only.  Copies one packet of packet_size bytes.
+	void write(const unsigned char *packet, uint64_t time_ns);
+
+	uint64_t packets_recorded() { return d_packets; };
+	uint64_t packets_dropped() { return d_dropped; };
+	uint64_t raw_bytes() { return d_raw_bytes; };
+	uint64_t stored_bytes() { return d_stored_bytes; };
+	bool direct_io() { return d_direct_io; };
+	const std::string & last_error() { return d_last_error; };
+
+	// Whether this build can write the codec.
+	static bool codec_available(int codec);
+	static const char *codec_name(int codec);
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_RECORDER_H */
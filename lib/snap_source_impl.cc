@@ -27,7 +27,9 @@
 #include <inttypes.h>
 
 #include "snap_source_impl.h"
+#include "snap_unpack.h"
 #include <gnuradio/io_signature.h>
+#include <gnuradio/rpcregisterhelpers.h>
 #include <sstream>
 #include <boost/asio/signal_set.hpp>
 
@@ -37,12 +39,22 @@
 #include <net/if.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
+#include <sys/stat.h>
+#include <linux/sock_diag.h>
 
 #define THREAD_RECEIVE
 
 #define DS_NETWORK 1
 #define DS_MCAST 2
 #define DS_PCAP 3
+#define DS_RECORDING 4
+
+#define PCAP_PACING_NONE 0
+#define PCAP_PACING_CAPTURE_TIME 1
+#define PCAP_PACING_SNAP_CLOCK 2
+
+// Each voltage sample_number is one 4 microsecond SNAP time frame.
+#define SNAP_NS_PER_SAMPLE 4000
 
 // This is the maximum missed frames before we declare something went terribly wrong.
 // 10000 = 0.04 seconds
@@ -53,6 +65,12 @@ const int MAX_MISSED_SETS=20000;
 const int MAX_WORK_BUFF_SIZE=125000;
 // This is number of packets now.  So memory is this * packet size.
 #define MAX_NET_CIRC_BUFFER 1000000
+// Compression threads per source when recording.
+#define RECORDER_COMPRESS_THREADS 2
+// Decompression threads per source when playing back a recording, unless decode_threads says otherwise.
+#define RECORDING_PREFETCH_THREADS 2
+// How long the reader thread waits for the next decompressed chunk before checking back.
+#define RECORDING_READ_WAIT_MS 20
 
 
 namespace gr {
@@ -64,7 +82,10 @@ snap_source::sptr snap_source::make(int port,
 		bool sourceZeros, bool ipv6,
 		int starting_channel, int ending_channel,
 		int data_source, std::string file, bool repeat_file, bool packed_output,std::string mcast_group,
-		bool send_start_msg, std::string udp_ip) {
+		bool send_start_msg, std::string udp_ip, bool wait_for_align, uint64_t start_sample, uint64_t end_sample,
+		int pcap_pacing, double pacing_speedup, int loop_cache_mb, bool loop_continue_timestamps,
+		int decode_threads, std::string record_file, int record_compression, double stats_interval,
+		bool rx_timestamps, double quant_stats_interval) {
 	int data_size;
 	if (headerType == SNAP_PACKETTYPE_VOLTAGE) {
 		data_size = sizeof(char);
@@ -75,7 +96,9 @@ snap_source::sptr snap_source::make(int port,
 	return gnuradio::get_initial_sptr(
 			new snap_source_impl(port, headerType,
 					notifyMissed, sourceZeros, ipv6, starting_channel, ending_channel, data_size, data_source, file, repeat_file,
-					packed_output, mcast_group, send_start_msg, udp_ip));
+					packed_output, mcast_group, send_start_msg, udp_ip, wait_for_align, start_sample, end_sample,
+					pcap_pacing, pacing_speedup, loop_cache_mb, loop_continue_timestamps, decode_threads,
+					record_file, record_compression, stats_interval, rx_timestamps, quant_stats_interval));
 }
 
 /*
@@ -87,30 +110,68 @@ snap_source_impl::snap_source_impl(int port,
 		bool sourceZeros, bool ipv6,
 		int starting_channel, int ending_channel, int data_size,
 		int data_source, std::string file, bool repeat_file, bool packed_output,
-		std::string mcast_group, bool send_start_msg, std::string udp_ip)
+		std::string mcast_group, bool send_start_msg, std::string udp_ip, bool wait_for_align,
+		uint64_t start_sample, uint64_t end_sample, int pcap_pacing, double pacing_speedup,
+		int loop_cache_mb, bool loop_continue_timestamps, int decode_threads,
+		std::string record_file, int record_compression, double stats_interval,
+		bool rx_timestamps, double quant_stats_interval)
 : gr::sync_block("snap_src_" + std::to_string(port) + "_",
 		gr::io_signature::make(0, 0, 0),
 		gr::io_signature::make(1, 4,
-				(headerType == SNAP_PACKETTYPE_VOLTAGE) ? data_size * (ending_channel-starting_channel+1)*2:data_size * (ending_channel-starting_channel+1)))
+				(headerType == SNAP_PACKETTYPE_VOLTAGE) ? data_size * (ending_channel-starting_channel+1)*2:data_size * (ending_channel-starting_channel+1))),
+d_stats(MMSG_LENGTH)
 #ifdef USE_CIRC_VB
-seq_num_queue(MAX_WORK_BUFF_SIZE),x_vector_queue(MAX_WORK_BUFF_SIZE),y_vector_queue(MAX_WORK_BUFF_SIZE),
+,seq_num_queue(MAX_WORK_BUFF_SIZE),arrival_queue(MAX_WORK_BUFF_SIZE),x_vector_queue(MAX_WORK_BUFF_SIZE),y_vector_queue(MAX_WORK_BUFF_SIZE),
 xx_vector_queue(MAX_WORK_BUFF_SIZE),yy_vector_queue(MAX_WORK_BUFF_SIZE),xy_real_vector_queue(MAX_WORK_BUFF_SIZE),xy_imag_vector_queue(MAX_WORK_BUFF_SIZE)
 #endif
 {
 	d_udp_ip = udp_ip;
 
 	d_send_start_msg = send_start_msg;
+	d_wait_for_align = wait_for_align;
 
-	if (data_source == DS_PCAP) {
+	if (d_wait_for_align && (headerType != SNAP_PACKETTYPE_VOLTAGE)) {
+		GR_LOG_WARN(d_logger, "Wait for alignment only applies to voltage sources.  Use a synchronizer on the spectrometer outputs instead.  Ignoring.");
+		d_wait_for_align = false;
+	}
+
+	if (d_wait_for_align && !d_send_start_msg) {
+		GR_LOG_WARN(d_logger, "Wait for alignment is enabled without send start message.  The synchronizer will never hear from this source.");
+	}
+
+	if ((data_source == DS_PCAP) || (data_source == DS_RECORDING)) {
 		d_use_pcap = true;
 	}
 	else {
 		d_use_pcap = false;
 	}
 
+	d_use_recording = (data_source == DS_RECORDING);
+
 	d_file = file;
 	d_repeat_file = repeat_file;
 	pcap_file_done = false;
+	d_start_sample = start_sample;
+	d_end_sample = end_sample;
+
+	if ((d_end_sample > 0) && (d_end_sample <= d_start_sample)) {
+		GR_LOG_WARN(d_logger, "end_sample is not after start_sample.  Ignoring end_sample.");
+		d_end_sample = 0;
+	}
+
+	d_pcap_pacing = pcap_pacing;
+
+	if ((d_pcap_pacing == PCAP_PACING_SNAP_CLOCK) && (headerType != SNAP_PACKETTYPE_VOLTAGE)) {
+		GR_LOG_WARN(d_logger, "Pacing by the SNAP sample clock needs voltage packets.  Pacing by capture timestamps instead.");
+		d_pcap_pacing = PCAP_PACING_CAPTURE_TIME;
+	}
+
+	if (pacing_speedup <= 0.0) {
+		GR_LOG_WARN(d_logger, "Pacing speed-up must be greater than 0.  Using 1.0.");
+		pacing_speedup = 1.0;
+	}
+
+	d_pacing_clock.set_speed(pacing_speedup);
 
 	d_data_source = data_source;
 	d_mcast_group = mcast_group;
@@ -140,8 +201,54 @@ xx_vector_queue(MAX_WORK_BUFF_SIZE),yy_vector_queue(MAX_WORK_BUFF_SIZE),xy_real_
 			throw std::runtime_error("[SNAP Source] can't open pcap file");
 			return;
 		}
+	}
 
-		openPCAP();
+	if (d_use_recording) {
+		if (d_file.length() == 0) {
+			GR_LOG_ERROR(d_logger, "No recording file name provided.  Please provide a filename.");
+			throw std::runtime_error("[SNAP Source] No recording file name provided.  Please provide a filename.");
+			return;
+		}
+
+		d_record_reader.reset(new snap_record_reader());
+
+		if (!d_record_reader->open(d_file)) {
+			GR_LOG_ERROR(d_logger, d_record_reader->last_error());
+			throw std::runtime_error("[SNAP Source] can't open recording file");
+			return;
+		}
+
+		if (d_record_reader->packet_type() != headerType) {
+			std::stringstream msg;
+			msg << d_file << " holds " << ((d_record_reader->packet_type() == SNAP_PACKETTYPE_VOLTAGE) ? "voltage" : "spectrometer") <<
+					" packets, which doesn't match the source's mode.";
+			GR_LOG_ERROR(d_logger, msg.str());
+			throw std::runtime_error("[SNAP Source] recording doesn't match the source's mode");
+			return;
+		}
+
+		if (!d_record_reader->closed_cleanly()) {
+			std::stringstream msg;
+			msg << "[SNAP Source] " << d_file << " wasn't closed cleanly.  Found " << d_record_reader->num_chunks() << " complete chunks.";
+			GR_LOG_WARN(d_logger, msg.str());
+		}
+
+		if (d_record_reader->port() != port) {
+			std::stringstream msg;
+			msg << "[SNAP Source] " << d_file << " was recorded from UDP port " << d_record_reader->port() << ".  Playing it back as port " << port << ".";
+			GR_LOG_INFO(d_logger, msg.str());
+		}
+
+		if (d_start_sample > 0) {
+			d_record_start_chunk = d_record_reader->find_chunk(d_start_sample);
+
+			std::stringstream msg;
+			msg << "[SNAP Source] Starting at chunk " << d_record_start_chunk << " of " << d_record_reader->num_chunks() <<
+					" for sample_number " << d_start_sample;
+			GR_LOG_INFO(d_logger, msg.str());
+		}
+
+		d_record_threads = (decode_threads > 0) ? decode_threads : RECORDING_PREFETCH_THREADS;
 	}
 
 	is_ipv6 = ipv6;
@@ -149,9 +256,117 @@ xx_vector_queue(MAX_WORK_BUFF_SIZE),yy_vector_queue(MAX_WORK_BUFF_SIZE),xy_real_
 	d_packed_output = packed_output;
 
 	d_port = port;
+
+	if (decode_threads > 0) {
+		if (!d_use_pcap || (headerType != SNAP_PACKETTYPE_VOLTAGE)) {
+			GR_LOG_WARN(d_logger, "Offline decoding only applies to voltage captures.  Ignoring.");
+		}
+		else if (d_pcap_pacing != PCAP_PACING_NONE) {
+			GR_LOG_WARN(d_logger, "Offline decoding runs as fast as it can and can't be paced.  Using the standard reader.");
+		}
+		else if (d_wait_for_align) {
+			GR_LOG_WARN(d_logger, "Offline decoding can't wait for alignment from a synchronizer.  Using the standard reader.");
+		}
+		else {
+			bool opened = false;
+
+			if (d_use_recording) {
+				snap_record_chunk_decoder *decoder = new snap_record_chunk_decoder(d_file, starting_channel, ending_channel,
+						packed_output, decode_threads, d_repeat_file, d_start_sample, d_end_sample, MAX_MISSED_SETS);
+				d_chunk_decoder.reset(decoder);
+				opened = decoder->open();
+			}
+			else {
+				pcap_index index;
+
+				if (load_pcap_index(index)) {
+					pcap_chunk_decoder *decoder = new pcap_chunk_decoder(d_file, d_port, starting_channel, ending_channel,
+							packed_output, decode_threads, d_repeat_file, d_start_sample, d_end_sample, MAX_MISSED_SETS);
+					d_chunk_decoder.reset(decoder);
+					opened = decoder->open(index);
+				}
+			}
+
+			if (opened) {
+				d_offline_decode = true;
+
+				std::stringstream msg;
+				msg << "[SNAP Source] Decoding " << d_file << " port " << d_port << " offline with " << decode_threads <<
+						" threads in " << d_chunk_decoder->num_regions() << " chunks.";
+				GR_LOG_INFO(d_logger, msg.str());
+			}
+			else if (d_chunk_decoder) {
+				std::stringstream msg;
+				msg << "[SNAP Source] Unable to set up offline decoding: " << d_chunk_decoder->last_error() << ".  Using the standard reader.";
+				GR_LOG_WARN(d_logger, msg.str());
+				d_chunk_decoder.reset();
+			}
+		}
+	}
+
+	d_record_file = record_file;
+	d_record_compression = record_compression;
+
+	if (d_record_file.length() > 0) {
+		if (d_offline_decode) {
+			GR_LOG_WARN(d_logger, "Recording isn't available with offline decoding.  Nothing will be recorded.");
+			d_record_file = "";
+		}
+		else if (!snap_recorder::codec_available(d_record_compression)) {
+			std::stringstream msg;
+			msg << "[SNAP Source] This build doesn't support " << snap_recorder::codec_name(d_record_compression) <<
+					" compression.  Recording uncompressed.";
+			GR_LOG_WARN(d_logger, msg.str());
+			d_record_compression = SNAP_RECORD_CODEC_NONE;
+		}
+	}
+
+	if (d_use_recording && (loop_cache_mb > 0)) {
+		GR_LOG_INFO(d_logger, "The loop cache only applies to PCAP files.  Recordings repeat from the file.");
+	}
+	else if (d_use_pcap && d_repeat_file && (loop_cache_mb > 0) && !d_offline_decode) {
+		struct stat st;
+
+		if ((stat(d_file.c_str(), &st) == 0) && ((uint64_t)st.st_size <= (uint64_t)loop_cache_mb * 1024ULL * 1024ULL)) {
+			// The payloads are smaller than the records they came in, so the file size is always enough.
+			if (d_loop_cache.allocate(st.st_size)) {
+				d_use_loop_cache = true;
+			}
+			else {
+				std::stringstream msg;
+				msg << "[SNAP Source] Unable to reserve " << (st.st_size / (1024*1024)) << " MB for the loop cache.  Repeating from the file.";
+				GR_LOG_WARN(d_logger, msg.str());
+			}
+		}
+		else {
+			std::stringstream msg;
+			msg << "[SNAP Source] " << d_file << " is larger than the " << loop_cache_mb << " MB loop cache limit.  Repeating from the file.";
+			GR_LOG_INFO(d_logger, msg.str());
+		}
+	}
+
+	if (loop_continue_timestamps) {
+		if (d_use_loop_cache && (headerType == SNAP_PACKETTYPE_VOLTAGE)) {
+			d_loop_continue_timestamps = true;
+		}
+		else {
+			GR_LOG_WARN(d_logger, "Timestamp continuation only applies to voltage captures repeated from the loop cache.  Ignoring.");
+		}
+	}
+
+	if (d_use_pcap && !d_offline_decode) {
+		// Needs the port to subscribe to the shared reader.
+		openPCAP();
+	}
 	d_last_channel_block = -1;
 	d_last_timestamp = 0;
 	d_notifyMissed = notifyMissed;
+	d_last_sample_out = 0;
+	d_stats_interval = stats_interval;
+	d_next_stats_ns = 0;
+	d_rx_timestamps = rx_timestamps;
+	d_quant_stats_interval = (headerType == SNAP_PACKETTYPE_VOLTAGE && !d_offline_decode) ? quant_stats_interval : 0.0;
+	d_pmt_rx_time = pmt::string_to_symbol("rx_time");
 	d_sourceZeros = sourceZeros;
 	d_partialFrameCounter = 0;
 
@@ -209,6 +424,9 @@ xx_vector_queue(MAX_WORK_BUFF_SIZE),yy_vector_queue(MAX_WORK_BUFF_SIZE),xy_real_
 
 		d_veclen = d_channel_diff * 2;
 
+		if (d_quant_stats_interval > 0.0)
+			d_quant_stats.resize(d_channel_diff);
+
 		// We're going to lay out the 2-dimensional array as a contiguous block of memory.
 		// This will make multi-vector copies in work faster as well, ensuring we have
 		// contiguous memory.  The 16 comes from each packet having 16 time samples
@@ -231,6 +449,7 @@ xx_vector_queue(MAX_WORK_BUFF_SIZE),yy_vector_queue(MAX_WORK_BUFF_SIZE),xy_real_
 		d_channel_diff = 4096;
 
 		channels_per_packet = 512;
+		packets_per_frame = d_channel_diff / channels_per_packet;
 
 		d_veclen = 4096;
 		vector_buffer_size = d_veclen * sizeof(float);
@@ -257,12 +476,32 @@ xx_vector_queue(MAX_WORK_BUFF_SIZE),yy_vector_queue(MAX_WORK_BUFF_SIZE),xy_real_
 	}
 
 	message_port_register_out(pmt::mp("sync_header"));
+	message_port_register_out(pmt::mp("stats"));
+	message_port_register_out(pmt::mp("quant_stats"));
 	message_port_register_in(pmt::mp("sync"));
 	set_msg_handler(pmt::mp("sync"), boost::bind(&snap_source_impl::handleSyncMsg, this, _1) );
 }
 
 void snap_source_impl::handleSyncMsg(pmt::pmt_t msg) {
 	pmt::pmt_t data = pmt::cdr(msg);
+
+	if (pmt::eq(pmt::car(msg), pmt::mp("align_timestamp"))) {
+		// The synchronizer is telling us where the common start is.
+		// Frames before it get dropped in work() rather than downstream.
+		if (d_align_timed_out) {
+			GR_LOG_WARN(d_logger, "An align_timestamp arrived after this source gave up waiting and started unaligned.  Ignoring it.");
+			return;
+		}
+
+		try {
+			d_align_timestamp = pmt::to_uint64(data);
+		}
+		catch(...) {
+			GR_LOG_WARN(d_logger, "An align_timestamp PMT message was received that could not be converted to a uint64.");
+		}
+		return;
+	}
+
 	try {
 		sync_timestamp = pmt::to_uint64(data);
 	}
@@ -282,6 +521,40 @@ snap_source_impl::~snap_source_impl() {
 
 void snap_source_impl::openPCAP() {
 	gr::thread::scoped_lock lock(fp_mutex);
+
+	if (d_use_recording) {
+		d_record_chunk.reset();
+		d_record_packet = 0;
+		d_record_prefetcher.reset(new snap_record_prefetcher(*d_record_reader, d_record_start_chunk, d_record_threads));
+		d_record_prefetcher->start();
+		return;
+	}
+
+	if (!d_pcap_fallback) {
+		std::string error;
+		d_pcap_demux = pcap_demux::get(d_file, error);
+
+		if (d_pcap_demux) {
+			// The header walk assumes Ethernet framing, same as with libpcap.
+			if (d_pcap_demux->link_type() != DLT_EN10MB) {
+				std::stringstream msg;
+				msg << "[SNAP Source] " << d_file << " has link type " << d_pcap_demux->link_type() << ".  Only Ethernet captures are supported.";
+				GR_LOG_WARN(d_logger, msg.str());
+			}
+
+			// With the loop cache we only read the file once and do our own repeating.
+			d_pcap_subscriber = d_pcap_demux->subscribe(d_port, d_repeat_file && !d_use_loop_cache);
+			d_pcap_demux->request_start_offset(find_pcap_start());
+			return;
+		}
+		else {
+			std::stringstream msg;
+			msg << "[SNAP Source] Unable to map capture file, falling back to libpcap: " << error;
+			GR_LOG_WARN(d_logger, msg.str());
+			d_pcap_fallback = true;
+		}
+	}
+
 	char errbuf[PCAP_ERRBUF_SIZE];
 	try {
 		pcapFile = pcap_open_offline(d_file.c_str(), errbuf);
@@ -302,10 +575,201 @@ void snap_source_impl::openPCAP() {
 
 void snap_source_impl::closePCAP() {
 	gr::thread::scoped_lock lock(fp_mutex);
+
+	if (d_record_prefetcher) {
+		// Queued packets are copies, so they can stay.
+		d_record_prefetcher->stop();
+
+		if (d_record_prefetcher->damaged_chunks() > 0) {
+			std::stringstream msg;
+			msg << "[SNAP Source] Skipped " << d_record_prefetcher->damaged_chunks() << " damaged chunks in " << d_file;
+			GR_LOG_WARN(d_logger, msg.str());
+		}
+
+		d_record_prefetcher.reset();
+		d_record_chunk.reset();
+	}
 	if (pcapFile != NULL) {
 		pcap_close(pcapFile);
 		pcapFile = NULL;
 	}
+
+	if (d_pcap_demux) {
+		// Anything still queued points into the mapping (unless it was all copied to the loop cache).
+		if (d_localqueue && !d_use_loop_cache) {
+			gr::thread::scoped_lock guard(d_net_mutex);
+			d_localqueue->clear();
+		}
+
+		d_pcap_demux->unsubscribe(d_pcap_subscriber);
+		d_pcap_subscriber = -1;
+		// The file is unmapped once the last source lets go of it.
+		d_pcap_demux.reset();
+	}
+}
+
+bool snap_source_impl::load_pcap_index(pcap_index &index) {
+	std::string index_file = pcap_index::index_filename(d_file);
+
+	if (index.load(index_file) && index.matches(d_file)) {
+		if (index.packet_type() == d_header_type)
+			return true;
+
+		std::stringstream msg;
+		msg << "[SNAP Source] " << index_file << " indexes " << ((index.packet_type() == SNAP_PACKETTYPE_VOLTAGE) ? "voltage" : "spectrometer") <<
+				" packets, not " << ((d_header_type == SNAP_PACKETTYPE_VOLTAGE) ? "voltage" : "spectrometer") << " packets.  Rebuilding it.";
+		GR_LOG_WARN(d_logger, msg.str());
+	}
+
+	std::stringstream msg;
+	msg << "[SNAP Source] Building timestamp index for " << d_file << ".  Run snap-pcap-index on the capture ahead of time to skip this.";
+	GR_LOG_INFO(d_logger, msg.str());
+
+	uint64_t stride = (d_header_type == SNAP_PACKETTYPE_VOLTAGE) ? PCAP_INDEX_DEFAULT_STRIDE : PCAP_INDEX_DEFAULT_SPECT_STRIDE;
+
+	if (!index.build(d_file, stride, d_header_type)) {
+		std::stringstream msg;
+		msg << "[SNAP Source] Unable to index " << d_file << ": " << index.last_error();
+		GR_LOG_WARN(d_logger, msg.str());
+		return false;
+	}
+
+	if (!index.save(index_file)) {
+		std::stringstream msg;
+		msg << "[SNAP Source] " << index.last_error() << ".  The index will be rebuilt next time.";
+		GR_LOG_WARN(d_logger, msg.str());
+	}
+
+	return true;
+}
+
+size_t snap_source_impl::find_pcap_start() {
+	if (d_start_sample == 0)
+		return 0;
+
+	pcap_index index;
+
+	if (!load_pcap_index(index)) {
+		GR_LOG_WARN(d_logger, "[SNAP Source] Reading from the start of the file.");
+		return 0;
+	}
+
+	uint64_t file_offset;
+
+	if (!index.find(d_port, d_start_sample, file_offset)) {
+		std::stringstream msg;
+		msg << "[SNAP Source] No packets for port " << d_port << " in " << d_file;
+		GR_LOG_WARN(d_logger, msg.str());
+		return 0;
+	}
+
+	std::stringstream msg;
+	msg << "[SNAP Source] Starting at file offset " << file_offset << " for sample_number " << d_start_sample;
+	GR_LOG_INFO(d_logger, msg.str());
+
+	return file_offset;
+}
+
+void snap_source_impl::finish_loop_cache() {
+	if (d_loop_cache.size() == 0) {
+		// Nothing to repeat.
+		pcap_file_done = true;
+		return;
+	}
+
+	// Each voltage packet carries 16 time frames.
+	d_loop_cache.finish(16);
+
+	// Done with the file itself.
+	closePCAP();
+
+	std::stringstream msg;
+	msg << "[SNAP Source] Cached " << d_loop_cache.size() << " packets (" << (d_loop_cache.bytes() / (1024*1024)) << " MB) from " << d_file << ".  Repeating from memory.";
+	GR_LOG_INFO(d_logger, msg.str());
+}
+
+bool snap_source_impl::next_pcap_payload(unsigned char *&pData, size_t &len, bool &end_of_file) {
+	end_of_file = false;
+
+	if (d_loop_cache.ready()) {
+		uint64_t time_ns;
+
+		if (!d_loop_cache.next(pData, len, time_ns, d_loop_sample_offset)) {
+			end_of_file = true;
+			return false;
+		}
+
+		d_pcap_packet_time_ns = time_ns;
+
+		return true;
+	}
+
+	if (d_record_prefetcher) {
+		while (!d_record_chunk || (d_record_packet >= d_record_chunk->num_packets)) {
+			if (!d_record_prefetcher->next(d_record_chunk, end_of_file, RECORDING_READ_WAIT_MS))
+				return false;
+
+			d_record_packet = 0;
+		}
+
+		len = d_record_reader->packet_size();
+		pData = (unsigned char *)d_record_chunk->packets + (size_t)d_record_packet * len;
+
+		// The recording only keeps the first and last arrival time of each chunk, so
+		// spread the packets evenly between them for pacing.
+		uint64_t time_ns = d_record_chunk->first_time_ns;
+
+		if ((d_record_chunk->num_packets > 1) && (d_record_chunk->last_time_ns > time_ns)) {
+			time_ns += (uint64_t)((double)(d_record_chunk->last_time_ns - time_ns) * d_record_packet /
+					(d_record_chunk->num_packets - 1));
+		}
+
+		d_pcap_packet_time_ns = time_ns;
+		pcap_header.ts.tv_sec = time_ns / 1000000000ULL;
+		pcap_header.ts.tv_usec = (time_ns % 1000000000ULL) / 1000;
+
+		d_record_packet++;
+
+		return true;
+	}
+
+	if (d_pcap_demux) {
+		pcap_payload payload;
+
+		if (!d_pcap_demux->next(d_pcap_subscriber, payload, end_of_file))
+			return false;
+
+		pData = (unsigned char *)payload.data;
+		len = payload.len;
+		d_pcap_packet_time_ns = payload.timestamp_ns;
+		pcap_header.ts.tv_sec = payload.timestamp_ns / 1000000000ULL;
+		pcap_header.ts.tv_usec = (payload.timestamp_ns % 1000000000ULL) / 1000;
+
+		return true;
+	}
+
+	const u_char *p;
+	uint16_t destPort;
+	const unsigned char *payload;
+
+	while ((pcapFile != NULL) && (p = pcap_next(pcapFile, &pcap_header))) {
+		if (pcap_header.len != pcap_header.caplen) {
+			continue;
+		}
+
+		if (!pcap_mmap_reader::udp_payload(p, pcap_header.caplen, destPort, payload, len)) {
+			continue;
+		}
+
+		if (destPort == d_port) {
+			pData = (unsigned char *)payload;
+			d_pcap_packet_time_ns = (uint64_t)pcap_header.ts.tv_sec * 1000000000ULL + (uint64_t)pcap_header.ts.tv_usec * 1000ULL;
+			return true;
+		}
+	}
+
+	end_of_file = true;
+	return false;
 }
 
 bool snap_source_impl::start() {
@@ -328,6 +792,8 @@ bool snap_source_impl::start() {
 			iovecs[i].iov_len          = total_packet_size;
 			msgs[i].msg_hdr.msg_iov    = &iovecs[i];
 			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = msg_control[i];
+			msgs[i].msg_hdr.msg_controllen = MMSG_CONTROL_LENGTH;
 		}
 		timeout.tv_sec = MMSG_TIMEOUT;
 		timeout.tv_nsec = 0;
@@ -395,7 +861,7 @@ bool snap_source_impl::start() {
 		try {
 			boost::system::error_code error_code;
 			// 100*1024*1024 = what we normally set rmem_max to: 104857600
-			d_udpsocket->set_option(boost::asio::socket_base::receive_buffer_size(100*1024*1024), error_code);
+			d_udpsocket->set_option(boost::asio::socket_base::receive_buffer_size(RECEIVE_BUFFER_BYTES), error_code);
 		} catch (const std::exception &ex) {
 			throw std::runtime_error(std::string("[SNAP Source] Error occurred: ") +
 					ex.what());
@@ -411,6 +877,8 @@ bool snap_source_impl::start() {
 			}
 		}
 
+		setup_socket_stats();
+
 		std::stringstream msg_stream;
 		if (d_use_mcast) {
 			msg_stream << "Listening for data on multicast group " << d_mcast_group << " on port " << d_port << ".";
@@ -463,9 +931,58 @@ bool snap_source_impl::start() {
 	async_buffer = new unsigned char[total_packet_size];
 	d_udp_recv_buf_size = total_packet_size;
 
+	// Playback time starts with the first packet we queue.
+	d_pacing_clock.reset();
+
+	if (d_record_file.length() > 0) {
+		d_recorder.reset(new snap_recorder(d_record_file, d_header_type, total_packet_size, d_port, d_record_compression,
+				RECORDER_COMPRESS_THREADS));
+
+		if (!d_recorder->open()) {
+			std::stringstream msg_stream;
+			msg_stream << "Unable to start recording: " << d_recorder->last_error();
+			GR_LOG_ERROR(d_logger, msg_stream.str());
+			d_recorder.reset();
+
+			throw std::runtime_error("[SNAP Source] " + msg_stream.str());
+		}
+
+		std::stringstream msg_stream;
+		msg_stream << "Recording to " << d_record_file << " (compression: " << snap_recorder::codec_name(d_record_compression) << ")";
+
+		if (!d_recorder->direct_io())
+			msg_stream << ".  The filesystem doesn't support O_DIRECT, so writes go through the page cache";
+
+		msg_stream << ".";
+		GR_LOG_INFO(d_logger, msg_stream.str());
+	}
+
+	snap_stats_shm_info shm_info;
+	shm_info.kind = SNAP_STATS_SHM_KIND_SOURCE;
+	shm_info.block_name = alias();
+	shm_info.port = d_use_pcap ? -1 : d_port;
+	shm_info.packet_type = d_header_type;
+	shm_info.packet_size = total_packet_size;
+	shm_info.num_inputs = d_channel_diff;
+	shm_info.num_values = SNAP_SHM_SRC_NUM_VALUES;
+
+	d_stats_shm.reset(new snap_stats_shm_segment(shm_info, boost::bind(&snap_source_impl::fill_stats_shm, this, _1)));
+
+	if (!d_stats_shm->open()) {
+		// Monitoring is nice to have, so carry on without it.
+		GR_LOG_WARN(d_logger, "Statistics won't be visible to snap-top.  " + d_stats_shm->last_error());
+		d_stats_shm.reset();
+	}
+
+	if (d_offline_decode) {
+		// The decoder's own workers do all the reading.
+		d_chunk_decoder->start();
+	}
+	else {
 #ifdef THREAD_RECEIVE
-	proc_thread = new boost::thread(boost::bind(&snap_source_impl::runThread, this));
+		proc_thread = new boost::thread(boost::bind(&snap_source_impl::runThread, this));
 #endif
+	}
 
 	return true;
 }
@@ -473,6 +990,8 @@ bool snap_source_impl::start() {
 bool snap_source_impl::stop() {
 	stop_thread = true;
 
+	d_stats_shm.reset();
+
 	if (proc_thread) {
 		if (d_udpsocket) {
 			d_udpsocket->cancel();
@@ -486,8 +1005,44 @@ bool snap_source_impl::stop() {
 		proc_thread = NULL;
 	}
 
+	if (d_chunk_decoder)
+		d_chunk_decoder->stop();
+
+	if (d_recorder) {
+		// The receive thread is gone, so the last partial chunk can be flushed.
+		d_recorder->close();
+
+		std::stringstream msg_stream;
+		msg_stream << "Recorded " << d_recorder->packets_recorded() << " packets to " << d_record_file << " (" <<
+				(d_recorder->stored_bytes() / (1024*1024)) << " MB on disk for " << (d_recorder->raw_bytes() / (1024*1024)) << " MB of packets)";
+
+		if (d_recorder->packets_dropped() > 0)
+			msg_stream << ".  " << d_recorder->packets_dropped() << " packets were not recorded because the disk couldn't keep up";
+
+		if (d_recorder->last_error().length() > 0)
+			msg_stream << ".  " << d_recorder->last_error();
+
+		msg_stream << ".";
+
+		if ((d_recorder->packets_dropped() > 0) || (d_recorder->last_error().length() > 0))
+			GR_LOG_WARN(d_logger, msg_stream.str());
+		else
+			GR_LOG_INFO(d_logger, msg_stream.str());
+
+		d_recorder.reset();
+	}
+
 	closePCAP();
 
+	if (d_udpsocket && ((d_stats.kernel_drops.value() > 0) || (d_stats.queue_full_drops.value() > 0))) {
+		// Where the packets went tells you what to tune: the socket buffer (rmem_max) or how fast the flowgraph runs.
+		std::stringstream msg_stream;
+		msg_stream << "Port " << d_port << " lost " << d_stats.kernel_drops.value() << " packets in the kernel (socket buffer full, peak " <<
+				d_stats.socket_backlog.max() << " of " << d_stats.rcvbuf_bytes.value() << " bytes) and " << d_stats.queue_full_drops.value() <<
+				" packets in the receive queue (flowgraph not keeping up).";
+		GR_LOG_WARN(d_logger, msg_stream.str());
+	}
+
 	if (d_udpsocket) {
 		if (d_use_mcast) {
 			boost::system::error_code ec;
@@ -567,11 +1122,14 @@ void snap_source_impl::handle_receive(const boost::system::error_code& error,
 {
 	// std::cout << "[" << identifier() << "] handle_receive called with " << bytes_transferred << " bytes" << std::endl;
 	if (!error) {
+		d_stats.packets_received.add();
+
 		if (!d_found_start_channel) {
 			// We're not synchronized on the first packet yet, so we're looking for it.
-			if (SNAP_PACKETTYPE_VOLTAGE) {
+			if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
 				if (!voltage_synchronize(async_buffer)) {
 					// we're still not sync'd.  So don't bother queueing the packet.
+					d_stats.packets_before_sync.add();
 					start_receive();
 					return;
 				}
@@ -579,6 +1137,7 @@ void snap_source_impl::handle_receive(const boost::system::error_code& error,
 			else {
 				if (!spect_synchronize(async_buffer)) {
 					// we're still not sync'd.  So don't bother queueing the packet.
+					d_stats.packets_before_sync.add();
 					start_receive();
 					return;
 				}
@@ -588,7 +1147,7 @@ void snap_source_impl::handle_receive(const boost::system::error_code& error,
 		// check for bad channel id first.
 		uint16_t channel_id;
 
-		if (SNAP_PACKETTYPE_VOLTAGE) {
+		if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
 			struct voltage_header *v_hdr = (struct voltage_header *)async_buffer;
 			channel_id = be16toh(v_hdr->chan);
 		}
@@ -612,6 +1171,7 @@ void snap_source_impl::handle_receive(const boost::system::error_code& error,
 			}
 
 			GR_LOG_ERROR(d_logger, msg_stream.str());
+			d_stats.bad_channel_packets.add();
 		}
 
 		// We'll only get here if we've sync'd and the id is good.  so the main work doesn't need to track this anymore.
@@ -620,7 +1180,7 @@ void snap_source_impl::handle_receive(const boost::system::error_code& error,
 #ifdef THREAD_RECEIVE
 			gr::thread::scoped_lock guard(d_net_mutex);
 #endif
-			d_localqueue->push_back(new_data);
+			queue_packet(new_data);
 		}
 		// An attempt at multipacket receive while still using async_receive.  If there's a lot of data outstanding,
 		// this receive will grab the rest of it.
@@ -661,56 +1221,16 @@ void snap_source_impl::copy_volt_data_to_vector_buffer(snap_header& hdr) {
 	// cycle through the time entry rows in the packet. (will always be 16)
 
 	int channel_offset_within_time_block = (hdr.channel_id - d_starting_channel) * 2;
+	voltage_code_counter *counter = NULL;
 
-	if (d_packed_output) {
-		unsigned char *x_pol;
-		for (int t=0;t<16;t++) {
-			// This moves us in the packet memory to the correct time row
-			int vector_start = t * d_veclen  + channel_offset_within_time_block;
-			// For packed output, the output is [IQ packed 4-bit] Xn,[IQ packed 4-bit] Yn,...
-			// Both go in the x_pol output.
-			x_pol = (unsigned char *)&x_vector_buffer[vector_start];
-
-			for (int sample=0;sample<256;sample++) {
-				int TwoS = 2*sample;
-
-				x_pol[TwoS] = vp->data[sample][t][0];
-				// In packed mode, this is actually y to put it in a single block output
-				x_pol[TwoS + 1] = vp->data[sample][t][1];
-			}
-		}
-	}
-	else {
-		// Note these are char rather than unsigned char because in this unpacking
-		// mode, we actually two's complement extract the signed input.
-		char *x_pol;
-		char *y_pol;
-		for (int t=0;t<16;t++) {
-			// This moves us in the packet memory to the correct time row
-			int vector_start = t * d_veclen  + channel_offset_within_time_block;
-			x_pol = &x_vector_buffer[vector_start];
-			y_pol = &y_vector_buffer[vector_start];
-
-			for (int sample=0;sample<256;sample++) {
-				int TwoS = 2*sample;
-				int TwoS1 = TwoS + 1;
-
-				// The 2.0 format reverses the [t][sample] index position to [sample][t].
-				x_pol[TwoS] = (char)(vp->data[sample][t][0] >> 4); // I
-				// Need to adjust twos-complement
-				x_pol[TwoS] = TwosComplementLookup4Bit(x_pol[TwoS]); // TwosComplement4Bit(x_pol[TwoS]);
-
-				x_pol[TwoS1] = (char)(vp->data[sample][t][0] & 0x0F);  // Q
-				x_pol[TwoS1] = TwosComplementLookup4Bit(x_pol[TwoS1]); // TwosComplement4Bit(x_pol[TwoS1]);
-
-				y_pol[TwoS] = (char)(vp->data[sample][t][1] >> 4); // I
-				y_pol[TwoS] = TwosComplementLookup4Bit(y_pol[TwoS]); // TwosComplement4Bit(y_pol[TwoS]);
-
-				y_pol[TwoS1] = (char)(vp->data[sample][t][1] & 0x0F);  // Q
-				y_pol[TwoS1] = TwosComplementLookup4Bit(y_pol[TwoS1]); // TwosComplement4Bit(y_pol[TwoS1]);
-			} // for sample
-		} // for t
-	} // if d_packet_output /else
+	if (d_quant_stats_interval > 0.0)
+		counter = d_quant_stats.counter();
+
+	unpack_voltage_packet(vp->data, x_vector_buffer, y_vector_buffer, d_veclen, channel_offset_within_time_block,
+			d_packed_output, twosComplementLUT, counter);
+
+	if (counter)
+		d_quant_stats.packet_done(hdr.channel_id - d_starting_channel, hdr.sample_number);
 
 #ifdef ZEROCOPY
 	{
@@ -721,7 +1241,9 @@ void snap_source_impl::copy_volt_data_to_vector_buffer(snap_header& hdr) {
 #endif
 }
 
-void snap_source_impl::queue_voltage_data(snap_header& hdr) {
+void snap_source_impl::queue_voltage_data(uint64_t sample_number) {
+	SNAP_TRACE3(frame_complete, d_port, sample_number, b_one_packet ? 1 : multipacket_frame_pkt_ctr);
+
 	for (int this_time_start=0;this_time_start<16;this_time_start++) {
 		int block_start = this_time_start * d_veclen;
 
@@ -744,7 +1266,10 @@ void snap_source_impl::queue_voltage_data(snap_header& hdr) {
 		}
 
 		if (sync_timestamp == 0)
-			seq_num_queue.push_back(hdr.sample_number);
+			seq_num_queue.push_back(sample_number);
+
+		if (d_rx_timestamps)
+			arrival_queue.push_back((this_time_start == 0) ? d_frame_arrival_ns : 0);
 	} // this_time_start
 }
 
@@ -800,12 +1325,47 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 			meta = pmt::dict_add(meta, pmt::mp("starting_channel"), pmt::mp(async_volt_sync_hdr.channel_id));
 			meta = pmt::dict_add(meta, pmt::mp("sample_number"), pmt::mp(async_volt_sync_hdr.sample_number));
 			meta = pmt::dict_add(meta, pmt::mp("firmware_version"), pmt::mp(async_volt_sync_hdr.firmware_version));
+			meta = pmt::dict_add(meta, pmt::mp("port"), pmt::mp(d_port));
 
 			pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
 			message_port_pub(pmt::mp("sync_header"), pdu);
 		}
 	}
 
+	if (liveWork && d_wait_for_align) {
+		// Hold everything in the packet queue until the synchronizer answers.  This only
+		// happens once, at startup.  Nothing re-aligns the source after that.
+		uint64_t now_ns = snap_source_stats::now_ns();
+
+		if (d_align_hold_until_ns == 0)
+			d_align_hold_until_ns = now_ns + (uint64_t)ALIGN_HOLD_TIMEOUT_SEC * 1000000000ULL;
+
+		if ((d_align_timestamp == 0) && (now_ns < d_align_hold_until_ns)) {
+			usleep(100);
+			return 0;
+		}
+
+		if (d_align_timestamp == 0) {
+			std::stringstream msg;
+			msg << "[SNAP Source] No align_timestamp from the synchronizer for port " << d_port << " after " << ALIGN_HOLD_TIMEOUT_SEC <<
+					" seconds.  Check the sync_header and sync connections.  Output will not be aligned.";
+			GR_LOG_WARN(d_logger, msg.str());
+			d_align_timed_out = true;
+		}
+
+		uint64_t hold_drops = d_stats.align_hold_drops.value();
+
+		if (hold_drops > 0) {
+			std::stringstream msg;
+			msg << "[SNAP Source] The receive queue on port " << d_port << " filled while waiting for alignment.  " << hold_drops <<
+					" packets were dropped.";
+			GR_LOG_WARN(d_logger, msg.str());
+		}
+
+		// Done holding.
+		d_wait_for_align = false;
+	}
+
 	// If we're here, async receive has synchronized and we have data to process.
 	d_partialFrameCounter = 0;
 
@@ -819,12 +1379,22 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 		fill_local_buffer();
 		get_voltage_header(hdr);
 
+		if (hdr.sample_number < d_align_timestamp) {
+			// Ahead of the other sources.  Drop it so we start on the common timestamp.
+			num_packets_available--;
+			continue;
+		}
+
 		if (b_one_packet || ((d_last_timestamp > 0) && (hdr.sample_number != d_last_timestamp)) ) {
 			// If we're in this code block, we have a next frame
+			if ((d_last_timestamp > 0) && (hdr.sample_number < d_last_timestamp))
+				d_stats.late_packets.add();
+
 			if (!b_one_packet) {
 				// If we're not in 1-packet mode, queue whatever data we already had first since a new
 				// timestamp means we're out of the previous frame, then check for missing frames.
-				queue_voltage_data(hdr);
+				// hdr is already the next frame's, so the finished one is tagged with its own timestamp.
+				queue_voltage_data(d_last_timestamp);
 
 				// See if we missed any packets in the last set.
 				// This calc only applies to multi-packet frames as in 1-packet mode a missed timestamp implies the missed packets
@@ -839,6 +1409,8 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 				// missed_sets will be zero when we haven't missed a frame
 				if (missed_sets > 0) {
 					skippedPackets += missed_sets * packets_per_frame;
+					d_stats.gap_frames.add(missed_sets);
+					SNAP_TRACE4(gap, d_port, d_last_timestamp, hdr.sample_number, missed_sets);
 
 					if  (missed_sets <= MAX_MISSED_SETS) {
 						for (uint64_t missed_timestamp=d_last_timestamp+16;missed_timestamp<hdr.sample_number;missed_timestamp+=16) {
@@ -855,6 +1427,9 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 
 								if (sync_timestamp == 0)
 									seq_num_queue.push_back(missed_timestamp);
+
+								if (d_rx_timestamps)
+									arrival_queue.push_back(0);
 							}
 						}
 					}
@@ -868,10 +1443,12 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 				// If we're in 1-packet mode, we check for missing first, then queue what we just got
 				// since each packet is a frame and is atomic.
 				copy_volt_data_to_vector_buffer(hdr);
-				queue_voltage_data(hdr);
+				d_frame_arrival_ns = d_local_arrival_ns;
+				queue_voltage_data(hdr.sample_number);
 			}
 			else {
 				multipacket_frame_pkt_ctr = 1;
+				d_frame_arrival_ns = d_local_arrival_ns;
 				// We're starting a new multi-part vector, so zero out what we have and set that we have one packet
 				memset(x_vector_buffer,0x00,vector_buffer_size);
 				if (!d_packed_output)
@@ -890,6 +1467,7 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 			if (d_last_timestamp == 0) {
 				// This is our very first packet in a multipacket set.
 				d_last_timestamp = hdr.sample_number;
+				d_frame_arrival_ns = d_local_arrival_ns;
 				// multipacket_frame_pkt_ctr is initialized to 0 in the constructor
 			}
 			// In the middle of a multi-packet frame, so we're just filling it.
@@ -911,6 +1489,9 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 		items_returned = x_vector_queue.size();
 	}
 
+	// Everything in this call leaves work() at about the same time.
+	uint64_t output_ns = d_rx_timestamps ? recorder_time_ns() : 0;
+
 	// This is where data actually gets moved to output_items
 	for (int i=0;i<items_returned;i++) {
 		// This needs to come from the new queue
@@ -924,17 +1505,26 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 			y_vector_queue.pop_front();
 		}
 
-		// We'll only send tags if we haven't received a sync handshake
+		if (d_rx_timestamps) {
+			uint64_t arrival_ns = arrival_queue.front();
+			arrival_queue.pop_front();
+
+			if (arrival_ns > 0)
+				output_arrival(i, arrival_ns, output_ns, liveWork, d_packed_output ? 1 : 2);
+		}
+
+		// We'll only send tags if we haven't received a sync handshake
 		if (sync_timestamp == 0) {
 			// Add sequence number start tag for down-stream coherence
 			// Since each packet set contains 16 time samples for the same packet sequence number,
 			// You'll see output vectors in blocks of 16 with the same sequence number.
 			// This is expected.
 
-			if (liveWork) {
-				uint64_t vector_seq_num = seq_num_queue.front();
-				seq_num_queue.pop_front();
+			uint64_t vector_seq_num = seq_num_queue.front();
+			seq_num_queue.pop_front();
+			d_last_sample_out = vector_seq_num;
 
+			if (liveWork) {
 				pmt::pmt_t pmt_sequence_number =pmt::from_uint64(vector_seq_num);
 
 				add_item_tag(0, nitems_written(0) + i, d_pmt_seqnum, pmt_sequence_number,d_block_name);
@@ -942,9 +1532,6 @@ int snap_source_impl::work_volt_mode(int noutput_items,
 					add_item_tag(1, nitems_written(0) + i, d_pmt_seqnum, pmt_sequence_number,d_block_name);
 				}
 			}
-			else {
-				seq_num_queue.pop_front();
-			}
 		}
 	}
 
@@ -976,9 +1563,10 @@ int snap_source_impl::work_spec_mode(int noutput_items,
 #endif
 
 	int num_packets_available = packets_available();
+	int max_wait_counter = 0;
 
 	// Handle case where no data is available
-	while (!stop_thread && !pcap_file_done && (num_packets_available == 0) && (x_vector_queue.size() == 0) ) {
+	while (!stop_thread && !pcap_file_done && (num_packets_available == 0) && (xx_vector_queue.size() == 0) ) {
 		if (d_use_pcap) {
 			usleep(8);
 		}
@@ -987,6 +1575,12 @@ int snap_source_impl::work_spec_mode(int noutput_items,
 		}
 
 		num_packets_available = packets_available();
+
+		// Same as voltage mode: don't wait forever, or a stalled stream hangs the caller.
+		if (num_packets_available == 0) {
+			if (max_wait_counter++ > 120000)
+				return 0;
+		}
 	}
 
 	snap_header hdr;
@@ -1028,7 +1622,22 @@ int snap_source_impl::work_spec_mode(int noutput_items,
 		get_spectrometer_header(hdr);
 		snapshot_packets_available--;
 
+		// Spectrometer frames count up by one.  d_last_timestamp is only used for the stats in this mode.
+		if (d_last_timestamp > 0) {
+			if (hdr.sample_number < d_last_timestamp)
+				d_stats.late_packets.add();
+			else if (hdr.sample_number > d_last_timestamp + 1) {
+				d_stats.gap_frames.add(hdr.sample_number - d_last_timestamp - 1);
+				SNAP_TRACE4(gap, d_port, d_last_timestamp, hdr.sample_number, hdr.sample_number - d_last_timestamp - 1);
+			}
+		}
+
+		if (hdr.sample_number > d_last_timestamp)
+			d_last_timestamp = hdr.sample_number;
+
 		if (hdr.channel_id == d_starting_channel) {
+			d_frame_arrival_ns = d_local_arrival_ns;
+
 			// We're starting a new vector, so zero out what we have.
 			memset(xx_buffer,0x00,vector_buffer_size);
 			memset(yy_buffer,0x00,vector_buffer_size);
@@ -1070,22 +1679,8 @@ int snap_source_impl::work_spec_mode(int noutput_items,
 		// Channels received in this mode will always be 0-4095
 		int channel_offset_within_block = hdr.channel_id;
 
-		float *xx;
-		float *yy;
-		float *xy_real;
-		float *xy_imag;
-
-		xx = &xx_buffer[channel_offset_within_block];
-		yy = &yy_buffer[channel_offset_within_block];
-		xy_real = &xy_real_buffer[channel_offset_within_block];
-		xy_imag = &xy_imag_buffer[channel_offset_within_block];
-
-		for (int sample=0;sample<512;sample++) {
-			*xx++ = sp->data[sample][0];
-			*yy++ = sp->data[sample][1];
-			*xy_real++ = sp->data[sample][2];
-			*xy_imag++ = sp->data[sample][3];
-		}
+		deinterleave_spect_packet(sp->data, &xx_buffer[channel_offset_within_block], &yy_buffer[channel_offset_within_block],
+				&xy_real_buffer[channel_offset_within_block], &xy_imag_buffer[channel_offset_within_block]);
 
 		// Now check if we've completed a set.  If so, let's queue it up
 		// for output consumption.
@@ -1107,6 +1702,11 @@ int snap_source_impl::work_spec_mode(int noutput_items,
 			xy_imag_vector_queue.push_back(xy_imag_cur_vector);
 
 			seq_num_queue.push_back(hdr.sample_number);
+
+			if (d_rx_timestamps)
+				arrival_queue.push_back(d_frame_arrival_ns);
+
+			SNAP_TRACE3(frame_complete, d_port, hdr.sample_number, 0);
 		}
 	}
 
@@ -1116,6 +1716,8 @@ int snap_source_impl::work_spec_mode(int noutput_items,
 		items_returned = xx_vector_queue.size();
 	}
 
+	uint64_t output_ns = d_rx_timestamps ? recorder_time_ns() : 0;
+
 	for (int i=0;i<items_returned;i++) {
 		// This needs to come from the new queue
 		uint64_t vector_seq_num = seq_num_queue.front();
@@ -1140,17 +1742,24 @@ int snap_source_impl::work_spec_mode(int noutput_items,
 		xy_real_vector_queue.pop_front();
 		xy_imag_vector_queue.pop_front();
 		seq_num_queue.pop_front();
+		d_last_sample_out = vector_seq_num;
 
-		// Add sequence number start tag for down-stream coherence
-		// Since each packet set contains 16 time samples for the same packet sequence number,
-		// You'll see output vectors in blocks of 16 with the same sequence number.
-		// This is expected.
+		if (d_rx_timestamps) {
+			uint64_t arrival_ns = arrival_queue.front();
+			arrival_queue.pop_front();
+
+			if (arrival_ns > 0)
+				output_arrival(i, arrival_ns, output_ns, liveWork, output_items.size());
+		}
 
-		if (liveWork && (sync_timestamp > 0)) {
+		// Add sequence number start tag for down-stream coherence.  Each spectrometer
+		// vector is a whole frame, so every one gets its own sample number.  Like voltage
+		// mode, tags stop once we've had a sync handshake.
+		if (liveWork && (sync_timestamp == 0)) {
 			pmt::pmt_t pmt_sequence_number =pmt::from_uint64(vector_seq_num);
 
-			add_item_tag(0, nitems_written(0) + i, d_pmt_seqnum, pmt_sequence_number,d_block_name);
-			add_item_tag(1, nitems_written(0) + i, d_pmt_seqnum, pmt_sequence_number,d_block_name);
+			for (size_t port=0;port<output_items.size();port++)
+				add_item_tag(port, nitems_written(port) + i, d_pmt_seqnum, pmt_sequence_number,d_block_name);
 		}
 	}
 
@@ -1187,11 +1796,165 @@ int snap_source_impl::work_test_copy(int noutput_items,
 int snap_source_impl::work_test(int noutput_items,
 		gr_vector_const_void_star &input_items,
 		gr_vector_void_star &output_items) {
-	if (SNAP_PACKETTYPE_VOLTAGE) {
-		return work_volt_mode(noutput_items, input_items, output_items, false);
+	uint64_t start_ns = snap_source_stats::now_ns();
+	int items_returned;
+
+	if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
+		items_returned = work_volt_mode(noutput_items, input_items, output_items, false);
 	}
 	else {
-		return work_spec_mode(noutput_items, input_items, output_items, false);
+		items_returned = work_spec_mode(noutput_items, input_items, output_items, false);
+	}
+
+	work_finished(start_ns, items_returned, false);
+
+	return items_returned;
+}
+
+void snap_source_impl::work_finished(uint64_t start_ns, int items_returned, bool liveWork) {
+	uint64_t now_ns = snap_source_stats::now_ns();
+	uint64_t queue_depth = packets_available();
+
+	if (d_stats.work_tid.load(std::memory_order_relaxed) == 0)
+		d_stats.work_tid.store(snap_stats_thread_id(), std::memory_order_relaxed);
+
+	SNAP_TRACE3(work_exit, d_port, items_returned, queue_depth);
+
+	d_stats.work_calls.add();
+	d_stats.items_out.add(items_returned);
+	d_stats.work_ns.add(now_ns - start_ns);
+	d_stats.queue_depth.set(queue_depth);
+	d_stats.queue_depth_hist.add(queue_depth);
+
+	if (d_quant_stats_interval > 0.0)
+		publish_quant_stats(now_ns, liveWork);
+
+	if (!liveWork || (d_stats_interval <= 0.0) || (now_ns < d_next_stats_ns))
+		return;
+
+	d_next_stats_ns = now_ns + (uint64_t)(d_stats_interval * 1e9);
+
+	pmt::pmt_t dict = d_stats.to_dict();
+	dict = pmt::dict_add(dict, pmt::mp("port"), pmt::mp(d_port));
+
+	if (d_found_start_channel) {
+		// Which antenna, from the first packet we synchronized on.
+		const snap_header &hdr = (d_header_type == SNAP_PACKETTYPE_VOLTAGE) ? async_volt_sync_hdr : async_spect_sync_hdr;
+		dict = pmt::dict_add(dict, pmt::mp("antenna_id"), pmt::mp(hdr.antenna_id));
+	}
+
+	message_port_pub(pmt::mp("stats"), pmt::cons(dict, pmt::PMT_NIL));
+}
+
+// Each interval's code histograms go out as a PDU and counting starts over.  The first
+// interval starts with the first call rather than going out right away.
+void snap_source_impl::publish_quant_stats(uint64_t now_ns, bool liveWork) {
+	if (d_next_quant_stats_ns == 0)
+		d_next_quant_stats_ns = now_ns + (uint64_t)(d_quant_stats_interval * 1e9);
+
+	if ((now_ns < d_next_quant_stats_ns) && !d_quant_stats.full())
+		return;
+
+	d_next_quant_stats_ns = now_ns + (uint64_t)(d_quant_stats_interval * 1e9);
+
+	if (liveWork && (d_quant_stats.packets() > 0)) {
+		pmt::pmt_t meta = pmt::make_dict();
+		meta = pmt::dict_add(meta, pmt::mp("port"), pmt::mp(d_port));
+
+		if (d_found_start_channel)
+			meta = pmt::dict_add(meta, pmt::mp("antenna_id"), pmt::mp(async_volt_sync_hdr.antenna_id));
+
+		meta = pmt::dict_add(meta, pmt::mp("starting_channel"), pmt::mp(d_starting_channel));
+
+		message_port_pub(pmt::mp("quant_stats"), d_quant_stats.to_pdu(meta));
+	}
+
+	d_quant_stats.clear();
+}
+
+// Latency for a frame's first vector on its way out, and its rx_time tag.  The tag is the
+// usual GNU Radio (uint64 seconds, double fractional seconds) tuple, in the kernel's clock.
+void snap_source_impl::output_arrival(int item, uint64_t arrival_ns, uint64_t now_ns, bool liveWork, int num_tagged_outputs) {
+	d_stats.latency_ns.add((now_ns > arrival_ns) ? now_ns - arrival_ns : 0);
+
+	if (!liveWork)
+		return;
+
+	pmt::pmt_t rx_time = pmt::make_tuple(pmt::from_uint64(arrival_ns / 1000000000ULL),
+			pmt::from_double((double)(arrival_ns % 1000000000ULL) / 1e9));
+
+	for (int port=0;port<num_tagged_outputs;port++)
+		add_item_tag(port, nitems_written(port) + item, d_pmt_rx_time, rx_time, d_block_name);
+}
+
+// Runs on the stats publisher's thread, so only the atomics in d_stats can be read here.
+void snap_source_impl::fill_stats_shm(uint64_t *values) {
+	values[SNAP_SHM_SRC_PACKETS_RECEIVED] = d_stats.packets_received.value();
+	values[SNAP_SHM_SRC_PACKETS_QUEUED] = d_stats.packets_queued.value();
+	values[SNAP_SHM_SRC_QUEUE_FULL_DROPS] = d_stats.queue_full_drops.value();
+	values[SNAP_SHM_SRC_BAD_CHANNEL_PACKETS] = d_stats.bad_channel_packets.value();
+	values[SNAP_SHM_SRC_LATE_PACKETS] = d_stats.late_packets.value();
+	values[SNAP_SHM_SRC_GAP_FRAMES] = d_stats.gap_frames.value();
+	values[SNAP_SHM_SRC_MISSED_PACKETS] = d_stats.missed_packets.value();
+	values[SNAP_SHM_SRC_QUEUE_DEPTH] = d_stats.queue_depth.value();
+	values[SNAP_SHM_SRC_QUEUE_DEPTH_MAX] = d_stats.queue_depth.max();
+	values[SNAP_SHM_SRC_WORK_CALLS] = d_stats.work_calls.value();
+	values[SNAP_SHM_SRC_ITEMS_OUT] = d_stats.items_out.value();
+	values[SNAP_SHM_SRC_WORK_NS_P99] = d_stats.work_ns.percentile(99.0);
+
+	pid_t receive_tid = d_stats.receive_tid.load(std::memory_order_relaxed);
+	pid_t work_tid = d_stats.work_tid.load(std::memory_order_relaxed);
+	int64_t cpu_ns;
+
+	if (receive_tid && ((cpu_ns = snap_stats_thread_cpu_ns(receive_tid)) >= 0))
+		values[SNAP_SHM_SRC_RECEIVE_CPU_NS] = cpu_ns;
+
+	if (work_tid && ((cpu_ns = snap_stats_thread_cpu_ns(work_tid)) >= 0))
+		values[SNAP_SHM_SRC_WORK_CPU_NS] = cpu_ns;
+
+	int antenna_id = d_stats.antenna_id.load(std::memory_order_relaxed);
+	values[SNAP_SHM_SRC_ANTENNA_ID] = (antenna_id >= 0) ? antenna_id + 1 : 0;
+
+	values[SNAP_SHM_SRC_KERNEL_DROPS] = d_stats.kernel_drops.value();
+	values[SNAP_SHM_SRC_SOCKET_BACKLOG_MAX] = d_stats.socket_backlog.max();
+	values[SNAP_SHM_SRC_RCVBUF] = d_stats.rcvbuf_bytes.value();
+	values[SNAP_SHM_SRC_LATENCY_P50] = d_stats.latency_ns.percentile(50.0);
+	values[SNAP_SHM_SRC_LATENCY_P99] = d_stats.latency_ns.percentile(99.0);
+	values[SNAP_SHM_SRC_ARRIVAL_GAP_P99] = d_stats.arrival_gap_ns.percentile(99.0);
+}
+
+void snap_source_impl::setup_rpc() {
+	struct stat_variable {
+		const char *name;
+		uint64_t (snap_source_impl::*get)();
+		const char *units;
+		const char *description;
+	};
+
+	static const stat_variable variables[] = {
+		{ "packets received", &snap_source_impl::stat_packets_received, "packets", "Packets read from the socket or capture" },
+		{ "packets queued", &snap_source_impl::stat_packets_queued, "packets", "Packets put on the receive queue" },
+		{ "queue full drops", &snap_source_impl::stat_queue_full_drops, "packets", "Packets lost to a full receive queue" },
+		{ "align hold drops", &snap_source_impl::stat_align_hold_drops, "packets", "Of the queue full drops, those lost waiting for alignment" },
+		{ "bad channel packets", &snap_source_impl::stat_bad_channel_packets, "packets", "Packets with a channel outside the configured range" },
+		{ "late packets", &snap_source_impl::stat_late_packets, "packets", "Packets that arrived after their frame went out" },
+		{ "gap frames", &snap_source_impl::stat_gap_frames, "frames", "Frames that never arrived" },
+		{ "missed packets", &snap_source_impl::stat_missed_packets, "packets", "Packets missing from output frames" },
+		{ "queue depth", &snap_source_impl::stat_queue_depth, "packets", "Receive queue depth at the last work() call" },
+		{ "queue depth max", &snap_source_impl::stat_queue_depth_max, "packets", "Deepest the receive queue has been" },
+		{ "work time p99", &snap_source_impl::stat_work_ns_p99, "ns", "99th percentile time in work()" },
+		{ "kernel drops", &snap_source_impl::stat_kernel_drops, "packets", "Packets the kernel dropped with the socket buffer full" },
+		{ "socket backlog max", &snap_source_impl::stat_socket_backlog_max, "bytes", "Most the socket buffer has held" },
+		{ "receive buffer", &snap_source_impl::stat_rcvbuf_bytes, "bytes", "Socket receive buffer the kernel allowed" },
+		{ "latency p99", &snap_source_impl::stat_latency_ns_p99, "ns", "99th percentile kernel receive to work() output, with rx_timestamps" },
+		{ "arrival gap p99", &snap_source_impl::stat_arrival_gap_ns_p99, "ns", "99th percentile time between packets, with rx_timestamps" },
+	};
+
+	for (size_t i=0;i<sizeof(variables)/sizeof(variables[0]);i++) {
+		add_rpc_variable(rpcbasic_sptr(new rpcbasic_register_get<snap_source_impl, uint64_t>(
+				alias(), variables[i].name, variables[i].get, pmt::from_uint64(0), pmt::from_uint64(UINT64_MAX),
+				pmt::from_uint64(0), variables[i].units, variables[i].description, RPC_PRIVLVL_MIN,
+				DISPTIME | DISPOPTSTRIP)));
 	}
 }
 
@@ -1202,6 +1965,21 @@ int snap_source_impl::work(int noutput_items,
 
 	gr::thread::scoped_lock guard(d_setlock);
 
+	uint64_t start_ns = snap_source_stats::now_ns();
+	SNAP_TRACE2(work_entry, d_port, noutput_items);
+	int items_returned;
+
+	if (d_offline_decode) {
+		items_returned = work_offline(noutput_items, output_items);
+
+		if (items_returned == WORK_DONE)
+			return WORK_DONE;
+
+		work_finished(start_ns, items_returned, true);
+
+		return items_returned;
+	}
+
 	if (d_use_pcap && pcap_file_done) {
 		if (packets_available() == 0) {
 			GR_LOG_INFO(d_logger,"End of PCAP file reached.");
@@ -1210,12 +1988,94 @@ int snap_source_impl::work(int noutput_items,
 		}
 	}
 
-	if (SNAP_PACKETTYPE_VOLTAGE) {
-		return work_volt_mode(noutput_items, input_items, output_items, true);
+	if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
+		items_returned = work_volt_mode(noutput_items, input_items, output_items, true);
 	}
 	else {
-		return work_spec_mode(noutput_items, input_items, output_items, true);
+		items_returned = work_spec_mode(noutput_items, input_items, output_items, true);
+	}
+
+	work_finished(start_ns, items_returned, true);
+
+	return items_returned;
+}
+
+int snap_source_impl::work_offline(int noutput_items, gr_vector_void_star &output_items) {
+	char *x_out = (char *)output_items[0];
+	char *y_out = d_packed_output ? NULL : (char *)output_items[1];
+
+	int items_returned = 0;
+	int skippedPackets = 0;
+
+	// Take whatever's been decoded, waiting only if there's nothing at all yet.
+	while (items_returned < noutput_items) {
+		uint64_t sample_number;
+		int first_row;
+		int missing_packets;
+
+		int num_vectors = d_chunk_decoder->read(&x_out[items_returned * d_veclen],
+				y_out ? &y_out[items_returned * d_veclen] : NULL, noutput_items - items_returned,
+				sample_number, first_row, missing_packets, items_returned == 0);
+
+		if (num_vectors == 0)
+			break;
+
+		skippedPackets += missing_packets;
+
+		if (d_send_start_msg && !d_offline_start_sent && d_chunk_decoder->first_header(async_volt_sync_hdr)) {
+			d_offline_start_sent = true;
+
+			pmt::pmt_t meta = pmt::make_dict();
+
+			meta = pmt::dict_add(meta, pmt::mp("antenna_id"), pmt::mp(async_volt_sync_hdr.antenna_id));
+			meta = pmt::dict_add(meta, pmt::mp("starting_channel"), pmt::mp(d_starting_channel));
+			meta = pmt::dict_add(meta, pmt::mp("sample_number"), pmt::mp(async_volt_sync_hdr.sample_number));
+			meta = pmt::dict_add(meta, pmt::mp("firmware_version"), pmt::mp(async_volt_sync_hdr.firmware_version));
+			meta = pmt::dict_add(meta, pmt::mp("port"), pmt::mp(d_port));
+
+			pmt::pmt_t pdu = pmt::cons(meta, pmt::PMT_NIL);
+			message_port_pub(pmt::mp("sync_header"), pdu);
+		}
+
+		if (sync_timestamp == 0) {
+			// Same tags as the standard path: every vector gets its frame's sample_number.
+			for (int i=0;i<num_vectors;i++) {
+				uint64_t vector_seq_num = sample_number + ((first_row + i) / 16) * 16;
+				pmt::pmt_t pmt_sequence_number = pmt::from_uint64(vector_seq_num);
+
+				add_item_tag(0, nitems_written(0) + items_returned + i, d_pmt_seqnum, pmt_sequence_number,d_block_name);
+				if (!d_packed_output) {
+					add_item_tag(1, nitems_written(0) + items_returned + i, d_pmt_seqnum, pmt_sequence_number,d_block_name);
+				}
+			}
+		}
+
+		d_last_sample_out = sample_number + ((first_row + num_vectors - 1) / 16) * 16;
+		items_returned += num_vectors;
 	}
+
+	NotifyMissed(skippedPackets);
+
+	if ((items_returned == 0) && d_chunk_decoder->finished()) {
+		std::stringstream msg;
+		msg << "End of file reached.  Decoded " << d_chunk_decoder->packets_decoded() << " packets";
+
+		if (d_chunk_decoder->duplicates() > 0)
+			msg << ", skipped " << d_chunk_decoder->duplicates() << " duplicates";
+
+		if (d_chunk_decoder->out_of_range() > 0)
+			msg << ", skipped " << d_chunk_decoder->out_of_range() << " with unexpected channel ids";
+
+		if (d_chunk_decoder->misaligned() > 0)
+			msg << ", skipped " << d_chunk_decoder->misaligned() << " off the frame boundaries";
+
+		msg << ".";
+		GR_LOG_INFO(d_logger, msg.str());
+
+		return WORK_DONE;
+	}
+
+	return items_returned;
 }
 
 void snap_source_impl::queue_data() {
@@ -1250,6 +2110,8 @@ void snap_source_impl::queue_data() {
 
 			size_t bytesRead = d_udpsocket->receive_from(boost::asio::buffer(local_net_buffer,bytes_to_read), d_endpoint);
 			if (bytesRead > 0) {
+				d_stats.packets_received.add(num_packets);
+
 				// Get the data and add it to our local queue.  We have to maintain a
 				// local queue in case we read more bytes than noutput_items is asking
 				// for.  In that case we'll only return noutput_items bytes
@@ -1257,11 +2119,12 @@ void snap_source_impl::queue_data() {
 					for (long i = 0; i < num_packets; i++) {
 						unsigned char *pData = &local_net_buffer[i*total_packet_size];
 
-						if (SNAP_PACKETTYPE_VOLTAGE) {
+						if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
 							if (!d_found_start_channel) {
 								// We're not synchronized on the first packet yet, so we're looking for it.
 								if (!voltage_synchronize(pData)) {
 									// we're still not sync'd.  So don't bother queueing the packet.
+									d_stats.packets_before_sync.add();
 									continue;
 								}
 							}
@@ -1280,6 +2143,7 @@ void snap_source_impl::queue_data() {
 								}
 
 								GR_LOG_ERROR(d_logger, msg_stream.str());
+								d_stats.bad_channel_packets.add();
 
 								continue;
 							}
@@ -1289,6 +2153,7 @@ void snap_source_impl::queue_data() {
 								// We're not synchronized on the first packet yet, so we're looking for it.
 								if (!spect_synchronize(pData)) {
 									// we're still not sync'd.  So don't bother queueing the packet.
+									d_stats.packets_before_sync.add();
 									continue;
 								}
 							}
@@ -1311,11 +2176,15 @@ void snap_source_impl::queue_data() {
 								}
 
 								GR_LOG_ERROR(d_logger, msg_stream.str());
+								d_stats.bad_channel_packets.add();
 
 								continue;
 							}
 						}
 
+						if (d_recorder)
+							d_recorder->write(pData, recorder_time_ns());
+
 						data_vector<unsigned char> new_data((unsigned char *)pData,total_packet_size);
 
 						{
@@ -1323,7 +2192,7 @@ void snap_source_impl::queue_data() {
 #ifdef THREAD_RECEIVE
 							gr::thread::scoped_lock guard(d_net_mutex);
 #endif
-							d_localqueue->push_back(new_data);
+							queue_packet(new_data);
 						}
 					}
 				}
@@ -1332,65 +2201,49 @@ void snap_source_impl::queue_data() {
 	}
 }
 
-void snap_source_impl::queue_pcap_data() {
+long snap_source_impl::queue_pcap_data() {
 
 	// Lets try to keep 16 packets queued up at a time.
 	long queue_size = packets_available();
+	long matchingPackets = 0;
+	bool past_end_sample = false;
+	bool loop_cache_full = false;
 
 	// while (!pcap_file_done && !stop_thread && (queue_size < min_pcap_queue_size) ) {
-	if (queue_size < min_pcap_queue_size) {
+	// When paced, the clock decides when packets go in, not how full the queue is.  Just
+	// like live data, if work() can't keep up the queue fills and old packets get dropped.
+	if ((queue_size < min_pcap_queue_size) || (d_pcap_pacing != PCAP_PACING_NONE)) {
 		long queue_diff = min_pcap_queue_size - queue_size;
-		long matchingPackets = 0;
 
-		static int sizeUDPHeader = sizeof(struct udphdr);
-		const u_char *p;
-		int etherIPHeaderSize;
-		uint16_t destPort;
 		size_t len;
 		unsigned char *pData;
+		bool end_of_file = false;
 
-		while ( (matchingPackets < reload_size) && (p = pcap_next(pcapFile, &pcap_header)) && !stop_thread ) {
-			if (pcap_header.len != pcap_header.caplen) {
-				continue;
-			}
-			auto eth = reinterpret_cast<const ether_header *>(p);
-
-			// jump over and ignore vlan tag
-			if (ntohs(eth->ether_type) == ETHERTYPE_VLAN) {
-				p += 4;
-				eth = reinterpret_cast<const ether_header *>(p);
-			}
-			if (ntohs(eth->ether_type) != ETHERTYPE_IP) {
-				continue;
-			}
-			auto ip = reinterpret_cast<const iphdr *>(p + sizeof(ether_header));
-			if (ip->version != 4) {
-				continue;
-			}
-
-			if (ip->protocol != IPPROTO_UDP) {
-				continue;
-			}
-
-			// IP Header length is defined in a packet field (IHL).  IHL represents
-			// the # of 32-bit words So header size is ihl * 4 [bytes]
-			etherIPHeaderSize = sizeof(ether_header) + ip->ihl * 4;
-
-			auto udp = reinterpret_cast<const udphdr *>(p + etherIPHeaderSize);
+		while ( (matchingPackets < reload_size) && !stop_thread && next_pcap_payload(pData, len, end_of_file) ) {
+			if (len == total_packet_size) {
+				matchingPackets++;
+				d_stats.packets_received.add();
 
-			destPort = ntohs(udp->dest);
-			len = ntohs(udp->len) - sizeUDPHeader;
+				if ((d_start_sample > 0) || (d_end_sample > 0)) {
+					// The index only gets us to within a stride of the start, so trim the rest here.
+					uint64_t sample_number = packet_sample_number(pData);
 
-			if ((destPort == d_port) && (len == total_packet_size)) {
-				matchingPackets++;
+					if (sample_number < d_start_sample) {
+						continue;
+					}
 
-				pData = (u_char *)&p[etherIPHeaderSize + sizeUDPHeader];
+					if ((d_end_sample > 0) && (sample_number >= d_end_sample)) {
+						past_end_sample = true;
+						break;
+					}
+				}
 
-				if (SNAP_PACKETTYPE_VOLTAGE) {
+				if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
 					if (!d_found_start_channel) {
 						// We're not synchronized on the first packet yet, so we're looking for it.
 						if (!voltage_synchronize(pData)) {
 							// we're still not sync'd.  So don't bother queueing the packet.
+							d_stats.packets_before_sync.add();
 							continue;
 						}
 					}
@@ -1409,6 +2262,7 @@ void snap_source_impl::queue_pcap_data() {
 						}
 
 						GR_LOG_ERROR(d_logger, msg_stream.str());
+						d_stats.bad_channel_packets.add();
 
 						continue;
 					}
@@ -1418,6 +2272,7 @@ void snap_source_impl::queue_pcap_data() {
 						// We're not synchronized on the first packet yet, so we're looking for it.
 						if (!spect_synchronize(pData)) {
 							// we're still not sync'd.  So don't bother queueing the packet.
+							d_stats.packets_before_sync.add();
 							continue;
 						}
 					}
@@ -1440,23 +2295,97 @@ void snap_source_impl::queue_pcap_data() {
 						}
 
 						GR_LOG_ERROR(d_logger, msg_stream.str());
+						d_stats.bad_channel_packets.add();
 
 						continue;
 					}
 				}
 
-				data_vector<unsigned char> new_data(pData,len);
+				if (d_pcap_pacing != PCAP_PACING_NONE) {
+					uint64_t packet_time_ns;
+
+					if (d_pcap_pacing == PCAP_PACING_SNAP_CLOCK)
+						packet_time_ns = (be64toh(((struct voltage_header *)pData)->timestamp) + d_loop_sample_offset) * SNAP_NS_PER_SAMPLE;
+					else
+						packet_time_ns = d_pcap_packet_time_ns;
+
+					if (!d_pacing_clock.wait_until_due(packet_time_ns, stop_thread))
+						break;
+				}
+
+				// When the file is mapped, just queue a pointer to the payload.  Recording
+				// chunks are let go of as soon as they're read, so those are copied.
+				bool copy_data = !d_pcap_demux;
+				bool continue_timestamp = false;
+
+				if (d_loop_cache.ready()) {
+					copy_data = false;
+
+					if (d_loop_continue_timestamps && (d_loop_sample_offset > 0)) {
+						// Later loops get a copy with the sample_number moved on.  The cache stays as captured.
+						continue_timestamp = true;
+						copy_data = true;
+					}
+				}
+				else if (d_use_loop_cache) {
+					uint64_t sample_number = 0;
+
+					if (d_header_type == SNAP_PACKETTYPE_VOLTAGE)
+						sample_number = be64toh(((struct voltage_header *)pData)->timestamp);
+
+					unsigned char *cached = d_loop_cache.append(pData, len, d_pcap_packet_time_ns, sample_number);
+
+					if (!cached) {
+						// Can only happen if the file grew after we sized the cache.  Loop what we have.
+						GR_LOG_WARN(d_logger, "[SNAP Source] Loop cache is full.  Repeating the packets cached so far.");
+						loop_cache_full = true;
+						break;
+					}
+
+					pData = cached;
+					copy_data = false;
+				}
+
+				data_vector<unsigned char> new_data(pData,len,copy_data);
+
+				if (continue_timestamp) {
+					// The copy is ours, so it can be patched here on the reader thread.
+					struct voltage_header *v_hdr = (struct voltage_header *)new_data.data_pointer();
+					v_hdr->timestamp = htobe64(be64toh(v_hdr->timestamp) + d_loop_sample_offset);
+				}
+
+				if (d_recorder)
+					d_recorder->write(new_data.data_pointer(), d_pcap_packet_time_ns);
 
 				{
 					gr::thread::scoped_lock guard(d_net_mutex);
-					d_localqueue->push_back(new_data);
+					queue_packet(new_data);
 				}
-			} // if ports match
+			} // if size matches
 		} // while read
 
-		// if ((!p) && (matchingPackets < queue_diff)) {
-		if (!p) {
-			// We've reached the end of the file.  restart it if necessary.
+		if (d_loop_cache.ready()) {
+			// Playing from memory.  The cache never runs out.
+		}
+		else if (d_use_loop_cache) {
+			if (end_of_file || past_end_sample || loop_cache_full)
+				finish_loop_cache();
+		}
+		else if (d_pcap_demux) {
+			// The shared reader takes care of repeating.  It only reports the end of
+			// the file if we're not.
+			if (past_end_sample) {
+				d_pcap_demux->end_pass(d_pcap_subscriber);
+
+				if (!d_repeat_file)
+					pcap_file_done = true;
+			}
+			else if (end_of_file) {
+				pcap_file_done = true;
+			}
+		}
+		else if (end_of_file || past_end_sample) {
+			// We've reached the end of the file (or the requested window).  restart it if necessary.
 			if (d_repeat_file) {
 				closePCAP();
 				openPCAP();
@@ -1468,82 +2397,226 @@ void snap_source_impl::queue_pcap_data() {
 		// Refresh the queue size counter (work() will be consuming while we're filling here)
 		// queue_size = packets_available();
 	} // queue_size < min_queue_size
+
+	return matchingPackets;
+}
+
+void snap_source_impl::setup_socket_stats() {
+	int fd = d_udpsocket->native_handle();
+	int enable = 1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) != 0) {
+		GR_LOG_WARN(d_logger, "Unable to turn on SO_RXQ_OVFL.  Packets dropped by the kernel won't be counted.");
+	}
+
+	d_last_rxq_ovfl = 0;
+
+	if (d_rx_timestamps && (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) != 0)) {
+		GR_LOG_WARN(d_logger, "Unable to turn on SO_TIMESTAMPNS.  Arrival times will come from the receive thread's clock instead of the kernel's.");
+	}
+
+	d_last_arrival_ns = 0;
+
+	// The kernel doubles what's asked for to cover its own overhead, and reports it that way.
+	int rcvbuf = 0;
+	socklen_t rcvbuf_len = sizeof(rcvbuf);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_len) != 0)
+		return;
+
+	d_stats.rcvbuf_bytes.set(rcvbuf);
+	d_stats.rcvbuf_requested.set(2 * (uint64_t)RECEIVE_BUFFER_BYTES);
+
+	std::stringstream msg_stream;
+
+	if ((uint64_t)rcvbuf < 2 * (uint64_t)RECEIVE_BUFFER_BYTES) {
+		msg_stream << "Port " << d_port << " socket receive buffer is " << (rcvbuf / 2) / (1024*1024) << " MB rather than the " <<
+				RECEIVE_BUFFER_BYTES / (1024*1024) << " MB asked for.  net.core.rmem_max is capping it, so bursts will be dropped by the kernel.  " <<
+				"Raise it with: sysctl -w net.core.rmem_max=" << RECEIVE_BUFFER_BYTES;
+		GR_LOG_WARN(d_logger, msg_stream.str());
+	}
+	else {
+		msg_stream << "Port " << d_port << " socket receive buffer is " << (rcvbuf / 2) / (1024*1024) << " MB.";
+		GR_LOG_INFO(d_logger, msg_stream.str());
+	}
 }
 
 int snap_source_impl::mmsg_receive()
 {
 	int retval = recvmmsg(d_udpsocket->native_handle(), msgs, MMSG_LENGTH, MSG_DONTWAIT, nullptr);
-	if (retval == -1) {
+	if (retval <= 0) {
 		//GR_LOG_ERROR(d_logger,"ERROR receiving data from recvmmsg (-1)");
+		d_stats.receive_batch.add(0);
 		return 0;
 	}
 
-	// check for bad channel id first.
-	uint16_t channel_id;
-	unsigned char *cur_pkt;
+	d_stats.receive_batch.add(retval);
+	d_stats.packets_received.add(retval);
+	SNAP_TRACE2(recv_batch, d_port, retval);
+
+	// Once the kernel has dropped anything on this socket, every packet carries its running
+	// total, so the last packet in the batch has the latest count.
+	struct msghdr *last_hdr = &msgs[retval - 1].msg_hdr;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(last_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(last_hdr, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+			uint32_t kernel_drops;
+			memcpy(&kernel_drops, CMSG_DATA(cmsg), sizeof(kernel_drops));
+
+			// The count wraps at 32 bits.
+			d_stats.kernel_drops.add((uint32_t)(kernel_drops - d_last_rxq_ovfl));
+			d_last_rxq_ovfl = kernel_drops;
+		}
+	}
+
+	if (retval == MMSG_LENGTH) {
+		// A full batch means more may be waiting, so see how much.  Otherwise we've drained the socket.
+		// FIONREAD only gives the next datagram's size on a UDP socket, so this asks for the buffer's memory use.
+		uint32_t meminfo[SK_MEMINFO_VARS];
+		socklen_t meminfo_len = sizeof(meminfo);
+
+		if (getsockopt(d_udpsocket->native_handle(), SOL_SOCKET, SO_MEMINFO, meminfo, &meminfo_len) == 0)
+			d_stats.socket_backlog.set(meminfo[SK_MEMINFO_RMEM_ALLOC]);
+	}
+	else {
+		d_stats.socket_backlog.set(0);
+	}
 
 	/*
 	if (retval > 1) {
 		printf("%d messages received\n", retval);
 	}
 	*/
+	// One arrival time for the whole batch is plenty for the recording's chunk index.
+	uint64_t batch_time_ns = (d_recorder || d_rx_timestamps) ? recorder_time_ns() : 0;
+	uint64_t arrival_ns = 0;
+
 	gr::thread::scoped_lock guard(d_net_mutex);
 
 	for (int i = 0; i < retval; i++) {
-		cur_pkt = bufs[i];
+		if (d_rx_timestamps) {
+			arrival_ns = packet_arrival_ns(&msgs[i].msg_hdr, batch_time_ns);
 
-		if (!d_found_start_channel) {
-			// We're not synchronized on the first packet yet, so we're looking for it.
-			if (SNAP_PACKETTYPE_VOLTAGE) {
-				if (!voltage_synchronize(cur_pkt)) {
-					// we're still not sync'd.  So don't bother queueing the packet.
-					continue;
-				}
+			if (d_last_arrival_ns > 0)
+				d_stats.arrival_gap_ns.add((arrival_ns > d_last_arrival_ns) ? arrival_ns - d_last_arrival_ns : 0);
+
+			d_last_arrival_ns = arrival_ns;
+		}
+
+		accept_packet(bufs[i], msgs[i].msg_len, arrival_ns, batch_time_ns);
+	}
+
+	// recvmmsg() sets these to what it used.
+	for (int i = 0; i < retval; i++)
+		msgs[i].msg_hdr.msg_controllen = MMSG_CONTROL_LENGTH;
+
+	return retval;
+}
+
+// The checks every packet off the network goes through before it's queued: waiting for the
+// start channel, then the channel range.  Caller holds d_net_mutex.
+bool snap_source_impl::accept_packet(unsigned char *cur_pkt, size_t len, uint64_t arrival_ns, uint64_t batch_time_ns) {
+	if (!d_found_start_channel) {
+		// We're not synchronized on the first packet yet, so we're looking for it.
+		if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
+			if (!voltage_synchronize(cur_pkt)) {
+				// we're still not sync'd.  So don't bother queueing the packet.
+				d_stats.packets_before_sync.add();
+				return false;
 			}
-			else {
-				if (!spect_synchronize(cur_pkt)) {
-					// we're still not sync'd.  So don't bother queueing the packet.
-					continue;
-				}
+		}
+		else {
+			if (!spect_synchronize(cur_pkt)) {
+				// we're still not sync'd.  So don't bother queueing the packet.
+				d_stats.packets_before_sync.add();
+				return false;
 			}
 		}
+	}
 
-		if (SNAP_PACKETTYPE_VOLTAGE) {
-			struct voltage_header *v_hdr = (struct voltage_header *)cur_pkt;
-			channel_id = be16toh(v_hdr->chan);
+	// check for bad channel id first.
+	uint16_t channel_id;
+
+	if (d_header_type == SNAP_PACKETTYPE_VOLTAGE) {
+		struct voltage_header *v_hdr = (struct voltage_header *)cur_pkt;
+		channel_id = be16toh(v_hdr->chan);
+	}
+	else {
+		uint64_t *header_as_uint64 = (uint64_t *)cur_pkt;
+
+		// Convert from network format to host format.
+		uint64_t header = be64toh(*header_as_uint64);
+		channel_id = ((header >> 8) & 0x07) * 512; // Id cycles 0-7.  Channel is 512*val
+	}
+
+	if ((channel_id < d_starting_channel) || (channel_id > d_ending_channel_packet_channel_id) ) {
+		std::stringstream msg_stream;
+		msg_stream << "Received an unexpected channel index.  Skipping packet.  Received block starting channel id: " << channel_id;
+
+		if (b_one_packet) {
+			msg_stream << " expected " << d_starting_channel;
 		}
 		else {
-			uint64_t *header_as_uint64 = (uint64_t *)cur_pkt;
-
-			// Convert from network format to host format.
-			uint64_t header = be64toh(*header_as_uint64);
-			channel_id = ((header >> 8) & 0x07) * 512; // Id cycles 0-7.  Channel is 512*val
+			msg_stream << " expected block channel between " << d_starting_channel << " and " << d_ending_channel_packet_channel_id;
 		}
 
-		if ((channel_id < d_starting_channel) || (channel_id > d_ending_channel_packet_channel_id) ) {
-			std::stringstream msg_stream;
-			msg_stream << "Received an unexpected channel index.  Skipping packet.  Received block starting channel id: " << channel_id;
+		GR_LOG_ERROR(d_logger, msg_stream.str());
+		d_stats.bad_channel_packets.add();
 
-			if (b_one_packet) {
-				msg_stream << " expected " << d_starting_channel;
-			}
-			else {
-				msg_stream << " expected block channel between " << d_starting_channel << " and " << d_ending_channel_packet_channel_id;
-			}
+		return false;
+	}
 
-			GR_LOG_ERROR(d_logger, msg_stream.str());
-		}
+	if (d_recorder && (len == total_packet_size))
+		d_recorder->write(cur_pkt, batch_time_ns);
 
-		// We'll only get here if we've sync'd and the id is good.  so the main work doesn't need to track this anymore.
-		data_vector<unsigned char> new_data((unsigned char *)cur_pkt,total_packet_size);
-		d_localqueue->push_back(new_data);
+	// We'll only get here if we've sync'd and the id is good.  so the main work doesn't need to track this anymore.
+	data_vector<unsigned char> new_data((unsigned char *)cur_pkt,total_packet_size);
+	new_data.set_arrival_time(arrival_ns);
+	queue_packet(new_data);
+
+	return true;
+}
+
+size_t snap_source_impl::inject_packets(const unsigned char *packets, size_t num_packets, size_t packet_size) {
+	if (packet_size != total_packet_size) {
+		std::stringstream msg_stream;
+		msg_stream << "Injected packets are " << packet_size << " bytes.  This source takes " << total_packet_size << " byte packets.";
+		GR_LOG_ERROR(d_logger, msg_stream.str());
+		return 0;
 	}
 
-	return retval;
+	uint64_t now_ns = (d_recorder || d_rx_timestamps) ? recorder_time_ns() : 0;
+	size_t queued = 0;
+
+	gr::thread::scoped_lock guard(d_net_mutex);
+
+	d_stats.packets_received.add(num_packets);
+
+	for (size_t i=0;i<num_packets;i++) {
+		if (accept_packet((unsigned char *)&packets[i * packet_size], packet_size, d_rx_timestamps ? now_ns : 0, now_ns))
+			queued++;
+	}
+
+	return queued;
+}
+
+// The kernel's receive time for a packet, or fallback_ns if it didn't attach one.
+uint64_t snap_source_impl::packet_arrival_ns(struct msghdr *hdr, uint64_t fallback_ns) {
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+			return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+	}
+
+	return fallback_ns;
 }
 
 void snap_source_impl::runThread() {
 	threadRunning = true;
+	d_stats.receive_tid.store(snap_stats_thread_id(), std::memory_order_relaxed);
 	/*
 	if (!d_use_pcap) {
 		// data dump until work starts.
@@ -1599,8 +2672,9 @@ void snap_source_impl::runThread() {
 
 		}
 		else {
-			queue_pcap_data();
-			usleep(8);
+			// Only back off if the queue is already full enough.  Otherwise keep reading.
+			if (queue_pcap_data() == 0)
+				usleep(8);
 		}
 	}
 
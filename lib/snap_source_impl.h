@@ -27,6 +27,18 @@
 #include <boost/circular_buffer.hpp>
 #include <ata/snap_source.h>
 #include <pcap/pcap.h>
+#include "pcap_mmap_reader.h"
+#include "pcap_index.h"
+#include "pcap_demux.h"
+#include "pacing_clock.h"
+#include "pcap_loop_cache.h"
+#include "pcap_chunk_decoder.h"
+#include "snap_record_chunk_decoder.h"
+#include "snap_record_reader.h"
+#include "snap_recorder.h"
+#include "snap_stats.h"
+#include "snap_stats_shm.h"
+#include "snap_trace.h"
 #include <sys/socket.h>
 
 namespace gr {
@@ -35,7 +47,13 @@ namespace ata {
 #define SNAPFORMAT_2_0_0
 
 #define MMSG_LENGTH 32
+// Room for the ancillary data on each received packet.
+#define MMSG_CONTROL_LENGTH 64
+// What we ask for as the socket's receive buffer.  net.core.rmem_max can silently cap it.
+#define RECEIVE_BUFFER_BYTES (100*1024*1024)
 #define MMSG_TIMEOUT 1
+// How long Wait For Alignment holds output waiting on the synchronizer.
+#define ALIGN_HOLD_TIMEOUT_SEC 10
 
 const int VP_DATA_STRIDE=256*16*2;
 
@@ -85,6 +103,11 @@ class data_vector {
 protected:
 	T *data=NULL;
 	size_t data_size=0;
+	// If false, data points into memory someone else owns (e.g. a mapped capture file)
+	// and copies of this vector just share the pointer.
+	bool owns_data=true;
+	// When the kernel received the packet, CLOCK_REALTIME ns.  0 if not known.
+	uint64_t arrival_ns=0;
 
 public:
 	data_vector() {
@@ -93,7 +116,14 @@ public:
 	};
 
 	data_vector(const data_vector<T>& src) {
-		if (src.data && (src.data_size > 0)) {
+		arrival_ns = src.arrival_ns;
+
+		if (!src.owns_data) {
+			data = src.data;
+			data_size = src.data_size;
+			owns_data = false;
+		}
+		else if (src.data && (src.data_size > 0)) {
 			data_size = src.data_size;
 			data = new T[data_size];
 			memcpy(data,src.data,data_size*sizeof(T));
@@ -118,6 +148,19 @@ public:
 		memcpy(data,src_data,data_size*sizeof(T));
 	};
 
+	data_vector(T *src_data,size_t src_size,bool copy_data) {
+		if (copy_data) {
+			data_size = src_size;
+			data = new T[data_size];
+			memcpy(data,src_data,data_size*sizeof(T));
+		}
+		else {
+			data = src_data;
+			data_size = src_size;
+			owns_data = false;
+		}
+	};
+
 	data_vector(size_t src_size) {
 		// Initialize with empty memory.
 		data_size = src_size;
@@ -127,8 +170,14 @@ public:
 
 	data_vector<T>& operator= ( const data_vector<T> & src) {
 		clear();
+		arrival_ns = src.arrival_ns;
 
-		if (src.data && (src.data_size > 0)) {
+		if (!src.owns_data) {
+			data = src.data;
+			data_size = src.data_size;
+			owns_data = false;
+		}
+		else if (src.data && (src.data_size > 0)) {
 			data_size = src.data_size;
 			data = new T[data_size];
 			memcpy(data,src.data,data_size*sizeof(T));
@@ -149,6 +198,13 @@ public:
 	virtual T * data_pointer() { return data; };
 
 	virtual void store(T *src_data,size_t src_size) {
+		if (!owns_data) {
+			// Stop sharing and take a copy of our own.
+			data = NULL;
+			data_size = 0;
+			owns_data = true;
+		}
+
 		if (!src_data || (src_size == 0)) {
 			// If we requested NULL or zero size, clear our buffer.
 			if (data) {
@@ -181,16 +237,20 @@ public:
 
 	virtual size_t size() { return data_size; };
 
+	uint64_t arrival_time() const { return arrival_ns; };
+	void set_arrival_time(uint64_t ns) { arrival_ns = ns; };
+
 	virtual void clear() {
-		if (data) {
+		if (data && owns_data) {
 			delete[] data;
-			data = NULL;
 		}
+		data = NULL;
 		data_size = 0;
+		owns_data = true;
 	}
 
 	virtual ~data_vector() {
-		if (data) {
+		if (data && owns_data) {
 			delete[] data;
 			// Pulled safeties off for speedup
 			// data = NULL;
@@ -204,6 +264,33 @@ protected:
 	size_t d_veclen;
 
 	bool d_notifyMissed;
+	// Runtime counters, kept whether or not missed packets are logged.
+	snap_source_stats d_stats;
+	// Seconds between dicts on the stats port (0 = never).
+	double d_stats_interval;
+	uint64_t d_next_stats_ns;
+	void work_finished(uint64_t start_ns, int items_returned, bool liveWork);
+	// The counters again, in shared memory for snap-top.
+	std::unique_ptr<snap_stats_shm_segment> d_stats_shm;
+	void fill_stats_shm(uint64_t *values);
+	// sample_number of the last vector work() handed out.
+	uint64_t d_last_sample_out;
+	// Kernel receive timestamps (SO_TIMESTAMPNS) on each packet, for the latency histograms
+	// and rx_time tags.  All CLOCK_REALTIME ns, 0 where unknown.
+	bool d_rx_timestamps;
+	// Receive thread: the previous packet off the socket.
+	uint64_t d_last_arrival_ns = 0;
+	// Work thread: the packet in localBuffer, and the first packet of the frame being built.
+	uint64_t d_local_arrival_ns = 0;
+	uint64_t d_frame_arrival_ns = 0;
+	pmt::pmt_t d_pmt_rx_time;
+	void output_arrival(int item, uint64_t arrival_ns, uint64_t now_ns, bool liveWork, int num_tagged_outputs);
+	// Seconds between 4-bit code histograms on the quant_stats port (0 = don't count).
+	// Counted as packets are unpacked, so voltage mode only and not with offline decoding.
+	double d_quant_stats_interval;
+	uint64_t d_next_quant_stats_ns = 0;
+	snap_quantization_stats d_quant_stats;
+	void publish_quant_stats(uint64_t now_ns, bool liveWork);
 	bool d_sourceZeros;
 	int d_partialFrameCounter;
 
@@ -214,6 +301,62 @@ protected:
 	bool d_repeat_file;
 	bool pcap_file_done;
 	pcap_t *pcapFile = NULL;
+	// Captures on disk are read through a file mapping shared by every source replaying
+	// the same file, and the queue holds pointers into it rather than copies.  libpcap is
+	// only used if the file can't be mapped.
+	std::shared_ptr<pcap_demux> d_pcap_demux;
+	int d_pcap_subscriber = -1;
+	bool d_pcap_fallback = false;
+
+	// Capture window in sample_number units (0 = no limit).  With a mapped file, the
+	// sidecar index gets us close to d_start_sample without parsing what's in front of it.
+	uint64_t d_start_sample;
+	uint64_t d_end_sample;
+
+	// Playing back a .snaprec recording instead of a capture.  Chunks are decompressed
+	// ahead of the reader thread on a small pool, and the chunk index takes the place of
+	// the capture's timestamp index.  Everything after next_pcap_payload() is the same as
+	// for a capture, so tags and gap handling match live data.
+	bool d_use_recording = false;
+	std::unique_ptr<snap_record_reader> d_record_reader;
+	std::unique_ptr<snap_record_prefetcher> d_record_prefetcher;
+	std::shared_ptr<snap_record_chunk_data> d_record_chunk;
+	uint32_t d_record_packet = 0;
+	size_t d_record_start_chunk = 0;
+	int d_record_threads = 0;
+
+	// Playback pacing for captures (PCAP_PACING_*).  When paced, packets are released to
+	// the queue on the schedule they arrived on rather than as fast as work() takes them.
+	int d_pcap_pacing;
+	pacing_clock d_pacing_clock;
+	uint64_t d_pcap_packet_time_ns = 0;
+
+	// With repeat on, small enough captures are played from memory after the first pass
+	// instead of going back to the file.  d_loop_continue_timestamps moves sample_number
+	// forward on every loop so downstream sees one long recording.
+	bool d_use_loop_cache = false;
+	bool d_loop_continue_timestamps = false;
+	pcap_loop_cache d_loop_cache;
+	uint64_t d_loop_sample_offset = 0;
+	void finish_loop_cache();
+
+	// Offline mode: a pool of threads decodes the capture in chunks and work() just
+	// copies the results out, instead of the reader thread and work_volt_mode().
+	bool d_offline_decode = false;
+	std::unique_ptr<snap_chunk_decoder> d_chunk_decoder;
+	bool d_offline_start_sent = false;
+
+	// Optional raw recording of every packet that passes validation, straight from the
+	// receive path (see snap_recorder).
+	std::string d_record_file;
+	int d_record_compression;
+	std::unique_ptr<snap_recorder> d_recorder;
+
+	uint64_t recorder_time_ns() {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	};
 	boost::mutex fp_mutex;
 	long min_pcap_queue_size;
 	long reload_size;
@@ -225,6 +368,18 @@ protected:
 
 	bool d_send_start_msg;
 
+	// Source-side alignment.  If d_wait_for_align is set, no frames are output until a
+	// synchronizer sends us an align_timestamp.  Packets before it are discarded.  If the
+	// answer doesn't come within ALIGN_HOLD_TIMEOUT_SEC, output starts unaligned and a late
+	// align_timestamp is ignored.  While we hold, a full receive queue overwrites its oldest
+	// packets; d_stats.align_hold_drops counts them.
+	bool d_wait_for_align;
+	uint64_t d_align_timestamp = 0;
+	uint64_t d_align_hold_until_ns = 0;
+	bool d_align_timed_out = false;
+
+	bool align_hold_active() { return d_wait_for_align && (d_align_timestamp == 0) && !d_align_timed_out; };
+
 	bool d_packed_output;
 
 	int d_port;
@@ -265,7 +420,13 @@ protected:
 	struct mmsghdr msgs[MMSG_LENGTH];
 	struct iovec iovecs[MMSG_LENGTH];
 	unsigned char bufs[MMSG_LENGTH][9000];
+	alignas(struct cmsghdr) unsigned char msg_control[MMSG_LENGTH][MMSG_CONTROL_LENGTH];
 	struct timespec timeout;
+	// The kernel's running count of packets dropped on this socket, as of the last batch.
+	uint32_t d_last_rxq_ovfl = 0;
+	void setup_socket_stats();
+	uint64_t packet_arrival_ns(struct msghdr *hdr, uint64_t fallback_ns);
+	bool accept_packet(unsigned char *cur_pkt, size_t len, uint64_t arrival_ns, uint64_t batch_time_ns);
 	int mmsg_sleep_time = 0;
 
 	// Separate receive thread
@@ -286,7 +447,7 @@ protected:
 
 	// A queue is required because we have 2 different timing
 	// domains: The network packets and the GR work()/scheduler
-	boost::circular_buffer<data_vector<unsigned char>> *d_localqueue;
+	boost::circular_buffer<data_vector<unsigned char>> *d_localqueue=NULL;
 	unsigned char *localBuffer;
 	char *test_buffer = NULL;
 #ifdef ZEROCOPY
@@ -298,8 +459,12 @@ protected:
 	int channels_per_packet;
 #ifdef USE_CIRC_VB
 	boost::circular_buffer<uint64_t> seq_num_queue;
+	// With d_rx_timestamps, one entry per queued vector: the frame's arrival time on its
+	// first vector and 0 on the rest and on zero-filled frames.
+	boost::circular_buffer<uint64_t> arrival_queue;
 #else
 	std::deque<uint64_t> seq_num_queue;
+	std::deque<uint64_t> arrival_queue;
 #endif
 
 	// async receive items
@@ -339,20 +504,17 @@ protected:
 
 	void openPCAP();
 	void closePCAP();
+	bool next_pcap_payload(unsigned char *&pData, size_t &len, bool &end_of_file);
+	bool load_pcap_index(pcap_index &index);
+	size_t find_pcap_start();
 
 	int mmsg_receive();
 
 	void copy_volt_data_to_vector_buffer(snap_header& hdr);
-	void queue_voltage_data(snap_header& hdr);
+	void queue_voltage_data(uint64_t sample_number);
 
 	void get_voltage_header(snap_header& hdr, unsigned char *pBuff) {
-		struct voltage_header *v_hdr;
-		v_hdr = (struct voltage_header *)pBuff;
-		hdr.antenna_id = be16toh(v_hdr->feng_id);
-		hdr.channel_id = be16toh(v_hdr->chan);
-		hdr.firmware_version = v_hdr->version; // no need to network->host order, only a byte
-		hdr.sample_number = be64toh(v_hdr->timestamp);
-		hdr.type = v_hdr->type;
+		parse_voltage_header(hdr, pBuff);
 	}
 
 	bool voltage_synchronize(unsigned char *pBuff) {
@@ -368,6 +530,7 @@ protected:
 			d_found_start_channel = true;
 
 			get_voltage_header(async_volt_sync_hdr,pBuff);
+			d_stats.antenna_id.store(async_volt_sync_hdr.antenna_id, std::memory_order_relaxed);
 
 			std::stringstream msg_stream;
 			if (d_use_pcap) {
@@ -403,6 +566,7 @@ protected:
 			d_found_start_channel = true;
 
 			get_spect_header(async_spect_sync_hdr, pBuff);
+			d_stats.antenna_id.store(async_spect_sync_hdr.antenna_id, std::memory_order_relaxed);
 
 			std::stringstream msg_stream;
 			if (d_use_pcap) {
@@ -425,31 +589,29 @@ protected:
 	}
 
 	void get_spect_header(snap_header& hdr, unsigned char *pBuff) {
-		uint64_t *header_as_uint64 = (uint64_t *)pBuff;
-
-		// Convert from network format to host format.
-		uint64_t header = be64toh(*header_as_uint64);
-
-		hdr.antenna_id = header & 0xff;
-		hdr.channel_id = ((header >> 8) & 0x07) * 512; // Id cycles 0-7.  Channel is 512*val
-		hdr.sample_number = (header >> 11) & 0x1fffffffffffULL;
-		hdr.firmware_version = (header >> 56) & 0xff;
+		parse_spect_header(hdr, pBuff);
 	}
 
 	void get_spectrometer_header(snap_header& hdr) {
-		uint64_t *header_as_uint64;
-		header_as_uint64 = (uint64_t *)localBuffer;
+		parse_spect_header(hdr, localBuffer);
+	}
 
-		// Convert from network format to host format.
-		uint64_t header = be64toh(*header_as_uint64);
+	// sample_number of a raw packet, whichever header type this source reads.
+	uint64_t packet_sample_number(const unsigned char *pBuff) {
+		snap_header hdr;
+
+		if (d_header_type == SNAP_PACKETTYPE_VOLTAGE)
+			parse_voltage_header(hdr, pBuff);
+		else
+			parse_spect_header(hdr, pBuff);
 
-		hdr.antenna_id = header & 0xff;
-		hdr.channel_id = ((header >> 8) & 0x07) * 512; // Id cycles 0-7.  Channel is 512*val
-		hdr.sample_number = (header >> 11) & 0x1fffffffffffULL;
-		hdr.firmware_version = (header >> 56) & 0xff;
+		return hdr.sample_number;
 	}
 
 	void NotifyMissed(int skippedPackets) {
+		if (skippedPackets > 0)
+			d_stats.missed_packets.add(skippedPackets);
+
 		if (skippedPackets > 0 && d_notifyMissed) {
 			std::stringstream msg_stream;
 			msg_stream << "[UDP source:" << d_port
@@ -490,11 +652,28 @@ protected:
 		hdr.type = v_hdr->type;
 	}
 
+	// Caller holds d_net_mutex if receiving on a thread.
+	void queue_packet(data_vector<unsigned char> &new_data) {
+		bool overwrite = d_localqueue->full();
+
+		if (overwrite) {
+			d_stats.queue_full_drops.add();
+
+			if (align_hold_active())
+				d_stats.align_hold_drops.add();
+		}
+
+		d_localqueue->push_back(new_data);
+		d_stats.packets_queued.add();
+		SNAP_TRACE3(enqueue, d_port, d_localqueue->size(), overwrite);
+	};
+
 	void fill_local_buffer(void) {
 		gr::thread::scoped_lock guard(d_net_mutex);
 
 		unsigned char *first_packet = d_localqueue->front().data_pointer();
 		memcpy(localBuffer,first_packet,total_packet_size);
+		d_local_arrival_ns = d_localqueue->front().arrival_time();
 		d_localqueue->pop_front();
 	};
 
@@ -517,12 +696,18 @@ protected:
 			gr_vector_void_star &output_items, bool liveWork);
 	int work_spec_mode(int noutput_items, gr_vector_const_void_star &input_items,
 			gr_vector_void_star &output_items, bool liveWork);
+	int work_offline(int noutput_items, gr_vector_void_star &output_items);
 public:
 	snap_source_impl(int port, int headerType,
 			bool notifyMissed, bool sourceZeros, bool ipv6,
 			int starting_channel, int ending_channel, int data_size,
 			int data_source, std::string file="", bool repeat_file=false, bool packed_output=false,
-			std::string mcast_group="", bool send_start_msg=false, std::string udp_ip="");
+			std::string mcast_group="", bool send_start_msg=false, std::string udp_ip="",
+			bool wait_for_align=false, uint64_t start_sample=0, uint64_t end_sample=0,
+			int pcap_pacing=0, double pacing_speedup=1.0,
+			int loop_cache_mb=0, bool loop_continue_timestamps=false, int decode_threads=0,
+			std::string record_file="", int record_compression=0, double stats_interval=1.0,
+			bool rx_timestamps=false, double quant_stats_interval=0.0);
 
 	~snap_source_impl();
 
@@ -533,8 +718,36 @@ public:
 
 	size_t packet_size() { return total_packet_size; };
 	bool packets_aligned() { return d_found_start_channel; };
+	const snap_source_stats & stats() { return d_stats; };
+	uint64_t missed_packets() { return d_stats.missed_packets.value(); };
+	// Only safe to read from the thread calling work().
+	uint64_t last_sample_out() { return d_last_sample_out; };
+
+	// For ControlPort.
+	void setup_rpc();
+	uint64_t stat_packets_received() { return d_stats.packets_received.value(); };
+	uint64_t stat_packets_queued() { return d_stats.packets_queued.value(); };
+	uint64_t stat_queue_full_drops() { return d_stats.queue_full_drops.value(); };
+	uint64_t stat_align_hold_drops() { return d_stats.align_hold_drops.value(); };
+	uint64_t stat_bad_channel_packets() { return d_stats.bad_channel_packets.value(); };
+	uint64_t stat_late_packets() { return d_stats.late_packets.value(); };
+	uint64_t stat_gap_frames() { return d_stats.gap_frames.value(); };
+	uint64_t stat_missed_packets() { return d_stats.missed_packets.value(); };
+	uint64_t stat_queue_depth() { return d_stats.queue_depth.value(); };
+	uint64_t stat_queue_depth_max() { return d_stats.queue_depth.max(); };
+	uint64_t stat_work_ns_p99() { return d_stats.work_ns.percentile(99.0); };
+	uint64_t stat_kernel_drops() { return d_stats.kernel_drops.value(); };
+	uint64_t stat_socket_backlog_max() { return d_stats.socket_backlog.max(); };
+	uint64_t stat_rcvbuf_bytes() { return d_stats.rcvbuf_bytes.value(); };
+	uint64_t stat_latency_ns_p99() { return d_stats.latency_ns.percentile(99.0); };
+	uint64_t stat_arrival_gap_ns_p99() { return d_stats.arrival_gap_ns.percentile(99.0); };
+	// Puts packets on the receive queue as if they had come off the socket, with the same
+	// checks, for tests and benchmarks that generate their own (see snap_packet_generator).
+	// The calling thread stands in for the receive thread, so the source should be on a
+	// port nothing else is sending to.  Returns how many were queued.
+	size_t inject_packets(const unsigned char *packets, size_t num_packets, size_t packet_size);
 	void queue_data();
-	void queue_pcap_data();
+	long queue_pcap_data();
 
 	void create_test_buffer();
 
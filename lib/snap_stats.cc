@@ -0,0 +1,258 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_stats.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <math.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace gr {
+namespace ata {
+
+pid_t snap_stats_thread_id() {
+	return (pid_t)syscall(SYS_gettid);
+}
+
+// The kernel takes any thread's tid as a clock id the same way pthread_getcpuclockid()
+// builds one, which works for threads we didn't start.  /proc is the fallback, in clock ticks.
+int64_t snap_stats_thread_cpu_ns(pid_t tid) {
+	clockid_t clock_id = (clockid_t)((~(unsigned int)tid << 3) | 6);
+	struct timespec ts;
+
+	if (clock_gettime(clock_id, &ts) == 0)
+		return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+	std::stringstream path;
+	path << "/proc/self/task/" << tid << "/stat";
+
+	std::ifstream stat_file(path.str());
+	std::string line;
+
+	if (!std::getline(stat_file, line))
+		return -1;
+
+	// The command name can hold spaces, so start after it.
+	size_t name_end = line.rfind(')');
+
+	if (name_end == std::string::npos)
+		return -1;
+
+	std::stringstream fields(line.substr(name_end + 2));
+	std::string field;
+	int64_t utime = 0;
+	int64_t stime = 0;
+
+	// Fields 3 to 13, then utime and stime.
+	for (int i=3;i<=13;i++)
+		fields >> field;
+
+	if (!(fields >> utime >> stime))
+		return -1;
+
+	return (utime + stime) * (1000000000LL / sysconf(_SC_CLK_TCK));
+}
+
+std::vector<uint64_t> stats_histogram::values() const {
+	std::vector<uint64_t> v(d_num_bins);
+
+	for (int i=0;i<d_num_bins;i++)
+		v[i] = bin(i);
+
+	return v;
+}
+
+uint64_t stats_histogram::percentile(double p) const {
+	std::vector<uint64_t> v = values();
+	uint64_t total = 0;
+
+	for (int i=0;i<d_num_bins;i++)
+		total += v[i];
+
+	if (total == 0)
+		return 0;
+
+	uint64_t target = (uint64_t)(p / 100.0 * total);
+	uint64_t seen = 0;
+
+	for (int i=0;i<d_num_bins;i++) {
+		seen += v[i];
+
+		if ((seen > target) || (i == d_num_bins - 1)) {
+			if (!d_log2_bins)
+				return i;
+
+			return (i == 0) ? 0 : ((1ULL << i) - 1);
+		}
+	}
+
+	return 0;
+}
+
+// A packet adds at most 32 to a 16-bit counter.
+#define QUANT_PACKETS_PER_FOLD (0xFFFF / 32)
+
+void snap_quantization_stats::resize(int num_channels) {
+	d_num_channels = num_channels;
+	d_lanes.assign((size_t)num_channels * 8, 0);
+	d_counts.assign((size_t)num_channels * 32, 0);
+	clear();
+}
+
+void snap_quantization_stats::clear() {
+	std::fill(d_lanes.begin(), d_lanes.end(), 0);
+	std::fill(d_counts.begin(), d_counts.end(), 0);
+	d_packets_in_lanes = 0;
+	d_packets = 0;
+	d_first_sample_number = 0;
+	d_last_sample_number = 0;
+}
+
+void snap_quantization_stats::packet_done(int channel_index, uint64_t sample_number) {
+	const uint64_t even_bytes = 0x00FF00FF00FF00FFULL;
+	uint64_t *lanes = &d_lanes[(size_t)channel_index * 8];
+
+	for (int c=0;c<256;c++) {
+		for (int pol=0;pol<2;pol++) {
+			uint64_t low_codes = d_counter.lanes[c][pol][0];
+			uint64_t high_codes = d_counter.lanes[c][pol][1];
+
+			lanes[0] += low_codes & even_bytes;
+			lanes[1] += (low_codes >> 8) & even_bytes;
+			lanes[2] += high_codes & even_bytes;
+			lanes[3] += (high_codes >> 8) & even_bytes;
+			lanes += 4;
+		}
+	}
+
+	if (++d_packets_in_lanes >= QUANT_PACKETS_PER_FOLD)
+		fold_lanes();
+
+	if (d_packets++ == 0)
+		d_first_sample_number = sample_number;
+
+	d_last_sample_number = sample_number;
+}
+
+void snap_quantization_stats::fold_lanes() {
+	size_t num_rows = (size_t)d_num_channels * 2;
+
+	for (size_t row=0;row<num_rows;row++) {
+		for (int code=0;code<16;code++)
+			d_counts[row * 16 + code] = (uint32_t)code_count(row, code);
+	}
+
+	std::fill(d_lanes.begin(), d_lanes.end(), 0);
+	d_packets_in_lanes = 0;
+}
+
+uint64_t snap_quantization_stats::code_count(size_t row, int code) const {
+	uint64_t word = d_lanes[row * 4 + (code & 0x08) / 4 + (code & 0x01)];
+
+	return d_counts[row * 16 + code] + ((word >> (16 * ((code & 0x07) >> 1))) & 0xFFFF);
+}
+
+pmt::pmt_t snap_quantization_stats::to_pdu(pmt::pmt_t meta) const {
+	size_t num_rows = (size_t)d_num_channels * 2;
+	std::vector<uint32_t> hist(num_rows * 16);
+	std::vector<float> rms(num_rows);
+	std::vector<float> clipped(num_rows);
+
+	for (size_t row=0;row<num_rows;row++) {
+		uint64_t total = 0;
+		uint64_t sum_squares = 0;
+		uint64_t clip_count = 0;
+
+		for (int bin=0;bin<16;bin++) {
+			// Bin b is the code for b - 8, which is b ^ 8.  The RMS and clipping use the value
+			// the output gets, and twosComplementLUT reads code 8 (-8) as 0.
+			int value = (bin == 0) ? 0 : bin - 8;
+			uint64_t n = code_count(row, bin ^ 8);
+
+			hist[row * 16 + bin] = (uint32_t)n;
+			total += n;
+			sum_squares += n * (uint64_t)(value * value);
+
+			if ((value == -7) || (value == 7))
+				clip_count += n;
+		}
+
+		rms[row] = (total > 0) ? (float)sqrt((double)sum_squares / (double)total) : 0.0f;
+		clipped[row] = (total > 0) ? (float)((double)clip_count / (double)total) : 0.0f;
+	}
+
+	meta = pmt::dict_add(meta, pmt::mp("num_channels"), pmt::mp(d_num_channels));
+	meta = pmt::dict_add(meta, pmt::mp("packets"), pmt::from_uint64(d_packets));
+	meta = pmt::dict_add(meta, pmt::mp("first_sample_number"), pmt::from_uint64(d_first_sample_number));
+	meta = pmt::dict_add(meta, pmt::mp("last_sample_number"), pmt::from_uint64(d_last_sample_number));
+	meta = pmt::dict_add(meta, pmt::mp("rms"), pmt::init_f32vector(rms.size(), rms));
+	meta = pmt::dict_add(meta, pmt::mp("clip_fraction"), pmt::init_f32vector(clipped.size(), clipped));
+
+	return pmt::cons(meta, pmt::init_u32vector(hist.size(), hist));
+}
+
+pmt::pmt_t snap_source_stats::to_dict() const {
+	pmt::pmt_t dict = pmt::make_dict();
+
+	dict = pmt::dict_add(dict, pmt::mp("packets_received"), pmt::from_uint64(packets_received.value()));
+	dict = pmt::dict_add(dict, pmt::mp("packets_before_sync"), pmt::from_uint64(packets_before_sync.value()));
+	dict = pmt::dict_add(dict, pmt::mp("bad_channel_packets"), pmt::from_uint64(bad_channel_packets.value()));
+	dict = pmt::dict_add(dict, pmt::mp("packets_queued"), pmt::from_uint64(packets_queued.value()));
+	dict = pmt::dict_add(dict, pmt::mp("queue_full_drops"), pmt::from_uint64(queue_full_drops.value()));
+	dict = pmt::dict_add(dict, pmt::mp("align_hold_drops"), pmt::from_uint64(align_hold_drops.value()));
+	dict = pmt::dict_add(dict, pmt::mp("kernel_drops"), pmt::from_uint64(kernel_drops.value()));
+	dict = pmt::dict_add(dict, pmt::mp("socket_backlog_bytes"), pmt::from_uint64(socket_backlog.value()));
+	dict = pmt::dict_add(dict, pmt::mp("socket_backlog_max_bytes"), pmt::from_uint64(socket_backlog.max()));
+	dict = pmt::dict_add(dict, pmt::mp("rcvbuf_bytes"), pmt::from_uint64(rcvbuf_bytes.value()));
+	dict = pmt::dict_add(dict, pmt::mp("rcvbuf_requested_bytes"), pmt::from_uint64(rcvbuf_requested.value()));
+	dict = pmt::dict_add(dict, pmt::mp("work_calls"), pmt::from_uint64(work_calls.value()));
+	dict = pmt::dict_add(dict, pmt::mp("items_out"), pmt::from_uint64(items_out.value()));
+	dict = pmt::dict_add(dict, pmt::mp("late_packets"), pmt::from_uint64(late_packets.value()));
+	dict = pmt::dict_add(dict, pmt::mp("gap_frames"), pmt::from_uint64(gap_frames.value()));
+	dict = pmt::dict_add(dict, pmt::mp("missed_packets"), pmt::from_uint64(missed_packets.value()));
+	dict = pmt::dict_add(dict, pmt::mp("queue_depth"), pmt::from_uint64(queue_depth.value()));
+	dict = pmt::dict_add(dict, pmt::mp("queue_depth_max"), pmt::from_uint64(queue_depth.max()));
+	dict = pmt::dict_add(dict, pmt::mp("work_ns_p50"), pmt::from_uint64(work_ns.percentile(50.0)));
+	dict = pmt::dict_add(dict, pmt::mp("work_ns_p99"), pmt::from_uint64(work_ns.percentile(99.0)));
+	dict = pmt::dict_add(dict, pmt::mp("latency_ns_p50"), pmt::from_uint64(latency_ns.percentile(50.0)));
+	dict = pmt::dict_add(dict, pmt::mp("latency_ns_p99"), pmt::from_uint64(latency_ns.percentile(99.0)));
+	dict = pmt::dict_add(dict, pmt::mp("arrival_gap_ns_p50"), pmt::from_uint64(arrival_gap_ns.percentile(50.0)));
+	dict = pmt::dict_add(dict, pmt::mp("arrival_gap_ns_p99"), pmt::from_uint64(arrival_gap_ns.percentile(99.0)));
+
+	// Histograms go out whole.  See stats_histogram for the bin edges.
+	dict = pmt::dict_add(dict, pmt::mp("receive_batch_hist"), pmt::init_u64vector(receive_batch.num_bins(), receive_batch.values()));
+	dict = pmt::dict_add(dict, pmt::mp("queue_depth_log2_hist"), pmt::init_u64vector(queue_depth_hist.num_bins(), queue_depth_hist.values()));
+	dict = pmt::dict_add(dict, pmt::mp("work_ns_log2_hist"), pmt::init_u64vector(work_ns.num_bins(), work_ns.values()));
+	dict = pmt::dict_add(dict, pmt::mp("latency_ns_log2_hist"), pmt::init_u64vector(latency_ns.num_bins(), latency_ns.values()));
+	dict = pmt::dict_add(dict, pmt::mp("arrival_gap_ns_log2_hist"), pmt::init_u64vector(arrival_gap_ns.num_bins(), arrival_gap_ns.values()));
+
+	return dict;
+}
+
+} /* namespace ata */
+} /* namespace gr */
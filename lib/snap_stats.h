@@ -0,0 +1,265 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_STATS_H
+#define INCLUDED_ATA_SNAP_STATS_H
+
+#include <pmt/pmt.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "snap_unpack.h"
+
+namespace gr {
+namespace ata {
+
+/*
+ * Counters for the hot paths.  Each one has a single writer (the receive thread or the
+ * thread calling work()), so an update is a relaxed load and store with no locked
+ * instruction, and any other thread can read it at any time.  Readers see a recent
+ * value of each counter, not a snapshot that's consistent across counters.
+ */
+class stats_counter {
+protected:
+	std::atomic<uint64_t> d_value;
+
+public:
+	stats_counter() : d_value(0) {};
+
+	void add(uint64_t n=1) {
+		d_value.store(d_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	};
+
+	uint64_t value() const { return d_value.load(std::memory_order_relaxed); };
+};
+
+// A level that goes up and down, with the highest it's been.
+class stats_gauge {
+protected:
+	std::atomic<uint64_t> d_value;
+	std::atomic<uint64_t> d_max;
+
+public:
+	stats_gauge() : d_value(0), d_max(0) {};
+
+	void set(uint64_t value) {
+		d_value.store(value, std::memory_order_relaxed);
+
+		if (value > d_max.load(std::memory_order_relaxed))
+			d_max.store(value, std::memory_order_relaxed);
+	};
+
+	uint64_t value() const { return d_value.load(std::memory_order_relaxed); };
+	uint64_t max() const { return d_max.load(std::memory_order_relaxed); };
+};
+
+/*
+ * Single writer histogram.  With log2 bins, bin 0 counts zeros and bin k counts values
+ * from 2^(k-1) up to 2^k - 1.  Otherwise bin k counts the value k.  Anything past the
+ * last bin lands in it.
+ */
+class stats_histogram {
+protected:
+	int d_num_bins;
+	bool d_log2_bins;
+	std::unique_ptr<std::atomic<uint64_t>[]> d_bins;
+
+public:
+	stats_histogram(int num_bins, bool log2_bins) : d_num_bins(num_bins), d_log2_bins(log2_bins),
+		d_bins(new std::atomic<uint64_t>[num_bins]) {
+		for (int i=0;i<d_num_bins;i++)
+			d_bins[i].store(0, std::memory_order_relaxed);
+	};
+
+	void add(uint64_t value) {
+		int bin;
+
+		if (d_log2_bins)
+			bin = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+		else
+			bin = (value < (uint64_t)d_num_bins) ? (int)value : d_num_bins - 1;
+
+		if (bin >= d_num_bins)
+			bin = d_num_bins - 1;
+
+		d_bins[bin].store(d_bins[bin].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	};
+
+	int num_bins() const { return d_num_bins; };
+	bool log2_bins() const { return d_log2_bins; };
+	uint64_t bin(int index) const { return d_bins[index].load(std::memory_order_relaxed); };
+
+	std::vector<uint64_t> values() const;
+	// Smallest value that p percent of the counts are at or below, taking each bin's upper edge.
+	uint64_t percentile(double p) const;
+};
+
+// The calling thread's kernel thread ID.
+pid_t snap_stats_thread_id();
+// CPU time a thread in this process has used, or -1 if it's gone.
+int64_t snap_stats_thread_cpu_ns(pid_t tid);
+
+// Bins for the SNAP source's histograms.
+#define SNAP_STATS_LOG2_BINS 40
+
+/*
+ * What the SNAP source has seen since it started.  Published on its stats message port
+ * and through ControlPort.
+ */
+struct snap_source_stats {
+	// Receive thread.
+	stats_counter packets_received;
+	stats_counter packets_before_sync;
+	stats_counter bad_channel_packets;
+	stats_counter packets_queued;
+	// The receive queue was full, so the oldest packet in it was overwritten.
+	stats_counter queue_full_drops;
+	// Of those, the ones lost while Wait For Alignment held the queue.
+	stats_counter align_hold_drops;
+	// Packets per recvmmsg() call, including calls that found nothing.
+	stats_histogram receive_batch;
+	// Packets the kernel dropped because the socket's receive buffer was full (SO_RXQ_OVFL).
+	stats_counter kernel_drops;
+	// Bytes waiting in the socket buffer, sampled when a recvmmsg() call comes back full.
+	stats_gauge socket_backlog;
+	// The receive buffer the kernel actually gave us, in its accounting (double the
+	// setsockopt() value), and what we asked for.
+	stats_gauge rcvbuf_bytes;
+	stats_gauge rcvbuf_requested;
+	// With rx_timestamps, ns between one packet's kernel receive time and the next's.
+	stats_histogram arrival_gap_ns;
+
+	// Thread calling work().
+	stats_counter work_calls;
+	stats_counter items_out;
+	// Packets that turned up after their frame had already gone out.
+	stats_counter late_packets;
+	// Whole frames that never arrived.
+	stats_counter gap_frames;
+	stats_counter missed_packets;
+	// Receive queue depth as work() finds it, in packets.
+	stats_gauge queue_depth;
+	stats_histogram queue_depth_hist;
+	// Time spent in work(), in ns.
+	stats_histogram work_ns;
+	// With rx_timestamps, ns from the kernel receiving a frame's first packet to the frame
+	// leaving work().
+	stats_histogram latency_ns;
+
+	// Who's doing the work, for monitors.  Thread IDs are 0 and the antenna is -1 until known.
+	std::atomic<pid_t> receive_tid;
+	std::atomic<pid_t> work_tid;
+	std::atomic<int> antenna_id;
+
+	snap_source_stats(int max_batch) : receive_batch(max_batch + 1, false), arrival_gap_ns(SNAP_STATS_LOG2_BINS, true),
+		queue_depth_hist(SNAP_STATS_LOG2_BINS, true), work_ns(SNAP_STATS_LOG2_BINS, true), latency_ns(SNAP_STATS_LOG2_BINS, true),
+		receive_tid(0), work_tid(0), antenna_id(-1) {
+	};
+
+	pmt::pmt_t to_dict() const;
+
+	static uint64_t now_ns() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	};
+};
+
+/*
+ * Quantization counts for a voltage source: a histogram of the 4-bit codes for every
+ * channel and polarization, counted by unpack_voltage_packet() as it unpacks, so the
+ * digital gain can be checked without another pass over the data.  Only the thread
+ * calling work() touches it.
+ */
+class snap_quantization_stats {
+protected:
+	int d_num_channels;
+	voltage_code_counter d_counter;
+	// Each packet's 8-bit counters are folded into 16-bit ones here, four to a word,
+	// indexed [channel][pol][word].  Word w holds codes (w & 2) * 4 + (w & 1) + 2k for
+	// k = 0-3.  Those are folded into d_counts before they can overflow.
+	std::vector<uint64_t> d_lanes;
+	std::vector<uint32_t> d_counts;
+	uint32_t d_packets_in_lanes;
+	uint64_t d_packets;
+	uint64_t d_first_sample_number;
+	uint64_t d_last_sample_number;
+
+	void fold_lanes();
+	uint64_t code_count(size_t row, int code) const;
+
+public:
+	snap_quantization_stats() : d_num_channels(0), d_packets_in_lanes(0), d_packets(0), d_first_sample_number(0), d_last_sample_number(0) {};
+
+	void resize(int num_channels);
+	void clear();
+
+	// What to hand unpack_voltage_packet().
+	voltage_code_counter *counter() { return &d_counter; };
+
+	// Adds the counter's packet to the channels starting channel_index into the source's range.
+	void packet_done(int channel_index, uint64_t sample_number);
+
+	uint64_t packets() const { return d_packets; };
+	// True once another packet could overflow a count.  Each packet adds 32 codes to each
+	// of its channels' histograms.
+	bool full() const { return d_packets >= (0xFFFFFFFFULL / 32) - 1; };
+
+	/*
+	 * A PDU with the histograms as a u32vector indexed [channel][pol][value + 8], so bin 0
+	 * is -8 and bin 15 is +7.  meta gets num_channels, packets, the first and last
+	 * sample_number counted, and f32vectors indexed [channel][pol] of the RMS in 4-bit
+	 * units (I and Q together) and the fraction of values at -7 or +7.  The RMS and clip
+	 * fraction are of the values the source outputs, which read -8 as 0, so bin 0 is
+	 * kept on its own to show how often the SNAP sent it.
+	 */
+	pmt::pmt_t to_pdu(pmt::pmt_t meta) const;
+};
+
+// What a synchronizer has done since it started.  All written by the thread calling general_work().
+struct snap_synchronizer_stats {
+	stats_counter work_calls;
+	stats_counter items_out;
+	// Items dropped from the inputs to line them up, summed over inputs.
+	stats_counter items_dropped;
+	stats_counter syncs;
+	stats_counter resyncs;
+	// 1 while the inputs are aligned.
+	stats_gauge synchronized;
+
+	std::atomic<pid_t> work_tid;
+	// Room for this many copy pool threads.  Each is 0 until its thread starts.
+	int max_copy_threads;
+	std::unique_ptr<std::atomic<pid_t>[]> copy_tids;
+
+	snap_synchronizer_stats(int max_threads) : work_tid(0), max_copy_threads(max_threads > 0 ? max_threads : 1),
+		copy_tids(new std::atomic<pid_t>[max_copy_threads]) {
+		for (int i=0;i<max_copy_threads;i++)
+			copy_tids[i].store(0, std::memory_order_relaxed);
+	};
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_STATS_H */
@@ -0,0 +1,324 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "snap_stats_shm.h"
+#include "snap_stats.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+// Tries before a reader gives up on a segment the publisher keeps busy.
+#define SNAPSHOT_TRIES 100
+
+namespace gr {
+namespace ata {
+
+/*
+ * The process's publisher.  publisher_lifecycle_mutex covers starting and stopping the
+ * thread, and publisher_mutex covers the segment list.  The thread holds publisher_mutex
+ * while it publishes, so once remove_segment() returns the segment is never touched again.
+ */
+static boost::mutex publisher_lifecycle_mutex;
+static boost::mutex publisher_mutex;
+static boost::condition_variable publisher_cond;
+static std::vector<snap_stats_shm_segment *> published_segments;
+static boost::thread *publisher_thread = NULL;
+static bool stop_publisher = false;
+
+static std::atomic<int> next_segment_number(0);
+
+static void run_publisher() {
+	boost::unique_lock<boost::mutex> lock(publisher_mutex);
+
+	while (!stop_publisher) {
+		for (size_t i=0;i<published_segments.size();i++)
+			published_segments[i]->publish();
+
+		publisher_cond.timed_wait(lock, boost::posix_time::milliseconds(SNAP_STATS_SHM_PUBLISH_MS));
+	}
+}
+
+static void add_segment(snap_stats_shm_segment *segment) {
+	boost::lock_guard<boost::mutex> lifecycle(publisher_lifecycle_mutex);
+
+	{
+		boost::lock_guard<boost::mutex> lock(publisher_mutex);
+		published_segments.push_back(segment);
+		stop_publisher = false;
+	}
+
+	if (!publisher_thread)
+		publisher_thread = new boost::thread(run_publisher);
+}
+
+static void remove_segment(snap_stats_shm_segment *segment) {
+	boost::lock_guard<boost::mutex> lifecycle(publisher_lifecycle_mutex);
+	bool last = false;
+
+	{
+		boost::lock_guard<boost::mutex> lock(publisher_mutex);
+		published_segments.erase(std::remove(published_segments.begin(), published_segments.end(), segment), published_segments.end());
+
+		if (published_segments.empty()) {
+			stop_publisher = true;
+			last = true;
+		}
+	}
+
+	if (last && publisher_thread) {
+		publisher_cond.notify_all();
+		publisher_thread->join();
+		delete publisher_thread;
+		publisher_thread = NULL;
+	}
+}
+
+snap_stats_shm_segment::snap_stats_shm_segment(const snap_stats_shm_info &info, fill_function fill)
+: d_info(info), d_fill(fill), d_layout(NULL)
+{
+	if (d_info.num_values > SNAP_STATS_SHM_MAX_VALUES)
+		d_info.num_values = SNAP_STATS_SHM_MAX_VALUES;
+}
+
+snap_stats_shm_segment::~snap_stats_shm_segment() {
+	close();
+}
+
+bool snap_stats_shm_segment::open() {
+	if (d_layout)
+		return true;
+
+	std::stringstream name;
+	name << "/" << SNAP_STATS_SHM_PREFIX << getpid() << "." << next_segment_number.fetch_add(1);
+	d_name = name.str();
+
+	int fd = shm_open(d_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+
+	if (fd < 0) {
+		d_last_error = "Unable to create " + d_name + ": " + strerror(errno);
+		return false;
+	}
+
+	if (ftruncate(fd, sizeof(snap_stats_shm_layout)) != 0) {
+		d_last_error = "Unable to size " + d_name + ": " + strerror(errno);
+		::close(fd);
+		shm_unlink(d_name.c_str());
+		return false;
+	}
+
+	void *mapping = mmap(NULL, sizeof(snap_stats_shm_layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (mapping == MAP_FAILED) {
+		d_last_error = "Unable to map " + d_name + ": " + strerror(errno);
+		shm_unlink(d_name.c_str());
+		return false;
+	}
+
+	// New shared memory is zeroed, so only the fixed fields need filling in.  Readers
+	// ignore the segment until the magic is there.
+	d_layout = (snap_stats_shm_layout *)mapping;
+	d_layout->version = SNAP_STATS_SHM_VERSION;
+	d_layout->kind = d_info.kind;
+	d_layout->pid = getpid();
+	d_layout->port = d_info.port;
+	d_layout->packet_type = d_info.packet_type;
+	d_layout->packet_size = d_info.packet_size;
+	d_layout->num_inputs = d_info.num_inputs;
+	d_layout->num_values = d_info.num_values;
+	strncpy(d_layout->block_name, d_info.block_name.c_str(), SNAP_STATS_SHM_NAME_LEN - 1);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	d_layout->created_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	publish();
+	d_layout->magic.store(SNAP_STATS_SHM_MAGIC, std::memory_order_release);
+
+	add_segment(this);
+
+	return true;
+}
+
+void snap_stats_shm_segment::close() {
+	if (!d_layout)
+		return;
+
+	remove_segment(this);
+
+	munmap(d_layout, sizeof(snap_stats_shm_layout));
+	d_layout = NULL;
+
+	shm_unlink(d_name.c_str());
+}
+
+void snap_stats_shm_segment::publish() {
+	uint64_t values[SNAP_STATS_SHM_MAX_VALUES];
+	memset(values, 0, sizeof(values));
+
+	d_fill(values);
+
+	uint64_t sequence = d_layout->sequence.load(std::memory_order_relaxed);
+
+	d_layout->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (int i=0;i<d_info.num_values;i++)
+		d_layout->values[i].store(values[i], std::memory_order_relaxed);
+
+	d_layout->update_ns.store(snap_source_stats::now_ns(), std::memory_order_relaxed);
+
+	d_layout->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+snap_stats_shm_reader::snap_stats_shm_reader() : d_layout(NULL) {
+}
+
+snap_stats_shm_reader::~snap_stats_shm_reader() {
+	close();
+}
+
+std::vector<std::string> snap_stats_shm_reader::list() {
+	std::vector<std::string> names;
+	DIR *dir = opendir("/dev/shm");
+
+	if (!dir)
+		return names;
+
+	struct dirent *entry;
+	size_t prefix_len = strlen(SNAP_STATS_SHM_PREFIX);
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, SNAP_STATS_SHM_PREFIX, prefix_len) == 0)
+			names.push_back(entry->d_name);
+	}
+
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+
+	return names;
+}
+
+bool snap_stats_shm_reader::owner_alive(pid_t pid) {
+	// EPERM means it's there but belongs to someone else.
+	return (kill(pid, 0) == 0) || (errno == EPERM);
+}
+
+bool snap_stats_shm_reader::remove(const std::string &name) {
+	return shm_unlink(("/" + name).c_str()) == 0;
+}
+
+bool snap_stats_shm_reader::open(const std::string &name) {
+	close();
+
+	int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+
+	if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(snap_stats_shm_layout))) {
+		::close(fd);
+		return false;
+	}
+
+	void *mapping = mmap(NULL, sizeof(snap_stats_shm_layout), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (mapping == MAP_FAILED)
+		return false;
+
+	d_name = name;
+	d_layout = (const snap_stats_shm_layout *)mapping;
+
+	return true;
+}
+
+void snap_stats_shm_reader::close() {
+	if (!d_layout)
+		return;
+
+	munmap((void *)d_layout, sizeof(snap_stats_shm_layout));
+	d_layout = NULL;
+}
+
+bool snap_stats_shm_reader::snapshot(snap_stats_shm_snapshot &snap) {
+	if (!d_layout)
+		return false;
+
+	if ((d_layout->magic.load(std::memory_order_acquire) != SNAP_STATS_SHM_MAGIC) || (d_layout->version != SNAP_STATS_SHM_VERSION))
+		return false;
+
+	int num_values = std::min((int)d_layout->num_values, SNAP_STATS_SHM_MAX_VALUES);
+	snap.values.assign(SNAP_STATS_SHM_MAX_VALUES, 0);
+
+	for (int attempt=0;attempt<SNAPSHOT_TRIES;attempt++) {
+		uint64_t sequence = d_layout->sequence.load(std::memory_order_acquire);
+
+		if (sequence & 1) {
+			sched_yield();
+			continue;
+		}
+
+		for (int i=0;i<num_values;i++)
+			snap.values[i] = d_layout->values[i].load(std::memory_order_relaxed);
+
+		snap.update_ns = d_layout->update_ns.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (d_layout->sequence.load(std::memory_order_relaxed) != sequence)
+			continue;
+
+		snap.name = d_name;
+		snap.kind = d_layout->kind;
+		snap.pid = d_layout->pid;
+		snap.port = d_layout->port;
+		snap.packet_type = d_layout->packet_type;
+		snap.packet_size = d_layout->packet_size;
+		snap.num_inputs = d_layout->num_inputs;
+		snap.block_name = std::string(d_layout->block_name, strnlen(d_layout->block_name, SNAP_STATS_SHM_NAME_LEN));
+		snap.created_ns = d_layout->created_ns;
+
+		return true;
+	}
+
+	return false;
+}
+
+} // namespace ata
+} // namespace gr
@@ -0,0 +1,218 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_STATS_SHM_H
+#define INCLUDED_ATA_SNAP_STATS_SHM_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Shared memory statistics segments.  Each SNAP source and synchronizer in a process gets
+ * a POSIX shared memory object named SNAP_STATS_SHM_PREFIX<pid>.<n> with the fixed layout
+ * below.  One publisher thread per process copies every block's counters into its segment
+ * a few times a second, so nothing is added to the receive or work() paths, and tools like
+ * snap-top can read them without ControlPort or Python.
+ *
+ * The values are guarded by a seqlock: the publisher makes the sequence odd, writes the
+ * values and makes it even again.  A reader copies the values between two reads of the
+ * sequence and tries again if it was odd or changed.
+ */
+
+// "SNAPSTAT"
+#define SNAP_STATS_SHM_MAGIC 0x5441545350414e53ULL
+#define SNAP_STATS_SHM_VERSION 1
+// Under /dev/shm.
+#define SNAP_STATS_SHM_PREFIX "gr-ata-stats."
+#define SNAP_STATS_SHM_NAME_LEN 64
+#define SNAP_STATS_SHM_MAX_VALUES 32
+#define SNAP_STATS_SHM_PUBLISH_MS 250
+
+#define SNAP_STATS_SHM_KIND_SOURCE 1
+#define SNAP_STATS_SHM_KIND_SYNCHRONIZER 2
+
+// Value slots in a source's segment.  Counters are totals since the block started.
+enum snap_source_shm_value {
+	SNAP_SHM_SRC_PACKETS_RECEIVED = 0,
+	SNAP_SHM_SRC_PACKETS_QUEUED,
+	SNAP_SHM_SRC_QUEUE_FULL_DROPS,
+	SNAP_SHM_SRC_BAD_CHANNEL_PACKETS,
+	SNAP_SHM_SRC_LATE_PACKETS,
+	SNAP_SHM_SRC_GAP_FRAMES,
+	SNAP_SHM_SRC_MISSED_PACKETS,
+	SNAP_SHM_SRC_QUEUE_DEPTH,
+	SNAP_SHM_SRC_QUEUE_DEPTH_MAX,
+	SNAP_SHM_SRC_WORK_CALLS,
+	SNAP_SHM_SRC_ITEMS_OUT,
+	SNAP_SHM_SRC_WORK_NS_P99,
+	SNAP_SHM_SRC_RECEIVE_CPU_NS,
+	SNAP_SHM_SRC_WORK_CPU_NS,
+	// F-engine ID plus one, 0 until the source has aligned.
+	SNAP_SHM_SRC_ANTENNA_ID,
+	SNAP_SHM_SRC_KERNEL_DROPS,
+	SNAP_SHM_SRC_SOCKET_BACKLOG_MAX,
+	SNAP_SHM_SRC_RCVBUF,
+	// ns, 0 without rx_timestamps.
+	SNAP_SHM_SRC_LATENCY_P50,
+	SNAP_SHM_SRC_LATENCY_P99,
+	SNAP_SHM_SRC_ARRIVAL_GAP_P99,
+	SNAP_SHM_SRC_NUM_VALUES
+};
+
+// Value slots in a synchronizer's segment.
+enum snap_synchronizer_shm_value {
+	SNAP_SHM_SYNC_WORK_CALLS = 0,
+	SNAP_SHM_SYNC_ITEMS_OUT,
+	SNAP_SHM_SYNC_ITEMS_DROPPED,
+	SNAP_SHM_SYNC_SYNCS,
+	SNAP_SHM_SYNC_RESYNCS,
+	SNAP_SHM_SYNC_SYNCHRONIZED,
+	SNAP_SHM_SYNC_WORK_CPU_NS,
+	// All the copy pool threads together.
+	SNAP_SHM_SYNC_COPY_CPU_NS,
+	SNAP_SHM_SYNC_NUM_VALUES
+};
+
+namespace gr {
+namespace ata {
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "The stats segment needs lock free 64-bit atomics to be shared between processes."
+#endif
+
+// Everything but the sequence, update time and values is written once, before magic.
+struct snap_stats_shm_layout {
+	std::atomic<uint64_t> magic;
+	uint32_t version;
+	uint32_t kind;
+	int32_t pid;
+	// UDP port for a source, -1 if it's reading a file.
+	int32_t port;
+	// SNAP_PACKETTYPE_* and bytes per packet for a source.  A synchronizer puts its item size in packet_size.
+	int32_t packet_type;
+	uint32_t packet_size;
+	// Synchronizer inputs, or the number of channels for a source.
+	uint32_t num_inputs;
+	uint32_t num_values;
+	char block_name[SNAP_STATS_SHM_NAME_LEN];
+	// CLOCK_REALTIME, ns.
+	uint64_t created_ns;
+
+	std::atomic<uint64_t> sequence;
+	// CLOCK_MONOTONIC, ns.
+	std::atomic<uint64_t> update_ns;
+	std::atomic<uint64_t> values[SNAP_STATS_SHM_MAX_VALUES];
+};
+
+// What a block tells the segment about itself.
+struct snap_stats_shm_info {
+	int kind = 0;
+	std::string block_name;
+	int port = -1;
+	int packet_type = 0;
+	size_t packet_size = 0;
+	int num_inputs = 0;
+	int num_values = 0;
+};
+
+/*
+ * A block's segment.  open() creates it and adds it to the process's publisher, which
+ * calls fill() from its own thread to get the current values, so fill() may only read
+ * things that are safe to read from another thread.  close() (or destruction) takes it
+ * back out and removes the shared memory object.
+ */
+class snap_stats_shm_segment {
+public:
+	typedef std::function<void(uint64_t *values)> fill_function;
+
+protected:
+	snap_stats_shm_info d_info;
+	fill_function d_fill;
+
+	std::string d_name;
+	snap_stats_shm_layout *d_layout;
+	std::string d_last_error;
+
+public:
+	snap_stats_shm_segment(const snap_stats_shm_info &info, fill_function fill);
+	virtual ~snap_stats_shm_segment();
+
+	bool open();
+	void close();
+	bool is_open() { return d_layout != NULL; };
+
+	// Publisher thread (and close()) only.
+	void publish();
+
+	const std::string & name() { return d_name; };
+	const std::string & last_error() { return d_last_error; };
+};
+
+// A consistent copy of a segment.
+struct snap_stats_shm_snapshot {
+	std::string name;
+	int kind;
+	pid_t pid;
+	int port;
+	int packet_type;
+	size_t packet_size;
+	int num_inputs;
+	std::string block_name;
+	uint64_t created_ns;
+	uint64_t update_ns;
+	std::vector<uint64_t> values;
+};
+
+// Read side, for monitors.
+class snap_stats_shm_reader {
+protected:
+	std::string d_name;
+	const snap_stats_shm_layout *d_layout;
+
+public:
+	snap_stats_shm_reader();
+	virtual ~snap_stats_shm_reader();
+
+	// Segment names on this host, without the leading slash.
+	static std::vector<std::string> list();
+	// True if the process that made the segment is still running.
+	static bool owner_alive(pid_t pid);
+	// Removes a segment left behind by a process that didn't exit cleanly.
+	static bool remove(const std::string &name);
+
+	bool open(const std::string &name);
+	void close();
+	bool is_open() { return d_layout != NULL; };
+
+	// False if the segment isn't filled in yet or the publisher kept it busy.  values always
+	// has SNAP_STATS_SHM_MAX_VALUES entries, with zeros past what the segment holds, so
+	// slots added later read as 0 from older writers.
+	bool snapshot(snap_stats_shm_snapshot &snap);
+};
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_STATS_SHM_H */
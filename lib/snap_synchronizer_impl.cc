@@ -0,0 +1,636 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gnuradio/io_signature.h>
+#include "snap_synchronizer_impl.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
+#include <sched.h>
+
+namespace gr {
+namespace ata {
+
+template <class T, int FRAME_ITEMS>
+typename snap_synchronizer<T, FRAME_ITEMS>::sptr
+snap_synchronizer<T, FRAME_ITEMS>::make(int num_inputs, int vlen, int resync_interval, int num_threads,
+		int frame_timestamp_step)
+{
+	return gnuradio::get_initial_sptr
+			(new snap_synchronizer_impl<T, FRAME_ITEMS>(num_inputs, vlen, resync_interval, num_threads, frame_timestamp_step));
+}
+
+/*
+ * The private constructor
+ */
+template <class T, int FRAME_ITEMS>
+snap_synchronizer_impl<T, FRAME_ITEMS>::snap_synchronizer_impl(int num_inputs, int vlen, int resync_interval, int num_threads,
+		int frame_timestamp_step)
+: gr::block("snap_synchronizer",
+		gr::io_signature::make(num_inputs, num_inputs, sizeof(T)*vlen),
+		gr::io_signature::make(num_inputs, num_inputs, sizeof(T)*vlen)),
+		d_num_inputs(num_inputs), d_vlen(vlen), d_frame_timestamp_step(frame_timestamp_step),
+		d_resync_interval(resync_interval), d_items_since_check(0),
+		d_num_threads(num_threads), d_job_generation(0), d_jobs_pending(0), d_stop_workers(false),
+		d_job_noutput_items(0), d_job_with_tags(false), d_job_inputs(NULL), d_job_outputs(NULL),
+		d_stats(num_inputs)
+{
+	d_synchronized = false;
+	d_have_alignment_plan = false;
+	d_align_target = 0;
+
+	if (d_frame_timestamp_step < 1)
+		d_frame_timestamp_step = 1;
+
+	// No point in having more workers than inputs.
+	if (d_num_threads > d_num_inputs)
+		d_num_threads = d_num_inputs;
+
+	if (d_num_threads < 1)
+		d_num_threads = 1;
+
+	d_pmt_seqnum = pmt::string_to_symbol("sample_num");
+
+	d_block_name = pmt::string_to_symbol(this->identifier());
+
+	tag_list = new unsigned long[d_num_inputs];
+	d_timestamp_offsets.assign(d_num_inputs, 0);
+
+	this->set_tag_propagation_policy(gr::block::TPP_DONT);
+
+	// The SNAP source outputs whole frames (16 time steps per voltage packet).  So let's take advantage of that here.
+	this->set_output_multiple(FRAME_ITEMS);
+
+	this->message_port_register_out(pmt::mp("sync"));
+	this->message_port_register_out(pmt::mp("resync"));
+}
+
+/*
+ * Our virtual destructor.
+ */
+template <class T, int FRAME_ITEMS>
+snap_synchronizer_impl<T, FRAME_ITEMS>::~snap_synchronizer_impl()
+{
+	stop_workers();
+	delete[] tag_list;
+}
+
+template <class T, int FRAME_ITEMS>
+bool
+snap_synchronizer_impl<T, FRAME_ITEMS>::start()
+{
+	snap_stats_shm_info shm_info;
+	shm_info.kind = SNAP_STATS_SHM_KIND_SYNCHRONIZER;
+	shm_info.block_name = this->alias();
+	shm_info.packet_size = sizeof(T)*d_vlen;
+	shm_info.num_inputs = d_num_inputs;
+	shm_info.num_values = SNAP_SHM_SYNC_NUM_VALUES;
+
+	d_stats_shm.reset(new snap_stats_shm_segment(shm_info,
+			boost::bind(&snap_synchronizer_impl<T, FRAME_ITEMS>::fill_stats_shm, this, _1)));
+
+	if (!d_stats_shm->open()) {
+		GR_LOG_WARN(this->d_logger, "Statistics won't be visible to snap-top.  " + d_stats_shm->last_error());
+		d_stats_shm.reset();
+	}
+
+	return true;
+}
+
+template <class T, int FRAME_ITEMS>
+bool
+snap_synchronizer_impl<T, FRAME_ITEMS>::stop()
+{
+	d_stats_shm.reset();
+	stop_workers();
+	return true;
+}
+
+// Runs on the stats publisher's thread.
+template <class T, int FRAME_ITEMS>
+void
+snap_synchronizer_impl<T, FRAME_ITEMS>::fill_stats_shm(uint64_t *values)
+{
+	values[SNAP_SHM_SYNC_WORK_CALLS] = d_stats.work_calls.value();
+	values[SNAP_SHM_SYNC_ITEMS_OUT] = d_stats.items_out.value();
+	values[SNAP_SHM_SYNC_ITEMS_DROPPED] = d_stats.items_dropped.value();
+	values[SNAP_SHM_SYNC_SYNCS] = d_stats.syncs.value();
+	values[SNAP_SHM_SYNC_RESYNCS] = d_stats.resyncs.value();
+	values[SNAP_SHM_SYNC_SYNCHRONIZED] = d_stats.synchronized.value();
+
+	pid_t tid = d_stats.work_tid.load(std::memory_order_relaxed);
+	int64_t cpu_ns;
+
+	if (tid && ((cpu_ns = snap_stats_thread_cpu_ns(tid)) >= 0))
+		values[SNAP_SHM_SYNC_WORK_CPU_NS] = cpu_ns;
+
+	for (int i=0;i<d_stats.max_copy_threads;i++) {
+		tid = d_stats.copy_tids[i].load(std::memory_order_relaxed);
+
+		if (tid && ((cpu_ns = snap_stats_thread_cpu_ns(tid)) >= 0))
+			values[SNAP_SHM_SYNC_COPY_CPU_NS] += cpu_ns;
+	}
+}
+
+template <class T, int FRAME_ITEMS>
+void
+snap_synchronizer_impl<T, FRAME_ITEMS>::start_workers()
+{
+	// Keep the workers on the same node as the block thread so the copies
+	// stay local to the buffers the scheduler allocated.
+	int numa_node = -1;
+
+#ifdef HAVE_NUMA
+	if (numa_available() >= 0) {
+		int cpu = sched_getcpu();
+
+		if (cpu >= 0)
+			numa_node = numa_node_of_cpu(cpu);
+	}
+#endif
+
+	d_stop_workers = false;
+
+	for (int i=1;i<d_num_threads;i++) {
+		d_workers.push_back(new boost::thread(boost::bind(&snap_synchronizer_impl<T, FRAME_ITEMS>::copy_worker, this, i, numa_node)));
+	}
+
+	std::stringstream msg_stream;
+	msg_stream << "Started " << d_num_threads - 1 << " copy worker threads";
+	if (numa_node >= 0)
+		msg_stream << " on NUMA node " << numa_node;
+	GR_LOG_INFO(this->d_logger, msg_stream.str());
+}
+
+template <class T, int FRAME_ITEMS>
+void
+snap_synchronizer_impl<T, FRAME_ITEMS>::stop_workers()
+{
+	if (d_workers.empty())
+		return;
+
+	{
+		gr::thread::scoped_lock lock(d_pool_mutex);
+		d_stop_workers = true;
+	}
+	d_job_ready.notify_all();
+
+	for (size_t i=0;i<d_workers.size();i++) {
+		d_workers[i]->join();
+		delete d_workers[i];
+	}
+
+	d_workers.clear();
+}
+
+template <class T, int FRAME_ITEMS>
+void
+snap_synchronizer_impl<T, FRAME_ITEMS>::copy_worker(int worker_index, int numa_node)
+{
+#ifdef HAVE_NUMA
+	if (numa_node >= 0) {
+		numa_run_on_node(numa_node);
+		numa_set_preferred(numa_node);
+	}
+#endif
+
+	d_stats.copy_tids[worker_index - 1].store(snap_stats_thread_id(), std::memory_order_relaxed);
+
+	// Each worker always gets the same slice of inputs.
+	int first_input = worker_index * d_num_inputs / d_num_threads;
+	int last_input = (worker_index + 1) * d_num_inputs / d_num_threads;
+
+	uint64_t last_generation = 0;
+
+	while (true) {
+		{
+			gr::thread::scoped_lock lock(d_pool_mutex);
+
+			while (!d_stop_workers && (d_job_generation == last_generation))
+				d_job_ready.wait(lock);
+
+			if (d_stop_workers)
+				return;
+
+			last_generation = d_job_generation;
+		}
+
+		// Tag lookups and adds lock the individual stream buffers, and each
+		// worker only touches its own inputs and outputs.
+		copy_input_range(first_input, last_input, d_job_noutput_items, *d_job_inputs, *d_job_outputs, d_job_with_tags);
+
+		{
+			gr::thread::scoped_lock lock(d_pool_mutex);
+			if (--d_jobs_pending == 0)
+				d_job_done.notify_one();
+		}
+	}
+}
+
+
+template <class T, int FRAME_ITEMS>
+void
+snap_synchronizer_impl<T, FRAME_ITEMS>::forecast (int noutput_items, gr_vector_int &ninput_items_required)
+{
+	for (int i=0;i< ninput_items_required.size();i++) {
+		ninput_items_required[i] = noutput_items;
+	}
+}
+
+template <class T, int FRAME_ITEMS>
+void
+snap_synchronizer_impl<T, FRAME_ITEMS>::copy_input_range(int first_input, int last_input, int noutput_items,
+		const gr_vector_const_void_star &input_items, gr_vector_void_star &output_items, bool with_tags)
+{
+	// Each worker needs its own tag vector.
+	std::vector<gr::tag_t> tags;
+
+	for (int cur_input=first_input;cur_input<last_input;cur_input++) {
+		const T * input_stream = (const T *)input_items[cur_input];
+		T * output_stream = (T *)output_items[cur_input];
+		memcpy(output_stream, input_stream, noutput_items*d_vlen*sizeof(T));
+
+		if (!with_tags)
+			continue;
+
+		// And copy the tags.  Inputs were consumed by different amounts while aligning,
+		// so the tags need to be moved relative to this input's read position.
+		uint64_t input_start = this->nitems_read(cur_input);
+		uint64_t output_start = this->nitems_written(cur_input);
+
+		tags.clear();
+		this->get_tags_in_range(tags, cur_input, input_start, input_start + noutput_items);
+
+		int num_tags = tags.size();
+
+		for (int i=0;i<num_tags;i++) {
+			this->add_item_tag(cur_input, output_start + (tags[i].offset - input_start), tags[i].key, tags[i].value, d_block_name);
+		}
+	}
+}
+
+template <class T, int FRAME_ITEMS>
+void
+snap_synchronizer_impl<T, FRAME_ITEMS>::copy_inputs(int noutput_items, gr_vector_const_void_star &input_items,
+		gr_vector_void_star &output_items, bool with_tags)
+{
+	// If we're synchronized, just memcpy the results.  The SNAP source blocks
+	// will fill in missing sequence numbers with zeros so they'll stay aligned.
+	if (d_num_threads == 1) {
+		copy_input_range(0, d_num_inputs, noutput_items, input_items, output_items, with_tags);
+		return;
+	}
+
+	if (d_workers.empty())
+		start_workers();
+
+	{
+		gr::thread::scoped_lock lock(d_pool_mutex);
+		d_job_noutput_items = noutput_items;
+		d_job_with_tags = with_tags;
+		d_job_inputs = &input_items;
+		d_job_outputs = &output_items;
+		d_jobs_pending = d_num_threads - 1;
+		d_job_generation++;
+	}
+	d_job_ready.notify_all();
+
+	// This thread takes the first slice.
+	copy_input_range(0, d_num_inputs / d_num_threads, noutput_items, input_items, output_items, with_tags);
+
+	gr::thread::scoped_lock lock(d_pool_mutex);
+	while (d_jobs_pending > 0)
+		d_job_done.wait(lock);
+}
+
+template <class T, int FRAME_ITEMS>
+int
+snap_synchronizer_impl<T, FRAME_ITEMS>::work_test_copy(int noutput_items, gr_vector_const_void_star &input_items,
+		gr_vector_void_star &output_items)
+{
+	if (d_stats.work_tid.load(std::memory_order_relaxed) == 0)
+		d_stats.work_tid.store(snap_stats_thread_id(), std::memory_order_relaxed);
+
+	copy_inputs(noutput_items, input_items, output_items, false);
+
+	d_stats.work_calls.add();
+	d_stats.items_out.add(noutput_items);
+
+	return noutput_items;
+}
+
+template <class T, int FRAME_ITEMS>
+bool
+snap_synchronizer_impl<T, FRAME_ITEMS>::head_timestamp(int cur_input, int available_items, uint64_t &timestamp)
+{
+	// The SNAP source always produces whole frames of FRAME_ITEMS items, so frames start on
+	// absolute item offsets that are multiples of FRAME_ITEMS, and each frame's timestamp is
+	// d_frame_timestamp_step more than the last.  So any sample_num tag in the window tells us the timestamp of the first
+	// item in the window.  The source normally tags every item, so try the first frame
+	// before asking for the whole window.
+	uint64_t window_start = this->nitems_read(cur_input);
+
+	d_tags.clear();
+	this->get_tags_in_range(d_tags, cur_input, window_start, window_start + std::min(available_items, FRAME_ITEMS), d_pmt_seqnum);
+
+	if (d_tags.empty() && (available_items > FRAME_ITEMS)) {
+		this->get_tags_in_range(d_tags, cur_input, window_start, window_start + available_items, d_pmt_seqnum);
+	}
+
+	if (d_tags.empty())
+		return false;
+
+	uint64_t frame_start = d_tags[0].offset - (d_tags[0].offset % FRAME_ITEMS);
+	uint64_t tag_timestamp = pmt::to_uint64(d_tags[0].value);
+
+	// Inputs that were re-based (see alignment_target()) are compared at their offset.
+	timestamp = tag_timestamp - (frame_start - window_start) / FRAME_ITEMS * d_frame_timestamp_step - d_timestamp_offsets[cur_input];
+
+	return true;
+}
+
+template <class T, int FRAME_ITEMS>
+uint64_t
+snap_synchronizer_impl<T, FRAME_ITEMS>::alignment_target()
+{
+	// Normally we align on the latest head so nobody has to wait on anybody.  But an input
+	// more than MAX_RESYNC_SKIP_FRAMES behind it would never catch up, so aim for the
+	// latest head that the most inputs can reach.
+	uint64_t max_skip = (uint64_t)MAX_RESYNC_SKIP_FRAMES * d_frame_timestamp_step;
+	uint64_t target = 0;
+	int target_reach = 0;
+
+	for (int candidate=0;candidate<d_num_inputs;candidate++) {
+		int reach = 0;
+
+		for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+			if ((tag_list[cur_input] <= tag_list[candidate]) && (tag_list[candidate] - tag_list[cur_input] <= max_skip))
+				reach++;
+		}
+
+		if ((reach > target_reach) || ((reach == target_reach) && (tag_list[candidate] > target))) {
+			target = tag_list[candidate];
+			target_reach = reach;
+		}
+	}
+
+	// Anyone who can't get there is carried on from where it is, offset to line up with
+	// the target.  Its output isn't time-aligned any more, but it doesn't stall the others.
+	for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+		if ((tag_list[cur_input] <= target) && (target - tag_list[cur_input] <= max_skip))
+			continue;
+
+		uint64_t timestamp = tag_list[cur_input] + d_timestamp_offsets[cur_input];
+		d_timestamp_offsets[cur_input] = timestamp - target;
+		tag_list[cur_input] = target;
+
+		pmt::pmt_t meta = pmt::make_dict();
+		meta = pmt::dict_add(meta, pmt::mp("input"), pmt::from_long(cur_input));
+		meta = pmt::dict_add(meta, pmt::mp("timestamp"), pmt::from_uint64(timestamp));
+		meta = pmt::dict_add(meta, pmt::mp("target"), pmt::from_uint64(target));
+		this->message_port_pub(pmt::mp("resync"), pmt::cons(pmt::intern("resync_error"), meta));
+
+		std::stringstream msg_stream;
+		msg_stream << "Input " << cur_input << " is at timestamp " << timestamp << ", more than " << MAX_RESYNC_SKIP_FRAMES <<
+				" frames from the other inputs' " << target << ".  Its SNAP may have restarted.  It will not be skipped into alignment, " <<
+				"and its output is no longer time-aligned with the other inputs.";
+		GR_LOG_ERROR(this->d_logger, msg_stream.str());
+	}
+
+	return target;
+}
+
+template <class T, int FRAME_ITEMS>
+int
+snap_synchronizer_impl<T, FRAME_ITEMS>::general_work (int noutput_items,
+		gr_vector_int &ninput_items,
+		gr_vector_const_void_star &input_items,
+		gr_vector_void_star &output_items)
+{
+	if (d_stats.work_tid.load(std::memory_order_relaxed) == 0)
+		d_stats.work_tid.store(snap_stats_thread_id(), std::memory_order_relaxed);
+
+	d_stats.work_calls.add();
+
+	if (d_synchronized && (d_resync_interval > 0) && (d_items_since_check >= d_resync_interval)) {
+		// Periodically make sure nobody has drifted.  A source that dropped more than its
+		// max missed sets, or a SNAP that restarted, will show up here as a timestamp mismatch.
+		// If a tag isn't available we'll just try again on the next call.
+		bool have_all = true;
+
+		for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+			uint64_t timestamp;
+
+			if (!head_timestamp(cur_input, FRAME_ITEMS, timestamp)) {
+				have_all = false;
+				break;
+			}
+
+			tag_list[cur_input] = timestamp;
+		}
+
+		if (have_all) {
+			d_items_since_check = 0;
+
+			bool diverged = false;
+
+			for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+				if (tag_list[cur_input] != tag_list[0])
+					diverged = true;
+			}
+
+			unsigned long highest_tag = 0;
+			std::vector<uint64_t> offsets(d_num_inputs);
+			bool skipping = false;
+
+			if (diverged) {
+				highest_tag = alignment_target();
+
+				// An input that was too far off has been re-based already, and if it was the
+				// only one there's nothing left to skip.
+				for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+					offsets[cur_input] = timestamp_diff_to_items(highest_tag - tag_list[cur_input]);
+
+					if (offsets[cur_input] > 0)
+						skipping = true;
+				}
+			}
+
+			if (skipping) {
+
+				pmt::pmt_t meta = pmt::make_dict();
+				meta = pmt::dict_add(meta, pmt::mp("timestamp"), pmt::from_uint64(highest_tag));
+				meta = pmt::dict_add(meta, pmt::mp("offsets"), pmt::init_u64vector(offsets.size(), offsets));
+				this->message_port_pub(pmt::mp("resync"), pmt::cons(pmt::intern("resync"), meta));
+
+				std::stringstream msg_stream;
+				msg_stream << "Inputs have drifted out of alignment.  Re-synchronizing on timestamp " << highest_tag << ".  Offsets:";
+				for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+					msg_stream << " " << offsets[cur_input];
+				}
+				GR_LOG_WARN(this->d_logger, msg_stream.str());
+
+				// Drop back into the alignment search below with the plan already made.
+				d_synchronized = false;
+				d_stats.resyncs.add();
+				d_stats.synchronized.set(0);
+				SNAP_TRACE2(sync_drift, highest_tag, d_num_inputs);
+				d_align_target = highest_tag;
+				d_skip_remaining = offsets;
+				d_have_alignment_plan = true;
+			}
+		}
+	}
+
+	if (d_synchronized) {
+		copy_inputs(noutput_items, input_items, output_items);
+		this->consume_each (noutput_items);
+
+		d_items_since_check += noutput_items;
+		d_stats.items_out.add(noutput_items);
+
+		// Tell runtime system how many output items we produced.
+		return noutput_items;
+	}
+
+	gr::thread::scoped_lock guard(this->d_setlock);
+
+	// We need to synchronize.
+	// Each frame's timestamp is always d_frame_timestamp_step past the last one.
+	// So once we know the timestamp at the head of every input, the number of items
+	// each input needs to drop is just the difference from the latest head.
+	if (!d_have_alignment_plan) {
+		bool have_all = true;
+
+		for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+			uint64_t timestamp;
+
+			if (head_timestamp(cur_input, ninput_items[cur_input], timestamp)) {
+				tag_list[cur_input] = timestamp;
+			}
+			else {
+				// No tags anywhere in what we have for this input.  There's no way to place
+				// this data, so drop whole frames of it rather than stall the other inputs.
+				have_all = false;
+				this->consume(cur_input, (ninput_items[cur_input] / FRAME_ITEMS) * FRAME_ITEMS);
+				d_stats.items_dropped.add((ninput_items[cur_input] / FRAME_ITEMS) * FRAME_ITEMS);
+				SNAP_TRACE2(sync_untagged, cur_input, (ninput_items[cur_input] / FRAME_ITEMS) * FRAME_ITEMS);
+			}
+		}
+
+		if (!have_all)
+			return 0;
+
+		// Normally the latest head.  Inputs too far off to ever get there are re-based onto
+		// it rather than skipped.
+		d_align_target = alignment_target();
+		d_skip_remaining.resize(d_num_inputs);
+
+		for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+			d_skip_remaining[cur_input] = timestamp_diff_to_items(d_align_target - tag_list[cur_input]);
+		}
+
+		d_have_alignment_plan = true;
+		SNAP_TRACE2(sync_plan, d_align_target, d_num_inputs);
+	}
+
+	// Work off the plan.  Skips are always whole frames, and we can only drop what's in the buffer.
+	bool plan_complete = true;
+
+	for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+		if (d_skip_remaining[cur_input] == 0)
+			continue;
+
+		uint64_t items_to_consume = d_skip_remaining[cur_input];
+		uint64_t available_frames = (ninput_items[cur_input] / FRAME_ITEMS) * FRAME_ITEMS;
+
+		if (items_to_consume > available_frames)
+			items_to_consume = available_frames;
+
+		this->consume(cur_input, items_to_consume);
+		d_skip_remaining[cur_input] -= items_to_consume;
+		d_stats.items_dropped.add(items_to_consume);
+		SNAP_TRACE3(sync_skip, cur_input, items_to_consume, d_skip_remaining[cur_input]);
+
+		if (d_skip_remaining[cur_input] > 0)
+			plan_complete = false;
+	}
+
+	if (!plan_complete) {
+		// We're going to return 0 here so we don't forward any data along yet.  That won't happen till we're synchronized.
+		return 0;
+	}
+
+	d_have_alignment_plan = false;
+
+	// If nothing needed to be dropped, the data in hand is already aligned and can go straight out.
+	// Otherwise the input pointers are stale, so the copy starts on the next call.
+	bool skipped_any = false;
+	for (int cur_input=0;cur_input<d_num_inputs;cur_input++) {
+		if (tag_list[cur_input] != d_align_target)
+			skipped_any = true;
+	}
+
+	d_synchronized = true;
+	d_items_since_check = 0;
+	d_stats.syncs.add();
+	d_stats.synchronized.set(1);
+	SNAP_TRACE2(sync_locked, d_align_target, skipped_any);
+
+	pmt::pmt_t pdu = pmt::cons( pmt::intern("synctimestamp"), pmt::from_uint64(d_align_target) );
+	this->message_port_pub(pmt::mp("sync"),pdu);
+
+	std::stringstream msg_stream;
+	msg_stream << "Synchronized on timestamp " << d_align_target;
+	GR_LOG_INFO(this->d_logger, msg_stream.str());
+
+	if (skipped_any)
+		return 0;
+
+	copy_inputs(noutput_items, input_items, output_items);
+	this->consume_each (noutput_items);
+	d_stats.items_out.add(noutput_items);
+
+	// Tell runtime system how many output items we produced.
+	return noutput_items;
+}
+
+template class snap_synchronizer<char, 16>;
+template class snap_synchronizer<unsigned char, 16>;
+template class snap_synchronizer<std::complex<int16_t>, 16>;
+template class snap_synchronizer<gr_complex, 16>;
+template class snap_synchronizer<float, 1>;
+
+template class snap_synchronizer_impl<char, 16>;
+template class snap_synchronizer_impl<unsigned char, 16>;
+template class snap_synchronizer_impl<std::complex<int16_t>, 16>;
+template class snap_synchronizer_impl<gr_complex, 16>;
+template class snap_synchronizer_impl<float, 1>;
+
+} /* namespace ata */
+} /* namespace gr */
@@ -0,0 +1,135 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_SYNCHRONIZER_IMPL_H
+#define INCLUDED_ATA_SNAP_SYNCHRONIZER_IMPL_H
+
+#include <ata/snap_synchronizer.h>
+#include "snap_stats.h"
+#include "snap_stats_shm.h"
+#include "snap_trace.h"
+#include <memory>
+#include <vector>
+#include <gnuradio/thread/thread.h>
+
+namespace gr {
+  namespace ata {
+
+// The most a resync will skip on an input, in frames.  The SNAP source zero-fills gaps of up
+// to MAX_MISSED_SETS (20000) frames, so real drift is bigger than that, but nothing upstream
+// buffers more than a few seconds of frames.  An input further off than this (a restarted
+// SNAP starts its sample numbers over) would never finish skipping.
+#define MAX_RESYNC_SKIP_FRAMES 100000
+
+    // This is the alignment engine for all of the synchronizers.  SNAPSynchronizerV3
+    // is the <char, 16> case with an additional align-at-source mode on top.
+    template <class T, int FRAME_ITEMS>
+    class snap_synchronizer_impl : public snap_synchronizer<T, FRAME_ITEMS>
+    {
+     protected:
+		bool d_synchronized;
+		int d_num_inputs;
+		int d_vlen;
+		int d_frame_timestamp_step;
+
+    	pmt::pmt_t d_pmt_seqnum;
+    	pmt::pmt_t d_block_name;
+
+    	unsigned long *tag_list;
+
+    	// Reused across work calls so we don't allocate on every pass.
+    	std::vector<gr::tag_t> d_tags;
+
+    	// Drift detection: how often (in items) to compare the input timestamps once synchronized.
+    	int d_resync_interval;
+    	long d_items_since_check;
+
+    	// Subtracted from each input's sample_num before comparing.  Zero unless the input was
+    	// too far off to skip into alignment and was carried on at an offset instead.
+    	std::vector<uint64_t> d_timestamp_offsets;
+
+    	// Alignment plan: how many items each input still needs to drop to reach d_align_target.
+    	bool d_have_alignment_plan;
+    	uint64_t d_align_target;
+    	std::vector<uint64_t> d_skip_remaining;
+
+    	bool head_timestamp(int cur_input, int available_items, uint64_t &timestamp);
+    	uint64_t alignment_target();
+
+    	// Converts a timestamp difference to a number of items.
+    	uint64_t timestamp_diff_to_items(uint64_t diff) { return diff / d_frame_timestamp_step * FRAME_ITEMS; };
+
+    	// Worker pool for splitting the per-input copies across cores.  Worker 0 is the
+    	// block thread itself, so d_num_threads - 1 extra threads get spawned.
+    	int d_num_threads;
+    	std::vector<boost::thread *> d_workers;
+    	gr::thread::mutex d_pool_mutex;
+    	boost::condition_variable d_job_ready;
+    	boost::condition_variable d_job_done;
+    	uint64_t d_job_generation;
+    	int d_jobs_pending;
+    	bool d_stop_workers;
+
+    	// The current job.  Only valid while d_jobs_pending > 0.
+    	int d_job_noutput_items;
+    	bool d_job_with_tags;
+    	const gr_vector_const_void_star *d_job_inputs;
+    	gr_vector_void_star *d_job_outputs;
+
+    	void start_workers();
+    	void stop_workers();
+    	void copy_worker(int worker_index, int numa_node);
+    	void copy_input_range(int first_input, int last_input, int noutput_items,
+    			const gr_vector_const_void_star &input_items, gr_vector_void_star &output_items, bool with_tags);
+
+    	void copy_inputs(int noutput_items, gr_vector_const_void_star &input_items,
+    			gr_vector_void_star &output_items, bool with_tags=true);
+
+    	// Counters for snap-top, published through a shared memory segment while running.
+    	snap_synchronizer_stats d_stats;
+    	std::unique_ptr<snap_stats_shm_segment> d_stats_shm;
+    	void fill_stats_shm(uint64_t *values);
+
+     public:
+      snap_synchronizer_impl(int num_inputs, int vlen, int resync_interval, int num_threads, int frame_timestamp_step);
+      ~snap_synchronizer_impl();
+
+      virtual bool start();
+      virtual bool stop();
+
+      // Benchmark hook: runs the synchronized copy without touching tags,
+      // so it can be called outside of a running flowgraph.
+      int work_test_copy(int noutput_items, gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items);
+
+      // Where all the action really happens
+      void forecast (int noutput_items, gr_vector_int &ninput_items_required);
+
+      int general_work(int noutput_items,
+           gr_vector_int &ninput_items,
+           gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items);
+
+    };
+
+  } // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_SYNCHRONIZER_IMPL_H */
@@ -0,0 +1,63 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_TRACE_H
+#define INCLUDED_ATA_SNAP_TRACE_H
+
+/*
+ * Static tracepoints in the SNAP receive, work and synchronizer paths.  Configure with
+ * -DENABLE_USDT=ON and they become USDT probes under the provider gr_ata, which
+ * bpftrace, perf and systemtap can attach to in a running flowgraph.  A probe nobody is
+ * attached to is a single nop plus whatever it takes to have the arguments in registers,
+ * so arguments should be values the code already has.  Without the option the macros
+ * are empty and nothing is evaluated.
+ *
+ * SNAP source (the first argument is always the block's port):
+ *   recv_batch(port, packets)                  a recvmmsg() call that returned packets
+ *   enqueue(port, queue_depth, overwrote)      a packet went on the receive queue
+ *   frame_complete(port, sample_number, packets)  a frame was queued for output.  packets
+ *                                              is 0 in spectrometer mode.
+ *   gap(port, last_sample_number, sample_number, missed_frames)
+ *   work_entry(port, noutput_items)
+ *   work_exit(port, items_returned, queue_depth)
+ *
+ * Synchronizers:
+ *   sync_untagged(input, items_dropped)        no tag to place this input's data by
+ *   sync_plan(target_sample_number, num_inputs)
+ *   sync_skip(input, items_dropped, items_left)
+ *   sync_locked(target_sample_number, dropped_any)
+ *   sync_drift(target_sample_number, num_inputs)  aligned inputs' tags no longer agree
+ *   sync_source_header(source_key, sample_number, sources_reported)
+ *   sync_align_sources(target_sample_number, num_inputs)
+ */
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define SNAP_TRACE2(probe, a1, a2) DTRACE_PROBE2(gr_ata, probe, a1, a2)
+#define SNAP_TRACE3(probe, a1, a2, a3) DTRACE_PROBE3(gr_ata, probe, a1, a2, a3)
+#define SNAP_TRACE4(probe, a1, a2, a3, a4) DTRACE_PROBE4(gr_ata, probe, a1, a2, a3, a4)
+#else
+#define SNAP_TRACE2(probe, a1, a2) do {} while (0)
+#define SNAP_TRACE3(probe, a1, a2, a3) do {} while (0)
+#define SNAP_TRACE4(probe, a1, a2, a3, a4) do {} while (0)
+#endif
+
+#endif /* INCLUDED_ATA_SNAP_TRACE_H */
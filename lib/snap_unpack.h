@@ -0,0 +1,153 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_ATA_SNAP_UNPACK_H
+#define INCLUDED_ATA_SNAP_UNPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace gr {
+namespace ata {
+
+/*
+ * Counts the 4-bit codes of one packet, I and Q together, while it's unpacked.  Rather
+ * than incrementing a histogram bin per code, which stalls on the same few bins over
+ * and over, each byte adds a word from increments that bumps both its codes' 8-bit
+ * counters.  lanes[c][pol][w] holds eight counters for the packet's channel c: word 0
+ * is codes 0-7 and word 1 is codes 8-15 (-8 to -1), code k in byte k & 7.  A packet
+ * adds at most 32 to a counter, so they can't overflow before the caller folds them.
+ */
+struct voltage_code_counter {
+	uint64_t increments[256][2];
+	uint64_t lanes[256][2][2];
+
+	voltage_code_counter() {
+		memset(increments, 0x00, sizeof(increments));
+
+		for (int b=0;b<256;b++) {
+			increments[b][b >> 7] += 1ULL << (8 * ((b >> 4) & 0x07));
+			increments[b][(b >> 3) & 0x01] += 1ULL << (8 * (b & 0x07));
+		}
+
+		memset(lanes, 0x00, sizeof(lanes));
+	};
+};
+
+/*
+ * Unpacks the payload of one v2.0 voltage packet (256 channels by 16 times by 2
+ * polarizations of 4-bit IQ) into the 16 output rows it covers.  Row t starts at
+ * x_rows + t * veclen (and y_rows likewise), and this packet's channels start
+ * channel_offset bytes into the row.  lut is the 4-bit two's complement lookup.
+ *
+ * Packed output keeps the 4-bit pairs and puts X and Y side by side in x_rows.
+ * Otherwise I and Q are expanded to signed bytes, X to x_rows and Y to y_rows.
+ *
+ * If counter isn't NULL, its lanes are cleared and then count this packet's codes in
+ * the same pass, while the bytes are already in registers.
+ */
+inline void unpack_voltage_packet(const unsigned char (*data)[16][2], char *x_rows, char *y_rows,
+		int veclen, int channel_offset, bool packed_output, const char *lut, voltage_code_counter *counter=NULL) {
+	if (counter)
+		memset(counter->lanes, 0x00, sizeof(counter->lanes));
+
+	if (packed_output) {
+		unsigned char *x_pol;
+		for (int t=0;t<16;t++) {
+			// This moves us in the packet memory to the correct time row
+			int vector_start = t * veclen  + channel_offset;
+			// For packed output, the output is [IQ packed 4-bit] Xn,[IQ packed 4-bit] Yn,...
+			// Both go in the x_pol output.
+			x_pol = (unsigned char *)&x_rows[vector_start];
+
+			for (int sample=0;sample<256;sample++) {
+				int TwoS = 2*sample;
+				unsigned char x = data[sample][t][0];
+				unsigned char y = data[sample][t][1];
+
+				x_pol[TwoS] = x;
+				// In packed mode, this is actually y to put it in a single block output
+				x_pol[TwoS + 1] = y;
+
+				if (counter) {
+					uint64_t (*lanes)[2] = counter->lanes[sample];
+					lanes[0][0] += counter->increments[x][0];
+					lanes[0][1] += counter->increments[x][1];
+					lanes[1][0] += counter->increments[y][0];
+					lanes[1][1] += counter->increments[y][1];
+				}
+			}
+		}
+	}
+	else {
+		// Note these are char rather than unsigned char because in this unpacking
+		// mode, we actually two's complement extract the signed input.
+		char *x_pol;
+		char *y_pol;
+		for (int t=0;t<16;t++) {
+			// This moves us in the packet memory to the correct time row
+			int vector_start = t * veclen  + channel_offset;
+			x_pol = &x_rows[vector_start];
+			y_pol = &y_rows[vector_start];
+
+			for (int sample=0;sample<256;sample++) {
+				int TwoS = 2*sample;
+				int TwoS1 = TwoS + 1;
+
+				// The 2.0 format reverses the [t][sample] index position to [sample][t].
+				unsigned char x = data[sample][t][0];
+				unsigned char y = data[sample][t][1];
+
+				x_pol[TwoS] = lut[x >> 4]; // I
+				x_pol[TwoS1] = lut[x & 0x0F];  // Q
+
+				y_pol[TwoS] = lut[y >> 4]; // I
+				y_pol[TwoS1] = lut[y & 0x0F];  // Q
+
+				if (counter) {
+					uint64_t (*lanes)[2] = counter->lanes[sample];
+					lanes[0][0] += counter->increments[x][0];
+					lanes[0][1] += counter->increments[x][1];
+					lanes[1][0] += counter->increments[y][0];
+					lanes[1][1] += counter->increments[y][1];
+				}
+			} // for sample
+		} // for t
+	} // if packed_output /else
+}
+
+/*
+ * Splits the payload of one spectrometer packet (512 channels of XX, YY, real XY*
+ * and imag XY*) into the four output vectors, starting at this packet's channel.
+ */
+inline void deinterleave_spect_packet(const float (*data)[4], float *xx, float *yy, float *xy_real, float *xy_imag) {
+	for (int sample=0;sample<512;sample++) {
+		*xx++ = data[sample][0];
+		*yy++ = data[sample][1];
+		*xy_real++ = data[sample][2];
+		*xy_imag++ = data[sample][3];
+	}
+}
+
+} // namespace ata
+} // namespace gr
+
+#endif /* INCLUDED_ATA_SNAP_UNPACK_H */
@@ -0,0 +1,265 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "snap_source_impl.h"
+#include "snap_packet_generator.h"
+
+using namespace gr::ata;
+
+/*
+ * Checks the SNAP source's loss, late and bad channel counters against what the packet
+ * generator says it did.  Each case injects a voltage stream with one kind of fault (and
+ * then all of them at once) straight into a source's receive queue, which goes through
+ * the same accept_packet() checks as the socket, and runs work() until it's all out.
+ */
+
+// Channel ranges for 4 packets per frame and for 1 packet per frame.
+#define MULTI_START 1792
+#define MULTI_END 2815
+#define SINGLE_START 1792
+#define SINGLE_END 2047
+
+// Clean frames before and after the faults, so the source syncs on the first packet and
+// the last faulty frame is finished (and counted) by the frame after it.
+#define CLEAN_FRAMES 4
+
+#define INJECT_BATCH 64
+#define OUTPUT_ITEMS 256
+
+int base_port = 10310;
+int num_frames = 2000;
+
+struct fault_run {
+	snap_generator_fault_counts generated;
+	uint64_t gap_frames;
+	uint64_t late_packets;
+	uint64_t bad_channel_packets;
+	uint64_t missed_packets;
+	int packets_per_frame;
+};
+
+void inject_and_drain(snap_source_impl *source, snap_packet_generator &generator, size_t num_packets,
+		std::vector<unsigned char> &packets, gr_vector_void_star &outputs) {
+	gr_vector_const_void_star inputs;
+
+	while (num_packets > 0) {
+		size_t batch = (num_packets < INJECT_BATCH) ? num_packets : INJECT_BATCH;
+		size_t generated = generator.generate(&packets[0], batch);
+
+		source->inject_packets(&packets[0], generated, generator.packet_size());
+		num_packets -= batch;
+
+		// work() waits for packets when there aren't any, so only call it while there are.
+		while (source->packets_available() > 0)
+			source->work_test(OUTPUT_ITEMS, inputs, outputs);
+	}
+}
+
+fault_run run_faults(int port, int starting_channel, int ending_channel, const snap_generator_faults &faults) {
+	snap_source_impl *source = new snap_source_impl(port, SNAP_PACKETTYPE_VOLTAGE, false, false, false,
+			starting_channel, ending_channel, 1, 0, "", false, false, "", false, "", false);
+	source->start();
+
+	snap_packet_generator generator(SNAP_PACKETTYPE_VOLTAGE, starting_channel, ending_channel, 1, 7, 16 * 1000);
+	int packets_per_frame = generator.packets_per_frame();
+
+	std::vector<unsigned char> packets(generator.packet_size() * INJECT_BATCH);
+	int veclen = (ending_channel - starting_channel + 1) * 2;
+	std::vector<char> x_out(OUTPUT_ITEMS * veclen);
+	std::vector<char> y_out(OUTPUT_ITEMS * veclen);
+	gr_vector_void_star outputs;
+	outputs.push_back(&x_out[0]);
+	outputs.push_back(&y_out[0]);
+
+	inject_and_drain(source, generator, CLEAN_FRAMES * packets_per_frame, packets, outputs);
+
+	generator.set_faults(faults);
+	inject_and_drain(source, generator, num_frames * packets_per_frame, packets, outputs);
+
+	// Anything held back or owed by the generator goes out with the clean frames.
+	generator.set_faults(snap_generator_faults());
+	inject_and_drain(source, generator, CLEAN_FRAMES * packets_per_frame, packets, outputs);
+
+	source->stop();
+
+	fault_run run;
+	run.generated = generator.fault_counts();
+	run.gap_frames = source->stats().gap_frames.value();
+	run.late_packets = source->stats().late_packets.value();
+	run.bad_channel_packets = source->stats().bad_channel_packets.value();
+	run.missed_packets = source->stats().missed_packets.value();
+	run.packets_per_frame = packets_per_frame;
+
+	delete source;
+
+	return run;
+}
+
+bool check(const std::string &what, uint64_t value, uint64_t low, uint64_t high) {
+	bool ok = (value >= low) && (value <= high);
+
+	std::cout << "    " << what << ": " << value;
+
+	if (low == high)
+		std::cout << " (expected " << low << ")";
+	else
+		std::cout << " (expected " << low << " to " << high << ")";
+
+	std::cout << (ok ? "" : "  <-- FAIL") << std::endl;
+
+	return ok;
+}
+
+void print_generated(const std::string &name, const fault_run &run) {
+	const snap_generator_fault_counts &c = run.generated;
+
+	std::cout << name << ": generator lost " << c.lost << ", reordered " << c.reordered << ", duplicated " << c.duplicated <<
+			", bad channel " << c.bad_channel << ", skipped " << c.frames_skipped << " frames in " << c.timestamp_jumps << " jumps" << std::endl;
+}
+
+int
+main (int argc, char **argv)
+{
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: test-snap-faults [--port=<port>] [--frames=<n>]" << std::endl;
+			std::cout << "Injects generated voltage packets with loss, reordering, duplicates, bad channel IDs and timestamp jumps into a SNAP source " <<
+						 "and checks its gap_frames, late_packets and bad_channel_packets counters against the generator's fault counts." << std::endl;
+			std::cout << "--port = UDP port the sources listen on.  Nothing should be sending to it.  Default is 10310." << std::endl <<
+						 "--frames = faulty frames per case.  Default is 2000." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--port") != std::string::npos) {
+			boost::replace_all(param,"--port=","");
+			base_port = atoi(param.c_str());
+		}
+		else if (param.find("--frames") != std::string::npos) {
+			boost::replace_all(param,"--frames=","");
+			num_frames = atoi(param.c_str());
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	bool passed = true;
+
+	{
+		// Lost packets leave holes in their frames, and jumps skip whole frames.
+		snap_generator_faults faults;
+		faults.loss = 0.01;
+		faults.timestamp_jump = 0.005;
+		faults.jump_frames = 10;
+
+		fault_run run = run_faults(base_port, MULTI_START, MULTI_END, faults);
+		const snap_generator_fault_counts &c = run.generated;
+		print_generated("Loss and timestamp jumps", run);
+
+		passed &= check("gap_frames", run.gap_frames, c.frames_skipped, c.frames_skipped);
+		passed &= check("missed_packets", run.missed_packets, c.lost + c.frames_skipped * run.packets_per_frame,
+				c.lost + c.frames_skipped * run.packets_per_frame);
+		passed &= check("late_packets", run.late_packets, 0, 0);
+		passed &= check("bad_channel_packets", run.bad_channel_packets, 0, 0);
+	}
+
+	{
+		// Bad channel IDs are dropped on receive, so their frames are a packet short.
+		snap_generator_faults faults;
+		faults.bad_channel = 0.01;
+
+		fault_run run = run_faults(base_port, MULTI_START, MULTI_END, faults);
+		const snap_generator_fault_counts &c = run.generated;
+		print_generated("Bad channel IDs", run);
+
+		passed &= check("bad_channel_packets", run.bad_channel_packets, c.bad_channel, c.bad_channel);
+		passed &= check("missed_packets", run.missed_packets, c.bad_channel, c.bad_channel);
+		passed &= check("gap_frames", run.gap_frames, 0, 0);
+		passed &= check("late_packets", run.late_packets, 0, 0);
+	}
+
+	{
+		// With one packet per frame, every reordered packet arrives after the next frame.
+		// The source sees a one frame gap when the next frame shows up first, counts the
+		// packet late when it does arrive, and then sees the frame after next as a one
+		// frame gap from it.  So each one is a late packet and two gap frames.
+		snap_generator_faults faults;
+		faults.reorder = 0.01;
+
+		fault_run run = run_faults(base_port, SINGLE_START, SINGLE_END, faults);
+		const snap_generator_fault_counts &c = run.generated;
+		print_generated("Reordered packets", run);
+
+		passed &= check("late_packets", run.late_packets, c.reordered, c.reordered);
+		passed &= check("gap_frames", run.gap_frames, 2 * c.reordered, 2 * c.reordered);
+		passed &= check("bad_channel_packets", run.bad_channel_packets, 0, 0);
+	}
+
+	{
+		// A duplicate follows its original, so it's neither late nor a gap.
+		snap_generator_faults faults;
+		faults.duplicate = 0.01;
+
+		fault_run run = run_faults(base_port, MULTI_START, MULTI_END, faults);
+		print_generated("Duplicated packets", run);
+
+		passed &= check("late_packets", run.late_packets, 0, 0);
+		passed &= check("gap_frames", run.gap_frames, 0, 0);
+		passed &= check("missed_packets", run.missed_packets, 0, 0);
+	}
+
+	{
+		// All at once the faults can overlap (a duplicated bad packet is dropped twice, a
+		// packet held back over a jump makes the jump count twice), so only bounds hold.
+		snap_generator_faults faults;
+		faults.loss = 0.01;
+		faults.reorder = 0.01;
+		faults.duplicate = 0.01;
+		faults.bad_channel = 0.01;
+		faults.timestamp_jump = 0.005;
+		faults.jump_frames = 10;
+
+		fault_run run = run_faults(base_port, MULTI_START, MULTI_END, faults);
+		const snap_generator_fault_counts &c = run.generated;
+		print_generated("All faults", run);
+
+		passed &= check("bad_channel_packets", run.bad_channel_packets, c.bad_channel, c.bad_channel + c.duplicated);
+		passed &= check("late_packets", run.late_packets, 0, c.reordered);
+		passed &= check("gap_frames", run.gap_frames, c.frames_skipped, c.frames_skipped + c.timestamp_jumps * faults.jump_frames);
+	}
+
+	std::cout << (passed ? "PASS" : "FAIL") << std::endl;
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <endian.h>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/asio.hpp>
+#include <gnuradio/top_block.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/thread/thread.h>
+
+#include <ata/snap_source.h>
+#include <ata/snap_synchronizer.h>
+
+using namespace gr::ata;
+
+/*
+ * Checks that two spectrometer SNAP sources that start at different sample numbers come
+ * out of snap_synchronizer_f lined up.  Frames are sent to each source over loopback UDP,
+ * source B starting a few frames after source A, and the sample_num tags at each output
+ * item have to match.
+ */
+
+#define SPECT_VLEN 4096
+#define SPECT_PACKETS_PER_FRAME 8
+#define SPECT_PACKET_SIZE 8200
+
+int base_port = 10300;
+int num_frames = 200;
+int start_offset_frames = 5;
+double timeout_seconds = 10.0;
+
+// Keeps the sample_num tag of every item it's given.
+class tag_capture_sink : public gr::sync_block {
+protected:
+	gr::thread::mutex d_mutex;
+	std::map<uint64_t, uint64_t> d_sample_numbers;
+	uint64_t d_items;
+	pmt::pmt_t d_pmt_seqnum;
+
+public:
+	tag_capture_sink() : gr::sync_block("tag_capture_sink",
+			gr::io_signature::make(1, 1, sizeof(float) * SPECT_VLEN),
+			gr::io_signature::make(0, 0, 0)), d_items(0), d_pmt_seqnum(pmt::string_to_symbol("sample_num")) {
+	};
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items) {
+		std::vector<gr::tag_t> tags;
+		get_tags_in_range(tags, 0, nitems_read(0), nitems_read(0) + noutput_items, d_pmt_seqnum);
+
+		gr::thread::scoped_lock guard(d_mutex);
+
+		for (size_t i=0;i<tags.size();i++)
+			d_sample_numbers[tags[i].offset] = pmt::to_uint64(tags[i].value);
+
+		d_items += noutput_items;
+
+		return noutput_items;
+	};
+
+	uint64_t items() {
+		gr::thread::scoped_lock guard(d_mutex);
+		return d_items;
+	};
+
+	std::map<uint64_t, uint64_t> sample_numbers() {
+		gr::thread::scoped_lock guard(d_mutex);
+		return d_sample_numbers;
+	};
+};
+
+// Sends one spectrometer frame (8 packets of 512 channels) with an all-zero payload.  The
+// header is big-endian: antenna ID in bits 0-7, channel block (channel / 512) in bits 8-10,
+// and the sample number from bit 11 up.
+void send_frame(boost::asio::ip::udp::socket &socket, boost::asio::ip::udp::endpoint &endpoint, int antenna_id, uint64_t sample_number) {
+	unsigned char packet[SPECT_PACKET_SIZE];
+	memset(packet, 0, sizeof(packet));
+
+	for (int block=0;block<SPECT_PACKETS_PER_FRAME;block++) {
+		uint64_t header = htobe64((sample_number << 11) | ((uint64_t)block << 8) | (uint64_t)antenna_id);
+		memcpy(packet, &header, sizeof(header));
+
+		socket.send_to(boost::asio::buffer(packet, sizeof(packet)), endpoint);
+	}
+}
+
+int
+main (int argc, char **argv)
+{
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: test-spect-sync [--port=<port>] [--frames=<n>] [--offset=<frames>]" << std::endl;
+			std::cout << "Checks that snap_synchronizer_f aligns two spectrometer sources that start at different sample numbers." << std::endl;
+			std::cout << "--port = first of the two UDP ports the sources listen on.  Nothing should be sending to them.  Default is 10300." << std::endl <<
+						 "--frames = spectrometer frames per source.  Default is 200." << std::endl <<
+						 "--offset = frames source B starts after source A.  Default is 5." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--port") != std::string::npos) {
+			boost::replace_all(param,"--port=","");
+			base_port = atoi(param.c_str());
+		}
+		else if (param.find("--frames") != std::string::npos) {
+			boost::replace_all(param,"--frames=","");
+			num_frames = atoi(param.c_str());
+		}
+		else if (param.find("--offset") != std::string::npos) {
+			boost::replace_all(param,"--offset=","");
+			start_offset_frames = atoi(param.c_str());
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	gr::top_block_sptr tb = gr::make_top_block("test-spect-sync");
+
+	snap_source::sptr sources[2];
+	std::shared_ptr<tag_capture_sink> yy_sinks[2];
+	std::shared_ptr<tag_capture_sink> sinks[2];
+
+	snap_synchronizer_f::sptr sync = snap_synchronizer_f::make(2, SPECT_VLEN);
+
+	for (int s=0;s<2;s++) {
+		sources[s] = snap_source::make(base_port + s, SNAP_PACKETTYPE_SPECT, false, false, false, 0, 4095, 1,
+				"", false, false, "", false, "127.0.0.1");
+		sinks[s] = gnuradio::get_initial_sptr(new tag_capture_sink());
+		yy_sinks[s] = gnuradio::get_initial_sptr(new tag_capture_sink());
+
+		// XX goes through the synchronizer.  YY just needs somewhere to go.
+		tb->connect(sources[s], 0, sync, s);
+		tb->connect(sources[s], 1, yy_sinks[s], 0);
+		tb->connect(sync, s, sinks[s], 0);
+	}
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::udp::socket socket(io_service);
+	socket.open(boost::asio::ip::udp::v4());
+
+	boost::asio::ip::udp::endpoint endpoints[2];
+	for (int s=0;s<2;s++)
+		endpoints[s] = boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), base_port + s);
+
+	tb->start();
+
+	// Give the sources a moment to open their sockets.
+	usleep(500000);
+
+	for (int f=0;f<num_frames;f++) {
+		send_frame(socket, endpoints[0], 1, 1000 + f);
+		send_frame(socket, endpoints[1], 2, 1000 + start_offset_frames + f);
+
+		// Don't outrun the sources' socket buffers.
+		usleep(1000);
+	}
+
+	// Every frame B sent has a partner in A, so all of them should come out.
+	uint64_t expected_items = num_frames - start_offset_frames;
+	int waited_ms = 0;
+
+	while (((sinks[0]->items() < expected_items) || (sinks[1]->items() < expected_items)) && (waited_ms < timeout_seconds * 1000)) {
+		usleep(10000);
+		waited_ms += 10;
+	}
+
+	tb->stop();
+	tb->wait();
+
+	std::map<uint64_t, uint64_t> tags_a = sinks[0]->sample_numbers();
+	std::map<uint64_t, uint64_t> tags_b = sinks[1]->sample_numbers();
+	bool passed = true;
+
+	std::cout << "Items out: " << sinks[0]->items() << " / " << sinks[1]->items() << ", tagged: " << tags_a.size() << " / " << tags_b.size() << std::endl;
+
+	if ((sinks[0]->items() < expected_items) || (sinks[1]->items() < expected_items) || tags_a.empty()) {
+		std::cout << "FAIL: expected at least " << expected_items << " tagged items on each output." << std::endl;
+		passed = false;
+	}
+
+	for (std::map<uint64_t, uint64_t>::iterator it=tags_a.begin();passed && (it != tags_a.end());it++) {
+		std::map<uint64_t, uint64_t>::iterator other = tags_b.find(it->first);
+
+		if ((other == tags_b.end()) || (other->second != it->second)) {
+			std::cout << "FAIL: item " << it->first << " is sample " << it->second << " on input 0 but ";
+
+			if (other == tags_b.end())
+				std::cout << "untagged";
+			else
+				std::cout << "sample " << other->second;
+
+			std::cout << " on input 1." << std::endl;
+			passed = false;
+		}
+	}
+
+	if (passed && (tags_a.begin()->second != (uint64_t)(1000 + start_offset_frames))) {
+		std::cout << "FAIL: output starts at sample " << tags_a.begin()->second << ", not source B's first sample " << 1000 + start_offset_frames << std::endl;
+		passed = false;
+	}
+
+	std::cout << (passed ? "PASS" : "FAIL") << std::endl;
+
+	return passed ? 0 : 1;
+}
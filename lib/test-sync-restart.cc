@@ -0,0 +1,333 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <boost/algorithm/string/replace.hpp>
+#include <gnuradio/top_block.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/thread/thread.h>
+
+#include <ata/SNAPSynchronizerV3.h>
+
+using namespace gr::ata;
+
+/*
+ * Checks SNAPSynchronizerV3's drift handling.  Two sources tag their frames the way the
+ * SNAP source does.  Partway through, input 1's timestamps either jump a little (it lost
+ * frames, and the synchronizer should skip input 0 to match) or start over near 0 (its
+ * SNAP restarted, which no amount of skipping can fix).  Either way the synchronizer has
+ * to keep both outputs moving.
+ */
+
+#define NUM_CHANNELS 16
+#define FRAME_ITEMS 16
+
+int num_items = 320000;
+int restart_item = 64000;
+int resync_interval = 1600;
+
+// Tags every item with its frame's sample number, 16 per 16-item frame.  From
+// restart_item on, the frames carry on from new_timestamp instead.
+class tagged_frame_source : public gr::sync_block {
+protected:
+	uint64_t d_first_timestamp;
+	uint64_t d_new_timestamp;
+	uint64_t d_restart_item;
+	uint64_t d_num_items;
+	pmt::pmt_t d_pmt_seqnum;
+	pmt::pmt_t d_block_name;
+
+public:
+	tagged_frame_source(uint64_t first_timestamp, uint64_t restart_item, uint64_t new_timestamp, uint64_t num_items) :
+		gr::sync_block("tagged_frame_source",
+			gr::io_signature::make(0, 0, 0),
+			gr::io_signature::make(1, 1, sizeof(char) * 2 * NUM_CHANNELS)),
+			d_first_timestamp(first_timestamp), d_new_timestamp(new_timestamp), d_restart_item(restart_item),
+			d_num_items(num_items), d_pmt_seqnum(pmt::string_to_symbol("sample_num")),
+			d_block_name(pmt::string_to_symbol("tagged_frame_source")) {
+		set_output_multiple(FRAME_ITEMS);
+	};
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items) {
+		uint64_t first_item = nitems_written(0);
+
+		if (first_item >= d_num_items)
+			return WORK_DONE;
+
+		if (first_item + noutput_items > d_num_items)
+			noutput_items = d_num_items - first_item;
+
+		memset(output_items[0], 0, noutput_items * sizeof(char) * 2 * NUM_CHANNELS);
+
+		for (int i=0;i<noutput_items;i++) {
+			uint64_t item = first_item + i;
+			uint64_t timestamp;
+
+			if (item < d_restart_item)
+				timestamp = d_first_timestamp + (item / FRAME_ITEMS) * FRAME_ITEMS;
+			else
+				timestamp = d_new_timestamp + ((item - d_restart_item) / FRAME_ITEMS) * FRAME_ITEMS;
+
+			add_item_tag(0, item, d_pmt_seqnum, pmt::from_uint64(timestamp), d_block_name);
+		}
+
+		return noutput_items;
+	};
+};
+
+// Keeps the sample_num tag of every item it's given.
+class tag_capture_sink : public gr::sync_block {
+protected:
+	std::map<uint64_t, uint64_t> d_sample_numbers;
+	uint64_t d_items;
+	pmt::pmt_t d_pmt_seqnum;
+
+public:
+	tag_capture_sink() : gr::sync_block("tag_capture_sink",
+			gr::io_signature::make(1, 1, sizeof(char) * 2 * NUM_CHANNELS),
+			gr::io_signature::make(0, 0, 0)), d_items(0), d_pmt_seqnum(pmt::string_to_symbol("sample_num")) {
+	};
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items) {
+		std::vector<gr::tag_t> tags;
+		get_tags_in_range(tags, 0, nitems_read(0), nitems_read(0) + noutput_items, d_pmt_seqnum);
+
+		for (size_t i=0;i<tags.size();i++)
+			d_sample_numbers[tags[i].offset] = pmt::to_uint64(tags[i].value);
+
+		d_items += noutput_items;
+
+		return noutput_items;
+	};
+
+	uint64_t items() { return d_items; };
+	std::map<uint64_t, uint64_t> &sample_numbers() { return d_sample_numbers; };
+};
+
+// Keeps what comes out of the synchronizer's resync port.
+class resync_collector : public gr::block {
+protected:
+	gr::thread::mutex d_mutex;
+	int d_resyncs;
+	std::vector<long> d_error_inputs;
+
+public:
+	resync_collector() : gr::block("resync_collector", gr::io_signature::make(0, 0, 0), gr::io_signature::make(0, 0, 0)),
+		d_resyncs(0) {
+		message_port_register_in(pmt::mp("in"));
+		set_msg_handler(pmt::mp("in"), boost::bind(&resync_collector::handle_msg, this, _1) );
+	};
+
+	void handle_msg(pmt::pmt_t msg) {
+		gr::thread::scoped_lock guard(d_mutex);
+
+		if (pmt::eq(pmt::car(msg), pmt::mp("resync_error")))
+			d_error_inputs.push_back(pmt::to_long(pmt::dict_ref(pmt::cdr(msg), pmt::mp("input"), pmt::PMT_NIL)));
+		else
+			d_resyncs++;
+	};
+
+	int resyncs() {
+		gr::thread::scoped_lock guard(d_mutex);
+		return d_resyncs;
+	};
+
+	std::vector<long> error_inputs() {
+		gr::thread::scoped_lock guard(d_mutex);
+		return d_error_inputs;
+	};
+};
+
+struct restart_run {
+	uint64_t items_out[2];
+	int resyncs;
+	std::vector<long> error_inputs;
+	// The sample_num tag on each output item, by output offset.
+	std::map<uint64_t, uint64_t> tags[2];
+};
+
+restart_run run_restart(uint64_t new_timestamp) {
+	gr::top_block_sptr tb = gr::make_top_block("test-sync-restart");
+
+	SNAPSynchronizerV3::sptr sync = SNAPSynchronizerV3::make(2, NUM_CHANNELS, false, resync_interval);
+	std::shared_ptr<resync_collector> collector = gnuradio::get_initial_sptr(new resync_collector());
+	std::shared_ptr<tag_capture_sink> sinks[2];
+
+	// Both start on the same timestamp.  Only input 1 restarts.
+	uint64_t first_timestamp = 16000000000ULL;
+	std::shared_ptr<tagged_frame_source> source_a = gnuradio::get_initial_sptr(
+			new tagged_frame_source(first_timestamp, num_items, 0, num_items));
+	std::shared_ptr<tagged_frame_source> source_b = gnuradio::get_initial_sptr(
+			new tagged_frame_source(first_timestamp, restart_item, new_timestamp, num_items));
+
+	tb->connect(source_a, 0, sync, 0);
+	tb->connect(source_b, 0, sync, 1);
+
+	for (int s=0;s<2;s++) {
+		sinks[s] = gnuradio::get_initial_sptr(new tag_capture_sink());
+		tb->connect(sync, s, sinks[s], 0);
+	}
+
+	tb->msg_connect(sync, "resync", collector, "in");
+
+	tb->run();
+
+	restart_run run;
+
+	for (int s=0;s<2;s++) {
+		run.items_out[s] = sinks[s]->items();
+		run.tags[s] = sinks[s]->sample_numbers();
+	}
+
+	run.resyncs = collector->resyncs();
+	run.error_inputs = collector->error_inputs();
+
+	return run;
+}
+
+// True if, over the last quarter of the run, input 1's sample numbers are always input 0's plus
+// the same offset.  Zero means the outputs are time-aligned again.
+bool constant_offset(restart_run &run, uint64_t &offset) {
+	uint64_t items = std::min(run.items_out[0], run.items_out[1]);
+	bool first = true;
+
+	for (std::map<uint64_t, uint64_t>::iterator it=run.tags[0].lower_bound(items * 3 / 4);it != run.tags[0].end();it++) {
+		if (it->first >= items)
+			break;
+
+		std::map<uint64_t, uint64_t>::iterator other = run.tags[1].find(it->first);
+
+		if (other == run.tags[1].end())
+			return false;
+
+		if (first) {
+			offset = other->second - it->second;
+			first = false;
+		}
+		else if (other->second - it->second != offset) {
+			return false;
+		}
+	}
+
+	return !first;
+}
+
+bool check_run(const std::string &name, restart_run &run, bool expect_error, uint64_t min_items) {
+	bool passed = true;
+	uint64_t offset = 0;
+	bool aligned = constant_offset(run, offset);
+
+	std::cout << name << ": items out " << run.items_out[0] << " / " << run.items_out[1] << ", resyncs " << run.resyncs <<
+			", resync errors " << run.error_inputs.size() << ", tail offset " << (aligned ? std::to_string(offset) : "varies") << std::endl;
+
+	if ((run.items_out[0] < min_items) || (run.items_out[1] < min_items)) {
+		std::cout << "    FAIL: expected at least " << min_items << " items on each output.  The synchronizer stalled." << std::endl;
+		passed = false;
+	}
+
+	if (!aligned) {
+		std::cout << "    FAIL: the outputs don't keep a fixed offset at the end of the run." << std::endl;
+		passed = false;
+	}
+
+	if (expect_error) {
+		if ((run.error_inputs.size() != 1) || (run.error_inputs[0] != 1)) {
+			std::cout << "    FAIL: expected one resync_error naming input 1." << std::endl;
+			passed = false;
+		}
+	}
+	else {
+		if (!run.error_inputs.empty()) {
+			std::cout << "    FAIL: expected no resync_error." << std::endl;
+			passed = false;
+		}
+
+		if (run.resyncs < 1) {
+			std::cout << "    FAIL: expected a resync." << std::endl;
+			passed = false;
+		}
+
+		if (aligned && (offset != 0)) {
+			std::cout << "    FAIL: the outputs weren't re-aligned." << std::endl;
+			passed = false;
+		}
+	}
+
+	return passed;
+}
+
+int
+main (int argc, char **argv)
+{
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: test-sync-restart [--items=<n>]" << std::endl;
+			std::cout << "Checks that SNAPSynchronizerV3 re-aligns an input whose timestamps jump, and keeps running with a resync_error " <<
+						 "when an input's timestamps start over." << std::endl;
+			std::cout << "--items = items per input.  Default is 320000." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--items") != std::string::npos) {
+			boost::replace_all(param,"--items=","");
+			num_items = atoi(param.c_str());
+			restart_item = (num_items / 5 / FRAME_ITEMS) * FRAME_ITEMS;
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	bool passed = true;
+
+	{
+		// Input 1 loses 32 frames.  Input 0 has to skip 32 frames to match it.
+		uint64_t jump = 32 * FRAME_ITEMS;
+		uint64_t new_timestamp = 16000000000ULL + restart_item + jump;
+
+		restart_run run = run_restart(new_timestamp);
+		passed &= check_run("Timestamp jump", run, false, num_items - jump - 2 * resync_interval);
+	}
+
+	{
+		// Input 1's SNAP restarts.  Skipping input 0 forward to a sample number near 0 can't
+		// happen, so input 1 should be reported and carried on at its new offset.
+		restart_run run = run_restart(1024);
+		passed &= check_run("SNAP restart", run, true, num_items - 2 * resync_interval);
+	}
+
+	std::cout << (passed ? "PASS" : "FAIL") << std::endl;
+
+	return passed ? 0 : 1;
+}
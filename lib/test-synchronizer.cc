@@ -0,0 +1,179 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <locale>
+#include <vector>
+#include <chrono>
+#include <string.h>
+#include <boost/algorithm/string/replace.hpp>
+
+#include "SNAPSynchronizerV3_impl.h"
+
+int iterations = 200;
+int num_channels = 256;
+int min_inputs = 2;
+int max_inputs = 42;
+int input_step = 4;
+int max_threads = 4;
+// The default GR buffer for these vector sizes will hand us about this many items per call.
+int items_per_call = 2048;
+
+class comma_numpunct : public std::numpunct<char>
+{
+  protected:
+    virtual char do_thousands_sep() const
+    {
+        return ',';
+    }
+
+    virtual std::string do_grouping() const
+    {
+        return "\03";
+    }
+};
+
+double testSynchronizerCopy(int num_inputs, int num_threads) {
+	int frame_size = num_channels * 2;
+	long stream_bytes = (long)frame_size * items_per_call;
+
+	gr::ata::SNAPSynchronizerV3_impl *test = new gr::ata::SNAPSynchronizerV3_impl(num_inputs, num_channels, false, 0, num_threads);
+
+	std::vector<std::vector<char>> inputs(num_inputs, std::vector<char>(stream_bytes, 0x01));
+	std::vector<std::vector<char>> outputs(num_inputs, std::vector<char>(stream_bytes, 0x00));
+	gr_vector_const_void_star inputPointers;
+	gr_vector_void_star outputPointers;
+
+	for (int i=0;i<num_inputs;i++) {
+		inputPointers.push_back((const void *)&inputs[i][0]);
+		outputPointers.push_back((void *)&outputs[i][0]);
+	}
+
+	// Get the first run out of the way.  This also spins up the workers.
+	test->work_test_copy(items_per_call, inputPointers, outputPointers);
+
+	std::chrono::time_point<std::chrono::steady_clock> start, end;
+
+	start = std::chrono::steady_clock::now();
+	for (int i=0;i<iterations;i++) {
+		test->work_test_copy(items_per_call, inputPointers, outputPointers);
+	}
+	end = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double> elapsed_seconds = end-start;
+
+	test->stop();
+	delete test;
+
+	// Items (time samples) per second across the whole block.
+	return (double)items_per_call * iterations / elapsed_seconds.count();
+}
+
+int
+main (int argc, char **argv)
+{
+	// Add comma's to numbers
+	std::locale comma_locale(std::locale(), new comma_numpunct());
+
+	// tell cout to use our new locale.
+	std::cout.imbue(comma_locale);
+
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: test-synchronizer [--num-channels=<channels>] [--min-inputs=<n>] [--max-inputs=<n>] [--input-step=<n>] [--max-threads=<n>] [--iterations=<n>]" << std::endl;
+			std::cout << "Times the synchronized copy in SNAPSynchronizerV3 for a range of input counts and worker thread counts." << std::endl;
+			std::cout << "--num-channels = channels per antenna.  Default is 256." << std::endl <<
+						 "--min-inputs / --max-inputs / --input-step = antenna sweep.  Default is 2 to 42 in steps of 4." << std::endl <<
+						 "--max-threads = largest worker pool to test.  Thread counts double from 1.  Default is 4." << std::endl <<
+						 "--iterations = work calls per measurement.  Default is 200." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--num-channels") != std::string::npos) {
+			boost::replace_all(param,"--num-channels=","");
+			num_channels = atoi(param.c_str());
+		}
+		else if (param.find("--min-inputs") != std::string::npos) {
+			boost::replace_all(param,"--min-inputs=","");
+			min_inputs = atoi(param.c_str());
+		}
+		else if (param.find("--max-inputs") != std::string::npos) {
+			boost::replace_all(param,"--max-inputs=","");
+			max_inputs = atoi(param.c_str());
+		}
+		else if (param.find("--input-step") != std::string::npos) {
+			boost::replace_all(param,"--input-step=","");
+			input_step = atoi(param.c_str());
+		}
+		else if (param.find("--max-threads") != std::string::npos) {
+			boost::replace_all(param,"--max-threads=","");
+			max_threads = atoi(param.c_str());
+		}
+		else if (param.find("--iterations") != std::string::npos) {
+			boost::replace_all(param,"--iterations=","");
+			iterations = atoi(param.c_str());
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	if (input_step < 1)
+		input_step = 1;
+
+	// A SNAP delivers one time sample every 4 microseconds.
+	const double realtime_items_per_sec = 250000.0;
+
+	std::cout << "----------------------------------------------------------" << std::endl;
+	std::cout << "Testing SNAP Synchronizer copy throughput" << std::endl;
+	std::cout << "Num Channels: " << num_channels << std::endl <<
+				 "Items per work call: " << items_per_call << std::endl << std::endl;
+
+	std::cout << std::setw(8) << "inputs" << std::setw(10) << "threads" << std::setw(18) << "items/sec" <<
+			std::setw(14) << "Gbps" << std::setw(14) << "x realtime" << std::endl;
+
+	for (int num_inputs=min_inputs;num_inputs<=max_inputs;num_inputs+=input_step) {
+		for (int num_threads=1;num_threads<=max_threads;num_threads*=2) {
+			if (num_threads > num_inputs)
+				break;
+
+			double items_per_sec = testSynchronizerCopy(num_inputs, num_threads);
+			double bits_per_sec = items_per_sec * num_channels * 2 * num_inputs * 8;
+
+			std::cout << std::setw(8) << num_inputs << std::setw(10) << num_threads <<
+					std::setw(18) << std::fixed << std::setprecision(0) << items_per_sec <<
+					std::setw(14) << std::setprecision(2) << bits_per_sec / 1e9 <<
+					std::setw(14) << items_per_sec / realtime_items_per_sec << std::endl;
+		}
+	}
+
+	std::cout << std::endl;
+
+	return 0;
+}
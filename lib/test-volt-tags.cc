@@ -0,0 +1,243 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 ghostop14.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <endian.h>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <boost/algorithm/string/replace.hpp>
+#include <boost/asio.hpp>
+#include <gnuradio/top_block.h>
+#include <gnuradio/sync_block.h>
+#include <gnuradio/io_signature.h>
+#include <gnuradio/thread/thread.h>
+
+#include <ata/snap_source.h>
+
+using namespace gr::ata;
+
+/*
+ * Checks that a voltage SNAP source whose channel range spans several packets tags each
+ * frame's vectors with that frame's own sample_number.  Frames are sent to the source
+ * over loopback UDP, every payload byte set to a value that identifies the frame, and one
+ * frame is left out so the zero-filled gap is covered too.  The source runs with packed
+ * output, so each vector's first byte is the payload byte it came from, and has to match
+ * the frame its sample_num tag names.
+ */
+
+#define STARTING_CHANNEL 1792
+#define NUM_CHANNELS 1024
+#define CHANNELS_PER_PACKET 256
+#define PACKETS_PER_FRAME (NUM_CHANNELS / CHANNELS_PER_PACKET)
+#define VOLTAGE_PACKET_SIZE (16 + 8192)
+#define FIRST_SAMPLE 16000ULL
+
+int base_port = 10310;
+int num_frames = 200;
+int missing_frame = 50;
+double timeout_seconds = 10.0;
+
+// Payload byte for a frame.  Never 0, which is what a zero-filled frame holds.
+unsigned char frame_marker(uint64_t sample_number) {
+	return (unsigned char)((((sample_number - FIRST_SAMPLE) / 16) % 250) + 1);
+}
+
+// Keeps the sample_num tag and first byte of every item it's given.
+class tag_capture_sink : public gr::sync_block {
+protected:
+	gr::thread::mutex d_mutex;
+	std::map<uint64_t, uint64_t> d_sample_numbers;
+	std::vector<unsigned char> d_first_bytes;
+	pmt::pmt_t d_pmt_seqnum;
+
+public:
+	tag_capture_sink() : gr::sync_block("tag_capture_sink",
+			gr::io_signature::make(1, 1, sizeof(char) * 2 * NUM_CHANNELS),
+			gr::io_signature::make(0, 0, 0)), d_pmt_seqnum(pmt::string_to_symbol("sample_num")) {
+	};
+
+	int work(int noutput_items, gr_vector_const_void_star &input_items, gr_vector_void_star &output_items) {
+		const unsigned char *in = (const unsigned char *)input_items[0];
+		std::vector<gr::tag_t> tags;
+		get_tags_in_range(tags, 0, nitems_read(0), nitems_read(0) + noutput_items, d_pmt_seqnum);
+
+		gr::thread::scoped_lock guard(d_mutex);
+
+		for (size_t i=0;i<tags.size();i++)
+			d_sample_numbers[tags[i].offset] = pmt::to_uint64(tags[i].value);
+
+		for (int i=0;i<noutput_items;i++)
+			d_first_bytes.push_back(in[i * 2 * NUM_CHANNELS]);
+
+		return noutput_items;
+	};
+
+	uint64_t items() {
+		gr::thread::scoped_lock guard(d_mutex);
+		return d_first_bytes.size();
+	};
+
+	std::map<uint64_t, uint64_t> sample_numbers() {
+		gr::thread::scoped_lock guard(d_mutex);
+		return d_sample_numbers;
+	};
+
+	std::vector<unsigned char> first_bytes() {
+		gr::thread::scoped_lock guard(d_mutex);
+		return d_first_bytes;
+	};
+};
+
+// Sends one voltage frame, PACKETS_PER_FRAME packets of 256 channels, with every payload
+// byte set to the frame's marker.
+void send_frame(boost::asio::ip::udp::socket &socket, boost::asio::ip::udp::endpoint &endpoint, uint64_t sample_number) {
+	unsigned char packet[VOLTAGE_PACKET_SIZE];
+	memset(packet + 16, frame_marker(sample_number), VOLTAGE_PACKET_SIZE - 16);
+
+	uint16_t n_chans = htobe16(CHANNELS_PER_PACKET);
+	uint16_t feng_id = htobe16(1);
+	uint64_t timestamp = htobe64(sample_number);
+
+	packet[0] = 2;
+	packet[1] = 0;
+	memcpy(packet + 2, &n_chans, sizeof(n_chans));
+	memcpy(packet + 6, &feng_id, sizeof(feng_id));
+	memcpy(packet + 8, &timestamp, sizeof(timestamp));
+
+	for (int p=0;p<PACKETS_PER_FRAME;p++) {
+		uint16_t chan = htobe16(STARTING_CHANNEL + p * CHANNELS_PER_PACKET);
+		memcpy(packet + 4, &chan, sizeof(chan));
+
+		socket.send_to(boost::asio::buffer(packet, sizeof(packet)), endpoint);
+	}
+}
+
+int
+main (int argc, char **argv)
+{
+	for (int i=1;i<argc;i++) {
+		std::string param = argv[i];
+
+		if (strcmp(argv[i],"--help")==0) {
+			std::cout << std::endl;
+			std::cout << "Usage: test-volt-tags [--port=<port>] [--frames=<n>]" << std::endl;
+			std::cout << "Checks that a multi-packet voltage source tags every frame with its own sample_number." << std::endl;
+			std::cout << "--port = UDP port the source listens on.  Nothing should be sending to it.  Default is 10310." << std::endl <<
+						 "--frames = voltage frames to send.  Default is 200." << std::endl;
+			std::cout << std::endl;
+			exit(0);
+		}
+		else if (param.find("--port") != std::string::npos) {
+			boost::replace_all(param,"--port=","");
+			base_port = atoi(param.c_str());
+		}
+		else if (param.find("--frames") != std::string::npos) {
+			boost::replace_all(param,"--frames=","");
+			num_frames = atoi(param.c_str());
+			missing_frame = num_frames / 4;
+		}
+		else {
+			std::cout << "ERROR: Unknown parameter: " << param << std::endl;
+			exit(1);
+		}
+	}
+
+	gr::top_block_sptr tb = gr::make_top_block("test-volt-tags");
+
+	snap_source::sptr source = snap_source::make(base_port, SNAP_PACKETTYPE_VOLTAGE, false, false, false,
+			STARTING_CHANNEL, STARTING_CHANNEL + NUM_CHANNELS - 1, 1, "", false, true, "", false, "127.0.0.1");
+	std::shared_ptr<tag_capture_sink> sink = gnuradio::get_initial_sptr(new tag_capture_sink());
+
+	tb->connect(source, 0, sink, 0);
+
+	boost::asio::io_service io_service;
+	boost::asio::ip::udp::socket socket(io_service);
+	socket.open(boost::asio::ip::udp::v4());
+
+	boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), base_port);
+
+	tb->start();
+
+	// Give the source a moment to open its socket.
+	usleep(500000);
+
+	for (int f=0;f<num_frames;f++) {
+		if (f != missing_frame)
+			send_frame(socket, endpoint, FIRST_SAMPLE + f * 16);
+
+		// Don't outrun the source's socket buffer.
+		usleep(1000);
+	}
+
+	// A frame is only finished when the next one starts, so the last one stays queued.
+	uint64_t expected_items = (num_frames - 1) * 16;
+	int waited_ms = 0;
+
+	while ((sink->items() < expected_items) && (waited_ms < timeout_seconds * 1000)) {
+		usleep(10000);
+		waited_ms += 10;
+	}
+
+	tb->stop();
+	tb->wait();
+
+	std::map<uint64_t, uint64_t> tags = sink->sample_numbers();
+	std::vector<unsigned char> first_bytes = sink->first_bytes();
+	bool passed = true;
+
+	std::cout << "Items out: " << first_bytes.size() << ", tagged: " << tags.size() << std::endl;
+
+	if ((first_bytes.size() < expected_items) || (tags.size() < first_bytes.size())) {
+		std::cout << "FAIL: expected at least " << expected_items << " items, each tagged." << std::endl;
+		passed = false;
+	}
+
+	for (std::map<uint64_t, uint64_t>::iterator it=tags.begin();passed && (it != tags.end());it++) {
+		uint64_t item = it->first;
+		uint64_t sample_number = it->second;
+
+		if (item >= first_bytes.size())
+			break;
+
+		// The first item of the run is the first frame sent, and every 16 items is the next.
+		uint64_t expected_sample = FIRST_SAMPLE + (item / 16) * 16;
+		unsigned char expected_byte = (expected_sample == FIRST_SAMPLE + missing_frame * 16) ? 0 : frame_marker(expected_sample);
+
+		if (sample_number != expected_sample) {
+			std::cout << "FAIL: item " << item << " is tagged sample " << sample_number << ", expected " << expected_sample << std::endl;
+			passed = false;
+		}
+		else if (first_bytes[item] != expected_byte) {
+			std::cout << "FAIL: item " << item << " (sample " << sample_number << ") holds frame data " << (int)first_bytes[item] <<
+					", expected " << (int)expected_byte << std::endl;
+			passed = false;
+		}
+	}
+
+	std::cout << (passed ? "PASS" : "FAIL") << std::endl;
+
+	return passed ? 0 : 1;
+}
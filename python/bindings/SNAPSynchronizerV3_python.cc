@@ -14,7 +14,7 @@
 /* BINDTOOL_GEN_AUTOMATIC(0)                                                       */
 /* BINDTOOL_USE_PYGCCXML(0)                                                        */
 /* BINDTOOL_HEADER_FILE(SNAPSynchronizerV3.h)                                        */
-/* BINDTOOL_HEADER_FILE_HASH(7c441cfa98c29017384b3955091ddca9)                     */
+/* BINDTOOL_HEADER_FILE_HASH(ed6a761f03203de44ae36d5ee12bd51b)                     */
 /***********************************************************************************/
 
 #include <pybind11/complex.h>
@@ -39,6 +39,9 @@ void bind_SNAPSynchronizerV3(py::module& m)
         .def(py::init(&SNAPSynchronizerV3::make),
            py::arg("num_inputs"),
            py::arg("num_channels"),
+           py::arg("align_at_source") = false,
+           py::arg("resync_interval") = 250000,
+           py::arg("num_threads") = 1,
            D(SNAPSynchronizerV3,make)
         )
         
@@ -23,6 +23,7 @@ namespace py = pybind11;
 // BINDING_FUNCTION_PROTOTYPES(
     void bind_snap_source(py::module& m);
     void bind_SNAPSynchronizerV3(py::module& m);
+    void bind_snap_synchronizer(py::module& m);
 // ) END BINDING_FUNCTION_PROTOTYPES
 
 
@@ -53,5 +54,6 @@ PYBIND11_MODULE(ata_python, m)
     // BINDING_FUNCTION_CALLS(
     bind_snap_source(m);
     bind_SNAPSynchronizerV3(m);
+    bind_snap_synchronizer(m);
     // ) END BINDING_FUNCTION_CALLS
 }
\ No newline at end of file
@@ -14,7 +14,7 @@
 /* BINDTOOL_GEN_AUTOMATIC(0)                                                       */
 /* BINDTOOL_USE_PYGCCXML(0)                                                        */
 /* BINDTOOL_HEADER_FILE(snap_source.h)                                        */
-/* BINDTOOL_HEADER_FILE_HASH(43bf03a2dd93842f8700b548a115c4a7)                     */
+/* BINDTOOL_HEADER_FILE_HASH(db63d372986441db8c750bc7dc60b8ce)                     */
 /***********************************************************************************/
 
 #include <pybind11/complex.h>
@@ -51,6 +51,19 @@ void bind_snap_source(py::module& m)
            py::arg("mcast_group") = "",
            py::arg("send_start_msg") = false,
            py::arg("udp_ip") = "",
+           py::arg("wait_for_align") = false,
+           py::arg("start_sample") = 0,
+           py::arg("end_sample") = 0,
+           py::arg("pcap_pacing") = 0,
+           py::arg("pacing_speedup") = 1.0,
+           py::arg("loop_cache_mb") = 0,
+           py::arg("loop_continue_timestamps") = false,
+           py::arg("decode_threads") = 0,
+           py::arg("record_file") = "",
+           py::arg("record_compression") = 0,
+           py::arg("stats_interval") = 1.0,
+           py::arg("rx_timestamps") = false,
+           py::arg("quant_stats_interval") = 0.0,
            D(snap_source,make)
         )
         
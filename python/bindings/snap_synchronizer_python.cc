@@ -0,0 +1,56 @@
+/*
+ * Copyright 2021 Free Software Foundation, Inc.
+ *
+ * This file is part of GNU Radio
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ */
+
+/***********************************************************************************/
+/* This file is automatically generated using bindtool and can be manually edited  */
+/* The following lines can be configured to regenerate this file during cmake      */
+/* If manual edits are made, the following tags should be modified accordingly.    */
+/* BINDTOOL_GEN_AUTOMATIC(0)                                                       */
+/* BINDTOOL_USE_PYGCCXML(0)                                                        */
+/* BINDTOOL_HEADER_FILE(snap_synchronizer.h)                                        */
+/* BINDTOOL_HEADER_FILE_HASH(e966da8fe40289817ed35fb6a8d44275)                     */
+/***********************************************************************************/
+
+#include <pybind11/complex.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+namespace py = pybind11;
+
+#include <ata/snap_synchronizer.h>
+// pydoc.h is automatically generated in the build directory
+#include <snap_synchronizer_pydoc.h>
+
+template <class T, int FRAME_ITEMS>
+void bind_snap_synchronizer_template(py::module& m, const char* classname)
+{
+    using snap_synchronizer = ::gr::ata::snap_synchronizer<T, FRAME_ITEMS>;
+
+    py::class_<snap_synchronizer, gr::block, gr::basic_block,
+        std::shared_ptr<snap_synchronizer>>(m, classname)
+
+        .def(py::init(&snap_synchronizer::make),
+           py::arg("num_inputs"),
+           py::arg("vlen"),
+           py::arg("resync_interval") = 250000,
+           py::arg("num_threads") = 1,
+           py::arg("frame_timestamp_step") = FRAME_ITEMS
+        )
+
+        ;
+}
+
+void bind_snap_synchronizer(py::module& m)
+{
+    bind_snap_synchronizer_template<char, 16>(m, "snap_synchronizer_b");
+    bind_snap_synchronizer_template<unsigned char, 16>(m, "snap_synchronizer_packed");
+    bind_snap_synchronizer_template<std::complex<int16_t>, 16>(m, "snap_synchronizer_sc16");
+    bind_snap_synchronizer_template<gr_complex, 16>(m, "snap_synchronizer_c");
+    bind_snap_synchronizer_template<float, 1>(m, "snap_synchronizer_f");
+}